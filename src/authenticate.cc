@@ -42,6 +42,7 @@
 #include <grp.h>
 #include <pwd.h>
 #include <signal.h>
+#include <fcntl.h>
 
 #ifndef HAVE_SYS_WAIT_H
 #include <wait.h>
@@ -278,6 +279,7 @@ int Binc::authenticate(Depot &depot, const string &username,
   com.disableInputLimit();
 
   bool eof = false;
+  bool splicing = true;
   while (!eof) {
     fd_set rtmp = rmask;
     struct timeval timeout;
@@ -348,7 +350,44 @@ int Binc::authenticate(Depot &depot, const string &username,
 
     if (FD_ISSET(intercomr[0], &rtmp)) {
       char buf[8192];
-      int ret = read(intercomr[0], buf, sizeof(buf));
+      int ret = -1;
+      bool spliced = false;
+
+#ifdef HAVE_SPLICE
+      // Without SSL, the server's output is moved to the client
+      // inside the kernel. If the client is not ready for more, wait
+      // for it rather than retry at once. If splice() fails, nothing
+      // was moved, and this and all later output is copied the usual
+      // way.
+      if (splicing && com.isModePlain()) {
+	alarm(session.transfertimeout);
+	for (;;) {
+	  ret = splice(intercomr[0], 0, fileno(stdout), 0, 65536,
+		       SPLICE_F_MOVE);
+	  if (ret != -1 || (errno != EINTR && errno != EAGAIN))
+	    break;
+
+	  if (errno == EAGAIN) {
+	    fd_set wtmp;
+	    FD_ZERO(&wtmp);
+	    FD_SET(fileno(stdout), &wtmp);
+	    if (select(fileno(stdout) + 1, 0, &wtmp, 0, 0) == -1
+		&& errno != EINTR)
+	      break;
+	  }
+	}
+	alarm(0);
+
+	if (ret == -1)
+	  splicing = false;
+	else
+	  spliced = true;
+      }
+#endif
+
+      if (!spliced)
+	ret = read(intercomr[0], buf, sizeof(buf));
+
       if (ret == 0) {
 	// Main server has shut down
 	eof = true;
@@ -365,9 +404,11 @@ int Binc::authenticate(Depot &depot, const string &username,
 	}
 
 	Session::getInstance().addWriteBytes(ret);
-	
-	com << string(buf, ret);
-	com.flushContent();
+
+	if (!spliced) {
+	  com << string(buf, ret);
+	  com.flushContent();
+	}
       }
     }
   }
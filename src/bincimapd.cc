@@ -35,6 +35,8 @@
 
 #include "broker.h"
 #include "depot.h"
+#include "filebatch.h"
+#include "notifier.h"
 #include "recursivedescent.h"
 #include "io.h"
 #include "operators.h"
@@ -105,6 +107,26 @@ int main(int argc, char *argv[])
     com.flushContent();
     com.enableInputLimit();
 
+    // With NOTIFY, changes to mailboxes are reported while the client
+    // is quiet between commands.
+    Notifier &notifier = Notifier::getInstance();
+    if (notifier.isActive()) {
+      int r = notifier.wait(*session.getDepot(), session.timeout());
+      if (r == 0) {
+	com << "* BYE Timeout after " << session.timeout()
+	    << " seconds of inactivity." << endl;
+	timeout = true;
+	abrt = true;
+	break;
+      }
+
+      if (r == -1) {
+	disconnected = true;
+	abrt = true;
+	break;
+      }
+    }
+
     switch (broker->parseStub(request)) {
     case Operator::TIMEOUT:
       com << "* BYE Timeout after " << session.timeout()
@@ -160,8 +182,9 @@ int main(int argc, char *argv[])
 
     switch (o->process(*dep, request)) {
     case Operator::OK:
-      com << request.getTag() << " OK " << request.getName()
-	  << " completed" << endl;
+      com << request.getTag() << " OK " << session.getResponseCode()
+	  << request.getName() << " completed" << endl;
+      session.clearResponseCode();
       break;
     case Operator::NO: 
       com << request.getTag() << " NO " << session.getResponseCode()
@@ -193,11 +216,15 @@ int main(int argc, char *argv[])
       logger << "client disconnected";
     logger << ") - bodies:" 
 	   << session.getBodies() << " statements:"
-	   << session.getStatements() << endl;
+	   << session.getStatements() << " file ops:"
+	   << FileBatch::getCompleted() << "/" << FileBatch::getSubmitted()
+	   << " (" << FileBatch::getEngine() << ")" << endl;
   } else {
     logger << "<" << session.getUserID() << "> logged off - bodies:" 
 	   << session.getBodies() << " statements:"
-	   << session.getStatements() << endl;
+	   << session.getStatements() << " file ops:"
+	   << FileBatch::getCompleted() << "/" << FileBatch::getSubmitted()
+	   << " (" << FileBatch::getEngine() << ")" << endl;
   }
 
   com.flushContent();
@@ -0,0 +1,361 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    bodysearch.cc
+ *
+ *  Description:
+ *    Implementation of the Binc::BodySearch class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <string.h>
+
+#include "bodysearch.h"
+#include "convert.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  // Headers longer than this are not looked at for the content type.
+  const string::size_type MAX_HEADER = 65536;
+
+  //----------------------------------------------------------------------
+  // Finds the value of a header in an unparsed header block.
+  string findHeader(const string &header, const string &name)
+  {
+    string value;
+    bool found = false;
+
+    string::size_type pos = 0;
+    while (pos < header.length()) {
+      string::size_type end = header.find('\n', pos);
+      if (end == string::npos)
+	end = header.length();
+
+      string line = header.substr(pos, end - pos);
+      pos = end + 1;
+
+      if (found) {
+	if (line == "" || !isspace((unsigned char) line[0]))
+	  break;
+	value += line;
+	continue;
+      }
+
+      string::size_type colon = line.find(':');
+      if (colon == string::npos)
+	continue;
+
+      string key = line.substr(0, colon);
+      trim(key);
+      lowercase(key);
+      if (key == name) {
+	value = line.substr(colon + 1);
+	found = true;
+      }
+    }
+
+    trim(value);
+    return value;
+  }
+}
+
+//------------------------------------------------------------------------
+BodySearch::Part::Part(void)
+  : text(true), message(false), digest(false), closed(false)
+{
+}
+
+//------------------------------------------------------------------------
+BodySearch::BodySearch(const string &text, bool o)
+  : matcher(text), onlyTextParts(o), inBody(false), inName(true),
+    inPartHeader(false), inLine(true), prefix(0)
+{
+  memset(cqueue, 0, sizeof(cqueue));
+}
+
+//------------------------------------------------------------------------
+bool BodySearch::feed(const char *data, unsigned int length)
+{
+  unsigned int i = 0;
+  if (!inBody) {
+    unsigned int keep = 0;
+    while (i < length && !inBody) {
+      char c = data[i++];
+      if (onlyTextParts && header.length() < MAX_HEADER)
+	header += c;
+      inBody = feedHeader(c, keep);
+    }
+
+    if (!inBody)
+      return false;
+
+    if (onlyTextParts) {
+      parts.push_back(Part());
+      startPart(header);
+      header = "";
+    }
+
+    // The header parser gives back the characters it read of a line
+    // that turned out to belong to the body.
+    if (keep != 0) {
+      string start = (name + "\n").substr(name.length() + 1 - keep);
+      if (feedBody(start.data(), start.length()))
+	return true;
+    }
+  }
+
+  return i < length && feedBody(data + i, length - i);
+}
+
+//------------------------------------------------------------------------
+bool BodySearch::feedHeader(char c, unsigned int &keep)
+{
+  // This follows MimePart::parseFull(), so that the body starts
+  // where FETCH BODY[TEXT] starts it.
+  if (inName) {
+    if (c == ':') {
+      if (name == "\r")
+	return true;
+
+      inName = false;
+      return false;
+    }
+
+    if (c == '\n') {
+      string tmp = name;
+      trim(tmp);
+      if (tmp != "")
+	keep = name.length();
+      return true;
+    }
+
+    name += c;
+    return false;
+  }
+
+  for (int i = 0; i < 3; ++i)
+    cqueue[i] = cqueue[i + 1];
+  cqueue[3] = c;
+
+  if (memcmp(cqueue, "\r\n\r\n", 4) == 0)
+    return true;
+
+  if (cqueue[2] == '\n' && !isspace((unsigned char) cqueue[3])) {
+    name = c;
+    inName = true;
+  }
+
+  return false;
+}
+
+//------------------------------------------------------------------------
+void BodySearch::startPart(const string &header)
+{
+  Part &part = parts.back();
+
+  string type = findHeader(header, "content-type");
+  if (type != "") {
+    vector<string> types;
+    split(type, ";", types);
+
+    string key = "text";
+    string value = "plain";
+    if (types.size() > 0) {
+      string tmp = types[0];
+      trim(tmp);
+      vector<string> v;
+      split(tmp, "/", v);
+      if (v.size() > 0) key = v[0];
+      if (v.size() > 1) value = v[1];
+      trim(key);
+      trim(value);
+      lowercase(key);
+      lowercase(value);
+    }
+
+    part.text = (key == "text");
+    part.message = (key == "message" && value == "rfc822");
+    part.digest = (key == "multipart" && value == "digest");
+
+    if (key == "multipart")
+      for (vector<string>::const_iterator i = types.begin();
+	   i != types.end(); ++i) {
+	string::size_type pos = (*i).find('=');
+	if (pos == string::npos)
+	  continue;
+
+	string k = (*i).substr(0, pos);
+	trim(k);
+	lowercase(k);
+	if (k == "boundary") {
+	  part.boundary = (*i).substr(pos + 1);
+	  trim(part.boundary, " \"");
+	}
+      }
+  } else if (parts.size() > 1 && parts[parts.size() - 2].digest) {
+    part.text = false;
+    part.message = true;
+  }
+
+  if (part.boundary != "")
+    part.text = false;
+
+  // The contents of a message/rfc822 part start with a header of
+  // their own.
+  if (part.message) {
+    part.text = false;
+    parts.push_back(Part());
+    inPartHeader = true;
+  } else
+    inPartHeader = false;
+
+  setPrefix();
+}
+
+//------------------------------------------------------------------------
+void BodySearch::setPrefix(void)
+{
+  // A line can only be a delimiter if it starts with "--" and one of
+  // the boundaries that are open.
+  prefix = 0;
+  for (vector<Part>::const_iterator i = parts.begin(); i != parts.end(); ++i)
+    if ((*i).boundary != "" && !(*i).closed
+	&& (*i).boundary.length() + 2 > prefix)
+      prefix = (*i).boundary.length() + 2;
+}
+
+//------------------------------------------------------------------------
+bool BodySearch::feedBody(const char *data, unsigned int length)
+{
+  if (!onlyTextParts)
+    return matcher.feed(data, length);
+
+  unsigned int i = 0;
+  while (i < length) {
+    if (inLine) {
+      // The start of a line is kept until it is known whether the
+      // line is a delimiter, and part header lines are kept whole.
+      char c = data[i++];
+      line += c;
+      if (c == '\n') {
+	if (endLine())
+	  return true;
+	line = "";
+	continue;
+      }
+
+      if (inPartHeader || line.length() < prefix)
+	continue;
+
+      bool delimiter = false;
+      if (line.length() >= 2 && line[0] == '-' && line[1] == '-')
+	for (vector<Part>::const_iterator j = parts.begin();
+	     j != parts.end(); ++j)
+	  if ((*j).boundary != "" && !(*j).closed
+	      && line.compare(2, (*j).boundary.length(), (*j).boundary) == 0)
+	    delimiter = true;
+
+      if (delimiter)
+	continue;
+
+      inLine = false;
+      if (parts.back().text && !parts.back().closed
+	  && matcher.feed(line.data(), line.length()))
+	return true;
+      line = "";
+      continue;
+    }
+
+    // The rest of a line that is not a delimiter.
+    const char *end = (const char *) memchr(data + i, '\n', length - i);
+    unsigned int n = end ? (end - (data + i)) + 1 : length - i;
+    if (parts.back().text && !parts.back().closed
+	&& matcher.feed(data + i, n))
+      return true;
+
+    i += n;
+    if (end)
+      inLine = true;
+  }
+
+  return false;
+}
+
+//------------------------------------------------------------------------
+bool BodySearch::endLine(void)
+{
+  string tmp = line;
+  chomp(tmp, " \t\r\n");
+
+  if (tmp.length() > 2 && tmp[0] == '-' && tmp[1] == '-') {
+    // Delimiters close the parts that are open inside of them.
+    for (int i = parts.size() - 1; i >= 0; --i) {
+      const string &boundary = parts[i].boundary;
+      if (boundary == "" || parts[i].closed
+	  || tmp.compare(2, boundary.length(), boundary) != 0)
+	continue;
+
+      parts.resize(i + 1);
+      matcher.reset();
+      header = "";
+
+      if (tmp.compare(2 + boundary.length(), 2, "--") == 0) {
+	parts.back().closed = true;
+	inPartHeader = false;
+      } else {
+	parts.push_back(Part());
+	inPartHeader = true;
+      }
+
+      setPrefix();
+      return false;
+    }
+  }
+
+  if (inPartHeader) {
+    if (line == "\r\n" || line == "\n") {
+      startPart(header);
+      header = "";
+    } else if (header.length() < MAX_HEADER)
+      header += line;
+
+    return false;
+  }
+
+  return parts.back().text && !parts.back().closed
+    && matcher.feed(line.data(), line.length());
+}
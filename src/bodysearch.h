@@ -0,0 +1,103 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    bodysearch.h
+ *
+ *  Description:
+ *    Declaration of the Binc::BodySearch class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifndef bodysearch_h_included
+#define bodysearch_h_included
+#include <string>
+#include <vector>
+
+#include "convert.h"
+
+namespace Binc {
+
+  /*!
+    \class BodySearch
+    \brief The BodySearch class searches the body of a message for a
+    string while the message is read, in one pass.
+
+    The message is fed in blocks as it is served, with CRLF line
+    ends. The header is skipped, and the body starts where
+    MimePart::parseFull() starts it. If only text parts are searched,
+    the MIME structure of the body is followed as it goes by, and
+    only the contents of text parts are searched.
+  */
+  class BodySearch {
+  public:
+    /*!
+      Feeds the next block of the message. Returns true as soon as
+      the string has been found.
+    */
+    bool feed(const char *data, unsigned int length);
+
+    //--
+    BodySearch(const std::string &text, bool onlyTextParts);
+
+  private:
+    class Part {
+    public:
+      std::string boundary;
+      bool text;
+      bool message;
+      bool digest;
+      bool closed;
+
+      Part(void);
+    };
+
+    bool feedHeader(char c, unsigned int &keep);
+    bool feedBody(const char *data, unsigned int length);
+    bool endLine(void);
+    void startPart(const std::string &header);
+    void setPrefix(void);
+
+    TextMatcher matcher;
+    bool onlyTextParts;
+
+    bool inBody;
+    bool inName;
+    std::string name;
+    char cqueue[4];
+    std::string header;
+
+    std::vector<Part> parts;
+    bool inPartHeader;
+    bool inLine;
+    std::string line;
+    unsigned int prefix;
+  };
+}
+
+#endif
@@ -39,6 +39,10 @@
 #include "io.h"
 #include <string>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using namespace ::std;
 using namespace Binc;
 
@@ -88,14 +92,20 @@ BincStream &BincStream::operator << (const string &t)
 //------------------------------------------------------------------------
 BincStream &BincStream::operator << (int t)
 {
-  nstr += toString(t);
+  char intbuf[24];
+  char *end = intbuf + sizeof(intbuf);
+  char *start = formatSigned(end, t);
+  nstr.append(start, end - start);
   return *this;
 }
 
 //------------------------------------------------------------------------
 BincStream &BincStream::operator << (unsigned int t)
 {
-  nstr += toString(t);
+  char intbuf[24];
+  char *end = intbuf + sizeof(intbuf);
+  char *start = formatUnsigned(end, t);
+  nstr.append(start, end - start);
   return *this;
 }
 
@@ -105,3 +115,155 @@ BincStream &BincStream::operator << (char t)
   nstr += t;
   return *this;
 }
+
+//------------------------------------------------------------------------
+BincStream &BincStream::operator << (const ImapString &t)
+{
+  if (needsImapLiteral(t.s)) {
+    nstr += '{';
+    *this << (unsigned int) t.s.length();
+    nstr += "}\r\n";
+    nstr += t.s;
+  } else {
+    nstr += '"';
+    nstr += t.s;
+    nstr += '"';
+  }
+
+  return *this;
+}
+
+//------------------------------------------------------------------------
+BincStream &BincStream::write(const char *data, unsigned int length)
+{
+  nstr.append(data, length);
+  return *this;
+}
+
+namespace {
+
+  //----------------------------------------------------------------------
+  // ASCII upper case, like toupper() in the C locale.
+  class UpperTable {
+  public:
+    unsigned char upper[256];
+
+    UpperTable(void)
+    {
+      for (int i = 0; i < 256; ++i)
+	upper[i] = (i >= 'a' && i <= 'z') ? i - 'a' + 'A' : i;
+    }
+  };
+
+  const UpperTable fold;
+
+  //----------------------------------------------------------------------
+  // Compares the n bytes at data with the upper cased needle.
+  inline bool equalsUpper(const unsigned char *data,
+			  const unsigned char *needle, unsigned int n)
+  {
+    for (unsigned int i = 0; i < n; ++i)
+      if (fold.upper[data[i]] != needle[i])
+	return false;
+
+    return true;
+  }
+}
+
+//------------------------------------------------------------------------
+TextMatcher::TextMatcher(const string &n) : needle(n)
+{
+  uppercase(needle);
+}
+
+//------------------------------------------------------------------------
+void TextMatcher::reset(void)
+{
+  tail = "";
+}
+
+//------------------------------------------------------------------------
+bool TextMatcher::find(const char *data, unsigned int length) const
+{
+  const unsigned int m = needle.length();
+  if (m == 0)
+    return true;
+  if (length < m)
+    return false;
+
+  const unsigned char *text = (const unsigned char *) data;
+  const unsigned char *n = (const unsigned char *) needle.data();
+  const unsigned char first = n[0];
+  const unsigned char last = n[m - 1];
+  const unsigned char firstlower = (first >= 'A' && first <= 'Z')
+    ? first - 'A' + 'a' : first;
+  const unsigned char lastlower = (last >= 'A' && last <= 'Z')
+    ? last - 'A' + 'a' : last;
+
+  // Positions from 0 to end can start a match.
+  const unsigned int end = length - m;
+  unsigned int i = 0;
+
+#ifdef __SSE2__
+  // Look for the first and the last character of the needle at the
+  // right distance from each other, 16 positions at a time, and only
+  // compare the rest at the positions where both are found.
+  const __m128i f1 = _mm_set1_epi8((char) first);
+  const __m128i f2 = _mm_set1_epi8((char) firstlower);
+  const __m128i l1 = _mm_set1_epi8((char) last);
+  const __m128i l2 = _mm_set1_epi8((char) lastlower);
+
+  for (; i + 16 <= end + 1; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (text + i));
+    __m128i b = _mm_loadu_si128((const __m128i *) (text + i + m - 1));
+    __m128i fa = _mm_or_si128(_mm_cmpeq_epi8(a, f1), _mm_cmpeq_epi8(a, f2));
+    __m128i lb = _mm_or_si128(_mm_cmpeq_epi8(b, l1), _mm_cmpeq_epi8(b, l2));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(fa, lb));
+
+    while (mask != 0) {
+      unsigned int bit = __builtin_ctz(mask);
+      if (equalsUpper(text + i + bit + 1, n + 1, m - 1))
+	return true;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i <= end; ++i)
+    if (fold.upper[text[i]] == first
+	&& fold.upper[text[i + m - 1]] == last
+	&& equalsUpper(text + i + 1, n + 1, m - 1))
+      return true;
+
+  return false;
+}
+
+//------------------------------------------------------------------------
+bool TextMatcher::feed(const char *data, unsigned int length)
+{
+  const unsigned int m = needle.length();
+  if (m == 0)
+    return true;
+
+  // Matches that start in the previous blocks and end in this one.
+  if (!tail.empty()) {
+    string joined = tail;
+    joined.append(data, length < m - 1 ? length : m - 1);
+    if (find(joined.data(), joined.length()))
+      return true;
+  }
+
+  if (find(data, length))
+    return true;
+
+  // Keep the last m - 1 characters for the next block.
+  if (length >= m - 1)
+    tail.assign(data + length - (m - 1), m - 1);
+  else {
+    tail.append(data, length);
+    if (tail.length() > m - 1)
+      tail.erase(0, tail.length() - (m - 1));
+  }
+
+  return false;
+}
@@ -50,28 +50,72 @@
 
 namespace Binc {
 
+  //----------------------------------------------------------------------
+  // Writes the decimal digits of i_in backwards from end, two at a
+  // time, and returns a pointer to the first digit. 20 characters are
+  // enough for any unsigned long.
+  inline char *formatUnsigned(char *end, unsigned long i_in)
+  {
+    static const char digits[] =
+      "0001020304050607080910111213141516171819"
+      "2021222324252627282930313233343536373839"
+      "4041424344454647484950515253545556575859"
+      "6061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+
+    while (i_in >= 100) {
+      const char *d = digits + 2 * (i_in % 100);
+      i_in /= 100;
+      *--end = d[1];
+      *--end = d[0];
+    }
+
+    if (i_in >= 10) {
+      const char *d = digits + 2 * i_in;
+      *--end = d[1];
+      *--end = d[0];
+    } else
+      *--end = '0' + i_in;
+
+    return end;
+  }
+
+  //----------------------------------------------------------------------
+  inline char *formatSigned(char *end, long i_in)
+  {
+    if (i_in >= 0)
+      return formatUnsigned(end, (unsigned long) i_in);
+
+    char *start = formatUnsigned(end, 0UL - (unsigned long) i_in);
+    *--start = '-';
+    return start;
+  }
+
   //----------------------------------------------------------------------
   inline std::string toString(int i_in)
   {
-    char intbuf[16];
-    snprintf(intbuf, sizeof(intbuf), "%i", i_in);
-    return std::string(intbuf);
+    char intbuf[24];
+    char *end = intbuf + sizeof(intbuf);
+    char *start = formatSigned(end, i_in);
+    return std::string(start, end - start);
   }
 
   //----------------------------------------------------------------------
   inline std::string toString(unsigned int i_in)
   {
-    char intbuf[16];
-    snprintf(intbuf, sizeof(intbuf), "%u", i_in);
-    return std::string(intbuf);
+    char intbuf[24];
+    char *end = intbuf + sizeof(intbuf);
+    char *start = formatUnsigned(end, i_in);
+    return std::string(start, end - start);
   }
 
   //----------------------------------------------------------------------
   inline std::string toString(unsigned long i_in)
   {
-    char longbuf[40];
-    snprintf(longbuf, sizeof(longbuf), "%lu", i_in);
-    return std::string(longbuf);
+    char longbuf[24];
+    char *end = longbuf + sizeof(longbuf);
+    char *start = formatUnsigned(end, i_in);
+    return std::string(start, end - start);
   }
 
   //----------------------------------------------------------------------
@@ -86,6 +130,35 @@ namespace Binc {
     return ::atoi(s_in.c_str());
   }
 
+  //----------------------------------------------------------------------
+  // Appends n to s as a little endian base 128 varint.
+  inline void appendVarint(std::string &s, unsigned int n)
+  {
+    while (n >= 0x80) {
+      s += (char) ((n & 0x7f) | 0x80);
+      n >>= 7;
+    }
+
+    s += (char) n;
+  }
+
+  //----------------------------------------------------------------------
+  // Reads a varint from s at pos and advances pos past it. Returns
+  // false if s ends in the middle of it.
+  inline bool readVarint(const std::string &s, std::string::size_type &pos,
+			 unsigned int &n)
+  {
+    n = 0;
+    for (int shift = 0; pos < s.length() && shift < 32; shift += 7) {
+      unsigned char c = (unsigned char) s[pos++];
+      n |= (unsigned int) (c & 0x7f) << shift;
+      if ((c & 0x80) == 0)
+	return true;
+    }
+
+    return false;
+  }
+
   //----------------------------------------------------------------------
   inline std::string toHex(const std::string &s)
   {
@@ -131,17 +204,35 @@ namespace Binc {
   }
   
   //----------------------------------------------------------------------
-  inline std::string toImapString(const std::string &s_in)
+  inline bool needsImapLiteral(const std::string &s_in)
   {
     for (std::string::const_iterator i = s_in.begin(); i != s_in.end(); ++i) {
       unsigned char c = (unsigned char)*i;
       if (c <= 31 || c >= 127 || c == '\"' || c == '\\')
-	return "{" + toString(s_in.length()) + "}\r\n" + s_in;
+	return true;
     }
+
+    return false;
+  }
+
+  //----------------------------------------------------------------------
+  inline std::string toImapString(const std::string &s_in)
+  {
+    if (needsImapLiteral(s_in))
+      return "{" + toString(s_in.length()) + "}\r\n" + s_in;
     
     return "\"" + s_in + "\"";
   }
 
+  //----------------------------------------------------------------------
+  // Streaming an ImapString into a BincStream or an IO writes s as a
+  // quoted string or as a literal, like toImapString(), but without
+  // building a temporary.
+  struct ImapString {
+    explicit ImapString(const std::string &s_in) : s(s_in) { }
+    const std::string &s;
+  };
+
   //----------------------------------------------------------------------
   inline void uppercase(std::string &input)
   {
@@ -167,8 +258,8 @@ namespace Binc {
   //----------------------------------------------------------------------
   inline void trim(std::string &s_in, const std::string &chars = " \t\r\n")
   {
-    while (s_in != "" && chars.find(s_in[0]) != std::string::npos)
-      s_in = s_in.substr(1);
+    std::string::size_type n = s_in.find_first_not_of(chars);
+    s_in.erase(0, n == std::string::npos ? s_in.length() : n);
     chomp(s_in, chars);
   }
 
@@ -177,6 +268,7 @@ namespace Binc {
 				  bool removecomment = true)
   {
     std::string tmp;
+    tmp.reserve(a.length());
     bool incomment = false;
     bool inquotes = false;
     for (std::string::const_iterator i = a.begin(); i != a.end(); ++i) {
@@ -286,6 +378,25 @@ namespace Binc {
     return regex;
   }
 
+  //------------------------------------------------------------------------
+  // Finds a string in text, ignoring the case of ASCII letters, the
+  // way SEARCH compares strings. find() searches one block of text.
+  // feed() searches consecutive blocks of a longer text, and also
+  // finds matches that span two blocks.
+  class TextMatcher {
+  public:
+    bool find(const char *data, unsigned int length) const;
+    bool feed(const char *data, unsigned int length);
+    void reset(void);
+
+    //--
+    explicit TextMatcher(const std::string &needle);
+
+  private:
+    std::string needle;
+    std::string tail;
+  };
+
   //------------------------------------------------------------------------
   class BincStream {
   private:
@@ -299,6 +410,8 @@ namespace Binc {
     BincStream &operator << (unsigned int t);
     BincStream &operator << (int t);
     BincStream &operator << (char t);
+    BincStream &operator << (const ImapString &t);
+    BincStream &write(const char *data, unsigned int length);
 
     //--
     const std::string &str(void) const;
@@ -0,0 +1,627 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    filebatch.cc
+ *
+ *  Description:
+ *    Implementation of the Binc::FileBatch class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef WITH_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#if defined(HAVE_IO_URING) && defined(HAVE_ATFUNCS)
+#define USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "convert.h"
+#include "filebatch.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  enum Engine { SYNC, THREADS, IO_URING };
+
+  // Batches smaller than this are not worth starting threads for.
+  const unsigned int MIN_THREADED = 16;
+
+  bool initialized = false;
+  Engine engine = SYNC;
+  string engineName = "sync";
+  unsigned int threads = 4;
+  unsigned int submitted = 0;
+  unsigned int completed = 0;
+
+#ifndef HAVE_ATFUNCS
+  //----------------------------------------------------------------------
+  string fullName(const string &directory, const string &name)
+  {
+    return name != "" && name[0] == '/' ? name : directory + "/" + name;
+  }
+#endif
+
+  //----------------------------------------------------------------------
+  // Carries out one operation with an ordinary system call.
+  void runOne(int dirfd, const string &directory, FileBatch::Op &op)
+  {
+    int res = -1;
+#ifdef HAVE_ATFUNCS
+    switch (op.type) {
+    case FileBatch::Op::STAT:
+      res = fstatat(dirfd, op.from.c_str(), &op.st, 0);
+      break;
+    case FileBatch::Op::RENAME:
+      res = renameat(dirfd, op.from.c_str(), dirfd, op.to.c_str());
+      break;
+    case FileBatch::Op::UNLINK:
+      res = unlinkat(dirfd, op.from.c_str(), 0);
+      break;
+    case FileBatch::Op::LINK:
+      res = linkat(dirfd, op.from.c_str(), dirfd, op.to.c_str(), 0);
+      break;
+    }
+#else
+    const string from = fullName(directory, op.from);
+    switch (op.type) {
+    case FileBatch::Op::STAT:
+      res = ::stat(from.c_str(), &op.st);
+      break;
+    case FileBatch::Op::RENAME:
+      res = ::rename(from.c_str(), fullName(directory, op.to).c_str());
+      break;
+    case FileBatch::Op::UNLINK:
+      res = ::unlink(from.c_str());
+      break;
+    case FileBatch::Op::LINK:
+      res = ::link(from.c_str(), fullName(directory, op.to).c_str());
+      break;
+    }
+#endif
+
+    op.error = res == 0 ? 0 : errno;
+  }
+
+#ifdef WITH_PTHREAD
+  //----------------------------------------------------------------------
+  // The operations of a batch, shared by the threads that run them.
+  class Work {
+  public:
+    vector<FileBatch::Op> &ops;
+    unsigned int next;
+    unsigned int end;
+    int dirfd;
+    const string &directory;
+    pthread_mutex_t lock;
+
+    Work(vector<FileBatch::Op> &o, unsigned int first, int fd,
+	 const string &d)
+      : ops(o), next(first), end(o.size()), dirfd(fd), directory(d)
+    {
+      pthread_mutex_init(&lock, 0);
+    }
+
+    ~Work(void)
+    {
+      pthread_mutex_destroy(&lock);
+    }
+  };
+
+  //----------------------------------------------------------------------
+  void *worker(void *arg)
+  {
+    Work &work = *(Work *) arg;
+    for (;;) {
+      pthread_mutex_lock(&work.lock);
+      unsigned int i = work.next;
+      if (i < work.end)
+	++work.next;
+      pthread_mutex_unlock(&work.lock);
+
+      if (i >= work.end)
+	return 0;
+
+      runOne(work.dirfd, work.directory, work.ops[i]);
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void runThreaded(vector<FileBatch::Op> &ops, unsigned int first,
+		   int dirfd, const string &directory)
+  {
+    Work work(ops, first, dirfd, directory);
+
+    // Signals are left to the main thread.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    vector<pthread_t> workers;
+    for (unsigned int i = 1; i < threads; ++i) {
+      pthread_t t;
+      if (pthread_create(&t, 0, worker, &work) != 0)
+	break;
+      workers.push_back(t);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+
+    worker(&work);
+    for (vector<pthread_t>::const_iterator i = workers.begin();
+	 i != workers.end(); ++i)
+      pthread_join(*i, 0);
+  }
+#endif
+
+#ifdef USE_IO_URING
+  //----------------------------------------------------------------------
+  // A submission and completion queue pair, set up with the raw
+  // system calls.
+  class Ring {
+  public:
+    bool open(unsigned int entries);
+    bool run(vector<FileBatch::Op> &ops, unsigned int first, int dirfd);
+
+    Ring(void) : fd(-1) {}
+
+  private:
+    bool supports(void);
+    void prepare(struct io_uring_sqe *sqe, FileBatch::Op &op,
+		 struct statx *stx, int dirfd);
+    unsigned int reap(vector<FileBatch::Op> &ops, unsigned int first);
+
+    int fd;
+    unsigned int entries;
+    // The kernel writes statx results here. They belong to the ring,
+    // so that they outlive operations it gave up waiting for.
+    vector<struct statx> stx;
+    unsigned int *sqHead;
+    unsigned int *sqTail;
+    unsigned int *sqMask;
+    unsigned int *sqArray;
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+  };
+
+  Ring ring;
+
+  //----------------------------------------------------------------------
+  bool Ring::open(unsigned int n)
+  {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if ((fd = syscall(__NR_io_uring_setup, n, &p)) < 0)
+      return false;
+
+    size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cqSize = p.cq_off.cqes
+      + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+      sqSize = cqSize = sqSize > cqSize ? sqSize : cqSize;
+
+    void *sq = mmap(0, sqSize, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    void *cq = sq;
+    if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP))
+      cq = mmap(0, cqSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+    void *s = MAP_FAILED;
+    if (sq != MAP_FAILED && cq != MAP_FAILED)
+      s = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe),
+	       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	       fd, IORING_OFF_SQES);
+
+    if (s == MAP_FAILED) {
+      // The mappings go with the process; the ring is not used.
+      close(fd);
+      fd = -1;
+      return false;
+    }
+
+    char *sqp = (char *) sq;
+    char *cqp = (char *) cq;
+    entries = p.sq_entries;
+    sqHead = (unsigned int *) (sqp + p.sq_off.head);
+    sqTail = (unsigned int *) (sqp + p.sq_off.tail);
+    sqMask = (unsigned int *) (sqp + p.sq_off.ring_mask);
+    sqArray = (unsigned int *) (sqp + p.sq_off.array);
+    cqHead = (unsigned int *) (cqp + p.cq_off.head);
+    cqTail = (unsigned int *) (cqp + p.cq_off.tail);
+    cqMask = (unsigned int *) (cqp + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (cqp + p.cq_off.cqes);
+    sqes = (struct io_uring_sqe *) s;
+    stx.resize(entries);
+
+    if (!supports()) {
+      close(fd);
+      fd = -1;
+      return false;
+    }
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  // Returns true if the kernel knows all operations a batch can have.
+  bool Ring::supports(void)
+  {
+    const unsigned int n = 256;
+    vector<char> buf(sizeof(struct io_uring_probe)
+		     + n * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe *probe = (struct io_uring_probe *) &buf[0];
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+		probe, n) < 0)
+      return false;
+
+    const int needed[] = {
+      IORING_OP_STATX, IORING_OP_RENAMEAT,
+      IORING_OP_UNLINKAT, IORING_OP_LINKAT
+    };
+
+    for (unsigned int i = 0; i < sizeof(needed) / sizeof(needed[0]); ++i)
+      if (needed[i] > probe->last_op
+	  || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+	return false;
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  void Ring::prepare(struct io_uring_sqe *sqe, FileBatch::Op &op,
+		     struct statx *stx, int dirfd)
+  {
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = dirfd;
+    sqe->addr = (unsigned long) op.from.c_str();
+
+    switch (op.type) {
+    case FileBatch::Op::STAT:
+      sqe->opcode = IORING_OP_STATX;
+      sqe->len = STATX_BASIC_STATS;
+      sqe->off = (unsigned long) stx;
+      break;
+    case FileBatch::Op::RENAME:
+      sqe->opcode = IORING_OP_RENAMEAT;
+      sqe->len = dirfd;
+      sqe->addr2 = (unsigned long) op.to.c_str();
+      break;
+    case FileBatch::Op::UNLINK:
+      sqe->opcode = IORING_OP_UNLINKAT;
+      break;
+    case FileBatch::Op::LINK:
+      sqe->opcode = IORING_OP_LINKAT;
+      sqe->len = dirfd;
+      sqe->addr2 = (unsigned long) op.to.c_str();
+      break;
+    }
+  }
+
+  //----------------------------------------------------------------------
+  // Stores the results of the completions on the queue, and returns
+  // how many there were.
+  unsigned int Ring::reap(vector<FileBatch::Op> &ops, unsigned int first)
+  {
+    unsigned int reaped = 0;
+    unsigned int head = *cqHead;
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+      const struct io_uring_cqe &cqe = cqes[head & *cqMask];
+      FileBatch::Op &op = ops[first + cqe.user_data];
+      op.error = cqe.res < 0 ? -cqe.res : 0;
+
+      if (op.type == FileBatch::Op::STAT && op.error == 0) {
+	const struct statx &x = stx[cqe.user_data];
+	memset(&op.st, 0, sizeof(op.st));
+	op.st.st_mode = x.stx_mode;
+	op.st.st_size = x.stx_size;
+	op.st.st_nlink = x.stx_nlink;
+	op.st.st_uid = x.stx_uid;
+	op.st.st_gid = x.stx_gid;
+	op.st.st_ino = x.stx_ino;
+	op.st.st_atime = x.stx_atime.tv_sec;
+	op.st.st_mtime = x.stx_mtime.tv_sec;
+	op.st.st_ctime = x.stx_ctime.tv_sec;
+      }
+
+      ++head;
+      ++reaped;
+    }
+
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return reaped;
+  }
+
+  //----------------------------------------------------------------------
+  // Returns false if the ring failed. It is then not used again, and
+  // the operations without a result are left for the caller.
+  bool Ring::run(vector<FileBatch::Op> &ops, unsigned int first, int dirfd)
+  {
+    while (first < ops.size()) {
+      // Fill the submission queue, and wait for all completions.
+      unsigned int n = ops.size() - first;
+      if (n > entries)
+	n = entries;
+
+      unsigned int tail = *sqTail;
+      for (unsigned int i = 0; i < n; ++i) {
+	const unsigned int index = tail & *sqMask;
+	prepare(&sqes[index], ops[first + i], &stx[i], dirfd);
+	sqes[index].user_data = i;
+	sqArray[index] = index;
+	++tail;
+      }
+
+      __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+      unsigned int pending = n;
+      unsigned int reaped = 0;
+      while (reaped < n) {
+	int res = syscall(__NR_io_uring_enter, fd, pending, n - reaped,
+			  IORING_ENTER_GETEVENTS, 0, 0);
+	if (res < 0) {
+	  if (errno == EINTR || errno == EAGAIN)
+	    continue;
+
+	  // Wait for what the kernel has already taken, as long as it
+	  // lets us. Anything still in flight after that may write only
+	  // to the ring's own buffers, which are kept.
+	  unsigned int inflight = n - pending - reaped;
+	  while (inflight > 0) {
+	    if (syscall(__NR_io_uring_enter, fd, 0, 1,
+			IORING_ENTER_GETEVENTS, 0, 0) < 0
+		&& errno != EINTR) {
+	      reap(ops, first);
+	      break;
+	    }
+
+	    const unsigned int r = reap(ops, first);
+	    inflight -= r < inflight ? r : inflight;
+	  }
+
+	  return false;
+	}
+
+	pending -= (unsigned int) res < pending ? res : pending;
+	reaped += reap(ops, first);
+      }
+
+      first += n;
+    }
+
+    return true;
+  }
+#endif
+
+  //----------------------------------------------------------------------
+  void initialize(void)
+  {
+    initialized = true;
+
+    Session &session = Session::getInstance();
+    string setting = session.globalconfig["Mailbox"]["io engine"];
+    lowercase(setting);
+
+    const string &t = session.globalconfig["Mailbox"]["io threads"];
+    if (t != "" && atoi(t.c_str()) > 0)
+      threads = atoi(t.c_str());
+
+#ifdef USE_IO_URING
+    if ((setting == "" || setting == "auto" || setting == "io_uring")
+	&& ring.open(64)) {
+      engine = IO_URING;
+      engineName = "io_uring";
+      return;
+    }
+#endif
+
+#ifdef WITH_PTHREAD
+    if ((setting == "" || setting == "auto" || setting == "io_uring"
+	 || setting == "threads") && threads > 1) {
+      engine = THREADS;
+      engineName = "threads";
+      return;
+    }
+#endif
+  }
+}
+
+//------------------------------------------------------------------------
+FileBatch::Op::Op(Type t, const string &f, const string &s)
+  : type(t), from(f), to(s), error(-1)
+{
+}
+
+//------------------------------------------------------------------------
+FileBatch::FileBatch(const string &d) : directory(d), dirfd(-1), done(0)
+{
+}
+
+//------------------------------------------------------------------------
+FileBatch::~FileBatch(void)
+{
+  if (dirfd != -1)
+    close(dirfd);
+}
+
+//------------------------------------------------------------------------
+unsigned int FileBatch::add(const Op &op)
+{
+  ops.push_back(op);
+  return ops.size() - 1;
+}
+
+//------------------------------------------------------------------------
+unsigned int FileBatch::stat(const string &name)
+{
+  return add(Op(Op::STAT, name));
+}
+
+//------------------------------------------------------------------------
+unsigned int FileBatch::rename(const string &from, const string &to)
+{
+  return add(Op(Op::RENAME, from, to));
+}
+
+//------------------------------------------------------------------------
+unsigned int FileBatch::unlink(const string &name)
+{
+  return add(Op(Op::UNLINK, name));
+}
+
+//------------------------------------------------------------------------
+unsigned int FileBatch::link(const string &from, const string &to)
+{
+  return add(Op(Op::LINK, from, to));
+}
+
+//------------------------------------------------------------------------
+void FileBatch::run(void)
+{
+  if (!initialized)
+    initialize();
+
+  if (done == ops.size())
+    return;
+
+#ifdef HAVE_ATFUNCS
+  if (dirfd == -1 && (dirfd = open(directory.c_str(), O_RDONLY)) == -1) {
+    for (; done < ops.size(); ++done)
+      ops[done].error = errno;
+    return;
+  }
+#endif
+
+  const unsigned int first = done;
+  submitted += ops.size() - first;
+
+  bool ran = false;
+#ifdef USE_IO_URING
+  if (engine == IO_URING) {
+    if (!ring.run(ops, first, dirfd)) {
+      engine = SYNC;
+      engineName = "sync";
+
+      // What the ring did not finish is run the usual way. A rename
+      // or unlink the kernel still carries out fails here, just as
+      // if another process had moved the file first.
+      for (unsigned int i = first; i < ops.size(); ++i)
+	if (ops[i].error == -1)
+	  runOne(dirfd, directory, ops[i]);
+    }
+
+    ran = true;
+  }
+#endif
+
+#ifdef WITH_PTHREAD
+  if (!ran && engine == THREADS && ops.size() - first >= MIN_THREADED) {
+    runThreaded(ops, first, dirfd, directory);
+    ran = true;
+  }
+#endif
+
+  if (!ran)
+    for (unsigned int i = first; i < ops.size(); ++i)
+      runOne(dirfd, directory, ops[i]);
+
+  for (unsigned int i = first; i < ops.size(); ++i)
+    if (ops[i].error != -1)
+      ++completed;
+
+  done = ops.size();
+}
+
+//------------------------------------------------------------------------
+int FileBatch::getError(unsigned int op) const
+{
+  return ops[op].error;
+}
+
+//------------------------------------------------------------------------
+const struct stat &FileBatch::getStat(unsigned int op) const
+{
+  return ops[op].st;
+}
+
+//------------------------------------------------------------------------
+unsigned int FileBatch::getSize(void) const
+{
+  return ops.size();
+}
+
+//------------------------------------------------------------------------
+void FileBatch::clear(void)
+{
+  ops.clear();
+  done = 0;
+}
+
+//------------------------------------------------------------------------
+unsigned int FileBatch::getSubmitted(void)
+{
+  return submitted;
+}
+
+//------------------------------------------------------------------------
+unsigned int FileBatch::getCompleted(void)
+{
+  return completed;
+}
+
+//------------------------------------------------------------------------
+const string &FileBatch::getEngine(void)
+{
+  if (!initialized)
+    initialize();
+
+  return engineName;
+}
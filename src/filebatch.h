@@ -0,0 +1,119 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    filebatch.h
+ *
+ *  Description:
+ *    Declaration of the Binc::FileBatch class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifndef filebatch_h_included
+#define filebatch_h_included
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace Binc {
+
+  /*!
+    \class FileBatch
+    \brief The FileBatch class runs a batch of file system operations
+    in one go.
+
+    Operations are queued with stat(), rename(), unlink() and link(),
+    and run() carries them all out before it returns. Relative names
+    are taken from the directory the batch was made for. Depending on
+    the "io engine" setting and on what the system supports, the
+    operations are submitted to io_uring, spread over a few threads,
+    or made one after the other.
+  */
+  class FileBatch {
+  public:
+    unsigned int stat(const std::string &name);
+    unsigned int rename(const std::string &from, const std::string &to);
+    unsigned int unlink(const std::string &name);
+    unsigned int link(const std::string &from, const std::string &to);
+
+    /*!
+      Runs all operations that have been queued since the last call.
+    */
+    void run(void);
+
+    /*!
+      Returns 0 if operation op succeeded, or else its errno.
+    */
+    int getError(unsigned int op) const;
+
+    /*!
+      Returns the status that stat operation op got.
+    */
+    const struct stat &getStat(unsigned int op) const;
+
+    unsigned int getSize(void) const;
+    void clear(void);
+
+    /*!
+      Returns the number of operations submitted and completed by
+      all batches, and the name of the engine in use.
+    */
+    static unsigned int getSubmitted(void);
+    static unsigned int getCompleted(void);
+    static const std::string &getEngine(void);
+
+    //--
+    FileBatch(const std::string &directory);
+    ~FileBatch(void);
+
+    class Op {
+    public:
+      enum Type { STAT, RENAME, UNLINK, LINK };
+
+      Type type;
+      std::string from;
+      std::string to;
+      int error;
+      struct stat st;
+
+      Op(Type t, const std::string &f, const std::string &s = "");
+    };
+
+  private:
+    unsigned int add(const Op &op);
+
+    std::string directory;
+    int dirfd;
+    std::vector<Op> ops;
+    unsigned int done;
+  };
+}
+
+#endif
@@ -0,0 +1,346 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    headersummary.cc
+ *  
+ *  Description:
+ *    Implementation of the Binc::HeaderSummary class.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "headersummary.h"
+#include "message.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  const string MAGIC = "BINCIMAP SUMMARY 1\n";
+
+  const char *const headers[HeaderSummary::COLUMNS] = {
+    "subject", "from", "to", "cc"
+  };
+
+  const char *const months[12] = {
+    "jan", "feb", "mar", "apr", "may", "jun",
+    "jul", "aug", "sep", "oct", "nov", "dec"
+  };
+}
+
+//------------------------------------------------------------------------
+HeaderSummary::HeaderSummary(void)
+{
+  clear();
+  changed = false;
+}
+
+//------------------------------------------------------------------------
+void HeaderSummary::clear(unsigned int uidvalidity_in)
+{
+  uids.clear();
+  days.clear();
+  present.clear();
+  for (int c = 0; c < COLUMNS; ++c) {
+    values[c] = "";
+    offsets[c].clear();
+    offsets[c].push_back(0);
+  }
+
+  uidvalidity = uidvalidity_in;
+  changed = true;
+}
+
+//------------------------------------------------------------------------
+void HeaderSummary::addRow(unsigned int uid, int day, unsigned char p,
+			   const string *v)
+{
+  uids.push_back(uid);
+  days.push_back(day);
+  present.push_back(p);
+  for (int c = 0; c < COLUMNS; ++c) {
+    values[c] += v[c];
+    offsets[c].push_back(values[c].length());
+  }
+}
+
+//------------------------------------------------------------------------
+bool HeaderSummary::load(const string &fileName)
+{
+  FILE *fp = fopen(fileName.c_str(), "r");
+  if (fp == 0)
+    return false;
+
+  string data;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    data.append(buf, n);
+
+  bool error = ferror(fp) != 0;
+  fclose(fp);
+
+  if (error || data.compare(0, MAGIC.length(), MAGIC) != 0)
+    return false;
+
+  clear();
+
+  // The header is followed by the rows: the UID delta, the day, a
+  // bit for each header that is present, and the header values.
+  string::size_type pos = MAGIC.length();
+  unsigned int rows = 0;
+  bool complete = readVarint(data, pos, uidvalidity)
+    && readVarint(data, pos, rows);
+
+  unsigned int uid = 0;
+  string v[COLUMNS];
+  for (unsigned int i = 0; complete && i < rows; ++i) {
+    unsigned int delta, day, p;
+    if (!readVarint(data, pos, delta) || !readVarint(data, pos, day)
+	|| !readVarint(data, pos, p)) {
+      complete = false;
+      break;
+    }
+
+    for (int c = 0; c < COLUMNS; ++c) {
+      unsigned int length;
+      if (!readVarint(data, pos, length) || length > data.length() - pos) {
+	complete = false;
+	break;
+      }
+
+      v[c].assign(data, pos, length);
+      pos += length;
+    }
+
+    uid += delta;
+    if (complete)
+      addRow(uid, (int) day, (unsigned char) p, v);
+  }
+
+  if (!complete || pos != data.length()) {
+    clear();
+    return false;
+  }
+
+  changed = false;
+  return true;
+}
+
+//------------------------------------------------------------------------
+bool HeaderSummary::save(const string &fileName)
+{
+  // Write a temporary file and rename it in place, so that other
+  // instances never see a partial summary.
+  string tpl = fileName + "XXXXXX";
+  vector<char> ftemplate(tpl.begin(), tpl.end());
+  ftemplate.push_back('\0');
+
+  int fd = mkstemp(&ftemplate[0]);
+  if (fd == -1)
+    return false;
+
+  FILE *fp = fdopen(fd, "w");
+  if (fp == 0) {
+    close(fd);
+    unlink(&ftemplate[0]);
+    return false;
+  }
+
+  string header = MAGIC;
+  appendVarint(header, uidvalidity);
+  appendVarint(header, uids.size());
+  fwrite(header.data(), 1, header.length(), fp);
+
+  unsigned int lastuid = 0;
+  for (unsigned int i = 0; i < uids.size(); ++i) {
+    string row;
+    appendVarint(row, uids[i] - lastuid);
+    appendVarint(row, (unsigned int) days[i]);
+    appendVarint(row, present[i]);
+    for (int c = 0; c < COLUMNS; ++c) {
+      appendVarint(row, offsets[c][i + 1] - offsets[c][i]);
+      row.append(values[c], offsets[c][i], offsets[c][i + 1] - offsets[c][i]);
+    }
+
+    fwrite(row.data(), 1, row.length(), fp);
+    lastuid = uids[i];
+  }
+
+  bool error = ferror(fp) != 0;
+  if (fclose(fp) != 0 || error
+      || rename(&ftemplate[0], fileName.c_str()) != 0) {
+    unlink(&ftemplate[0]);
+    return false;
+  }
+
+  changed = false;
+  return true;
+}
+
+//------------------------------------------------------------------------
+void HeaderSummary::add(unsigned int uid, Message &message)
+{
+  unsigned char p = 0;
+  string v[COLUMNS];
+  for (int c = 0; c < COLUMNS; ++c) {
+    // getHeader() returns "" both for empty and for missing headers.
+    v[c] = message.getHeader(headers[c]);
+    if (v[c] != "" || message.headerContains(headers[c], "")) {
+      p |= 1 << c;
+      uppercase(v[c]);
+    }
+  }
+
+  addRow(uid, getSentDay(message.getHeader("date")), p, v);
+  changed = true;
+}
+
+//------------------------------------------------------------------------
+void HeaderSummary::retain(const vector<unsigned int> &keep)
+{
+  HeaderSummary tmp;
+  tmp.clear(uidvalidity);
+
+  string v[COLUMNS];
+  for (unsigned int i = 0; i < uids.size(); ++i) {
+    if (!binary_search(keep.begin(), keep.end(), uids[i]))
+      continue;
+
+    for (int c = 0; c < COLUMNS; ++c)
+      v[c].assign(values[c], offsets[c][i], offsets[c][i + 1] - offsets[c][i]);
+    tmp.addRow(uids[i], days[i], present[i], v);
+  }
+
+  *this = tmp;
+  changed = true;
+}
+
+//------------------------------------------------------------------------
+void HeaderSummary::findText(Column c, const string &text,
+			     vector<unsigned int> &result) const
+{
+  result.clear();
+
+  const unsigned char bit = 1 << c;
+  const char *data = values[c].data();
+  const unsigned int *off = &offsets[c][0];
+  const unsigned int rows = uids.size();
+  const TextMatcher matcher(text);
+
+  for (unsigned int i = 0; i < rows; ++i) {
+    if (!(present[i] & bit))
+      continue;
+
+    if (matcher.find(data + off[i], off[i + 1] - off[i]))
+      result.push_back(uids[i]);
+  }
+}
+
+//------------------------------------------------------------------------
+void HeaderSummary::findSentDay(int first, int last,
+				vector<unsigned int> &result) const
+{
+  result.clear();
+
+  const unsigned int rows = uids.size();
+  for (unsigned int i = 0; i < rows; ++i)
+    if (days[i] >= first && days[i] <= last)
+      result.push_back(uids[i]);
+}
+
+//------------------------------------------------------------------------
+int HeaderSummary::getColumn(const string &header)
+{
+  string tmp = header;
+  lowercase(tmp);
+
+  for (int c = 0; c < COLUMNS; ++c)
+    if (tmp == headers[c])
+      return c;
+
+  return -1;
+}
+
+//------------------------------------------------------------------------
+int HeaderSummary::getDay(time_t t)
+{
+  struct tm *tm = localtime(&t);
+  if (tm == 0 || tm->tm_year + 1900 <= 0)
+    return 0;
+
+  return (tm->tm_year + 1900) * 10000 + (tm->tm_mon + 1) * 100 + tm->tm_mday;
+}
+
+//------------------------------------------------------------------------
+int HeaderSummary::getSentDay(const string &d_in)
+{
+  string date = d_in;
+  if (date == "")
+    return 0;
+
+  lowercase(date);
+
+  string::size_type n = date.find(',');
+  if (n != string::npos)
+    date = date.substr(n + 1);
+  trim(date);
+
+  vector<string> parts;
+  split(date, " ", parts);
+  if (parts.size() < 3)
+    return 0;
+
+  struct tm mold;
+  memset((char *) &mold, 0, sizeof(struct tm));
+  mold.tm_mday = atoi(parts[0].c_str());
+  mold.tm_year = atoi(parts[2].c_str()) - 1900;
+
+  for (int i = 0; i < 12; ++i)
+    if (parts[1] == months[i])
+      mold.tm_mon = i;
+
+  time_t t = mktime(&mold);
+  if (t == (time_t) -1)
+    return 0;
+
+  return getDay(t);
+}
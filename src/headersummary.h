@@ -0,0 +1,138 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    headersummary.h
+ *  
+ *  Description:
+ *    Declaration of the Binc::HeaderSummary class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifndef headersummary_h_included
+#define headersummary_h_included
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+namespace Binc {
+
+  class Message;
+
+  /*!
+    \class HeaderSummary
+    \brief The HeaderSummary class keeps the headers that SEARCH
+    looks at most often in columns, one row per message.
+
+    Header values are stored upper cased, and the Date header as a
+    day number (see getDay()), so that searches can scan the columns
+    without opening any messages. Rows are kept in ascending UID
+    order.
+  */
+  class HeaderSummary {
+  public:
+    enum Column {
+      SUBJECT, FROM, TO, CC, COLUMNS
+    };
+
+    /*!
+      Drops all rows and starts over for a new UIDVALIDITY.
+    */
+    void clear(unsigned int uidvalidity = 0);
+
+    bool load(const std::string &fileName);
+    bool save(const std::string &fileName);
+
+    /*!
+      Adds a row for message, which must have a higher UID than all
+      rows added before it.
+    */
+    void add(unsigned int uid, Message &message);
+
+    /*!
+      Removes all rows whose UIDs are not in the sorted list uids.
+    */
+    void retain(const std::vector<unsigned int> &uids);
+
+    /*!
+      Stores the UIDs of the messages whose header in column c
+      contains text, ignoring case, in uids.
+    */
+    void findText(Column c, const std::string &text,
+		  std::vector<unsigned int> &uids) const;
+
+    /*!
+      Stores the UIDs of the messages that were sent on a day from
+      first to last, inclusive, in uids.
+    */
+    void findSentDay(int first, int last,
+		     std::vector<unsigned int> &uids) const;
+
+    inline unsigned int getUidValidity(void) const { return uidvalidity; }
+    inline unsigned int getLastUid(void) const
+    { return uids.empty() ? 0 : uids.back(); }
+    inline unsigned int getRowCount(void) const { return uids.size(); }
+    inline bool isChanged(void) const { return changed; }
+
+    /*!
+      Returns the column that holds header, or -1.
+    */
+    static int getColumn(const std::string &header);
+
+    /*!
+      Returns the local date of t as a number that sorts like the
+      date, or 0 if t is invalid.
+    */
+    static int getDay(time_t t);
+
+    /*!
+      Returns the day number of the date in a Date header, or 0 if it
+      can not be parsed.
+    */
+    static int getSentDay(const std::string &date);
+
+    //--
+    HeaderSummary(void);
+
+  private:
+    void addRow(unsigned int uid, int day, unsigned char present,
+		const std::string *values);
+
+    std::vector<unsigned int> uids;
+    std::vector<int> days;
+    std::vector<unsigned char> present;
+    std::string values[COLUMNS];
+    std::vector<unsigned int> offsets[COLUMNS];
+
+    unsigned int uidvalidity;
+    bool changed;
+  };
+}
+
+#endif
@@ -39,6 +39,7 @@
 #include "io.h"
 #include "convert.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <map>
 #include <iostream>
@@ -51,9 +52,15 @@ using namespace Binc;
 
 //------------------------------------------------------------------------
 Request::Request(void) 
-  : extra(0), flags(), statuses(), bset(), searchkey(), fatt()
+  : extra(0), flags(), statuses(), returns(), criteria(), bset(), searchkey(), fatt()
 {
   uidmode = false;
+  hasmodseq = false;
+  modseq = 0;
+  vanished = false;
+  condstore = false;
+  qresync = false;
+  knownuidvalidity = 0;
 }
 
 Request::~Request(void)
@@ -230,6 +237,18 @@ vector<string> &Request::getStatuses(void)
   return statuses;
 }
 
+//------------------------------------------------------------------------
+vector<string> &Request::getReturns(void)
+{
+  return returns;
+}
+
+//------------------------------------------------------------------------
+vector<string> &Request::getCriteria(void)
+{
+  return criteria;
+}
+
 //------------------------------------------------------------------------
 vector<string> &Request::getFlags(void)
 {
@@ -237,13 +256,15 @@ vector<string> &Request::getFlags(void)
 }
 
 //------------------------------------------------------------------------
-SequenceSet::SequenceSet(void) : limited(true), nullSet(false)
+SequenceSet::SequenceSet(void)
+  : limited(true), nullSet(false), saved(false), ordered(true)
 {
 }
 
 //------------------------------------------------------------------------
 SequenceSet::SequenceSet(const SequenceSet &copy) 
-  : limited(copy.limited), nullSet(copy.nullSet), internal(copy.internal)
+  : limited(copy.limited), nullSet(copy.nullSet), saved(copy.saved),
+    ordered(copy.ordered), internal(copy.internal)
 {
 }
 
@@ -252,6 +273,8 @@ SequenceSet &SequenceSet::operator = (const SequenceSet &copy)
 {
   limited = copy.limited;
   nullSet = copy.nullSet;
+  saved = copy.saved;
+  ordered = copy.ordered;
   internal = copy.internal;
 
   return *this;
@@ -302,23 +325,79 @@ SequenceSet::Range::Range(unsigned int a, unsigned int b)
   }
 }
 
+//------------------------------------------------------------------------
+bool SequenceSet::Range::endsBefore(const Range &r, unsigned int n)
+{
+  return r.to < n;
+}
+
+//------------------------------------------------------------------------
+void SequenceSet::add(const Range &r)
+{
+  if (!internal.empty() && r.from <= internal.back().to)
+    ordered = false;
+
+  // A range that continues the last one is merged into it, so that
+  // sets built one number at a time stay short.
+  if (ordered && !internal.empty()
+      && internal.back().to != (unsigned int) -1
+      && r.from == internal.back().to + 1) {
+    internal.back().to = r.to;
+    return;
+  }
+
+  internal.push_back(r);
+}
+
 //------------------------------------------------------------------------
 void SequenceSet::addRange(unsigned int a, unsigned int b)
 {
   if (a == (unsigned int)-1 || b == (unsigned int)-1) limited = false;
-  internal.push_back(Range(a, b));
+  add(Range(a, b));
 }
 
 //------------------------------------------------------------------------
 void SequenceSet::addNumber(unsigned int a)
 {
   if (a == (unsigned int)-1) limited = false;
-  internal.push_back(Range(a, a));
+  add(Range(a, a));
+}
+
+//------------------------------------------------------------------------
+void SequenceSet::setSaved(void)
+{
+  saved = true;
+}
+
+//------------------------------------------------------------------------
+string SequenceSet::toString(void) const
+{
+  string tmp = saved ? "$" : "";
+  for (vector<Range>::const_iterator i = internal.begin();
+       i != internal.end(); ++i) {
+    if (tmp != "")
+      tmp += ",";
+
+    tmp += (*i).from == (unsigned int) -1 ? "*" : Binc::toString((*i).from);
+    if ((*i).to != (*i).from)
+      tmp += ":" + ((*i).to == (unsigned int) -1 ? string("*")
+		    : Binc::toString((*i).to));
+  }
+
+  return tmp;
 }
 
 //------------------------------------------------------------------------
 bool SequenceSet::isInSet(unsigned int n) const
 {
+  // Sets whose ranges were added in ascending order, like search
+  // results and most sets that clients send, are binary searched.
+  if (ordered && limited) {
+    vector<Range>::const_iterator i
+      = lower_bound(internal.begin(), internal.end(), n, Range::endsBefore);
+    return i != internal.end() && n >= (*i).from;
+  }
+
   unsigned int maxvalue = 0;
   for (vector<Range>::const_iterator i = internal.begin();
        i != internal.end(); ++i) {
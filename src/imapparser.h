@@ -51,6 +51,16 @@ namespace Binc {
     bool isInSet(unsigned int n) const;
     void addNumber(unsigned int a_in);
     inline bool isLimited(void) const { return limited; }
+    inline bool isEmpty(void) const { return internal.empty(); }
+
+    /*!
+      Marks the set as "$", the result that the last SEARCH with
+      RETURN (SAVE) kept in the selected mailbox.
+    */
+    void setSaved(void);
+    inline bool isSaved(void) const { return saved; }
+
+    std::string toString(void) const;
 
     static SequenceSet &all(void);
 
@@ -68,14 +78,20 @@ namespace Binc {
   private:
     bool limited;
     bool nullSet;
+    bool saved;
+    bool ordered;
 
     class Range {
     public:
       unsigned int from;
       unsigned int to;
       Range(unsigned int from, unsigned int to);
+
+      static bool endsBefore(const Range &r, unsigned int n);
     };
 
+    void add(const Range &r);
+
     std::vector<Range> internal;
   };
 
@@ -141,11 +157,25 @@ namespace Binc {
     BincImapParserData * extra;
     std::vector<std::string> flags;
     std::vector<std::string> statuses;
+    std::vector<std::string> returns;
+    std::vector<std::string> criteria;
 
     SequenceSet bset;
     BincImapParserSearchKey searchkey;
     std::vector<BincImapParserFetchAtt> fatt;
 
+    // RFC 7162: the mod-sequence of CHANGEDSINCE, UNCHANGEDSINCE or
+    // SELECT (QRESYNC ...), VANISHED in UID FETCH, and the CONDSTORE
+    // and QRESYNC parameters of SELECT with the UIDVALIDITY and UIDs
+    // that the client knows.
+    bool hasmodseq;
+    unsigned int modseq;
+    bool vanished;
+    bool condstore;
+    bool qresync;
+    unsigned int knownuidvalidity;
+    SequenceSet knownuids;
+
     void setUidMode(void);
     bool getUidMode(void) const;
 
@@ -189,6 +219,8 @@ namespace Binc {
 
     std::vector<std::string> &getFlags(void);
     std::vector<std::string> &getStatuses(void);
+    std::vector<std::string> &getReturns(void);
+    std::vector<std::string> &getCriteria(void);
 
     Request(void);
     ~Request(void);
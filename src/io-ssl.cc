@@ -39,6 +39,7 @@
 
 #include <string>
 
+#include <string.h>
 #include <openssl/ssl.h>
 
 #include "session.h"
@@ -222,30 +223,90 @@ void SSLEnabledIO::writeStr(const string s)
     syslog(LOG_INFO, "%s", s.c_str());
     alarm(0);
   } else if (mode == MODE_SSL) {
-    do {
-      alarm(transfertimeout);
-      int retval = SSL_write(ssl, s.c_str(), s.length());
-      alarm(0);
+    writeSSL(s.data(), s.length());
+  }
+}
+
+//------------------------------------------------------------------------
+bool SSLEnabledIO::writeSSL(const char *data, int length)
+{
+  do {
+    alarm(transfertimeout);
+    int retval = SSL_write(ssl, data, length);
+    alarm(0);
       
-      if (retval > 0) {
-	Session::getInstance().addWriteBytes(retval);
-	break;
-      } else if (retval == 0) {
-	/* call get_error */
-	setLastError("SSL_write returned 0");
-	return;
-      } else if (retval < 0) {
-	int err = SSL_get_error(ssl, retval);
+    if (retval > 0) {
+      Session::getInstance().addWriteBytes(retval);
+      return true;
+    } else if (retval == 0) {
+      /* call get_error */
+      setLastError("SSL_write returned 0");
+      return false;
+    } else if (retval < 0) {
+      int err = SSL_get_error(ssl, retval);
 	
-	if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
-	  setLastError("SSL_write returned < 0");
-	  return;
-	} else {
-	  // retry when we get this error.
-	} 
-      }
-    } while (1);
+      if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+	setLastError("SSL_write returned < 0");
+	return false;
+      } else {
+	// retry when we get this error.
+      } 
+    }
+  } while (1);
+}
+
+//------------------------------------------------------------------------
+IO &SSLEnabledIO::write(const char *data, size_t length)
+{
+  // Big blocks go to SSL_write directly instead of being copied into
+  // the output buffer first, unless they must be compressed.
+  if (mode != MODE_SSL || !enabled || deflater != 0
+      || (int) length < buffersize || length < 16384)
+    return IO::write(data, length);
+
+  flushContent();
+  writeSSL(data, length);
+  return *this;
+}
+
+//------------------------------------------------------------------------
+void SSLEnabledIO::writeVector(const struct iovec *iov, int iovcnt)
+{
+  if (mode != MODE_SSL) {
+    IO::writeVector(iov, iovcnt);
+    return;
+  }
+
+  // Pack small pieces into records of up to 16 KB; anything bigger is
+  // written as it is.
+  char record[16384];
+  int used = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    const char *data = (const char *) iov[i].iov_base;
+    size_t length = iov[i].iov_len;
+
+    if (length >= sizeof(record)) {
+      if (used != 0 && !writeSSL(record, used))
+	return;
+      used = 0;
+
+      if (!writeSSL(data, length))
+	return;
+      continue;
+    }
+
+    if (used + length > sizeof(record)) {
+      if (!writeSSL(record, used))
+	return;
+      used = 0;
+    }
+
+    memcpy(record + used, data, length);
+    used += length;
   }
+
+  if (used != 0)
+    writeSSL(record, used);
 }
 
 //------------------------------------------------------------------------
@@ -60,7 +60,11 @@ namespace Binc {
     bool isModeSSL(void);
     bool setModeSSL(void);
 
+    using IO::write;
+    IO &write(const char *data, size_t length);
+
     void writeStr(const std::string s);
+    void writeVector(const struct iovec *iov, int iovcnt);
     int fillBuffer(int timeout, bool retry);
 
     int pending(void) const;
@@ -74,6 +78,8 @@ namespace Binc {
     SSL *ssl;
     SSL_CTX *ctx;
 
+    bool writeSSL(const char *data, int length);
+
   };
 }
 
@@ -35,11 +35,27 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <iterator>
 #include <string>
 
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
 #include "session.h"
 #include "io.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
 
 using namespace ::std;
 using namespace Binc;
@@ -48,6 +64,7 @@ using namespace Binc;
 IO::IO()
 {
   pid = getpid();
+  fpout = 0;
   enabled = true;
   flushesOnEndl = true;
   mode = MODE_PLAIN;
@@ -57,6 +74,10 @@ IO::IO()
   transfertimeout = 0;
   inputsize = 0;
   inputlimit = true;
+  spanBytes = 0;
+  deflater = 0;
+  inflater = 0;
+  deflatePending = false;
 }
 
 //------------------------------------------------------------------------
@@ -73,11 +94,29 @@ IO::IO(FILE *fp)
   transfertimeout = 0;
   inputsize = 0;
   inputlimit = true;
+  spanBytes = 0;
+  deflater = 0;
+  inflater = 0;
+  deflatePending = false;
 }
 
 //------------------------------------------------------------------------
 IO::~IO(void)
 {
+  releaseSpans();
+
+#ifdef WITH_ZLIB
+  if (deflater != 0) {
+    deflateEnd(deflater);
+    delete deflater;
+  }
+
+  if (inflater != 0) {
+    inflateEnd(inflater);
+    delete inflater;
+  }
+#endif
+
   switch (mode) {
   case MODE_SYSLOG:
     closelog();
@@ -107,14 +146,19 @@ void IO::disable(void)
 
 //------------------------------------------------------------------------
 void IO::flushContent(void)
+{
+  flushOutput(true);
+}
+
+//------------------------------------------------------------------------
+void IO::flushOutput(bool sync)
 {
   if (!enabled) return;
 
-  string s = outputBuffer.str();
-  string tmpstr;
+  const string &s = outputBuffer.str();
   if (mode == MODE_SYSLOG) {
-    tmpstr = "";
-    for (string::iterator i = s.begin(); i != s.end(); ++i)
+    string tmpstr;
+    for (string::const_iterator i = s.begin(); i != s.end(); ++i)
       if (*i != '\r' && *i != '\n') {
 	tmpstr += *i;
       } else {
@@ -124,11 +168,256 @@ void IO::flushContent(void)
 
     if (tmpstr != "")
       writeStr(tmpstr);
-  } else
-    writeStr(s);
+  } else {
+    // Gather the protocol tokens in the output buffer and the queued
+    // literal spans in their original order, and hand everything to
+    // writeVector in one go. Spans that are sent from the file
+    // directly split the vector in two.
+    vector<struct iovec> iov;
+    iov.reserve(outputSpans.size() * 2 + 1);
+
+    string::size_type pos = 0;
+    struct iovec v;
+    for (vector<OutputSpan>::const_iterator i = outputSpans.begin();
+	 i != outputSpans.end(); ++i) {
+      if (i->position > pos) {
+	v.iov_base = (void *) (s.data() + pos);
+	v.iov_len = i->position - pos;
+	iov.push_back(v);
+	pos = i->position;
+      }
 
+      if (i->fd != -1) {
+	if (iov.size() != 0)
+	  writeVector(&iov[0], iov.size());
+	iov.clear();
+	sendFileSpan(*i);
+	continue;
+      }
+
+      v.iov_base = (void *) i->data;
+      v.iov_len = i->length;
+      iov.push_back(v);
+    }
+
+    if (s.length() > pos) {
+      v.iov_base = (void *) (s.data() + pos);
+      v.iov_len = s.length() - pos;
+      iov.push_back(v);
+    }
+
+    if (deflater != 0) {
+      // Only flush the compressor at the end of a response; flushes
+      // caused by a full output buffer let it compress across them.
+      for (vector<struct iovec>::const_iterator i = iov.begin();
+	   i != iov.end(); ++i)
+	deflateOutput((const char *) i->iov_base, i->iov_len, false);
+      if (sync && deflatePending)
+	deflateOutput(0, 0, true);
+    } else if (iov.size() != 0)
+      writeVector(&iov[0], iov.size());
+  }
 
   outputBuffer.clear();
+  releaseSpans();
+}
+
+//------------------------------------------------------------------------
+void IO::deflateOutput(const char *data, size_t length, bool sync)
+{
+#ifdef WITH_ZLIB
+  char buf[16384];
+
+  deflater->next_in = (Bytef *) data;
+  deflater->avail_in = length;
+  do {
+    deflater->next_out = (Bytef *) buf;
+    deflater->avail_out = sizeof(buf);
+    if (deflate(deflater, sync ? Z_SYNC_FLUSH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+      break;
+
+    struct iovec v;
+    v.iov_base = buf;
+    v.iov_len = sizeof(buf) - deflater->avail_out;
+    if (v.iov_len != 0)
+      writeVector(&v, 1);
+  } while (deflater->avail_out == 0);
+
+  deflatePending = !sync;
+#endif
+}
+
+//------------------------------------------------------------------------
+bool IO::enableCompression(int level)
+{
+#ifdef WITH_ZLIB
+  if (deflater != 0)
+    return true;
+
+  if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION)
+    level = Z_DEFAULT_COMPRESSION;
+
+  // RFC 4978 uses raw deflate streams without zlib headers.
+  z_stream *d = new z_stream;
+  memset(d, 0, sizeof(z_stream));
+  if (deflateInit2(d, level, Z_DEFLATED, -MAX_WBITS, 8,
+		   Z_DEFAULT_STRATEGY) != Z_OK) {
+    delete d;
+    setLastError("unable to initialize compression");
+    return false;
+  }
+
+  z_stream *i = new z_stream;
+  memset(i, 0, sizeof(z_stream));
+  if (inflateInit2(i, -MAX_WBITS) != Z_OK) {
+    deflateEnd(d);
+    delete d;
+    delete i;
+    setLastError("unable to initialize compression");
+    return false;
+  }
+
+  deflater = d;
+  inflater = i;
+  deflatePending = false;
+
+  // Anything the client sent after the COMPRESS command is already
+  // compressed.
+  if (!inputBuffer.empty()) {
+    string raw(inputBuffer.rbegin(), inputBuffer.rend());
+    inputBuffer.clear();
+    if (inflateInput(raw.data(), raw.length()) < 0)
+      return false;
+  }
+
+  return true;
+#else
+  setLastError("compression is not supported");
+  return false;
+#endif
+}
+
+//------------------------------------------------------------------------
+void IO::releaseSpans(void)
+{
+  for (vector<OutputSpan>::iterator i = outputSpans.begin();
+       i != outputSpans.end(); ++i)
+    if (i->fd != -1)
+      ::close(i->fd);
+    else
+      munmap(i->map, i->maplength);
+
+  outputSpans.clear();
+  spanBytes = 0;
+}
+
+//------------------------------------------------------------------------
+void IO::sendFileSpan(const OutputSpan &span)
+{
+  off_t offset = span.offset;
+  size_t length = span.length;
+
+#ifdef HAVE_SENDFILE
+  if (fpout != 0) {
+    alarm(transfertimeout);
+    while (length > 0) {
+      ssize_t n = sendfile(fileno(fpout), span.fd, &offset, length);
+      if (n == -1 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	break;
+
+      Session::getInstance().addWriteBytes(n);
+      length -= n;
+    }
+    alarm(0);
+  }
+#endif
+
+  // Whatever sendfile() could not handle is copied the usual way.
+  char buf[8192];
+  while (length > 0) {
+    ssize_t n = pread(span.fd, buf, length < sizeof(buf) ? length : sizeof(buf),
+		      offset);
+    if (n <= 0)
+      break;
+
+    struct iovec v;
+    v.iov_base = buf;
+    v.iov_len = n;
+    writeVector(&v, 1);
+    offset += n;
+    length -= n;
+  }
+}
+
+//------------------------------------------------------------------------
+void IO::writeFileSpan(int fd, off_t offset, size_t length)
+{
+  if (!enabled || length == 0) return;
+
+  // Large literals are queued by reference. In plain mode, when the
+  // output is not compressed, they are sent with sendfile() from a
+  // duplicate of fd; otherwise they are mapped. Either way the caller
+  // may close fd right away. Small literals, and anything we fail to
+  // queue, are copied into the output buffer instead.
+#ifdef HAVE_SENDFILE
+  if (mode == MODE_PLAIN && deflater == 0 && length >= 4096) {
+    int dupfd = dup(fd);
+    if (dupfd != -1) {
+      OutputSpan span;
+      span.position = outputBuffer.getSize();
+      span.data = 0;
+      span.length = length;
+      span.map = 0;
+      span.maplength = 0;
+      span.fd = dupfd;
+      span.offset = offset;
+      outputSpans.push_back(span);
+      spanBytes += length;
+
+      if ((int) (outputBuffer.getSize() + spanBytes) >= buffersize)
+	flushOutput(false);
+      return;
+    }
+  }
+#endif
+
+  if (mode != MODE_SYSLOG && length >= 4096) {
+    static const off_t pagesize = (off_t) sysconf(_SC_PAGESIZE);
+    off_t start = offset - (offset % pagesize);
+    size_t maplength = length + (size_t) (offset - start);
+
+    void *map = mmap(0, maplength, PROT_READ, MAP_SHARED, fd, start);
+    if (map != MAP_FAILED) {
+      OutputSpan span;
+      span.position = outputBuffer.getSize();
+      span.data = (const char *) map + (offset - start);
+      span.length = length;
+      span.map = map;
+      span.maplength = maplength;
+      span.fd = -1;
+      span.offset = 0;
+      outputSpans.push_back(span);
+      spanBytes += length;
+
+      if ((int) (outputBuffer.getSize() + spanBytes) >= buffersize)
+	flushOutput(false);
+      return;
+    }
+  }
+
+  char buf[8192];
+  while (length > 0) {
+    ssize_t n = pread(fd, buf, length < sizeof(buf) ? length : sizeof(buf),
+		      offset);
+    if (n <= 0)
+      break;
+
+    write(buf, n);
+    offset += n;
+    length -= n;
+  }
 }
 
 //------------------------------------------------------------------------
@@ -149,6 +438,7 @@ void IO::clear(void)
   if (!enabled) return;
 
   outputBuffer.clear();
+  releaseSpans();
 }
 
 //------------------------------------------------------------------------
@@ -191,14 +481,8 @@ IO &IO::operator << (std::ostream &(*man)(std::ostream &))
 { 
   if (!enabled) return *this;
   
-  if (useLogPrefix && outputBuffer.getSize() == 0) {
-    outputBuffer << pid;
-    outputBuffer << " ";
-    outputBuffer << seqnr++;
-    if (logprefix != "")
-      outputBuffer << " [" << logprefix << "]";
-    outputBuffer << " ";
-  }
+  if (useLogPrefix && outputBuffer.getSize() == 0)
+    addLogPrefix();
 
   static std::ostream &(*endl_funcpt)(std::ostream&) = std::endl;
   
@@ -210,12 +494,51 @@ IO &IO::operator << (std::ostream &(*man)(std::ostream &))
   } else
     outputBuffer << man;
   
-  if ((int) outputBuffer.getSize() >= buffersize)
-    flushContent();
+  if ((int) (outputBuffer.getSize() + spanBytes) >= buffersize)
+    flushOutput(false);
+
+  return *this;
+}
+
+//------------------------------------------------------------------------
+IO &IO::write(const string &s, string::size_type pos, string::size_type n)
+{
+  if (pos >= s.length())
+    return *this;
+
+  if (n > s.length() - pos)
+    n = s.length() - pos;
+
+  return write(s.data() + pos, n);
+}
+
+//------------------------------------------------------------------------
+IO &IO::write(const char *data, size_t length)
+{
+  if (!enabled || length == 0) return *this;
+
+  if (useLogPrefix && outputBuffer.getSize() == 0)
+    addLogPrefix();
+
+  outputBuffer.write(data, length);
+
+  if ((int) (outputBuffer.getSize() + spanBytes) >= buffersize)
+    flushOutput(false);
 
   return *this;
 }
 
+//------------------------------------------------------------------------
+void IO::addLogPrefix(void)
+{
+  outputBuffer << pid;
+  outputBuffer << " ";
+  outputBuffer << seqnr++;
+  if (logprefix != "")
+    outputBuffer << " [" << logprefix << "]";
+  outputBuffer << " ";
+}
+
 //------------------------------------------------------------------------
 int IO::select(int maxfd,
 	       fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
@@ -280,6 +603,73 @@ void IO::writeStr(const string s)
   }
 }
 
+//------------------------------------------------------------------------
+void IO::writeVector(const struct iovec *iov, int iovcnt)
+{
+  if (mode != MODE_PLAIN) {
+    for (int i = 0; i < iovcnt; ++i)
+      writeStr(string((const char *) iov[i].iov_base, iov[i].iov_len));
+    return;
+  }
+
+  if (fpout == 0)
+    return;
+
+  // Anything written with stdio must go out first.
+  fflush(fpout);
+
+  // Keep a private copy of the vector so that partial writes can
+  // advance it.
+  vector<struct iovec> v(iov, iov + iovcnt);
+  vector<struct iovec>::iterator i = v.begin();
+
+  alarm(transfertimeout);
+  while (i != v.end()) {
+    int cnt = v.end() - i;
+    ssize_t n = writev(fileno(fpout), &*i, cnt > IOV_MAX ? IOV_MAX : cnt);
+    if (n == -1) {
+      if (errno == EINTR)
+	continue;
+
+      // ignore error
+      break;
+    }
+
+    Session::getInstance().addWriteBytes(n);
+
+    while (i != v.end() && n >= (ssize_t) i->iov_len) {
+      n -= i->iov_len;
+      ++i;
+    }
+
+    if (n > 0) {
+      i->iov_base = (char *) i->iov_base + n;
+      i->iov_len -= n;
+    }
+  }
+  alarm(0);
+}
+
+//------------------------------------------------------------------------
+// Reads at most bytes characters into data, waiting for the client
+// only if nothing is buffered. Used for literals, which can be large
+// and are not subject to the input limit. Returns the number of
+// characters read, or what fillInput() returns on errors.
+int IO::readBlock(char *data, int bytes, int timeout, bool retry)
+{
+  if (inputBuffer.empty()) {
+    int ret = fillInput(timeout, retry);
+    if (ret <= 0)
+      return ret;
+  }
+
+  const int n = (int) inputBuffer.size() < bytes
+    ? (int) inputBuffer.size() : bytes;
+  copy(inputBuffer.rbegin(), inputBuffer.rbegin() + n, data);
+  inputBuffer.erase(inputBuffer.end() - n, inputBuffer.end());
+  return n;
+}
+
 //------------------------------------------------------------------------
 int IO::readChar(int timeout, bool retry)
 {
@@ -308,7 +698,7 @@ int IO::fillBuffer(int timeout, bool retry)
     return -1;
   }
   
-  char buf[1024];
+  char buf[8192];
   int readBytes = read(fileno(stdin), buf, sizeof(buf));
   if (readBytes <= 0) {
     setLastError("client disconnected");
@@ -317,12 +707,67 @@ int IO::fillBuffer(int timeout, bool retry)
 
   Session::getInstance().addReadBytes(readBytes);
   
-  for (int i = 0; i < readBytes; ++i)
-    inputBuffer.push_front(buf[i]);
+  // The input buffer is read from the back, so the bytes go in
+  // front of it last byte first.
+  inputBuffer.insert(inputBuffer.begin(),
+		     reverse_iterator<char *>(buf + readBytes),
+		     reverse_iterator<char *>(buf));
   
   return readBytes;
 }
 
+//------------------------------------------------------------------------
+int IO::fillInput(int timeout, bool retry)
+{
+  for (;;) {
+    int ret = fillBuffer(timeout, retry);
+    if (ret <= 0 || inflater == 0)
+      return ret;
+
+    // fillBuffer() pushed the raw bytes onto the front of the input
+    // buffer, last byte first. Replace them with their inflated
+    // contents, and read more if they did not complete anything.
+    string raw(ret, '\0');
+    for (int i = ret - 1; i >= 0; --i) {
+      raw[i] = inputBuffer.front();
+      inputBuffer.pop_front();
+    }
+
+    if ((ret = inflateInput(raw.data(), raw.length())) != 0)
+      return ret;
+  }
+}
+
+//------------------------------------------------------------------------
+int IO::inflateInput(const char *data, size_t length)
+{
+#ifdef WITH_ZLIB
+  char buf[8192];
+  int inflated = 0;
+
+  inflater->next_in = (Bytef *) data;
+  inflater->avail_in = length;
+  do {
+    inflater->next_out = (Bytef *) buf;
+    inflater->avail_out = sizeof(buf);
+    int res = inflate(inflater, Z_SYNC_FLUSH);
+    if (res != Z_OK && res != Z_BUF_ERROR) {
+      setLastError("error decompressing client input");
+      return -1;
+    }
+
+    int n = sizeof(buf) - inflater->avail_out;
+    for (int i = 0; i < n; ++i)
+      inputBuffer.push_front(buf[i]);
+    inflated += n;
+  } while (inflater->avail_out == 0);
+
+  return inflated;
+#else
+  return 0;
+#endif
+}
+
 //------------------------------------------------------------------------
 int IO::readStr(string &data, int bytes, int timeout, bool retry)
 {
@@ -355,7 +800,7 @@ int IO::readStr(string &data, int bytes, int timeout, bool retry)
     }
 
     // Fill the buffer with data, 
-    int ret = fillBuffer(timeout, retry);
+    int ret = fillInput(timeout, retry);
     if (ret < 0)
       return ret;
 
@@ -389,6 +834,43 @@ int IO::pending(void) const
   return 0;
 }
 
+//------------------------------------------------------------------------
+int IO::waitForInput(int fd, int timeout)
+{
+  // Returns 1 when there is input from the client, 2 when fd is
+  // readable and 0 after timeout milliseconds, or -1 on errors. A
+  // negative timeout waits for ever.
+  if (!inputBuffer.empty() || pending() > 0)
+    return 1;
+
+  for (;;) {
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(fileno(stdin), &rfds);
+    if (fd != -1)
+      FD_SET(fd, &rfds);
+
+    struct timeval t;
+    t.tv_sec = timeout / 1000;
+    t.tv_usec = (timeout % 1000) * 1000;
+
+    int maxfd = fd > fileno(stdin) ? fd : fileno(stdin);
+    int r = ::select(maxfd + 1, &rfds, 0, 0, timeout >= 0 ? &t : 0);
+    if (r == -1 && errno == EINTR)
+      continue;
+
+    if (r == -1) {
+      setLastError("error reading from client");
+      return -1;
+    }
+
+    if (r == 0)
+      return 0;
+
+    return FD_ISSET(fileno(stdin), &rfds) ? 1 : 2;
+  }
+}
+
 //------------------------------------------------------------------------
 const string &IO::getLastError(void) const
 {
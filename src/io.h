@@ -42,6 +42,7 @@
 #include <iostream>
 #include <iomanip>
 #include <map>
+#include <vector>
 
 #include <errno.h>
 #include <stdio.h>
@@ -50,12 +51,15 @@
 #include <ctype.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "convert.h"
 
 // #define DEBUG
 
+struct z_stream_s;
+
 namespace Binc {
 
   //----------------------------------------------------------------------
@@ -84,21 +88,33 @@ namespace Binc {
     void setModeSyslog(const std::string &servicename, int facility);
     void setFd(FILE *fpout);
 
+    void writeFileSpan(int fd, off_t offset, size_t length);
+
+    bool enableCompression(int level);
+    inline bool isCompressed(void) const { return deflater != 0; }
+
     virtual void writeStr(const std::string s);
+    virtual void writeVector(const struct iovec *iov, int iovcnt);
     virtual int readChar(int timeout = 0, bool retry = true);
     virtual int readStr(std::string &data, int bytes = -1, int timeout = 0, bool retry = true);
+    int readBlock(char *data, int bytes, int timeout = 0, bool retry = true);
     virtual int fillBuffer(int timeout, bool retry);
 
     void unReadChar(int c_in);
     void unReadChar(const std::string &s_in);
     virtual int pending(void) const;
+    int waitForInput(int fd, int timeout);
 
+    inline bool isModePlain(void) const { return mode == MODE_PLAIN; }
     inline void setBufferSize(int s) { buffersize = s; }
     inline void setTransferTimeout(int s) { transfertimeout = s; }
     inline void setLogPrefix(const std::string s_in) { logprefix = s_in; }
 
     template <class T> IO &operator << (const T &o);
     IO &operator << (std::ostream &(*man)(std::ostream &));
+    IO &write(const std::string &s, std::string::size_type pos = 0,
+	      std::string::size_type n = std::string::npos);
+    virtual IO &write(const char *data, size_t length);
 
     const std::string &getLastError(void) const;
     void setLastError(const std::string &e);
@@ -109,7 +125,19 @@ namespace Binc {
     virtual ~IO();
 
   protected:
+    struct OutputSpan {
+      std::string::size_type position;
+      const char *data;
+      size_t length;
+      void *map;
+      size_t maplength;
+      int fd;
+      off_t offset;
+    };
+
     BincStream outputBuffer;
+    std::vector<OutputSpan> outputSpans;
+    size_t spanBytes;
 
     std::deque<char> inputBuffer;
     std::string logprefix;
@@ -130,7 +158,18 @@ namespace Binc {
 
     FILE *fpout;
 
+    struct z_stream_s *deflater;
+    struct z_stream_s *inflater;
+    bool deflatePending;
+
     //--
+    void flushOutput(bool sync);
+    void deflateOutput(const char *data, size_t length, bool sync);
+    int inflateInput(const char *data, size_t length);
+    int fillInput(int timeout, bool retry);
+    void addLogPrefix(void);
+    void releaseSpans(void);
+    void sendFileSpan(const OutputSpan &span);
     int select(int maxfd, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, int &timeout);
   };
 
@@ -157,19 +196,13 @@ template <class T> Binc::IO &Binc::IO::operator << (const T &o)
 {
   using namespace ::std;
   
-  if (useLogPrefix && outputBuffer.getSize() == 0) {
-    outputBuffer << pid;
-    outputBuffer << " ";
-    outputBuffer << seqnr++;
-    if (logprefix != "")
-      outputBuffer << " [" << logprefix << "]";
-    outputBuffer << " ";
-  }
+  if (useLogPrefix && outputBuffer.getSize() == 0)
+    addLogPrefix();
   
   outputBuffer << o;
   
-  if ((int) outputBuffer.getSize() >= buffersize)
-    flushContent();
+  if ((int) (outputBuffer.getSize() + spanBytes) >= buffersize)
+    flushOutput(false);
   
   return *this;
 }
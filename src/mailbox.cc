@@ -56,7 +56,7 @@ Mailbox::BaseIterator::~BaseIterator(void)
 }
 
 //------------------------------------------------------------------------
-Mailbox::Mailbox(void) : readOnly(false)
+Mailbox::Mailbox(void) : readOnly(false), changeStamp(0)
 {
 }
 
@@ -65,6 +65,93 @@ Mailbox::~Mailbox(void)
 {
 }
 
+//------------------------------------------------------------------------
+bool Mailbox::getSearchCandidates(const string &text,
+				  vector<unsigned int> &uids)
+{
+  // No index; every message is a candidate.
+  return false;
+}
+
+//------------------------------------------------------------------------
+bool Mailbox::getHeaderMatches(const string &header, const string &text,
+			       vector<unsigned int> &uids)
+{
+  return false;
+}
+
+//------------------------------------------------------------------------
+bool Mailbox::getSentDayMatches(int first, int last,
+				vector<unsigned int> &uids)
+{
+  return false;
+}
+
+//------------------------------------------------------------------------
+unsigned int Mailbox::getChangeStamp(void) const
+{
+  return changeStamp;
+}
+
+//------------------------------------------------------------------------
+void Mailbox::bumpChangeStamp(void) const
+{
+  ++changeStamp;
+}
+
+//------------------------------------------------------------------------
+const SequenceSet &Mailbox::getSavedResult(void) const
+{
+  return savedResult;
+}
+
+//------------------------------------------------------------------------
+void Mailbox::setSavedResult(const SequenceSet &uids)
+{
+  savedResult = uids;
+}
+
+//------------------------------------------------------------------------
+void Mailbox::getVanished(const SequenceSet &known, SequenceSet &uids) const
+{
+  // The UIDs between two messages are the ones that went.
+  unsigned int next = 1;
+  iterator i = begin(SequenceSet::all(), SKIP_EXPUNGED | UID_MODE);
+  for (;; ++i) {
+    const bool done = !(i != end());
+    const unsigned int uid = done ? getUidNext() : (*i).getUID();
+    for (; next < uid; ++next)
+      if (known.isInSet(next))
+	uids.addNumber(next);
+
+    if (done)
+      break;
+
+    next = uid + 1;
+  }
+}
+
+//------------------------------------------------------------------------
+bool Mailbox::sortMessages(const vector<SortKeys::Criterion> &criteria,
+			   vector<unsigned int> &uids)
+{
+  return false;
+}
+
+//------------------------------------------------------------------------
+bool Mailbox::threadMessages(SortKeys::Algorithm algorithm,
+			     const vector<unsigned int> &uids,
+			     vector<SortKeys::ThreadNode> &tree)
+{
+  return false;
+}
+
+//------------------------------------------------------------------------
+bool Mailbox::getWatchPaths(const string &path, vector<string> &paths) const
+{
+  return false;
+}
+
 //------------------------------------------------------------------------
 bool Mailbox::isReadOnly(void) const
 {
@@ -49,6 +49,7 @@
 #include <sys/types.h>
 
 #include "imapparser.h"
+#include "sortkeys.h"
 
 namespace Binc {
 
@@ -115,6 +116,14 @@ namespace Binc {
     virtual unsigned int getStatusID(const std::string &) const = 0;
     virtual void bumpUidValidity(const std::string &) const = 0;
 
+    /*!
+      Adds the directories whose contents change when messages are
+      delivered to, expunged from or flagged in the mailbox at path,
+      so that they can be watched. Returns false if there are none.
+    */
+    virtual bool getWatchPaths(const std::string &path,
+			       std::vector<std::string> &paths) const;
+
     //-- Specific for one mailbox
     void setReadOnly(void);
     bool isReadOnly(void) const;
@@ -128,6 +137,13 @@ namespace Binc {
     virtual unsigned int getUidNext(void) const = 0;
     virtual unsigned int getUidValidity(void) const = 0;
 
+    /*!
+      Returns the highest mod-sequence of the mailbox (RFC 7162),
+      which grows whenever a message arrives, goes or has its flags
+      changed.
+    */
+    virtual unsigned int getHighestModSeq(void) const = 0;
+
     virtual bool getUpdates(bool scan, unsigned int type,
 			    PendingUpdates &updates, bool forceScan) = 0;
 
@@ -143,6 +159,51 @@ namespace Binc {
     virtual bool rollBackNewMessages(void) = 0;
     virtual bool fastCopy(Message &source, Mailbox &desttype, const std::string &destname) = 0;
 
+    virtual bool getSearchCandidates(const std::string &text,
+				     std::vector<unsigned int> &uids);
+    virtual bool getHeaderMatches(const std::string &header,
+				  const std::string &text,
+				  std::vector<unsigned int> &uids);
+    virtual bool getSentDayMatches(int first, int last,
+				   std::vector<unsigned int> &uids);
+
+    /*!
+      Sorts the ascending list of UIDs by criteria without opening
+      the messages. Returns false if the mailbox can not, and the
+      caller must look at the messages itself.
+    */
+    virtual bool sortMessages(const std::vector<SortKeys::Criterion> &criteria,
+			      std::vector<unsigned int> &uids);
+
+    /*!
+      Puts the messages in the ascending list of UIDs in threads
+      without opening them. Returns false if the mailbox can not.
+    */
+    virtual bool threadMessages(SortKeys::Algorithm algorithm,
+				const std::vector<unsigned int> &uids,
+				std::vector<SortKeys::ThreadNode> &tree);
+
+    /*!
+      Returns a number that changes whenever the messages of the
+      selected mailbox, their flags or their sequence numbers may
+      have changed.
+    */
+    unsigned int getChangeStamp(void) const;
+
+    /*!
+      The UIDs that the last SEARCH with RETURN (SAVE) found, which
+      "$" refers to. It is emptied when the mailbox is closed.
+    */
+    const SequenceSet &getSavedResult(void) const;
+    void setSavedResult(const SequenceSet &uids);
+
+    /*!
+      Adds the UIDs in known, up to the last one handed out, that no
+      message in the mailbox has, for VANISHED (EARLIER). There is no
+      record of when messages went, so these are all that ever went.
+    */
+    void getVanished(const SequenceSet &known, SequenceSet &uids) const;
+
     const std::string &getLastError(void) const;
     void setLastError(const std::string &error) const;
 
@@ -155,9 +216,14 @@ namespace Binc {
   protected:
     bool readOnly;
 
+    void bumpChangeStamp(void) const;
+
   private:
     Mailbox(const Mailbox &copy);
 
+    mutable unsigned int changeStamp;
+    SequenceSet savedResult;
+
     mutable std::string lastError;
 
     std::string name;
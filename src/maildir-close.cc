@@ -51,19 +51,35 @@ void Binc::Maildir::closeMailbox(void)
   if (!selected)
     return;
 
+  setSavedResult(SequenceSet());
+  bumpChangeStamp();
+
+  getHighestModSeq();
+
   if (mailboxchanged) {
     writeCache();
     mailboxchanged = false;
   }
 
-  if (uidnextchanged) {
-    const string uidvalfilename = path + "/bincimap-uidvalidity";
-    Storage uidvalfile("uidvalfilename", Storage::WriteOnly);
-    uidvalfile.put("depot", "_uidvalidity", toString(uidvalidity));
-    uidvalfile.put("depot", "_uidnext", toString(uidnext));
-    uidvalfile.put("depot", "_version", UIDVALFILEVERSION);
-    uidvalfile.commit();
+  if ((uidnextchanged || modseqchanged) && !readOnly) {
+    // UIDs may have been reserved since the last scan. These are
+    // kept, and UIDNEXT does not go back.
+    MaildirLock lock(path);
+    MaildirUidValFile uidvalfile;
+    if (!uidvalfile.read(path) || uidvalfile.uidvalidity != uidvalidity) {
+      uidvalfile.uidnext = 0;
+      uidvalfile.highestmodseq = 0;
+      uidvalfile.reserved.clear();
+    }
+
+    uidvalfile.uidvalidity = uidvalidity;
+    if (uidnext > uidvalfile.uidnext)
+      uidvalfile.uidnext = uidnext;
+    if (highestmodseq > uidvalfile.highestmodseq)
+      uidvalfile.highestmodseq = highestmodseq;
+    uidvalfile.write(path);
     uidnextchanged = false;
+    modseqchanged = false;
   }
 
   MaildirMessageCache::getInstance().clear();
@@ -71,6 +87,13 @@ void Binc::Maildir::closeMailbox(void)
   messages.clear();
   index.clear();
   newMessages.clear();
+  dirtyFlags.clear();
+  reservedUids.clear();
+  uids.clear();
+  expungeLog.clear();
+  flagLog.clear();
+  recentCount = 0;
+  highestmodseq = 0;
   oldrecent = 0;
   oldexists = 0;
   firstscan = true;
@@ -80,6 +103,13 @@ void Binc::Maildir::closeMailbox(void)
   selected = false;
   path = "";
 
+  textindex.clear();
+  textindexLoaded = false;
+  summary.clear();
+  summaryLoaded = false;
+  sortkeys.clear();
+  sortkeysLoaded = false;
+
   old_cur_st_mtime = 0; 
   old_cur_st_ctime = 0;
   old_new_st_mtime = 0;
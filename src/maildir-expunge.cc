@@ -35,10 +35,14 @@
 #include <config.h>
 #endif
 
+#include "filebatch.h"
 #include "io.h"
 #include "maildir.h"
 #include "maildirmessage.h"
 
+#include <errno.h>
+#include <string.h>
+
 using namespace ::std;
 using namespace Binc;
 
@@ -47,10 +51,19 @@ void Maildir::expungeMailbox(void)
 {
   if (readOnly) return;
 
-  Mailbox::iterator i = begin(SequenceSet::all(), SQNR_MODE|INCLUDE_EXPUNGED);
+  IO &logger = IOFactory::getInstance().get(2);
+  const string curpath = path + "/cur/";
+
+  // All messages are marked first, and then their files are removed
+  // in one batch, with the names the index got when cur/ was last
+  // read.
+  FileBatch batch(path + "/cur");
+  vector<string> targets;
+  vector<string> names;
+  vector<string> moved;
 
-  bool success = true;
-  for (; success && i != end(); ++i) {
+  Mailbox::iterator i = begin(SequenceSet::all(), SQNR_MODE|INCLUDE_EXPUNGED);
+  for (; i != end(); ++i) {
     MaildirMessage &message = reinterpret_cast<MaildirMessage &>(*i);
 
     if ((message.getStdFlags() & Message::F_DELETED) == 0)
@@ -59,31 +72,48 @@ void Maildir::expungeMailbox(void)
     message.setExpunged();
 
     const string &id = message.getUnique();
-
-    // The message might be gone already
     MaildirIndexItem *item = index.find(id);
-    if (!item)
+    if (!item || item->fileName == "") {
+      moved.push_back(id);
       continue;
+    }
 
-    string fpath = path + "/cur/" + item->fileName;
+    batch.unlink(item->fileName);
+    targets.push_back(id);
+    names.push_back(item->fileName);
+  }
 
-    while (unlink(fpath.c_str()) != 0) {
-      if (errno != ENOENT) {
-	IO &logger = IOFactory::getInstance().get(2);
-	logger << "unable to remove " << fpath << ": "
-	       << strerror(errno) << endl;
-	break;
-      }
+  batch.run();
+  for (unsigned int j = 0; j < targets.size(); ++j) {
+    const int error = batch.getError(j);
+    if (error == ENOENT)
+      moved.push_back(targets[j]);
+    else if (error != 0)
+      logger << "unable to remove " << curpath + names[j] << ": "
+	     << strerror(error) << endl;
+  }
 
-      if (!scanFileNames()) {
-	success = false;
-	break;
-      }
+  // Files that were renamed since are found by reading cur/ once
+  // more. Those that are not there are gone already.
+  if (moved.empty() || !scanFileNames())
+    return;
 
-      if ((item = index.find(id)))
-	break;
-      else
-	fpath = path + "/cur/" + item->fileName;
+  FileBatch retry(path + "/cur");
+  names.clear();
+  for (vector<string>::const_iterator j = moved.begin();
+       j != moved.end(); ++j) {
+    MaildirIndexItem *item = index.find(*j);
+    if (item && item->fileName != "") {
+      retry.unlink(item->fileName);
+      names.push_back(item->fileName);
     }
   }
+
+  retry.run();
+  for (unsigned int j = 0; j < names.size(); ++j) {
+    const int error = retry.getError(j);
+    if (error != 0 && error != ENOENT)
+      logger << "unable to remove " << curpath + names[j] << ": "
+	     << strerror(error) << endl;
+  }
 }
@@ -0,0 +1,120 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    maildir-headersummary.cc
+ *  
+ *  Description:
+ *    Implementation of the Maildir class.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include "convert.h"
+#include "maildir.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+//------------------------------------------------------------------------
+bool Maildir::getHeaderMatches(const string &header, const string &text,
+			       vector<unsigned int> &uids)
+{
+  Session &session = Session::getInstance();
+  if (session.globalconfig["Mailbox"]["header summary"] == "no")
+    return false;
+
+  int column = HeaderSummary::getColumn(header);
+  if (column == -1 || !updateHeaderSummary())
+    return false;
+
+  summary.findText((HeaderSummary::Column) column, text, uids);
+  return true;
+}
+
+//------------------------------------------------------------------------
+bool Maildir::getSentDayMatches(int first, int last,
+				vector<unsigned int> &uids)
+{
+  Session &session = Session::getInstance();
+  if (session.globalconfig["Mailbox"]["header summary"] == "no")
+    return false;
+
+  if (!updateHeaderSummary())
+    return false;
+
+  summary.findSentDay(first, last, uids);
+  return true;
+}
+
+//------------------------------------------------------------------------
+bool Maildir::updateHeaderSummary(void)
+{
+  const string summaryfilename = path + "/bincimap-summary";
+
+  if (!summaryLoaded) {
+    if (!summary.load(summaryfilename)
+	|| summary.getUidValidity() != uidvalidity)
+      summary.clear(uidvalidity);
+
+    summaryLoaded = true;
+  }
+
+  // Add rows for the messages that have arrived since the last
+  // update, and drop the rows of messages that are gone.
+  const unsigned int lastuid = summary.getLastUid();
+  const unsigned int oldcount = summary.getRowCount();
+  vector<unsigned int> uids;
+  unsigned int kept = 0;
+
+  Mailbox::iterator i = begin(SequenceSet::all(), INCLUDE_EXPUNGED);
+  for (; i != end(); ++i) {
+    MaildirMessage &message = (MaildirMessage &)*i;
+    if (message.getUID() <= lastuid) {
+      uids.push_back(message.getUID());
+      ++kept;
+      continue;
+    }
+
+    summary.add(message.getUID(), message);
+    uids.push_back(message.getUID());
+    message.close();
+  }
+
+  if (kept < oldcount)
+    summary.retain(uids);
+
+  if (summary.isChanged() && !readOnly)
+    summary.save(summaryfilename);
+
+  return true;
+}
@@ -39,6 +39,7 @@
 
 #include "io.h"
 #include "convert.h"
+#include "session.h"
 #include "storage.h"
 
 using namespace ::std;
@@ -47,35 +48,27 @@ using namespace Binc;
 //------------------------------------------------------------------------
 Maildir::ReadCacheResult Maildir::readCache(void)
 {
-  const string uidvalfilename = path + "/bincimap-uidvalidity";
   const string cachefilename = path + "/bincimap-cache";
 
   bool uidvalfiledropped = false;
 
-  Storage uidvalfile(uidvalfilename, Storage::ReadOnly);
+  MaildirUidValFile uidvalfile;
+  const bool valid = uidvalfile.read(path);
   string section, key, value;
-  string uidvalfileversion;
 
-  uidvalidity = 0;
-  uidnext = 0;
+  uidvalidity = uidvalfile.uidvalidity;
+  uidnext = uidvalfile.uidnext;
+  reservedUids = uidvalfile.reserved;
 
-  while (uidvalfile.get(&section, &key, &value))
-    if (section == "depot" && key == "_uidvalidity")
-      uidvalidity = (unsigned int) atoi(value);
-    else if (section == "depot" && key == "_uidnext")
-      uidnext  = (unsigned int) atoi(value);
-    else if (section == "depot" && key == "_version")
-      uidvalfileversion = value;
+  // Other sessions may have handed out higher ones.
+  if (uidvalfile.highestmodseq > highestmodseq)
+    highestmodseq = uidvalfile.highestmodseq;
 
-  if (!uidvalfile.eof()) {
-    uidnext = 1;
-    uidvalidity = time(0);
-    uidvalfiledropped = true;
-    return NoCache;
-  }
+  // Messages cached without a mod-sequence have 1.
+  if (highestmodseq == 0)
+    highestmodseq = 1;
 
-  if (uidvalfileversion != UIDVALFILEVERSION 
-      || uidvalidity == 0 || uidnext == 0) {
+  if (!valid) {
     uidnext = 1;
     uidvalidity = time(0);
     uidvalfiledropped = true;
@@ -89,8 +82,16 @@ Maildir::ReadCacheResult Maildir::readCache(void)
   unsigned int _uid = 0;
   unsigned int _size = 0;
   unsigned int _internaldate = 0;
+  unsigned char _crlf = 0;
+  unsigned int _modseq = 0;
+  unsigned char _modflags = MaildirMessage::UNKNOWN_FLAGS;
+  string _structures[MaildirMessage::STRUCTURES];
   string _id;
 
+  Session &session = Session::getInstance();
+  const bool keepStructures
+    = session.globalconfig["Mailbox"]["cache structure"] != "no";
+
   while (cache.get(&section, &key, &value)) {
     if (section == "depot" && key == "_version" && value != CACHEFILEVERSION) {
       uidnext = 1;
@@ -109,8 +110,13 @@ Maildir::ReadCacheResult Maildir::readCache(void)
 
 	  if (index.find(_id) == 0) {
 	    m.setUID(_uid);
-	    m.setInternalFlag(MaildirMessage::JustArrived);
+	    m.setInternalFlag(MaildirMessage::JustArrived | _crlf);
 	    m.setSize(_size);
+	    m.setModSeq(_modseq != 0 ? _modseq : 1, _modflags);
+	    if (_modseq > highestmodseq)
+	      highestmodseq = _modseq;
+	    for (int i = 0; i < MaildirMessage::STRUCTURES; ++i)
+	      m.setStructure((MaildirMessage::Structure) i, _structures[i]);
 	    add(m);
 	  } else {
 	    // Remember to insert the uid of the message again - we reset this
@@ -122,6 +128,11 @@ Maildir::ReadCacheResult Maildir::readCache(void)
 	_uid = 0;
 	_size = 0;
 	_internaldate = 0;
+	_crlf = 0;
+	_modseq = 0;
+	_modflags = MaildirMessage::UNKNOWN_FLAGS;
+	for (int i = 0; i < MaildirMessage::STRUCTURES; ++i)
+	  _structures[i] = "";
 	_id = "";
       }
 
@@ -130,6 +141,16 @@ Maildir::ReadCacheResult Maildir::readCache(void)
       else if (key == "_Size") _size = n;
       else if (key == "_InternalDate") _internaldate = n;
       else if (key == "_UID") _uid = n;
+      else if (key == "_CRLF")
+	_crlf = MaildirMessage::CRLFKnown | (n ? MaildirMessage::RawCRLF : 0);
+      else if (key == "_ModSeq") _modseq = n;
+      else if (key == "_ModFlags") _modflags = (unsigned char) n;
+      else if (keepStructures && key == "_Envelope")
+	_structures[MaildirMessage::ENVELOPE] = value;
+      else if (keepStructures && key == "_Body")
+	_structures[MaildirMessage::BODY] = value;
+      else if (keepStructures && key == "_BodyStructure")
+	_structures[MaildirMessage::BODYSTRUCTURE] = value;
     }
   }
 
@@ -140,7 +161,13 @@ Maildir::ReadCacheResult Maildir::readCache(void)
       m.setUnique(_id);
       m.setInternalDate(_internaldate);
       m.setUID(_uid);
-      m.setInternalFlag(MaildirMessage::JustArrived);
+      m.setInternalFlag(MaildirMessage::JustArrived | _crlf);
+      m.setSize(_size);
+      m.setModSeq(_modseq != 0 ? _modseq : 1, _modflags);
+      if (_modseq > highestmodseq)
+	highestmodseq = _modseq;
+      for (int i = 0; i < MaildirMessage::STRUCTURES; ++i)
+	m.setStructure((MaildirMessage::Structure) i, _structures[i]);
       add(m);
     } else {
       // Remember to insert the uid of the message again - we reset this
@@ -37,9 +37,12 @@
 
 #include <fcntl.h>
 #include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "filebatch.h"
 #include "io.h"
 #include "maildir.h"
 #include "storage.h"
@@ -50,62 +53,79 @@ using namespace ::std;
 namespace {
 
   //----------------------------------------------------------------------
-  class Lock {
-    string lock;
-
+  // An entry in cur/, and the stat operation for it, if any.
+  class Entry {
   public:
+    string uniquename;
+    unsigned char mflags;
+    int stat;
 
-    //--
-    Lock(const string &path)
-    {
-      IO &logger = IOFactory::getInstance().get(2);
+    Entry(const string &u, unsigned char f, int s)
+      : uniquename(u), mflags(f), stat(s) {}
+  };
 
-      lock = (path == "" ? "." : path) + "/bincimap-scan-lock";
+  //----------------------------------------------------------------------
+  // Returns the size of a message as sent with CRLF, if its file name
+  // tells it with the Maildir++ ",W=<size>" field, and 0 otherwise.
+  unsigned int getSizeFromName(const string &uniquename)
+  {
+    const string::size_type pos = uniquename.find(",W=");
+    if (pos == string::npos)
+      return 0;
 
-      int lockfd = -1;
-      while ((lockfd = ::open(lock.c_str(),
-			      O_CREAT | O_WRONLY | O_EXCL, 0666)) == -1) {
-	if (errno != EEXIST) {
-	  logger << "unable to lock mailbox: " << lock
-		 << ", " << string(strerror(errno)) << endl;
-	  return;
-	}
+    return (unsigned int) strtoul(uniquename.c_str() + pos + 3, 0, 10);
+  }
+}
+
+//------------------------------------------------------------------------
+MaildirLock::MaildirLock(const string &path)
+{
+  IO &logger = IOFactory::getInstance().get(2);
+
+  lock = (path == "" ? "." : path) + "/bincimap-scan-lock";
+
+  int lockfd = -1;
+  while ((lockfd = ::open(lock.c_str(),
+			  O_CREAT | O_WRONLY | O_EXCL, 0666)) == -1) {
+    if (errno != EEXIST) {
+      logger << "unable to lock mailbox: " << lock
+	     << ", " << string(strerror(errno)) << endl;
+      return;
+    }
 				 
-	struct stat mystat;
-	logger << "possible crash detected. waiting for mailbox lock " << lock << "." << endl;
-	if (lstat(lock.c_str(), &mystat) == 0) {
-	  if ((time(0) - mystat.st_ctime) > 300) {
-	    if (unlink(lock.c_str()) == 0) continue;
-	    else logger << "failed to force mailbox lock: " << lock
-			<< ", " << string(strerror(errno)) << endl;
-	  }
-	} else {
-	  if (errno != ENOENT) {
-	    string err = "invalid lock " + lock + ": "
-	      + strerror(errno);
-	    logger << err << endl;
-	    return;
-	  }
-	}
-	
-	// sleep one second.
-	sleep(1);
+    struct stat mystat;
+    logger << "possible crash detected. waiting for mailbox lock " << lock << "." << endl;
+    if (lstat(lock.c_str(), &mystat) == 0) {
+      if ((time(0) - mystat.st_ctime) > 300) {
+	if (unlink(lock.c_str()) == 0) continue;
+	else logger << "failed to force mailbox lock: " << lock
+		    << ", " << string(strerror(errno)) << endl;
+      }
+    } else {
+      if (errno != ENOENT) {
+	string err = "invalid lock " + lock + ": "
+	  + strerror(errno);
+	logger << err << endl;
+	return;
       }
-
-      close(lockfd);
     }
+	
+    // sleep one second.
+    sleep(1);
+  }
 
-    //--
-    ~Lock()
-    {
-      IO &logger = IOFactory::getInstance().get(2);
+  close(lockfd);
+}
 
-      // remove the lock
-      if (unlink(lock.c_str()) != 0)
-	logger << "failed to unlock mailbox: " << lock << ", "
-	       << strerror(errno) << endl;
-    }
-  };
+//------------------------------------------------------------------------
+MaildirLock::~MaildirLock(void)
+{
+  IO &logger = IOFactory::getInstance().get(2);
+
+  // remove the lock
+  if (unlink(lock.c_str()) != 0)
+    logger << "failed to unlock mailbox: " << lock << ", "
+	   << strerror(errno) << endl;
 }
 
 //------------------------------------------------------------------------
@@ -119,7 +139,6 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
 
   const string newpath = path + "/new/";
   const string curpath = path + "/cur/";
-  const string uidvalfilename = path + "/bincimap-uidvalidity";
   const string cachefilename = path + "/bincimap-cache";
 
   // check wether or not we need to bother scanning the folder.
@@ -170,9 +189,12 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
     old_new_st_ctime = oldnewstat.st_ctime;
   }
 
+  // Messages may come, go or change flags from here on.
+  bumpChangeStamp();
+
   // lock the directory as we are scanning. this prevents race
   // conditions with uid delegation
-  Lock lock(path);
+  MaildirLock lock(path);
 
   // Read the cache file if it's there. It holds important information
   // about the state of the depository, and serves to communicate
@@ -318,6 +340,23 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
   // this is to sort recent messages by internaldate
   multimap<time_t, MaildirMessage> tempMessageMap;
 
+  // Messages that were added with UIDs reserved for them get those
+  // UIDs, in the order they were added, whatever their internal dates.
+  map<unsigned int, MaildirMessage> reservedMessages;
+  unsigned int highestuid = 0;
+
+  // Messages that this session has just added bring what was known
+  // about them.
+  map<string, unsigned int> ours;
+  for (unsigned int k = 0; k < newMessages.size(); ++k)
+    if (newMessages[k].getInternalFlags() & MaildirMessage::Committed)
+      ours[newMessages[k].getUnique()] = k;
+
+  // The files that need a stat are stated in one batch after cur/
+  // has been read.
+  FileBatch batch(path + "/cur");
+  vector<Entry> entries;
+
   // scan all entries
   while ((pdirent = readdir(pdir)) != 0) {
     string filename = pdirent->d_name;
@@ -352,31 +391,41 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
 
     index.insert(uniquename, 0, filename);
 
-    struct stat mystat;
     MaildirMessage *message = get(uniquename);
-    if (!message || message->getInternalDate() == 0) {
-      string fullfilename = curpath + filename;
-      if (stat(fullfilename.c_str(), &mystat) != 0) {
-	if (errno == ENOENT) {
-	  // a rare race between readdir and stat force us to restart
-	  // the scan.
-	  index.clearFileNames();
-	  
-	  closedir(pdir);
-	  
-	  if ((pdir = opendir(newpath.c_str())) == 0) {
-	    string reason = "Warning: opendir(\"" + newpath + "\") == 0 (";
-	    reason += strerror(errno);
-	    reason += ")";
-	    setLastError(reason);
-	    
-	    return PermanentError;
-	  }
-	}
-	
+    if (!message || message->getInternalDate() == 0)
+      entries.push_back(Entry(uniquename, mflags, batch.stat(filename)));
+    else
+      entries.push_back(Entry(uniquename, mflags, -1));
+  }
+
+  closedir(pdir);
+
+  batch.run();
+
+  for (vector<Entry>::const_iterator e = entries.begin();
+       e != entries.end(); ++e) {
+    const string &uniquename = (*e).uniquename;
+    const unsigned char mflags = (*e).mflags;
+    MaildirMessage *message = get(uniquename);
+
+    // Only new messages, and those without an internal date, were
+    // stat'ed.
+    struct stat mystat;
+    memset(&mystat, 0, sizeof(mystat));
+    if ((*e).stat != -1) {
+      if (batch.getError((*e).stat) != 0) {
+	// The file was renamed or removed after cur/ was read. A
+	// message we know is kept until the next scan, which must
+	// not be skipped, finds out which.
+	if (message)
+	  message->setUnExpunged();
+
+	old_cur_st_mtime = (time_t) 0;
+	old_cur_st_ctime = (time_t) 0;
 	continue;
       }
 
+      mystat = batch.getStat((*e).stat);
       mailboxchanged = true;
     }
     
@@ -384,6 +433,9 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
     if (message) {
       oldmess++;
 
+      if (message->getUID() > highestuid)
+	highestuid = message->getUID();
+
       if (message->getInternalDate() == 0) {
 	mailboxchanged = true;
 	message->setInternalDate(mystat.st_mtime);
@@ -396,6 +448,9 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
       if (mflags != (message->getStdFlags() & ~Message::F_RECENT)) {
 	message->resetStdFlags();
 	message->setStdFlag(mflags);
+
+	// The file name already has these flags.
+	dirtyFlags.erase(message->getUID());
       }
 
       continue;
@@ -408,32 +463,76 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
     // UIDs.
     MaildirMessage m(*this);
     m.setUID(0);
-    m.setSize(0);
     m.setInternalDate(mystat.st_mtime);
     m.setStdFlag(mflags | Message::F_RECENT);
     m.setUnique(uniquename);
-    tempMessageMap.insert(make_pair(mystat.st_mtime, m));
+
+    // The size in the file name is only taken if the file can be
+    // that long once LF is turned into CRLF. Parsing the message
+    // puts it right otherwise.
+    const unsigned int namedsize = getSizeFromName(uniquename);
+    if (namedsize >= (unsigned int) mystat.st_size
+	&& namedsize <= 2 * (unsigned int) mystat.st_size)
+      m.setSize(namedsize);
+
+    map<string, unsigned int>::const_iterator o = ours.find(uniquename);
+    if (o != ours.end()) {
+      // A copied message brings what was known about its source.
+      const MaildirMessage &source = newMessages[o->second];
+      for (int i = 0; i < MaildirMessage::STRUCTURES; ++i)
+	m.setStructure((MaildirMessage::Structure) i,
+		       source.getStructure((MaildirMessage::Structure) i));
+    }
+
+    map<string, unsigned int>::const_iterator r
+      = reservedUids.find(uniquename);
+    if (r != reservedUids.end())
+      reservedMessages.insert(make_pair(r->second, m));
+    else
+      tempMessageMap.insert(make_pair(mystat.st_mtime, m));
 
     mailboxchanged = true;
   }
 
-  closedir(pdir);
-
-  // Recent messages are added, ordered by internaldate.
+  // Messages with reserved UIDs are added first, as the UIDs were
+  // reserved below UIDNEXT, followed by the other recent messages
+  // ordered by internaldate. A reserved UID is only given out if it
+  // is higher than those of the messages already known; it is not if
+  // the uidvalidity file was lost.
   {
+    vector<pair<unsigned int, MaildirMessage *> > arrivals;
+    map<unsigned int, MaildirMessage>::iterator j = reservedMessages.begin();
+    for (; j != reservedMessages.end(); ++j)
+      arrivals.push_back(make_pair(j->first, &j->second));
+
     multimap<time_t, MaildirMessage>::iterator i = tempMessageMap.begin();
-    while (i != tempMessageMap.end()) {
-      i->second.setUID(uidnext++);
-      multimap<time_t, MaildirMessage>::iterator itmp = i;
-      ++itmp;
-      add(i->second);
-      tempMessageMap.erase(i);
-      i = itmp;
+    for (; i != tempMessageMap.end(); ++i)
+      arrivals.push_back(make_pair(0, &i->second));
+
+    for (unsigned int k = 0; k < arrivals.size(); ++k) {
+      MaildirMessage &m = *arrivals[k].second;
+      const unsigned int reserved = arrivals[k].first;
+      if (reserved > highestuid && reserved < uidnext)
+	m.setUID(reserved);
+      else
+	m.setUID(uidnext++);
+      highestuid = m.getUID();
+      m.setModSeq(++highestmodseq, m.getStdFlags() & ~Message::F_RECENT);
+      modseqchanged = true;
+      add(m);
       uidnextchanged = true;
     }
   }
 
   tempMessageMap.clear();
+  reservedMessages.clear();
+
+  // The messages that UIDs were reserved for are in cur/ before the
+  // reservation is written, so those not seen here are gone.
+  if (!reservedUids.empty()) {
+    reservedUids.clear();
+    uidnextchanged = true;
+  }
 
   // Messages that existed in the cache that we read, but did not
   // exist in the Maildir, are removed from the messages list.
@@ -492,6 +591,10 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
     }
   }
 
+  // Flag changes found above get their mod-sequences before these
+  // are saved.
+  getHighestModSeq();
+
   if (mailboxchanged && !readOnly) {
     if (!writeCache())
       return PermanentError;
@@ -499,17 +602,18 @@ Maildir::ScanResult Maildir::scan(bool forceScan)
     mailboxchanged = false;
   }
 
-  if (uidnextchanged && !readOnly) {
-    Storage uidvalfile(uidvalfilename, Storage::WriteOnly);
-    uidvalfile.put("depot", "_uidvalidity", toString(uidvalidity));
-    uidvalfile.put("depot", "_uidnext", toString(uidnext));
-    uidvalfile.put("depot", "_version", UIDVALFILEVERSION);
-    if (!uidvalfile.commit()) {
+  if ((uidnextchanged || modseqchanged) && !readOnly) {
+    MaildirUidValFile uidvalfile;
+    uidvalfile.uidvalidity = uidvalidity;
+    uidvalfile.uidnext = uidnext;
+    uidvalfile.highestmodseq = highestmodseq;
+    if (!uidvalfile.write(path)) {
       setLastError("Unable to save cache file.");
       return PermanentError;
     }
 
     uidnextchanged = false;
+    modseqchanged = false;
   }
 
   firstscan = false;
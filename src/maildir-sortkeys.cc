@@ -0,0 +1,117 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    maildir-sortkeys.cc
+ *  
+ *  Description:
+ *    Implementation of the Maildir class.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include "maildir.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+//------------------------------------------------------------------------
+bool Maildir::sortMessages(const vector<SortKeys::Criterion> &criteria,
+			   vector<unsigned int> &uids)
+{
+  Session &session = Session::getInstance();
+  if (session.globalconfig["Mailbox"]["sort keys"] == "no")
+    return false;
+
+  if (!updateSortKeys())
+    return false;
+
+  return sortkeys.sort(criteria, uids);
+}
+
+//------------------------------------------------------------------------
+bool Maildir::threadMessages(SortKeys::Algorithm algorithm,
+			     const vector<unsigned int> &uids,
+			     vector<SortKeys::ThreadNode> &tree)
+{
+  Session &session = Session::getInstance();
+  if (session.globalconfig["Mailbox"]["sort keys"] == "no")
+    return false;
+
+  if (!updateSortKeys())
+    return false;
+
+  return sortkeys.thread(algorithm, uids, tree);
+}
+
+//------------------------------------------------------------------------
+bool Maildir::updateSortKeys(void)
+{
+  const string sortkeysfilename = path + "/bincimap-sortkeys";
+
+  if (!sortkeysLoaded) {
+    if (!sortkeys.load(sortkeysfilename)
+	|| sortkeys.getUidValidity() != uidvalidity)
+      sortkeys.clear(uidvalidity);
+
+    sortkeysLoaded = true;
+  }
+
+  // Add rows for the messages that scan() has found since the last
+  // update, and drop the rows of messages that are gone.
+  const unsigned int lastuid = sortkeys.getLastUid();
+  const unsigned int oldcount = sortkeys.getRowCount();
+  vector<unsigned int> uids;
+  unsigned int kept = 0;
+
+  Mailbox::iterator i = begin(SequenceSet::all(), INCLUDE_EXPUNGED);
+  for (; i != end(); ++i) {
+    MaildirMessage &message = (MaildirMessage &)*i;
+    if (message.getUID() <= lastuid) {
+      uids.push_back(message.getUID());
+      ++kept;
+      continue;
+    }
+
+    sortkeys.add(message.getUID(), message);
+    uids.push_back(message.getUID());
+    message.close();
+  }
+
+  if (kept < oldcount)
+    sortkeys.retain(uids);
+
+  if (sortkeys.isChanged() && !readOnly)
+    sortkeys.save(sortkeysfilename);
+
+  return true;
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    maildir-textindex.cc
+ *  
+ *  Description:
+ *    Implementation of the Maildir class.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "maildir.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+//------------------------------------------------------------------------
+bool Maildir::getSearchCandidates(const string &text,
+				  vector<unsigned int> &uids)
+{
+  Session &session = Session::getInstance();
+  if (session.globalconfig["Mailbox"]["text index"] != "yes")
+    return false;
+
+  if (!updateTextIndex())
+    return false;
+
+  return textindex.getCandidates(text, uids);
+}
+
+//------------------------------------------------------------------------
+bool Maildir::updateTextIndex(void)
+{
+  const string textindexfilename = path + "/bincimap-textindex";
+
+  if (!textindexLoaded) {
+    if (!textindex.load(textindexfilename)
+	|| textindex.getUidValidity() != uidvalidity)
+      textindex.clear(uidvalidity);
+
+    textindexLoaded = true;
+  }
+
+  // Index the messages that have arrived since the last update, in
+  // UID order. The index only covers UIDs up to its last one, so it
+  // stops at a message that cannot be read; the caller then searches
+  // without it, and the next update tries that message again.
+  const unsigned int lastuid = textindex.getLastUid();
+  const unsigned int oldcount = textindex.getMessageCount();
+  vector<unsigned int> uids;
+  unsigned int indexed = 0;
+  bool complete = true;
+
+  char buf[65536];
+  Mailbox::iterator i = begin(SequenceSet::all(), INCLUDE_EXPUNGED);
+  for (; i != end(); ++i) {
+    MaildirMessage &message = (MaildirMessage &)*i;
+    if (message.getUID() <= lastuid) {
+      uids.push_back(message.getUID());
+      ++indexed;
+      continue;
+    }
+
+    int fd = message.getFile();
+    if (fd == -1) {
+      complete = false;
+      break;
+    }
+
+    textindex.beginMessage(message.getUID());
+    uids.push_back(message.getUID());
+
+    off_t offset = 0;
+    ssize_t n;
+    while ((n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+      textindex.addText(buf, n);
+      offset += n;
+    }
+
+    message.close();
+  }
+
+  // Drop messages that have been removed from the mailbox once they
+  // make up half of the index.
+  if (oldcount > 2 * indexed)
+    textindex.retain(uids);
+
+  if (textindex.isChanged() && !readOnly)
+    textindex.save(textindexfilename);
+
+  return complete;
+}
@@ -37,73 +37,141 @@
 
 #include "maildir.h"
 
-#include <dirent.h>
-#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
+#include "filebatch.h"
 #include "io.h"
 
 using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  //----------------------------------------------------------------------
+  string getFlagString(int mflags)
+  {
+    string flags;
+    if (mflags & Message::F_DRAFT) flags += "D";
+    if (mflags & Message::F_FLAGGED) flags += "F";
+    if (mflags & Message::F_ANSWERED) flags += "R";
+    if (mflags & Message::F_SEEN) flags += "S";
+    if (mflags & Message::F_DELETED) flags += "T";
+    return flags;
+  }
+}
 
 //------------------------------------------------------------------------
-void Binc::Maildir::updateFlags(void)
+string Binc::Maildir::findFileName(const string &unique, bool &scanned) const
 {
-  IO &logger = IOFactory::getInstance().get(2);
+  // Another client has most likely changed the standard flags, so
+  // those names are tried, in one batch, before cur/ is read again.
+  vector<string> names(1, unique);
+  for (int mflags = 0; mflags < 32; ++mflags)
+    names.push_back(unique + ":2," + getFlagString(
+      ((mflags & 1) ? Message::F_DRAFT : 0)
+      | ((mflags & 2) ? Message::F_FLAGGED : 0)
+      | ((mflags & 4) ? Message::F_ANSWERED : 0)
+      | ((mflags & 8) ? Message::F_SEEN : 0)
+      | ((mflags & 16) ? Message::F_DELETED : 0)));
+
+  FileBatch batch(path + "/cur");
+  for (vector<string>::const_iterator i = names.begin();
+       i != names.end(); ++i)
+    batch.stat(*i);
 
-  if (readOnly) return;
+  batch.run();
+  for (unsigned int i = 0; i < names.size(); ++i)
+    if (batch.getError(i) == 0)
+      return names[i];
 
-  string curpath = path + "/cur/";
-  DIR *pdir = opendir(curpath.c_str());
-  if (pdir == 0) {
-    string reason = "failed to open " + curpath + ": ";
-    reason += strerror(errno);
+  if (!scanned) {
+    scanFileNames();
+    scanned = true;
+  }
 
-    logger << reason << endl;
+  MaildirIndexItem *item = index.find(unique);
+  return item ? item->fileName : "";
+}
+
+//------------------------------------------------------------------------
+void Binc::Maildir::updateFlags(void)
+{
+  IO &logger = IOFactory::getInstance().get(2);
+
+  if (readOnly || dirtyFlags.empty()) {
+    dirtyFlags.clear();
     return;
   }
-  
-  struct dirent *pdirent;
-  while ((pdirent = readdir(pdir)) != 0) {
-    string filename = pdirent->d_name;
-    if (filename[0] == '.')
+
+  // Only the messages whose flags were set since the last call are
+  // renamed, from the file names that the index knows, in one batch.
+  const string curpath = path + "/cur/";
+  FileBatch batch(path + "/cur");
+  vector<string> uniques;
+  vector<string> srcnames;
+  vector<string> destnames;
+  bool scanned = false;
+
+  set<unsigned int>::const_iterator i = dirtyFlags.begin();
+  for (; i != dirtyFlags.end(); ++i) {
+    MessageMap::iterator m = messages.find(*i);
+    if (m == messages.end() || m->second.isExpunged())
       continue;
 
-    string uniquename;
-    string::size_type pos;
-    if ((pos = filename.find(":2,")) != string::npos)
-      uniquename = filename.substr(0, pos);
-    else
-      uniquename = filename;    
-
-    MaildirMessage *message = get(uniquename);
-    if (message) {
-      string flags;
-      int mflags = message->getStdFlags();
-      if (mflags & Message::F_DRAFT) flags += "D";
-      if (mflags & Message::F_FLAGGED) flags += "F";
-      if (mflags & Message::F_ANSWERED) flags += "R";
-      if (mflags & Message::F_SEEN) flags += "S";
-      if (mflags & Message::F_DELETED) flags += "T";
-
-      string srcname = curpath + filename;
-      string destname = curpath + uniquename + ":2," + flags;
-     
-      if (srcname != destname) {
-	if (rename(srcname.c_str(), destname.c_str()) != 0) {
-	  if (errno == ENOENT) {
-	    // FIXME: restart scan
-	  }
-
-	  logger << "warning: rename(" << srcname
-		 << "," << destname << ") == "
-		 << errno << ": " << strerror(errno) << endl;
-	} else {
-	  index.insert(uniquename, 0,  uniquename + ":2," + flags);
-	}
-      }
-   
+    MaildirMessage &message = m->second;
+    const string &uniquename = message.getUnique();
+    const string destname = uniquename + ":2,"
+      + getFlagString(message.getStdFlags());
+
+    MaildirIndexItem *item = index.find(uniquename);
+    string srcname = item ? item->fileName : "";
+    if (srcname == "")
+      srcname = findFileName(uniquename, scanned);
+
+    if (srcname == "") {
+      logger << "warning: no file for " << curpath + uniquename << endl;
+      continue;
+    }
+
+    if (srcname == destname) {
+      index.insert(uniquename, 0, destname);
       continue;
     }
+
+    batch.rename(srcname, destname);
+    uniques.push_back(uniquename);
+    srcnames.push_back(srcname);
+    destnames.push_back(destname);
   }
 
-  closedir(pdir);
+  dirtyFlags.clear();
+  batch.run();
+
+  for (unsigned int j = 0; j < uniques.size(); ++j) {
+    int error = batch.getError(j);
+
+    // The file was renamed behind our back, so it is looked for.
+    string &srcname = srcnames[j];
+    if (error == ENOENT) {
+      srcname = findFileName(uniques[j], scanned);
+      if (srcname == destnames[j])
+	error = 0;
+      else if (srcname != "") {
+	FileBatch retry(path + "/cur");
+	retry.rename(srcname, destnames[j]);
+	retry.run();
+	error = retry.getError(0);
+      }
+    }
+
+    if (error != 0) {
+      logger << "warning: rename(" << curpath + srcname
+	     << "," << curpath + destnames[j] << ") == "
+	     << error << ": " << strerror(error) << endl;
+      continue;
+    }
+
+    index.insert(uniques[j], 0, destnames[j]);
+  }
 }
@@ -38,6 +38,7 @@
 #include "maildir.h"
 
 #include "io.h"
+#include "session.h"
 #include "storage.h"
 
 using namespace ::std;
@@ -51,6 +52,10 @@ bool Binc::Maildir::writeCache(void)
   const string cachefilename = path + "/bincimap-cache";
   const string uidvalfilename = path + "/bincimap-uidvalidity";
 
+  Session &session = Session::getInstance();
+  const bool keepStructures
+    = session.globalconfig["Mailbox"]["cache structure"] != "no";
+
   Storage cache(cachefilename, Storage::WriteOnly);
   int n = 0;
 
@@ -62,7 +67,30 @@ bool Binc::Maildir::writeCache(void)
     cache.put(nstr, "_UID", toString(message.getUID()));
     if (message.getSize() != 0)
       cache.put(nstr, "_Size", toString(message.getSize()));
+
+    unsigned char iflags = message.getInternalFlags();
+    if (iflags & MaildirMessage::CRLFKnown)
+      cache.put(nstr, "_CRLF", (iflags & MaildirMessage::RawCRLF) ? "1" : "0");
     
+    cache.put(nstr, "_ModSeq", toString(message.getModSeq()));
+    cache.put(nstr, "_ModFlags",
+	      toString((int) (message.getStdFlags() & ~Message::F_RECENT)));
+
+    if (keepStructures) {
+      const string &envelope = message.getStructure(MaildirMessage::ENVELOPE);
+      if (envelope != "")
+	cache.put(nstr, "_Envelope", envelope);
+
+      const string &body = message.getStructure(MaildirMessage::BODY);
+      if (body != "")
+	cache.put(nstr, "_Body", body);
+
+      const string &bodystructure
+	= message.getStructure(MaildirMessage::BODYSTRUCTURE);
+      if (bodystructure != "")
+	cache.put(nstr, "_BodyStructure", bodystructure);
+    }
+
     cache.put(nstr, "_ID", message.getUnique());
     cache.put(nstr, "_InternalDate",
 	      toString((int) message.getInternalDate()));
@@ -53,6 +53,7 @@
 #include "status.h"
 #include "storage.h"
 #include "convert.h"
+#include "filebatch.h"
 #include "maildir.h"
 #include "maildirmessage.h"
 #include "pendingupdates.h"
@@ -161,7 +162,13 @@ void Maildir::iterator::reposition(void)
 Mailbox::iterator Maildir::begin(const SequenceSet &bset,
 				 unsigned int mod) const
 {
-  beginIterator = iterator((Maildir *)this, messages.begin(), bset, mod);
+  // "$" holds UIDs, also in commands that use sequence numbers.
+  if (bset.isSaved())
+    beginIterator = iterator((Maildir *)this, messages.begin(),
+			     getSavedResult(),
+			     (mod & ~SQNR_MODE) | UID_MODE);
+  else
+    beginIterator = iterator((Maildir *)this, messages.begin(), bset, mod);
   beginIterator.reposition();
 
   return Mailbox::iterator(beginIterator);
@@ -180,10 +187,8 @@ void Maildir::iterator::erase(void)
 {
   MessageMap::iterator iter = i;
   ++iter;
-   
-  MaildirMessageCache::getInstance().removeStatus(&curMessage());
-  mailbox->index.remove(i->second.getUnique());
-  mailbox->messages.erase(i);
+
+  mailbox->remove(i);
 
   i = iter;
   reposition();
@@ -199,6 +204,13 @@ Maildir::Maildir(void) : Mailbox()
   selected = false;
   oldrecent = 0;
   oldexists = 0;
+  recentCount = 0;
+  highestmodseq = 0;
+  modseqchanged = false;
+  writeFd = -1;
+  textindexLoaded = false;
+  summaryLoaded = false;
+  sortkeysLoaded = false;
 }
 
 //------------------------------------------------------------------------
@@ -219,57 +231,52 @@ bool Maildir::getUpdates(bool doscan, unsigned int type,
   if (doscan && scan(forceScan) != Success)
     return false;
 
-  unsigned int exists = 0;
-  unsigned int recent = 0;
-
-  // count messages, find recent
-  if (!readOnly && (type & PendingUpdates::EXPUNGE)) {  
-    Mailbox::iterator i = begin(SequenceSet::all(),
-				INCLUDE_EXPUNGED | SQNR_MODE);
-
-    while (i != end()) {
-      Message &message = *i;
-
-      if (message.isExpunged()) {
-	updates.addExpunged(i.getSqnr());
-	i.erase();
-      } else
-	++i;
+  // Expunged messages go in UID order, each reported with its
+  // sequence number at the time it is removed.
+  if (!readOnly && (type & PendingUpdates::EXPUNGE))
+    while (!expungeLog.empty()) {
+      const unsigned int uid = *expungeLog.begin();
+      updates.addExpunged(getSqnr(uid), uid);
+      remove(messages.find(uid));
+
+      // Expunges move HIGHESTMODSEQ too.
+      ++highestmodseq;
+      modseqchanged = true;
     }
-  }
-
-  Mailbox::iterator i = begin(SequenceSet::all(),
-			      INCLUDE_EXPUNGED | SQNR_MODE);
-  for (; i != end(); ++i) {
-    Message & message = *i;
-    // at this point, there is a message that is not expunged
-    ++exists;
-    if (message.getStdFlags() & Message::F_RECENT) ++recent;
-  }
 
+  const unsigned int exists = messages.size();
   if (exists != oldexists)
     updates.setExists(oldexists = exists);
 
-  if (recent != oldrecent)
-    updates.setRecent(oldrecent = recent);
-  
-  if (type & PendingUpdates::FLAGS) {   
-    Mailbox::iterator i = begin(SequenceSet::all(), SQNR_MODE);
-    for (; i != end(); ++i) {
-      Message &message = *i;
-      if (message.hasFlagsChanged()) {
-	int flags = message.getStdFlags();
-	
-	updates.addFlagUpdates(i.getSqnr(), flags);
-
-	message.setFlagsUnchanged();
-      }
+  if (recentCount != oldrecent)
+    updates.setRecent(oldrecent = recentCount);
+
+  if (type & PendingUpdates::FLAGS) {
+    set<unsigned int> changed;
+    changed.swap(flagLog);
+
+    for (set<unsigned int>::const_iterator i = changed.begin();
+	 i != changed.end(); ++i) {
+      MaildirMessage &message = messages.find(*i)->second;
+      updates.addFlagUpdates(getSqnr(*i), message.getStdFlags(),
+			     *i, message.getModSeq());
+      message.setFlagsUnchanged();
     }
-  }  
+  }
 
   return true;
 }
 
+//------------------------------------------------------------------------
+bool Maildir::getWatchPaths(const string &path, vector<string> &paths) const
+{
+  // Deliveries land in new/, and flag changes and expunges are
+  // renames and unlinks in cur/.
+  paths.push_back(path + "/new");
+  paths.push_back(path + "/cur");
+  return true;
+}
+
 //------------------------------------------------------------------------
 bool Maildir::isMailbox(const std::string &s_in) const
 {
@@ -328,8 +335,14 @@ unsigned int Maildir::getStatusID(const string &path) const
   if (stat((path + "/cur").c_str(), &mystat) == 0)
     statusid += mystat.st_ctime;
 
+  // The cache and uidvalidity files are replaced on each write, so
+  // their inode numbers also tell writes apart that happen within
+  // the same second.
   if (stat((path + "/bincimap-cache").c_str(), &mystat) == 0)
-    statusid += mystat.st_ctime;
+    statusid += mystat.st_ctime + mystat.st_ino;
+
+  if (stat((path + "/bincimap-uidvalidity").c_str(), &mystat) == 0)
+    statusid += mystat.st_ctime + mystat.st_ino;
 
   return statusid;
 }
@@ -342,10 +355,8 @@ bool Maildir::getStatus(const string &path, Status &s) const
   unsigned int recent = 0;
 
   const string cachefilename = path + "/bincimap-cache";
-  const string uidvalfilename = path + "/bincimap-uidvalidity";
 
   Storage cache(cachefilename, Storage::ReadOnly);
-  Storage uidvalfile(uidvalfilename, Storage::ReadOnly);
 
   string section, key, value;
   map<string, bool> mincache;
@@ -353,13 +364,14 @@ bool Maildir::getStatus(const string &path, Status &s) const
     if (isdigit(section[0]) && key == "_ID")
       mincache[value] = true;
 
-  unsigned int uidvalidity = 0;
-  unsigned int uidnext = 0;
-  while (uidvalfile.get(&section, &key, &value))
-    if (section == "depot" && key == "_uidvalidity")
-      uidvalidity = (unsigned int) atoi(value);
-    else if (section == "depot" && key == "_uidnext")
-      uidnext  = (unsigned int) atoi(value);
+  // Messages with reserved UIDs are already counted in UIDNEXT.
+  MaildirUidValFile uidvalfile;
+  uidvalfile.read(path);
+  const map<string, unsigned int> &reserved = uidvalfile.reserved;
+
+  unsigned int uidvalidity = uidvalfile.uidvalidity;
+  unsigned int uidnext = uidvalfile.uidnext;
+  unsigned int highestmodseq = uidvalfile.highestmodseq;
 
   s.setUidValidity(uidvalidity < 1 ? time(0) : uidvalidity);
 
@@ -376,7 +388,9 @@ bool Maildir::getStatus(const string &path, Status &s) const
       continue;
 
     ++recent;
-    ++uidnext;
+    if (reserved.find(filename) == reserved.end())
+      ++uidnext;
+    ++highestmodseq;
     ++unseen;
     ++messages;
   }
@@ -400,7 +414,9 @@ bool Maildir::getStatus(const string &path, Status &s) const
     if (pos != string::npos) {
       if (mincache.find(dname.substr(0, pos)) == mincache.end()) {
 	++recent;
-	++uidnext;
+	if (reserved.find(dname.substr(0, pos)) == reserved.end())
+	  ++uidnext;
+	++highestmodseq;
       }
 
       if (dname.substr(pos).find('S') == string::npos)
@@ -408,7 +424,9 @@ bool Maildir::getStatus(const string &path, Status &s) const
     } else {
       if (mincache.find(dname) == mincache.end()) {
 	++recent;
-	++uidnext;
+	if (reserved.find(dname) == reserved.end())
+	  ++uidnext;
+	++highestmodseq;
       }
 
       ++unseen;
@@ -421,6 +439,7 @@ bool Maildir::getStatus(const string &path, Status &s) const
   s.setMessages(messages);
   s.setUnseen(unseen);
   s.setUidNext(uidnext);
+  s.setHighestModSeq(highestmodseq != 0 ? highestmodseq : 1);
 
   return true;
 }
@@ -449,6 +468,17 @@ unsigned int Maildir::getMaxSqnr(void) const
   return max;
 }
 
+//------------------------------------------------------------------------
+unsigned int Maildir::getHighestModSeq(void) const
+{
+  // Messages whose flags have changed get their mod-sequence first.
+  for (MessageMap::const_iterator i = messages.begin();
+       i != messages.end(); ++i)
+    i->second.getModSeq();
+
+  return highestmodseq != 0 ? highestmodseq : 1;
+}
+
 //------------------------------------------------------------------------
 unsigned int Maildir::getUidValidity(void) const
 {
@@ -509,6 +539,10 @@ bool Maildir::commitNewMessages(const string &mbox)
   vector<MaildirMessage>::iterator i = newMessages.begin();
   map<MaildirMessage *, string> committedMessages;
 
+  // No one scans the mailbox until the new messages have their UIDs
+  // reserved.
+  MaildirLock lock(mbox);
+
   struct timeval youngestFile = {0, 0};
   
   bool abort = false;
@@ -537,6 +571,12 @@ bool Maildir::commitNewMessages(const string &mbox)
 	    << "P" << session.getPid()
 	    << "Q" << numDeliveries++
 	    << "." << session.getHostname();
+
+      // The size was counted as the message was written, or comes
+      // with the message it was copied from. It goes into the file
+      // name, so that no one has to read the file to find it.
+      if (m.getSize() != 0)
+	ssid << ",W=" << m.getSize();
       
       BincStream ss;
       ss << mbox << "/new/" << ssid.str();
@@ -615,6 +655,10 @@ bool Maildir::commitNewMessages(const string &mbox)
     gettimeofday(&tv, 0);
   }
 
+  // The messages are moved to cur/ in one batch.
+  FileBatch batch(mbox + "/cur");
+  vector<string> sources;
+
   map<MaildirMessage *, string>::const_iterator j
     = committedMessages.begin();
   for (;j != committedMessages.end(); ++j) {
@@ -628,22 +672,77 @@ bool Maildir::commitNewMessages(const string &mbox)
     if (flags & Message::F_SEEN) flagStr += "S";
     if (flags & Message::F_DELETED) flagStr += "T";
     
-    string dest = mbox + "/cur/" + basename + ":2," + flagStr;
-    if (rename(j->second.c_str(), dest.c_str()) == 0)
-      continue;
+    // The names are relative to cur/, as mbox may be a relative path.
+    batch.rename("../new/" + basename, basename + ":2," + flagStr);
+    sources.push_back(j->second);
+  }
+
+  batch.run();
+  for (unsigned int k = 0; k < sources.size(); ++k) {
+    const int error = batch.getError(k);
+    if (error != 0 && error != ENOENT)
+      logger << "when setting flags on: " << sources[k]
+	     << ": " << strerror(error) << endl;
+  }
 
-    if (errno != ENOENT)
-      logger << "when setting flags on: " << j->second 
-	     << ": " << strerror(errno) << endl;
+  // The messages get one range of UIDs, in the order they were
+  // added, and whoever scans the mailbox next gives these out. A
+  // mailbox that has not been scanned yet starts with an empty cache.
+  MaildirUidValFile uidvalfile;
+  if (!uidvalfile.read(mbox)) {
+    uidvalfile.uidvalidity = time(0);
+    uidvalfile.uidnext = 1;
+    uidvalfile.highestmodseq = 1;
+    uidvalfile.reserved.clear();
+
+    Storage cache(mbox + "/bincimap-cache", Storage::WriteOnly);
+    cache.put("depot", "_version", CACHEFILEVERSION);
+    if (!cache.commit())
+      logger << "when reserving UIDs in " << toImapString(mbox)
+	     << ": unable to save cache file" << endl;
   }
 
+  for (i = newMessages.begin(); i != newMessages.end(); ++i)
+    if (committedMessages.find(&*i) != committedMessages.end())
+      uidvalfile.reserved[(*i).getUnique()] = uidvalfile.uidnext++;
+
+  if (!uidvalfile.write(mbox))
+    logger << "when reserving UIDs in " << toImapString(mbox)
+	   << ": unable to save uidvalidity file" << endl;
+
   committedMessages.clear();
   return true;
 }
 
+//------------------------------------------------------------------------
+bool Maildir::flushWriteBuffer(void)
+{
+  const char *data = writeBuffer.data();
+  size_t left = writeBuffer.length();
+  while (left > 0) {
+    ssize_t n = write(writeFd, data, left);
+    if (n == -1) {
+      if (errno == EINTR)
+	continue;
+
+      writeBuffer.clear();
+      return false;
+    }
+
+    data += n;
+    left -= n;
+  }
+
+  writeBuffer.clear();
+  return true;
+}
+
 //------------------------------------------------------------------------
 bool Maildir::rollBackNewMessages(void)
 {
+  writeBuffer.clear();
+  writeFd = -1;
+
   vector<MaildirMessage>::const_iterator i = newMessages.begin();
   // Fixme: Messages that are in committedMessages should be skipped
   // here.
@@ -740,8 +839,50 @@ MaildirMessage *Maildir::get(const std::string &id)
 //------------------------------------------------------------------------
 void Maildir::add(MaildirMessage &m)
 {
-  messages.insert(make_pair(m.getUID(), m));
-  index.insert(m.getUnique(), m.getUID());
+  const unsigned int uid = m.getUID();
+  const bool inserted = messages.insert(make_pair(uid, m)).second;
+  index.insert(m.getUnique(), uid);
+  if (!inserted)
+    return;
+
+  // New messages nearly always have the highest UID.
+  if (uids.empty() || uids.back() < uid)
+    uids.push_back(uid);
+  else
+    uids.insert(lower_bound(uids.begin(), uids.end(), uid), uid);
+
+  if (m.getStdFlags() & Message::F_RECENT)
+    ++recentCount;
+  if (m.hasFlagsChanged())
+    flagLog.insert(uid);
+  if (m.isExpunged())
+    expungeLog.insert(uid);
+}
+
+//------------------------------------------------------------------------
+void Maildir::remove(MessageMap::iterator i)
+{
+  const unsigned int uid = i->first;
+
+  vector<unsigned int>::iterator u
+    = lower_bound(uids.begin(), uids.end(), uid);
+  if (u != uids.end() && *u == uid)
+    uids.erase(u);
+
+  if (i->second.getStdFlags() & Message::F_RECENT)
+    --recentCount;
+  flagLog.erase(uid);
+  expungeLog.erase(uid);
+
+  MaildirMessageCache::getInstance().removeStatus(&i->second);
+  index.remove(i->second.getUnique());
+  messages.erase(i);
+}
+
+//------------------------------------------------------------------------
+unsigned int Maildir::getSqnr(unsigned int uid) const
+{
+  return lower_bound(uids.begin(), uids.end(), uid) - uids.begin() + 1;
 }
 
 //------------------------------------------------------------------------
@@ -805,3 +946,53 @@ void MaildirIndex::clearFileNames(void)
   for (; it != idx.end(); ++it)
     it->second.fileName = "";
 }
+
+//------------------------------------------------------------------------
+MaildirUidValFile::MaildirUidValFile(void)
+  : uidvalidity(0), uidnext(0), highestmodseq(0)
+{
+}
+
+//------------------------------------------------------------------------
+bool MaildirUidValFile::read(const string &path)
+{
+  Storage uidvalfile(path + "/bincimap-uidvalidity", Storage::ReadOnly);
+  string section, key, value;
+  string version;
+
+  uidvalidity = 0;
+  uidnext = 0;
+  highestmodseq = 0;
+  reserved.clear();
+
+  while (uidvalfile.get(&section, &key, &value))
+    if (section == "depot" && key == "_uidvalidity")
+      uidvalidity = (unsigned int) atoi(value);
+    else if (section == "depot" && key == "_uidnext")
+      uidnext = (unsigned int) atoi(value);
+    else if (section == "depot" && key == "_highestmodseq")
+      highestmodseq = (unsigned int) atoi(value);
+    else if (section == "depot" && key == "_version")
+      version = value;
+    else if (section == "reserved")
+      reserved[key] = (unsigned int) atoi(value);
+
+  return uidvalfile.eof() && version == UIDVALFILEVERSION
+    && uidvalidity != 0 && uidnext != 0;
+}
+
+//------------------------------------------------------------------------
+bool MaildirUidValFile::write(const string &path) const
+{
+  Storage uidvalfile(path + "/bincimap-uidvalidity", Storage::WriteOnly);
+  uidvalfile.put("depot", "_uidvalidity", toString(uidvalidity));
+  uidvalfile.put("depot", "_uidnext", toString(uidnext));
+  uidvalfile.put("depot", "_highestmodseq", toString(highestmodseq));
+  uidvalfile.put("depot", "_version", UIDVALFILEVERSION);
+
+  map<string, unsigned int>::const_iterator i = reserved.begin();
+  for (; i != reserved.end(); ++i)
+    uidvalfile.put("reserved", i->first, toString(i->second));
+
+  return uidvalfile.commit();
+}
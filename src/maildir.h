@@ -40,9 +40,13 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 
 #include "mailbox.h"
 #include "maildirmessage.h"
+#include "headersummary.h"
+#include "sortkeys.h"
+#include "textindex.h"
 
 namespace Binc {
   static const std::string CACHEFILEVERSION = "1.0.5";
@@ -72,6 +76,37 @@ namespace Binc {
     MaildirIndexItem *find(const std::string &unique);
   };
 
+  //------------------------------------------------------------------------
+  // The bincimap-uidvalidity file of a mailbox. Messages that are
+  // added to a mailbox get their UIDs reserved in reserved, keyed by
+  // unique name, until a scan gives the UIDs to them.
+  class MaildirUidValFile {
+  public:
+    unsigned int uidvalidity;
+    unsigned int uidnext;
+    unsigned int highestmodseq;
+    std::map<std::string, unsigned int> reserved;
+
+    bool read(const std::string &path);
+    bool write(const std::string &path) const;
+
+    //--
+    MaildirUidValFile(void);
+  };
+
+  //------------------------------------------------------------------------
+  // Held while a mailbox is scanned or has UIDs reserved, so that UIDs
+  // are handed out by one accessor at a time.
+  class MaildirLock {
+  public:
+    //--
+    MaildirLock(const std::string &path);
+    ~MaildirLock(void);
+
+  private:
+    std::string lock;
+  };
+
   //------------------------------------------------------------------------
   class Maildir : public Mailbox {
   public:
@@ -119,6 +154,7 @@ namespace Binc {
     unsigned int getMaxSqnr(void) const;
     unsigned int getUidValidity(void) const;
     unsigned int getUidNext(void) const;
+    unsigned int getHighestModSeq(void) const;
 
     bool getUpdates(bool doscan, unsigned int type,
 		    PendingUpdates &updates, bool forceScan);
@@ -129,6 +165,8 @@ namespace Binc {
     void bumpUidValidity(const std::string &) const;
 
     unsigned int getStatusID(const std::string &) const;
+    bool getWatchPaths(const std::string &path,
+		       std::vector<std::string> &paths) const;
     bool getStatus(const std::string &, Status &) const;
     void updateFlags(void);
 
@@ -146,6 +184,19 @@ namespace Binc {
 
     bool fastCopy(Message &source, Mailbox &desttype, const std::string &destname);
 
+    bool getSearchCandidates(const std::string &text,
+			     std::vector<unsigned int> &uids);
+    bool getHeaderMatches(const std::string &header,
+			  const std::string &text,
+			  std::vector<unsigned int> &uids);
+    bool getSentDayMatches(int first, int last,
+			   std::vector<unsigned int> &uids);
+    bool sortMessages(const std::vector<SortKeys::Criterion> &criteria,
+		      std::vector<unsigned int> &uids);
+    bool threadMessages(SortKeys::Algorithm algorithm,
+			const std::vector<unsigned int> &uids,
+			std::vector<SortKeys::ThreadNode> &tree);
+
     //--
     Maildir(void);
     ~Maildir(void);
@@ -163,6 +214,11 @@ namespace Binc {
     ReadCacheResult readCache(void);
     bool writeCache(void);
     bool scanFileNames(void) const;
+    std::string findFileName(const std::string &unique,
+			     bool &scanned) const;
+    bool updateTextIndex(void);
+    bool updateHeaderSummary(void);
+    bool updateSortKeys(void);
 
     enum ScanResult {
       Success = 0,
@@ -174,10 +230,19 @@ namespace Binc {
 
     MaildirMessage *get(const std::string &id);
     void add(MaildirMessage &m);
+    void remove(MessageMap::iterator i);
+    unsigned int getSqnr(unsigned int uid) const;
+
+    bool flushWriteBuffer(void);
 
   private:
     std::vector<MaildirMessage> newMessages;
 
+    // Data appended to a new message collects here, with carriage
+    // returns removed, and is written to writeFd in large pieces.
+    std::string writeBuffer;
+    int writeFd;
+
     unsigned int uidvalidity;
     unsigned int uidnext;
     bool selected;
@@ -189,8 +254,31 @@ namespace Binc {
     mutable bool firstscan;
     mutable bool cacheRead;
     mutable MaildirIndex index;
+    TextIndex textindex;
+    bool textindexLoaded;
+    HeaderSummary summary;
+    bool summaryLoaded;
+    SortKeys sortkeys;
+    bool sortkeysLoaded;
     mutable MessageMap messages;
 
+    // The UIDs of messages whose flags may differ from their file
+    // names. updateFlags() renames these, and only these.
+    std::set<unsigned int> dirtyFlags;
+
+    // The UIDs of the listed messages in ascending order, so that
+    // sequence numbers are found without walking the mailbox.
+    std::vector<unsigned int> uids;
+
+    // The changes that getUpdates() has yet to report: the UIDs of
+    // messages that are marked as expunged and of messages whose
+    // flags have changed. recentCount is the number of listed
+    // messages with \Recent. These are kept up to date as messages
+    // are added, changed and removed.
+    std::set<unsigned int> expungeLog;
+    std::set<unsigned int> flagLog;
+    unsigned int recentCount;
+
     mutable unsigned int oldrecent;
     mutable unsigned int oldexists;
 
@@ -201,6 +289,13 @@ namespace Binc {
 
     mutable bool uidnextchanged;
     mutable bool mailboxchanged;
+
+    // The highest mod-sequence handed out, kept with UIDNEXT.
+    mutable unsigned int highestmodseq;
+    mutable bool modseqchanged;
+
+    // UIDs reserved for messages that have yet to be scanned.
+    std::map<std::string, unsigned int> reservedUids;
   };
 }
 
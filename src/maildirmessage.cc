@@ -35,21 +35,26 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
 #include <string>
 
 #include <stack>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <ctype.h>
+#include <string.h>
 #include <time.h>
 #include <utime.h>
 
+#include "bodysearch.h"
 #include "maildir.h"
 #include "maildirmessage.h"
 #include "convert.h"
 #include "mime.h"
 #include "io.h"
 #include "mime-utils.h"
+#include "session.h"
 
 using namespace ::std;
 using namespace Binc;
@@ -59,21 +64,29 @@ string MaildirMessage::storage;
 
 namespace {
   //----------------------------------------------------------------------
-  void printOneHeader(IO &io, const MimePart *message, const string &s_in,
-		      bool removecomments = true)
+  // Returns true if ENVELOPE and BODYSTRUCTURE are kept in the cache.
+  bool keepStructures(void)
+  {
+    Session &session = Session::getInstance();
+    return session.globalconfig["Mailbox"]["cache structure"] != "no";
+  }
+
+  //----------------------------------------------------------------------
+  void printOneHeader(BincStream &io, const MimePart *message,
+		      const string &s_in, bool removecomments = true)
   {
     string tmp = "";
     HeaderItem hitem;
 
     if (message->h.getFirstHeader(s_in, hitem)) {
       tmp = hitem.getValue();
-      io << toImapString(unfold(tmp, removecomments));
+      io << ImapString(unfold(tmp, removecomments));
     } else
       io << "NIL";
   }
 
   //----------------------------------------------------------------------
-  void printOneAddressList(IO &io, const MimePart *message,
+  void printOneAddressList(BincStream &io, const MimePart *message,
 			   const string &s_in, bool removecomments = true)
   {
     string tmp = "";
@@ -95,7 +108,7 @@ namespace {
   }
 
   //----------------------------------------------------------------------
-  void envelope(IO &io, const MimePart *message)
+  void envelope(BincStream &io, const MimePart *message)
   {
     HeaderItem hitem;
     io << "(";
@@ -126,7 +139,8 @@ namespace {
   }
 
   //----------------------------------------------------------------------
-  void bodyStructure(IO &io, const MimePart *message, bool extended = true)
+  void bodyStructure(BincStream &io, const MimePart *message,
+		     bool extended = true)
   {
     HeaderItem hitem;
     if (message->isMultipart() && message->members.size() > 0) {
@@ -137,7 +151,7 @@ namespace {
 	bodyStructure(io, &(*i));
 
       io << " ";
-      io << toImapString(message->getSubType());
+      io << ImapString(message->getSubType());
       io << " ";
 
       vector<string> parameters;
@@ -174,7 +188,7 @@ namespace {
 	       i != parameters.end(); ++i) {
 	    if (i != parameters.begin())
 	      io << " ";
-	    io << toImapString(*i);
+	    io << ImapString(*i);
 	  }
 	  io << ")";
 	} else
@@ -194,7 +208,7 @@ namespace {
 	if (v.size() > 0) {
 	  string disp = v[0];
 	  trim(disp);
-	  io << "(" << toImapString(disp);
+	  io << "(" << ImapString(disp);
 	  io << " ";
 	  if (v.size() > 1) {
 	    io << "(";
@@ -216,10 +230,10 @@ namespace {
 	      
 	      if (!wrote) wrote = true;
 	      else io << " ";
-	      io << toImapString(key);
+	      io << ImapString(key);
 	      
 	      io << " ";
-	      io << toImapString(value);
+	      io << ImapString(value);
 	      
 	      ++i;
 	    }
@@ -289,9 +303,9 @@ namespace {
 	subtype = "plain";
       }
 
-      io << toImapString(type);
+      io << ImapString(type);
       io << " ";
-      io << toImapString(subtype);
+      io << ImapString(subtype);
 
       io << " ";
       if (parameters.size() != 0) {
@@ -300,7 +314,7 @@ namespace {
 	     i != parameters.end(); ++i) {
 	  if (i != parameters.begin())
 	    io << " ";
-	  io << toImapString(*i);
+	  io << ImapString(*i);
 	}
 	io << ")";
       } else
@@ -320,7 +334,7 @@ namespace {
       if (message->h.getFirstHeader("content-transfer-encoding", hitem)) {
 	tmp = hitem.getValue();
 	trim(tmp);
-	io << toImapString(tmp);
+	io << ImapString(tmp);
       } else
 	io << "\"7bit\"";
       io << " ";
@@ -361,7 +375,7 @@ namespace {
 	  if (v.size() > 0) {
 	    string disp = v[0];
 	    trim(disp);
-	    io << "(" << toImapString(disp);
+	    io << "(" << ImapString(disp);
 	    io << " ";
 	    if (v.size() > 1) {
 	      io << "(";
@@ -383,10 +397,10 @@ namespace {
 
 		if (!wrote) wrote = true;
 		else io << " ";
-		io << toImapString(key);
+		io << ImapString(key);
 
 		io << " ";
-		io << toImapString(value);
+		io << ImapString(value);
 
 		++i;
 	      }
@@ -411,13 +425,60 @@ namespace {
       io << ")";
     }
   }
+
+  //----------------------------------------------------------------------
+  // Searches length bytes of a file that is stored with CRLF, starting
+  // at offset, reading it in large blocks.
+  template <class Matcher>
+  bool fileContains(int fd, off_t offset, unsigned int length,
+		    Matcher &matcher)
+  {
+    char buf[65536];
+    while (length > 0) {
+      ssize_t n = pread(fd, buf, length < sizeof(buf) ? length : sizeof(buf),
+			offset);
+      if (n <= 0)
+	break;
+
+      if (matcher.feed(buf, n))
+	return true;
+
+      offset += n;
+      length -= n;
+    }
+
+    return false;
+  }
+
+  //----------------------------------------------------------------------
+  // Searches length bytes of a file as seen through the CRLF reader,
+  // starting at offset.
+  template <class Matcher>
+  bool crlfContains(int fd, unsigned int offset, unsigned int length,
+		    Matcher &matcher)
+  {
+    crlffile = fd;
+    crlfReset();
+    crlfSeek(offset);
+
+    const char *data;
+    unsigned int n;
+    while (length > 0 && (n = crlfGetBlock(data, length)) != 0) {
+      if (matcher.feed(data, n))
+	return true;
+
+      length -= n;
+    }
+
+    return false;
+  }
 }
 
 //------------------------------------------------------------------------
 MaildirMessage::MaildirMessage(Maildir &hom) 
   : fd(-1), doc(0), internalFlags(None), stdflags(F_NONE),
-    uid(0), size(0), unique(""), safeName(""), internaldate(0),
-    home(hom)
+    uid(0), size(0), modseq(0), modflags(UNKNOWN_FLAGS), unique(""),
+    safeName(""), internaldate(0), home(hom)
 {
 }
 
@@ -425,9 +486,12 @@ MaildirMessage::MaildirMessage(Maildir &hom)
 MaildirMessage::MaildirMessage(const MaildirMessage &copy) 
   : fd(copy.fd), doc(copy.doc), internalFlags(copy.internalFlags),
     stdflags(copy.stdflags), uid(copy.uid), size(copy.size),
-    unique(copy.unique), safeName(copy.safeName),
-    internaldate(copy.internaldate), home(copy.home)
+    modseq(copy.modseq), modflags(copy.modflags), unique(copy.unique),
+    safeName(copy.safeName), internaldate(copy.internaldate),
+    home(copy.home)
 {
+  for (int i = 0; i < STRUCTURES; ++i)
+    structures[i] = copy.structures[i];
 }
 
 //------------------------------------------------------------------------
@@ -444,8 +508,12 @@ MaildirMessage &MaildirMessage::operator =(const MaildirMessage &copy)
   stdflags = copy.stdflags;
   uid = copy.uid;
   size = copy.size;
+  modseq = copy.modseq;
+  modflags = copy.modflags;
   unique = copy.unique; 
   safeName = copy.safeName;
+  for (int i = 0; i < STRUCTURES; ++i)
+    structures[i] = copy.structures[i];
   internaldate = copy.internaldate;
   home = copy.home;
 
@@ -458,16 +526,32 @@ bool MaildirMessage::operator <(const MaildirMessage &a) const
   return uid < a.uid;
 }
 //------------------------------------------------------------------------
-void MaildirMessage::close(void)
+bool MaildirMessage::close(void)
 {
+  bool success = true;
+
   if (fd != -1) {
-    if ((internalFlags & WasWrittenTo) && fsync(fd) != 0
-	&& errno != EINVAL && errno != EROFS) {
-      // FIXME: report this error
+    if (home.writeFd == fd) {
+      success = flushChunks();
+      home.writeFd = -1;
+      string().swap(home.writeBuffer);
     }
 
-    if (::close(fd) != 0) {
-      // FIXME: report this error
+    // The message is normally on disk before it is linked into the
+    // mailbox. Sites that trade that for speed can turn it off.
+    Session &session = Session::getInstance();
+    if (success && (internalFlags & WasWrittenTo)
+	&& session.globalconfig["Mailbox"]["sync appends"] != "no"
+	&& fsync(fd) != 0 && errno != EINVAL && errno != EROFS) {
+      setLastError("Error syncing " + getSafeName() 
+		   + ": " + string(strerror(errno)));
+      success = false;
+    }
+
+    if (::close(fd) != 0 && success && (internalFlags & WasWrittenTo)) {
+      setLastError("Error closing " + getSafeName() 
+		   + ": " + string(strerror(errno)));
+      success = false;
     }
 
     fd = -1;
@@ -494,24 +578,33 @@ void MaildirMessage::close(void)
     delete doc;
     doc = 0;
   }
+
+  return success;
 }
 
 //------------------------------------------------------------------------
 void MaildirMessage::setExpunged(void)
 {
   internalFlags |= Expunged;
+  if (uid != 0)
+    home.expungeLog.insert(uid);
+  home.bumpChangeStamp();
 }
 
 //------------------------------------------------------------------------
 void MaildirMessage::setUnExpunged(void)
 {
   internalFlags &= ~Expunged;
+  if (uid != 0)
+    home.expungeLog.erase(uid);
 }
 
 //------------------------------------------------------------------------
 void MaildirMessage::setFlagsUnchanged(void)
 {
   internalFlags &= ~FlagsChanged;
+  if (uid != 0)
+    home.flagLog.erase(uid);
 }
 
 //------------------------------------------------------------------------
@@ -520,6 +613,30 @@ bool MaildirMessage::hasFlagsChanged(void) const
   return (internalFlags & FlagsChanged) != 0;
 }
 
+//------------------------------------------------------------------------
+unsigned int MaildirMessage::getModSeq(void) const
+{
+  // \Recent belongs to the session, and does not change the message.
+  const unsigned char flags = stdflags & ~F_RECENT;
+  if (modflags == UNKNOWN_FLAGS)
+    modflags = flags;
+  else if (flags != modflags) {
+    modseq = ++home.highestmodseq;
+    modflags = flags;
+    home.modseqchanged = true;
+    home.mailboxchanged = true;
+  }
+
+  return modseq;
+}
+
+//------------------------------------------------------------------------
+void MaildirMessage::setModSeq(unsigned int m, unsigned char flags)
+{
+  modseq = m;
+  modflags = flags;
+}
+
 //------------------------------------------------------------------------
 unsigned char MaildirMessage::getStdFlags(void) const
 {
@@ -571,14 +688,30 @@ void MaildirMessage::setInternalDate(time_t t)
 void MaildirMessage::setStdFlag(unsigned char f_in)
 {
   internalFlags |= FlagsChanged;
+  if (uid != 0) {
+    if ((f_in & F_RECENT) && !(stdflags & F_RECENT))
+      ++home.recentCount;
+    home.dirtyFlags.insert(uid);
+    home.flagLog.insert(uid);
+  }
+
   stdflags |= f_in;
+  home.bumpChangeStamp();
 }
 
 //------------------------------------------------------------------------
 void MaildirMessage::resetStdFlags(void)
 {
   internalFlags |= FlagsChanged;
+  if (uid != 0) {
+    if (stdflags & F_RECENT)
+      --home.recentCount;
+    home.dirtyFlags.insert(uid);
+    home.flagLog.insert(uid);
+  }
+
   stdflags = F_NONE;
+  home.bumpChangeStamp();
 }
 
 //------------------------------------------------------------------------
@@ -693,6 +826,12 @@ int MaildirMessage::readChunk(string &chunk)
 
 //------------------------------------------------------------------------
 bool MaildirMessage::appendChunk(const string &chunk)
+{
+  return appendChunk(chunk.data(), chunk.length());
+}
+
+//------------------------------------------------------------------------
+bool MaildirMessage::appendChunk(const char *data, size_t length)
 {
   if (fd == -1) {
     setLastError("Error writing to " + getSafeName() 
@@ -702,26 +841,37 @@ bool MaildirMessage::appendChunk(const string &chunk)
 
   internalFlags |= WasWrittenTo;
 
-  string out;
-  for (string::const_iterator i = chunk.begin(); i != chunk.end(); ++i) {
-    const char c = *i;
-    if (c != '\r')
-      out += c;
+  // The write buffer is shared by the messages of the mailbox, and
+  // holds data for one of them at a time.
+  if (home.writeFd != fd) {
+    if (home.writeFd != -1)
+      home.flushWriteBuffer();
+    home.writeFd = fd;
+    home.writeBuffer.reserve(WRITE_BUFFER_SIZE + length);
   }
 
-  ssize_t wroteBytes = 0;
-  for (;;) {
-    wroteBytes = write(fd, out.c_str(), (size_t) out.length());
-    if (wroteBytes == -1) {
-      if (errno == EINTR)
-	continue;
-      wroteBytes = 0;
-    }
-
-    break;
+  // Carriage returns are dropped. memchr() finds them many bytes at a
+  // time, and the runs in between are copied whole. Each LF counts
+  // twice in the size, as it is sent as CRLF.
+  const char *end = data + length;
+  while (data != end) {
+    const char *cr = (const char *) memchr(data, '\r', end - data);
+    const char *stop = cr != 0 ? cr : end;
+    home.writeBuffer.append(data, stop - data);
+    size += (stop - data) + std::count(data, stop, '\n');
+    data = cr != 0 ? cr + 1 : end;
   }
 
-  if (wroteBytes == (ssize_t) out.length())
+  if (home.writeBuffer.length() >= WRITE_BUFFER_SIZE)
+    return flushChunks();
+
+  return true;
+}
+
+//------------------------------------------------------------------------
+bool MaildirMessage::flushChunks(void)
+{
+  if (fd == -1 || home.writeFd != fd || home.flushWriteBuffer())
     return true;
 
   setLastError("Error writing to " + getSafeName() 
@@ -746,6 +896,20 @@ bool MaildirMessage::parseFull(void) const
     doc = new MimeDocument;
   doc->parseFull(fd);
 
+  // Remember whether the file is stored with CRLF already, so that
+  // later fetches of the whole message can skip the parsing.
+  unsigned char crlf = CRLFKnown | (doc->isRawCRLF() ? RawCRLF : 0);
+  if ((internalFlags & (CRLFKnown | RawCRLF)) != crlf) {
+    internalFlags = (internalFlags & ~RawCRLF) | crlf;
+    home.mailboxchanged = true;
+  }
+
+  // The parsed size wins over one that came from the file name.
+  if (size != doc->size) {
+    size = doc->size;
+    home.mailboxchanged = true;
+  }
+
   cache.addStatus(this, MaildirMessageCache::AllParsed);
 
   return true;
@@ -775,27 +939,71 @@ bool MaildirMessage::parseHeaders(void) const
 }
 
 //------------------------------------------------------------------------
-bool MaildirMessage::printBodyStructure(bool extended) const
+bool MaildirMessage::isStoredRaw(int file) const
 {
-  if (!parseFull())
+  // A file that is stored with CRLF is sent as it is, with the
+  // message size as its length. That size may have come from the
+  // file name, so it is only trusted if the file is that long.
+  if (!(internalFlags & RawCRLF) || size == 0)
     return false;
 
+  struct stat mystat;
+  return fstat(file, &mystat) == 0 && mystat.st_size == (off_t) size;
+}
+
+//------------------------------------------------------------------------
+bool MaildirMessage::printBodyStructure(bool extended) const
+{
+  // The structure is worked out once and then kept with the message.
+  string &text = structures[extended ? BODYSTRUCTURE : BODY];
+  if (text == "") {
+    if (!parseFull())
+      return false;
+
+    BincStream s;
+    bodyStructure(s, doc, extended);
+    text = s.str();
+    if (keepStructures())
+      home.mailboxchanged = true;
+  }
+
   IO &com = IOFactory::getInstance().get(1);
-  bodyStructure(com, doc, extended);
+  com << text;
   return true;
 }
 
 //------------------------------------------------------------------------
 bool MaildirMessage::printEnvelope(void) const
 {
-  if (!parseFull())
-    return false;
+  string &text = structures[ENVELOPE];
+  if (text == "") {
+    if (!parseFull())
+      return false;
+
+    BincStream s;
+    envelope(s, doc);
+    text = s.str();
+    if (keepStructures())
+      home.mailboxchanged = true;
+  }
 
   IO &com = IOFactory::getInstance().get(1);
-  envelope(com, doc);
+  com << text;
   return true;
 }
 
+//------------------------------------------------------------------------
+const string &MaildirMessage::getStructure(Structure which) const
+{
+  return structures[which];
+}
+
+//------------------------------------------------------------------------
+void MaildirMessage::setStructure(Structure which, const string &text)
+{
+  structures[which] = text;
+}
+
 //------------------------------------------------------------------------
 bool MaildirMessage::printHeader(const std::string &section,
 				 std::vector<std::string> headers,
@@ -805,7 +1013,7 @@ bool MaildirMessage::printHeader(const std::string &section,
 				 bool mime) const
 {
   IO &com = IOFactory::getInstance().get(1);
-  com << storage;
+  com.write(storage);
   storage = "";
   return true;
 }
@@ -864,7 +1072,15 @@ bool MaildirMessage::printBody(const std::string &section,
     return false;
 
   storage = "";
-  part->printBody(fd, com, startOffset, length);
+  if (part->rawcrlf) {
+    if (startOffset < part->bodylength) {
+      unsigned int s = part->bodylength - startOffset;
+      com.writeFileSpan(fd, part->bodystartoffsetraw + startOffset,
+			s < length ? s : length);
+    }
+  } else
+    part->printBody(fd, com, startOffset, length);
+
   return true;
 }
 
@@ -894,6 +1110,25 @@ bool MaildirMessage::printDoc(unsigned int startOffset,
 			      unsigned int length, bool onlyText) const
 {
   IO &com = IOFactory::getInstance().get(1);
+  storage = "";
+
+  // The whole message of a file that is known to be stored with CRLF
+  // is sent straight from the file, without parsing it first.
+  if (!onlyText && (internalFlags & RawCRLF)) {
+    int fd = getFile();
+    if (fd == -1)
+      return false;
+
+    if (isStoredRaw(fd)) {
+      if (startOffset < size) {
+	unsigned int s = size - startOffset;
+	com.writeFileSpan(fd, startOffset, s < length ? s : length);
+      }
+
+      return true;
+    }
+  }
+
   if (!parseFull())
     return false;
 
@@ -904,8 +1139,14 @@ bool MaildirMessage::printDoc(unsigned int startOffset,
   if (onlyText)
     startOffset += doc->bodystartoffsetcrlf;
 
-  storage = "";
-  doc->printDoc(fd, com, startOffset, length);
+  if (doc->isRawCRLF()) {
+    if (startOffset < doc->size) {
+      unsigned int s = doc->size - startOffset;
+      com.writeFileSpan(fd, startOffset, s < length ? s : length);
+    }
+  } else
+    doc->printDoc(fd, com, startOffset, length);
+
   return true;
 }
 
@@ -914,10 +1155,18 @@ unsigned int MaildirMessage::getDocSize(unsigned int startOffset,
 					unsigned int length, 
 					bool onlyText) const
 {
-  if (!parseFull())
-    return false;
+  unsigned int s;
+  int fd;
+  if (!onlyText && (internalFlags & RawCRLF) && (fd = getFile()) != -1
+      && isStoredRaw(fd))
+    s = size;
+  else {
+    if (!parseFull())
+      return false;
+
+    s = doc->size;
+  }
 
-  unsigned int s = doc->size;
   if (onlyText) s -= doc->bodystartoffsetcrlf;
 
   if (startOffset > s)
@@ -938,77 +1187,63 @@ bool MaildirMessage::headerContains(const std::string &header,
   if (!doc->h.getFirstHeader(header, hitem))
     return false;
 
-  string tmp = hitem.getValue();
-  uppercase(tmp);
-  string tmp2 = text;
-  uppercase(tmp2);
-  return (tmp.find(tmp2) != string::npos);
+  const string &value = hitem.getValue();
+  return TextMatcher(text).find(value.data(), value.length());
 }
 
 //------------------------------------------------------------------------
 bool MaildirMessage::bodyContains(const std::string &text)
 {
-  if (!parseFull())
-    return false;
-
   // search the body part of the message..
   int fd = getFile();
   if (fd == -1)
     return false;
 
-  crlffile = fd;
-  crlfReset();
-
-  char c;
-  for (unsigned int i = 0; i < doc->getBodyStartOffset(); ++i)
-    if (!crlfGetChar(c))
-      break;
-  
-  char *ring = new char[text.length()];
-  int pos = 0;
-  int length = doc->getBodyLength();
-  while (crlfGetChar(c) && length--) {
-    ring[pos % text.length()] = toupper(c);
-    
-    if (compareStringToQueue(text, ring, pos + 1, text.length())) {
-      delete ring;
-      return true;
-    }
-    
-    ++pos;
-  }
-  
-  delete ring;
-  return false;
+  Session &session = Session::getInstance();
+  return searchFile(fd, text, true,
+		    session.globalconfig["Mailbox"]["search text parts only"]
+		    == "yes");
 }
 
 //------------------------------------------------------------------------
 bool MaildirMessage::textContains(const std::string &text)
 {
-  // search the body part of the message..
+  // search the whole message..
   int fd = getFile();
   if (fd == -1)
     return false;
 
-  crlffile = fd;
-  crlfReset();
+  return searchFile(fd, text, false, false);
+}
 
-  char c;
-  char *ring = new char[text.length()];
-  int pos = 0;
-  while (crlfGetChar(c)) {
-    ring[pos % text.length()] = toupper(c);
-    
-    if (compareStringToQueue(text, ring, pos + 1, text.length())) {
-      delete ring;
-      return true;
-    }
-    
-    ++pos;
+//------------------------------------------------------------------------
+int MaildirMessage::getSearchFile(void)
+{
+  int file = getFile();
+  if (file == -1 || (file = dup(file)) == -1)
+    return -1;
+
+  lseek(file, 0, SEEK_SET);
+  return file;
+}
+
+//------------------------------------------------------------------------
+bool MaildirMessage::searchFile(int file, const std::string &text,
+				bool onlyBody, bool onlyTextParts) const
+{
+  bool raw = isStoredRaw(file);
+
+  // The body is found while the message is read, so it is read once,
+  // and never parsed.
+  if (onlyBody) {
+    BodySearch search(text, onlyTextParts);
+    return raw ? fileContains(file, 0, size, search)
+      : crlfContains(file, 0, (unsigned int) -1, search);
   }
-  
-  delete ring;
-  return false;
+
+  TextMatcher matcher(text);
+  return raw ? fileContains(file, 0, size, matcher)
+    : crlfContains(file, 0, (unsigned int) -1, matcher);
 }
 
 //------------------------------------------------------------------------
@@ -1019,11 +1254,14 @@ const std::string &MaildirMessage::getHeader(const std::string &header)
   if (!parseHeaders())
     return NIL;
 
+  // The value must outlive hitem; it is valid until the next call.
+  static string value;
   HeaderItem hitem;
   if (!doc->h.getFirstHeader(header, hitem))
     return NIL;
   
-  return hitem.getValue(); 
+  value = hitem.getValue();
+  return value;
 }
 
 //------------------------------------------------------------------------
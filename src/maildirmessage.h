@@ -146,6 +146,20 @@ namespace Binc {
     */
     bool hasFlagsChanged(void) const;
 
+    /*!
+      Returns the mod-sequence of the message. If its flags differ
+      from those it had when it got its mod-sequence, it gets the
+      next one of the mailbox first.
+    */
+    unsigned int getModSeq(void) const;
+
+    /*!
+      Sets the mod-sequence of the message, and the flags that it
+      had then. UNKNOWN_FLAGS takes the flags the message has when
+      getModSeq() is first called, without a new mod-sequence.
+    */
+    void setModSeq(unsigned int modseq, unsigned char flags);
+
     /*!
       Sets the internal date of a message. This is usually the date in
       which the message arrived in the mailbox.
@@ -182,9 +196,24 @@ namespace Binc {
     bool appendChunk(const std::string &chunk);
 
     /*!
-      Resets a message and frees all allocated resources.
+      Appends length bytes from data to a message. Carriage returns
+      are dropped, and the rest is buffered and written in large
+      pieces. The size of the message is kept up to date.
+    */
+    bool appendChunk(const char *data, size_t length);
+
+    /*!
+      Writes out what appendChunk() has buffered. Returns false if
+      this fails.
     */
-    void close(void);
+    bool flushChunks(void);
+
+    /*!
+      Resets a message and frees all allocated resources. A message
+      that was written to is flushed and synced first; returns false
+      if that fails.
+    */
+    bool close(void);
 
     /*!
       Marks the message as expunged. Equivalent to calling
@@ -217,10 +246,46 @@ namespace Binc {
     bool bodyContains(const std::string &text);
     bool textContains(const std::string &text);
 
+    /*!
+      Returns a new descriptor for the message file, positioned at
+      the start, for searchFile(). The caller closes it.
+    */
+    int getSearchFile(void);
+
+    /*!
+      Searches the body or the whole text of the message, reading
+      from fd, like bodyContains() and textContains() do. Unlike
+      them, it uses no state shared with other messages, so several
+      messages can be searched on different threads at once. With
+      onlyTextParts, only the text parts of the body are searched.
+    */
+    bool searchFile(int fd, const std::string &text, bool onlyBody,
+		    bool onlyTextParts) const;
+
     bool printBodyStructure(bool extended = true) const;
 
     bool printEnvelope(void) const;
 
+    enum Structure {
+      ENVELOPE,
+      BODY,
+      BODYSTRUCTURE,
+      STRUCTURES
+    };
+
+    /*!
+      Returns the ENVELOPE, BODY or BODYSTRUCTURE of the message as
+      last sent, or an empty string if it has not been worked out
+      yet. They are kept in the mailbox's cache.
+    */
+    const std::string &getStructure(Structure which) const;
+
+    /*!
+      Sets the ENVELOPE, BODY or BODYSTRUCTURE of the message, as read
+      from the mailbox's cache.
+    */
+    void setStructure(Structure which, const std::string &text);
+
     bool printHeader(const std::string &section,
 		     std::vector<std::string> headers,
 		     bool includeHeaders = false,
@@ -262,18 +327,26 @@ namespace Binc {
     MaildirMessage(const MaildirMessage &copy);
     MaildirMessage &operator = (const MaildirMessage &copy);
 
+    enum {
+      UNKNOWN_FLAGS = 0xff,
+      WRITE_BUFFER_SIZE = 262144
+    };
+
     enum Flags {
       None = 0x00,
       Expunged = 0x01,
       FlagsChanged = 0x02,
       JustArrived = 0x04,
       WasWrittenTo = 0x08,
-      Committed = 0x10      
+      Committed = 0x10,
+      CRLFKnown = 0x20,
+      RawCRLF = 0x40
     };
 
   protected:
     bool parseFull(void) const;
     bool parseHeaders(void) const;
+    bool isStoredRaw(int fd) const;
 
     std::string getFixedFilename(void) const;
     std::string getFileName(void) const;
@@ -291,8 +364,11 @@ namespace Binc {
     mutable unsigned char stdflags;
     mutable unsigned int uid;
     mutable unsigned int size;
+    mutable unsigned int modseq;
+    mutable unsigned char modflags;
     mutable std::string unique;
     mutable std::string safeName;
+    mutable std::string structures[STRUCTURES];
     time_t internaldate;
     
     Maildir &home;
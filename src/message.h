@@ -90,13 +90,17 @@ namespace Binc {
     virtual void setFlagsUnchanged(void) = 0;
     virtual bool hasFlagsChanged(void) const = 0;
 
+    virtual unsigned int getModSeq(void) const = 0;
+
     virtual void setInternalDate(time_t) = 0;
     virtual time_t getInternalDate(void) const = 0;
 
     //    virtual void rewind(void) = 0;
     virtual int readChunk(std::string &) = 0;
     virtual bool appendChunk(const std::string &) = 0;
-    virtual void close(void) = 0;
+    virtual bool appendChunk(const char *, size_t) = 0;
+    virtual bool flushChunks(void) = 0;
+    virtual bool close(void) = 0;
 
     virtual void setExpunged(void) = 0;
     virtual void setUnExpunged(void) = 0;
@@ -110,6 +114,10 @@ namespace Binc {
     virtual bool bodyContains(const std::string &text) = 0;
     virtual bool textContains(const std::string &text) = 0;
 
+    virtual int getSearchFile(void) = 0;
+    virtual bool searchFile(int fd, const std::string &text,
+			    bool onlyBody, bool onlyTextParts) const = 0;
+
     virtual bool printBodyStructure(bool extended = true) const = 0;
 
     virtual bool printEnvelope(void) const = 0;
@@ -147,6 +155,13 @@ namespace Binc {
     void setLastError(const std::string &) const;
     const std::string &getLastError(void) const;
 
+    /*!
+      Returns the parenthesized list of the standard flags in flags,
+      for example "(\\Seen \\Recent)". The lists for all 64
+      combinations are built on first use.
+    */
+    static const std::string &getStdFlagList(unsigned char flags);
+
   private:
     static std::string lastError;
   };
@@ -168,6 +183,32 @@ namespace Binc {
   {
     return lastError;
   }
+
+  inline const std::string &Message::getStdFlagList(unsigned char flags)
+  {
+    static std::string lists[64];
+    static bool initialized = false;
+
+    if (!initialized) {
+      for (int i = 0; i < 64; ++i) {
+	std::string &list = lists[i];
+	list = "(";
+	if (i & F_SEEN) list += "\\Seen ";
+	if (i & F_ANSWERED) list += "\\Answered ";
+	if (i & F_DELETED) list += "\\Deleted ";
+	if (i & F_DRAFT) list += "\\Draft ";
+	if (i & F_RECENT) list += "\\Recent ";
+	if (i & F_FLAGGED) list += "\\Flagged ";
+	if (list.length() > 1)
+	  list.resize(list.length() - 1);
+	list += ")";
+      }
+
+      initialized = true;
+    }
+
+    return lists[flags & 0x3f];
+  }
 }
 
 #endif
@@ -52,12 +52,14 @@
 
 using namespace ::std;
 
-int crlffile = 0;
-char crlfdata[4096];
-unsigned int crlftail = 0;
-unsigned int crlfhead = 0;
-unsigned int crlfoffset = 0;
-char lastchar = '\0';
+CRLF_THREAD int crlffile = 0;
+CRLF_THREAD char crlfdata[4096];
+CRLF_THREAD char crlfadded[4096];
+CRLF_THREAD unsigned int crlfnadded = 0;
+CRLF_THREAD unsigned int crlftail = 0;
+CRLF_THREAD unsigned int crlfhead = 0;
+CRLF_THREAD unsigned int crlfoffset = 0;
+CRLF_THREAD char lastchar = '\0';
 
 //------------------------------------------------------------------------
 bool fillInputBuffer(void)
@@ -74,25 +76,34 @@ bool fillInputBuffer(void)
     else break;
   }
   
+  // crlfadded marks the characters that are not in the file, so that
+  // the parser can tell which parts are stored with CRLF already.
   for (ssize_t i = 0; i < nbytes; ++i) {
     const char c = raw[i];
     switch (c) {
     case '\r':
       if (lastchar == '\r') {
+	crlfadded[crlftail & 0xfff] = 0;
 	crlfdata[crlftail++ & 0xfff] = '\r';
+	crlfadded[crlftail & 0xfff] = 1;
 	crlfdata[crlftail++ & 0xfff] = '\n';
       }
       break;
     case '\n':
+      crlfadded[crlftail & 0xfff] = (lastchar == '\r') ? 0 : 1;
       crlfdata[crlftail++ & 0xfff] = '\r';
+      crlfadded[crlftail & 0xfff] = 0;
       crlfdata[crlftail++ & 0xfff] = '\n';
       break;
     default:
       if (lastchar == '\r') {
+	crlfadded[crlftail & 0xfff] = 0;
 	crlfdata[crlftail++ & 0xfff] = '\r';
+	crlfadded[crlftail & 0xfff] = 1;
 	crlfdata[crlftail++ & 0xfff] = '\n';
       }
 
+      crlfadded[crlftail & 0xfff] = 0;
       crlfdata[crlftail++ & 0xfff] = c;
       break;
     }
@@ -131,6 +142,11 @@ void Binc::MimeDocument::parseFull(int fd) const
   while (crlfGetChar(c));
 
   size = crlfoffset;
+
+  // A trailing CR is dropped by the conversion, so the file is only
+  // identical to what we serve if nothing was added and nothing
+  // dropped.
+  rawIsCRLF = (crlfnadded == 0 && lastchar != '\r');
 }
 
 //------------------------------------------------------------------------
@@ -146,6 +162,7 @@ int Binc::MimePart::parseFull(const string &toboundary, int &boundarysize) const
   bool eof = false;
 
   headerstartoffsetcrlf = crlfoffset;
+  rawcrlf = false;
 
   while (!quit && !eof) {
     // read name
@@ -238,13 +255,18 @@ int Binc::MimePart::parseFull(const string &toboundary, int &boundarysize) const
   // CRLF.
   headerlength = crlfoffset - headerstartoffsetcrlf;
   bodystartoffsetcrlf = crlfoffset;
+  bodystartoffsetraw = crlfoffset - crlfnadded;
   bodylength = 0;
 
+  unsigned int nadded = crlfnadded;
+
   // If we encounter the end of file, we return 1 as if we found our
   // parent's terminal boundary. This will cause a safe exit, and
   // whatever we parsed until now will be available.
-  if (eof)
+  if (eof) {
+    rawcrlf = true;
     return 1;
+  }
 
   // Do simple parsing of headers to determine the
   // type of message (multipart,messagerfc822 etc)
@@ -655,5 +677,10 @@ int Binc::MimePart::parseFull(const string &toboundary, int &boundarysize) const
     }
   }
 
+  // The body is identical in the file if no characters were added
+  // while reading it. Characters added to the terminating boundary
+  // make us play safe.
+  rawcrlf = (crlfnadded == nadded);
+
   return (eof || foundendofpart) ? 1 : 0;
 }
@@ -67,11 +67,10 @@ void Binc::MimePart::printBody(int fd, IO &output, unsigned int startoffset,
   if (startoffset + length > bodylength)
     length = bodylength - startoffset;
 
-  char c = '\0';
-  for (unsigned int i = 0; i < length; ++i) {
-    if (!crlfGetChar(c))
-      break;
-
-    output << (char)c;
+  const char *data;
+  unsigned int n;
+  while (length > 0 && (n = crlfGetBlock(data, length)) != 0) {
+    output.write(data, n);
+    length -= n;
   }
 }
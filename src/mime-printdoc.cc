@@ -64,11 +64,10 @@ void Binc::MimePart::printDoc(int fd, IO &output, unsigned int startoffset,
 
   crlfSeek(startoffset);
 
-  char c;
-  for (unsigned int i = 0; i < length; ++i) {
-    if (!crlfGetChar(c))
-      break;
-
-    output << (char)c;
+  const char *data;
+  unsigned int n;
+  while (length > 0 && (n = crlfGetBlock(data, length)) != 0) {
+    output.write(data, n);
+    length -= n;
   }
 }
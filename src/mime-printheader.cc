@@ -52,6 +52,35 @@
 
 using namespace ::std;
 
+namespace {
+  //----------------------------------------------------------------------
+  // Appends the part of s that falls inside the window of startoffset
+  // and length to store, in one block.
+  void storeWindow(string &store, const string &s,
+		   unsigned int &processedbytes, unsigned int &wrotebytes,
+		   unsigned int startoffset, unsigned int length)
+  {
+    string::size_type pos = 0;
+    if (processedbytes < startoffset) {
+      pos = startoffset - processedbytes;
+      if (pos > s.length())
+	pos = s.length();
+      processedbytes += pos;
+    }
+
+    if (pos < s.length() && wrotebytes < length) {
+      string::size_type n = s.length() - pos;
+      if (n > length - wrotebytes)
+	n = length - wrotebytes;
+      store.append(s, pos, n);
+      wrotebytes += n;
+      pos += n;
+    }
+
+    processedbytes += s.length() - pos;
+  }
+}
+
 //------------------------------------------------------------------------
 void Binc::MimePart::printHeader(int fd,
 				 IO &output, vector<string> headers, bool includeheaders, 
@@ -154,15 +183,10 @@ void Binc::MimePart::printHeader(int fd,
 	}
 
 	if (foundMatch == includeheaders || headers.size() == 0) {
-	  string out = name + content;
-	  for (string::const_iterator i = out.begin(); i != out.end(); ++i)
-	    if (processedbytes >= startoffset && wrotebytes < length) {
-	      if (processedbytes >= startoffset) {
-		store += *i;
-		++wrotebytes;
-	      }
-	    } else
-	      ++processedbytes;
+	  storeWindow(store, name, processedbytes, wrotebytes,
+		      startoffset, length);
+	  storeWindow(store, content, processedbytes, wrotebytes,
+		      startoffset, length);
 	}
 
 	// move on to the next header
@@ -191,13 +215,10 @@ void Binc::MimePart::printHeader(int fd,
     }
     
     if (hasHeaderSeparator || foundMatch == includeheaders || headers.size() == 0) {
-      string out = name + content;
-      for (string::const_iterator i = out.begin(); i != out.end(); ++i)
-	if (processedbytes >= startoffset && wrotebytes < length) {
-	  store += *i;
-	  ++wrotebytes;
-	} else
-	  ++processedbytes;
+      storeWindow(store, name, processedbytes, wrotebytes,
+		  startoffset, length);
+      storeWindow(store, content, processedbytes, wrotebytes,
+		  startoffset, length);
     }
   }
 }
@@ -59,12 +59,22 @@ inline bool compareStringToQueue(const std::string &s_in,
   return true;
 }
 
-extern int crlffile;
-extern char crlfdata[];
-extern unsigned int crlfoffset;
-extern unsigned int crlftail;
-extern unsigned int crlfhead;
-extern char lastchar;
+// The CRLF reader keeps its state per thread, so that SEARCH can
+// parse and search several messages at once.
+#ifdef WITH_PTHREAD
+#define CRLF_THREAD __thread
+#else
+#define CRLF_THREAD
+#endif
+
+extern CRLF_THREAD int crlffile;
+extern CRLF_THREAD char crlfdata[];
+extern CRLF_THREAD char crlfadded[];
+extern CRLF_THREAD unsigned int crlfnadded;
+extern CRLF_THREAD unsigned int crlfoffset;
+extern CRLF_THREAD unsigned int crlftail;
+extern CRLF_THREAD unsigned int crlfhead;
+extern CRLF_THREAD char lastchar;
 
 bool fillInputBuffer(void);
 
@@ -73,15 +83,38 @@ inline bool crlfGetChar(char &c)
   if (crlfhead == crlftail && !fillInputBuffer())
     return false;
 
-  c = crlfdata[crlfhead++ & 0xfff];
+  c = crlfdata[crlfhead & 0xfff];
+  crlfnadded += crlfadded[crlfhead++ & 0xfff];
   ++crlfoffset;
   return true;
 }
 
+// Returns the number of characters, at most max, that can be read in
+// one block starting at data, or 0 at the end of the file.
+inline unsigned int crlfGetBlock(const char *&data, unsigned int max)
+{
+  if (crlfhead == crlftail && !fillInputBuffer())
+    return 0;
+
+  unsigned int pos = crlfhead & 0xfff;
+  unsigned int n = crlftail - crlfhead;
+  if (n > 0x1000 - pos) n = 0x1000 - pos;
+  if (n > max) n = max;
+
+  for (unsigned int i = 0; i < n; ++i)
+    crlfnadded += crlfadded[pos + i];
+
+  data = crlfdata + pos;
+  crlfhead += n;
+  crlfoffset += n;
+  return n;
+}
+
 inline void crlfUnGetChar(void)
 {
   --crlfhead;
   --crlfoffset;
+  crlfnadded -= crlfadded[crlfhead & 0xfff];
 }
 
 inline void crlfReset(void)
@@ -89,6 +122,7 @@ inline void crlfReset(void)
   if (crlfoffset != 0) {
     crlfoffset = 0;
     crlfhead = crlftail = 0;
+    crlfnadded = 0;
     lastchar = '\0';
     lseek(crlffile, 0, SEEK_SET);
   }
@@ -99,12 +133,9 @@ inline void crlfSeek(unsigned int offset)
   if (crlfoffset > offset)
     crlfReset();
    
-  char c;
-  int n = 0;
-  while (offset > crlfoffset) {
-    if (!crlfGetChar(c))
+  const char *data;
+  while (offset > crlfoffset)
+    if (crlfGetBlock(data, offset - crlfoffset) == 0)
       break;
-    ++n;
-  }
 }
 #endif
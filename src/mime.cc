@@ -56,6 +56,7 @@ Binc::MimeDocument::MimeDocument(void) : MimePart()
 {
   allIsParsed = false;
   headerIsParsed = false;
+  rawIsCRLF = false;
 }
 
 //------------------------------------------------------------------------
@@ -70,6 +71,7 @@ void Binc::MimeDocument::clear(void) const
   h.clear();
   headerIsParsed = false;
   allIsParsed = false;
+  rawIsCRLF = false;
 }
 
 //------------------------------------------------------------------------
@@ -85,7 +87,9 @@ Binc::MimePart::MimePart(void)
   size = 0;
   messagerfc822 = false;
   multipart = false;
+  rawcrlf = false;
 
+  bodystartoffsetraw = 0;
   nlines = 0;
   nbodylines = 0;
 }
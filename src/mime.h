@@ -91,10 +91,12 @@ namespace Binc {
     mutable unsigned int headerlength;
 
     mutable unsigned int bodystartoffsetcrlf;
+    mutable unsigned int bodystartoffsetraw;
     mutable unsigned int bodylength;
     mutable unsigned int nlines;
     mutable unsigned int nbodylines;
     mutable unsigned int size;
+    mutable bool rawcrlf;
 
   public:
     enum FetchType {
@@ -134,6 +136,7 @@ namespace Binc {
   private:
     mutable bool headerIsParsed;
     mutable bool allIsParsed;
+    mutable bool rawIsCRLF;
 
   public:
     void parseOnlyHeader(int fd) const;
@@ -142,6 +145,7 @@ namespace Binc {
     
     inline bool isHeaderParsed(void) { return headerIsParsed; }
     inline bool isAllParsed(void) { return allIsParsed; }
+    inline bool isRawCRLF(void) const { return rawIsCRLF; }
 
     //--
     MimeDocument(void);
@@ -0,0 +1,622 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    notifier.cc
+ *
+ *  Description:
+ *    Implementation of the Binc::Notifier class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include "convert.h"
+#include "depot.h"
+#include "io.h"
+#include "mailbox.h"
+#include "notifier.h"
+#include "pendingupdates.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  // Changes are reported once the mailboxes have been quiet for QUIET
+  // milliseconds, but no later than MAX_DELAY milliseconds after the
+  // first change.
+  const long QUIET = 250;
+  const long MAX_DELAY = 2000;
+
+  // Maildir::scan() leaves messages in new/ that are less than a
+  // second old, so the selected mailbox is looked at once more this
+  // long after a change has been reported.
+  const long SETTLE = 1100;
+
+  //----------------------------------------------------------------------
+  long now(void)
+  {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  }
+
+  //----------------------------------------------------------------------
+  bool getCurrentStatus(Depot &depot, const string &mailbox, Status &status)
+  {
+    // Depot::getStatus() keeps statuses until the directories get a
+    // new ctime, which can miss a change made in the same second.
+    Mailbox *m = depot.get(mailbox);
+    return m != 0 && m->getStatus(depot.mailboxToFilename(mailbox), status);
+  }
+}
+
+//------------------------------------------------------------------------
+Notifier::Group::Group(void) : filter(SELECTED), events(0)
+{
+}
+
+//------------------------------------------------------------------------
+Notifier::Settings::Settings(void) : status(false)
+{
+}
+
+//------------------------------------------------------------------------
+Notifier::Watched::Watched(void) : events(0), changed(false)
+{
+}
+
+//------------------------------------------------------------------------
+Notifier::Notifier(void)
+  : fd(-1), rootwd(-1), active(false), pending(false),
+    selectedChanged(false), rootChanged(false)
+{
+}
+
+//------------------------------------------------------------------------
+Notifier::~Notifier(void)
+{
+  clear();
+}
+
+//------------------------------------------------------------------------
+Notifier &Notifier::getInstance(void)
+{
+  static Notifier notifier;
+  return notifier;
+}
+
+//------------------------------------------------------------------------
+bool Notifier::isActive(void) const
+{
+  return active;
+}
+
+//------------------------------------------------------------------------
+const string &Notifier::getLastError(void) const
+{
+  return lastError;
+}
+
+//------------------------------------------------------------------------
+void Notifier::clear(void)
+{
+  if (fd != -1)
+    close(fd);
+
+  fd = -1;
+  rootwd = -1;
+  active = false;
+  pending = false;
+  selectedChanged = false;
+  rootChanged = false;
+  selected = "";
+
+  groups.clear();
+  mailboxes.clear();
+  existing.clear();
+  watches.clear();
+  subscribed.clear();
+}
+
+//------------------------------------------------------------------------
+bool Notifier::set(Depot &depot, const Settings &settings)
+{
+  clear();
+
+#ifdef HAVE_INOTIFY
+  Session &session = Session::getInstance();
+  const char delim = depot.getDelimiter();
+
+  groups = settings.groups;
+  for (vector<Group>::iterator i = groups.begin(); i != groups.end(); ++i)
+    for (vector<string>::iterator j = (*i).mailboxes.begin();
+	 j != (*i).mailboxes.end(); ++j) {
+      *j = toCanonMailbox(*j);
+      trim(*j, string(&delim, 1));
+    }
+
+  if ((fd = inotify_init()) == -1) {
+    lastError = "unable to watch mailboxes: ";
+    lastError += strerror(errno);
+    return false;
+  }
+
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  // Mailboxes are created, deleted and renamed in the depot, which is
+  // the current directory.
+  rootwd = inotify_add_watch(fd, ".", IN_CREATE | IN_DELETE | IN_MOVED_FROM
+			     | IN_MOVED_TO | IN_ONLYDIR);
+
+  subscribed = session.subscribed;
+  active = true;
+  if (!resolve(depot, false)) {
+    clear();
+    return false;
+  }
+
+  if (settings.status) {
+    IO &com = IOFactory::getInstance().get(1);
+    Mailbox *m = session.getState() == Session::SELECTED
+      ? depot.getSelected() : 0;
+
+    for (map<string, Watched>::const_iterator i = mailboxes.begin();
+	 i != mailboxes.end(); ++i)
+      if (m == 0 || i->first != m->getName())
+	sendStatus(i->first, i->second.status);
+
+    com.flushContent();
+  }
+
+  return true;
+#else
+  lastError = "NOTIFY is not supported on this system";
+  return false;
+#endif
+}
+
+//------------------------------------------------------------------------
+int Notifier::getEvents(const string &mailbox, bool isSelected) const
+{
+  Session &session = Session::getInstance();
+  Depot *depot = session.getDepot();
+  const char delim = depot->getDelimiter();
+
+  // The first group whose filter matches decides. The selected
+  // mailbox is only covered by the selected filters.
+  for (vector<Group>::const_iterator i = groups.begin();
+       i != groups.end(); ++i) {
+    const Group &group = *i;
+    bool match = false;
+
+    switch (group.filter) {
+    case SELECTED:
+    case SELECTED_DELAYED:
+      match = isSelected;
+      break;
+    case INBOXES:
+      match = !isSelected && mailbox == "INBOX";
+      break;
+    case PERSONAL:
+      match = !isSelected;
+      break;
+    case SUBSCRIBED:
+      for (vector<string>::const_iterator j = subscribed.begin();
+	   !isSelected && j != subscribed.end(); ++j) {
+	string tmp = toCanonMailbox(*j);
+	trim(tmp, string(&delim, 1));
+	if (tmp == mailbox)
+	  match = true;
+      }
+      break;
+    case SUBTREE:
+      for (vector<string>::const_iterator j = group.mailboxes.begin();
+	   !isSelected && j != group.mailboxes.end(); ++j)
+	if (mailbox == *j
+	    || (mailbox.length() > (*j).length()
+		&& mailbox.compare(0, (*j).length(), *j) == 0
+		&& mailbox[(*j).length()] == delim))
+	  match = true;
+      break;
+    case MAILBOXES:
+      for (vector<string>::const_iterator j = group.mailboxes.begin();
+	   !isSelected && j != group.mailboxes.end(); ++j)
+	if (mailbox == *j)
+	  match = true;
+      break;
+    }
+
+    if (match)
+      return group.events;
+  }
+
+  return 0;
+}
+
+//------------------------------------------------------------------------
+bool Notifier::resolve(Depot &depot, bool announce)
+{
+  IO &com = IOFactory::getInstance().get(1);
+  const char delim = depot.getDelimiter();
+
+  // Find all mailboxes, the same way as LIST does.
+  std::set<string> found;
+  for (Depot::iterator i = depot.begin("."); i != depot.end(); ++i) {
+    const string mpath = depot.filenameToMailbox(*i);
+    if (depot.get(mpath) == 0)
+      continue;
+
+    string tmp = toCanonMailbox(mpath);
+    trim(tmp, string(&delim, 1));
+    if (tmp != "")
+      found.insert(tmp);
+  }
+
+  if (announce) {
+    for (std::set<string>::const_iterator i = found.begin();
+	 i != found.end(); ++i)
+      if (existing.find(*i) == existing.end()
+	  && (getEvents(*i, false) & MAILBOX_NAME))
+	com << "* LIST () \"" << delim << "\" " << toImapString(*i) << endl;
+
+    for (std::set<string>::const_iterator i = existing.begin();
+	 i != existing.end(); ++i)
+      if (found.find(*i) == found.end()
+	  && (getEvents(*i, false) & MAILBOX_NAME))
+	com << "* LIST (\\NonExistent) \"" << delim << "\" "
+	    << toImapString(*i) << endl;
+  }
+
+  existing = found;
+
+  // Stop watching mailboxes that are gone or no longer wanted.
+  map<string, Watched>::iterator j = mailboxes.begin();
+  while (j != mailboxes.end()) {
+    const int events = getEvents(j->first, false);
+    if (existing.find(j->first) != existing.end()
+	&& (events & (MESSAGE_NEW | MESSAGE_EXPUNGE | FLAG_CHANGE))) {
+      j->second.events = events;
+      ++j;
+      continue;
+    }
+
+    if (j->first != selected)
+      unwatch(j->first);
+
+    mailboxes.erase(j++);
+  }
+
+  // Start watching new ones.
+  for (std::set<string>::const_iterator i = existing.begin();
+       i != existing.end(); ++i) {
+    const int events = getEvents(*i, false);
+    if (!(events & (MESSAGE_NEW | MESSAGE_EXPUNGE | FLAG_CHANGE))
+	|| mailboxes.find(*i) != mailboxes.end())
+      continue;
+
+    if (!watch(depot, *i))
+      return false;
+
+    Watched &w = mailboxes[*i];
+    w.events = events;
+    getCurrentStatus(depot, *i, w.status);
+  }
+
+  return true;
+}
+
+//------------------------------------------------------------------------
+bool Notifier::watch(Depot &depot, const string &mailbox)
+{
+#ifdef HAVE_INOTIFY
+  Mailbox *m = depot.get(mailbox);
+  vector<string> paths;
+  if (m == 0 || !m->getWatchPaths(depot.mailboxToFilename(mailbox), paths))
+    return true;
+
+  for (vector<string>::const_iterator i = paths.begin();
+       i != paths.end(); ++i) {
+    int wd = inotify_add_watch(fd, (*i).c_str(), IN_CREATE | IN_DELETE
+			       | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd == -1) {
+      if (errno == ENOENT)
+	continue;
+
+      lastError = "unable to watch " + toImapString(mailbox) + ": ";
+      lastError += strerror(errno);
+      return false;
+    }
+
+    watches[wd] = mailbox;
+  }
+#endif
+
+  return true;
+}
+
+//------------------------------------------------------------------------
+void Notifier::unwatch(const string &mailbox)
+{
+#ifdef HAVE_INOTIFY
+  map<int, string>::iterator i = watches.begin();
+  while (i != watches.end())
+    if (i->second == mailbox) {
+      inotify_rm_watch(fd, i->first);
+      watches.erase(i++);
+    } else
+      ++i;
+#endif
+}
+
+//------------------------------------------------------------------------
+bool Notifier::readEvents(void)
+{
+  bool changed = false;
+
+#ifdef HAVE_INOTIFY
+  union {
+    struct inotify_event event;
+    char data[4096];
+  } buf;
+
+  int n;
+  while ((n = read(fd, buf.data, sizeof(buf.data))) > 0) {
+    int pos = 0;
+    while (pos + (int) sizeof(struct inotify_event) <= n) {
+      const struct inotify_event *event
+	= (const struct inotify_event *) (buf.data + pos);
+      pos += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+	// Events were lost, so anything may have changed.
+	for (map<string, Watched>::iterator i = mailboxes.begin();
+	     i != mailboxes.end(); ++i)
+	  i->second.changed = true;
+	selectedChanged = rootChanged = changed = true;
+	continue;
+      }
+
+      if (event->wd == rootwd) {
+	if (event->mask & IN_ISDIR)
+	  rootChanged = changed = true;
+	continue;
+      }
+
+      map<int, string>::iterator i = watches.find(event->wd);
+      if (i == watches.end())
+	continue;
+
+      const string mailbox = i->second;
+      if (event->mask & IN_IGNORED) {
+	// The directory is gone; the mailbox was probably deleted.
+	watches.erase(i);
+	rootChanged = true;
+      }
+
+      map<string, Watched>::iterator j = mailboxes.find(mailbox);
+      if (j != mailboxes.end())
+	j->second.changed = true;
+
+      if (mailbox == selected)
+	selectedChanged = true;
+
+      changed = true;
+    }
+  }
+#endif
+
+  return changed;
+}
+
+//------------------------------------------------------------------------
+void Notifier::report(Depot &depot, bool forceScan)
+{
+  Session &session = Session::getInstance();
+  IO &com = IOFactory::getInstance().get(1);
+  IO &logger = IOFactory::getInstance().get(2);
+
+  if (rootChanged) {
+    rootChanged = false;
+    if (!resolve(depot, true))
+      logger << lastError << endl;
+  }
+
+  for (map<string, Watched>::iterator i = mailboxes.begin();
+       i != mailboxes.end(); ++i) {
+    Watched &w = i->second;
+    if (!w.changed)
+      continue;
+
+    w.changed = false;
+
+    Status status;
+    if (!getCurrentStatus(depot, i->first, status))
+      continue;
+
+    const Status &old = w.status;
+    bool changed = false;
+    if ((w.events & (MESSAGE_NEW | MESSAGE_EXPUNGE))
+	&& (status.getMessages() != old.getMessages()
+	    || status.getUidNext() != old.getUidNext()
+	    || status.getUidValidity() != old.getUidValidity()))
+      changed = true;
+
+    if ((w.events & FLAG_CHANGE) && status.getUnseen() != old.getUnseen())
+      changed = true;
+
+    // The selected mailbox gets pending updates instead.
+    if (changed && i->first != selected)
+      sendStatus(i->first, status);
+
+    w.status = status;
+  }
+
+  if (selectedChanged) {
+    selectedChanged = false;
+
+    const int events = getEvents(selected, true);
+    int type = PendingUpdates::EXISTS | PendingUpdates::RECENT;
+    if (events & FLAG_CHANGE)
+      type |= PendingUpdates::FLAGS;
+
+    // EXPUNGE responses are held back for selected-delayed, until a
+    // command that allows them.
+    bool delayed = false;
+    for (vector<Group>::const_iterator i = groups.begin();
+	 i != groups.end(); ++i)
+      if ((*i).filter == SELECTED || (*i).filter == SELECTED_DELAYED) {
+	delayed = (*i).filter == SELECTED_DELAYED;
+	break;
+      }
+
+    if ((events & MESSAGE_EXPUNGE) && !delayed)
+      type |= PendingUpdates::EXPUNGE;
+
+    if (events != 0
+	&& !pendingUpdates(depot.getSelected(), type, true, false, forceScan))
+      logger << "when scanning mailbox: " << session.getLastError() << endl;
+  }
+
+  com.flushContent();
+}
+
+//------------------------------------------------------------------------
+void Notifier::sendStatus(const string &mailbox, const Status &status) const
+{
+  IO &com = IOFactory::getInstance().get(1);
+
+  com << "* STATUS " << toImapString(mailbox)
+      << " (MESSAGES " << status.getMessages()
+      << " UIDNEXT " << status.getUidNext()
+      << " UIDVALIDITY " << status.getUidValidity()
+      << " UNSEEN " << status.getUnseen() << ")" << endl;
+}
+
+//------------------------------------------------------------------------
+int Notifier::wait(Depot &depot, int timeout)
+{
+  Session &session = Session::getInstance();
+  IO &com = IOFactory::getInstance().get(1);
+
+  // Follow the client to the mailbox it has selected.
+  Mailbox *m = session.getState() == Session::SELECTED
+    ? depot.getSelected() : 0;
+  const string name = m != 0 ? m->getName() : "";
+  if (name != selected) {
+    if (selected != "" && mailboxes.find(selected) == mailboxes.end())
+      unwatch(selected);
+
+    selected = name;
+    selectedChanged = false;
+    if (selected != "" && getEvents(selected, true) != 0
+	&& !watch(depot, selected)) {
+      IO &logger = IOFactory::getInstance().get(2);
+      logger << lastError << endl;
+    }
+  }
+
+  // The subscriptions decide what the subscribed filter covers.
+  if (session.subscribed != subscribed) {
+    subscribed = session.subscribed;
+    rootChanged = pending = true;
+  }
+
+  const long start = now();
+  long firstChange = start;
+  long lastChange = start;
+  long recheck = -1;
+
+  for (;;) {
+    long deadline = timeout > 0 ? start + (long) timeout * 1000 : -1;
+    long next = -1;
+    if (pending)
+      next = lastChange + QUIET < firstChange + MAX_DELAY
+	? lastChange + QUIET : firstChange + MAX_DELAY;
+    else if (recheck != -1)
+      next = recheck;
+
+    if (next != -1 && (deadline == -1 || next < deadline))
+      deadline = next;
+
+    long t = now();
+    int r = com.waitForInput(fd, deadline == -1 ? -1
+			     : (deadline > t ? (int) (deadline - t) : 0));
+    if (r == -1) {
+      lastError = com.getLastError();
+      return -1;
+    }
+
+    if (r == 1)
+      return 1;
+
+    t = now();
+    if (r == 2) {
+      if (readEvents()) {
+	if (!pending)
+	  firstChange = t;
+	lastChange = t;
+	pending = true;
+      }
+
+      continue;
+    }
+
+    if (pending && (t >= lastChange + QUIET || t >= firstChange + MAX_DELAY)) {
+      const bool selectedReported = selectedChanged
+	&& getEvents(selected, true) != 0;
+      report(depot, true);
+      pending = false;
+      recheck = selectedReported ? t + SETTLE : -1;
+    } else if (!pending && recheck != -1 && t >= recheck) {
+      selectedChanged = true;
+      report(depot, false);
+      recheck = -1;
+    }
+
+    if (timeout > 0 && t >= start + (long) timeout * 1000)
+      return 0;
+  }
+}
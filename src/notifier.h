@@ -0,0 +1,170 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    notifier.h
+ *
+ *  Description:
+ *    Declaration of the Binc::Notifier class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifndef notifier_h_included
+#define notifier_h_included
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "imapparser.h"
+#include "status.h"
+
+namespace Binc {
+
+  class Depot;
+
+  /*!
+    \class Notifier
+    \brief The Notifier class sends the notifications that a client
+    asks for with NOTIFY (RFC 5465).
+
+    The mailboxes that the client is interested in are watched with
+    inotify, so nothing is done for a mailbox until its directories
+    change. Changes are collected while a command runs and reported
+    while the server waits for the next one, as STATUS responses for
+    other mailboxes and as pending updates for the selected one.
+  */
+  class Notifier {
+  public:
+    enum {
+      MESSAGE_NEW = 0x01,
+      MESSAGE_EXPUNGE = 0x02,
+      FLAG_CHANGE = 0x04,
+      MAILBOX_NAME = 0x08
+    };
+
+    enum Filter {
+      SELECTED,
+      SELECTED_DELAYED,
+      INBOXES,
+      PERSONAL,
+      SUBSCRIBED,
+      SUBTREE,
+      MAILBOXES
+    };
+
+    //--
+    class Group {
+    public:
+      Filter filter;
+      std::vector<std::string> mailboxes;
+      int events;
+
+      Group(void);
+    };
+
+    //--
+    class Settings : public BincImapParserData {
+    public:
+      std::vector<Group> groups;
+      bool status;
+
+      // The first event that was asked for but is not supported.
+      std::string unsupported;
+
+      Settings(void);
+    };
+
+    /*!
+      Starts watching the mailboxes that the groups select, replacing
+      what was watched before. If status is true, the current status
+      of each of them is sent right away. Returns false if the
+      watches could not be set up.
+    */
+    bool set(Depot &depot, const Settings &settings);
+
+    /*!
+      Stops all notifications.
+    */
+    void clear(void);
+
+    bool isActive(void) const;
+
+    /*!
+      Waits for input from the client for at most timeout seconds (0
+      waits for ever), sending notifications meanwhile. Returns 1 when
+      the client has sent something, 0 on timeout and -1 on errors.
+    */
+    int wait(Depot &depot, int timeout);
+
+    const std::string &getLastError(void) const;
+
+    //--
+    static Notifier &getInstance(void);
+    ~Notifier(void);
+
+  private:
+    class Watched {
+    public:
+      int events;
+      Status status;
+      bool changed;
+
+      Watched(void);
+    };
+
+    std::vector<Group> groups;
+    std::vector<std::string> subscribed;
+    std::set<std::string> existing;
+    std::map<std::string, Watched> mailboxes;
+    std::map<int, std::string> watches;
+    int fd;
+    int rootwd;
+    bool active;
+    bool pending;
+
+    std::string selected;
+    bool selectedChanged;
+    bool rootChanged;
+
+    std::string lastError;
+
+    bool resolve(Depot &depot, bool announce);
+    bool watch(Depot &depot, const std::string &mailbox);
+    void unwatch(const std::string &mailbox);
+    bool readEvents(void);
+    void report(Depot &depot, bool forceScan);
+    void sendStatus(const std::string &mailbox, const Status &status) const;
+    int getEvents(const std::string &mailbox, bool selected) const;
+
+    //--
+    Notifier(void);
+  };
+}
+
+#endif
@@ -92,10 +92,66 @@ Operator::ProcessResult AppendOperator::process(Depot &depot,
     return NO;
   }
 
+  const string mbox = depot.mailboxToFilename(canonmailbox);
+
+  // With MULTIAPPEND (RFC 3502), more messages follow the first one,
+  // each with its own flags and date. They are all written to tmp/
+  // first, and then added in one go, or not at all.
+  vector<string> flags = command.flags;
+  string date = command.getDate();
+  for (;;) {
+    ProcessResult res = appendMessage(mailbox, mbox, flags, date);
+    if (res != OK) {
+      mailbox->rollBackNewMessages();
+      return res;
+    }
+
+    int c = com.readChar(session.timeout());
+    if (c == '\r' && com.readChar(session.timeout()) == '\n')
+      break;
+
+    if (c != ' ') {
+      mailbox->rollBackNewMessages();
+      session.setLastError("expected SPACE or CRLF after literal");
+      return BAD;
+    }
+
+    flags.clear();
+    date = "";
+    if (expectFlagsAndDate(flags, date) != ACCEPT) {
+      mailbox->rollBackNewMessages();
+      return BAD;
+    }
+  }
+
+  if (!mailbox->commitNewMessages(mbox)) {
+    session.setLastError("failed to commit after successful APPEND: "
+			 + mailbox->getLastError());
+    return NO;
+  }
+
+  if (mailbox == depot.getSelected()) {
+    pendingUpdates(mailbox, PendingUpdates::EXISTS
+		   | PendingUpdates::RECENT 
+		   | PendingUpdates::FLAGS, true, false, true);
+  }
+
+  return OK;
+}
+
+//----------------------------------------------------------------------
+Operator::ProcessResult
+AppendOperator::appendMessage(Mailbox *mailbox, const string &mbox,
+			      const vector<string> &flags,
+			      const string &date) const
+{
+  IO &com = IOFactory::getInstance().get(1);
+  Session &session = Session::getInstance();
+
   // mask all passed flags together
   unsigned int newflags = (unsigned int) Message::F_NONE;
-  vector<string>::const_iterator f_i = command.flags.begin();
-  while (f_i != command.flags.end()) {
+  vector<string>::const_iterator f_i = flags.begin();
+  while (f_i != flags.end()) {
     if (*f_i == "\\Deleted") newflags |= Message::F_DELETED;
     if (*f_i == "\\Answered") newflags |= Message::F_ANSWERED;
     if (*f_i == "\\Seen") newflags |= Message::F_SEEN;
@@ -108,8 +164,8 @@ Operator::ProcessResult AppendOperator::process(Depot &depot,
   char month[4];
 
   struct tm mytm;
-  if (command.getDate() != "") {  
-    sscanf(command.getDate().c_str(), "%2i-%3s-%4i %2i:%2i:%2i",
+  if (date != "") {  
+    sscanf(date.c_str(), "%2i-%3s-%4i %2i:%2i:%2i",
 	   &mday, month, &year, &hour, &minute, &second);
 
     month[3] = '\0';
@@ -170,10 +226,9 @@ Operator::ProcessResult AppendOperator::process(Depot &depot,
     return BAD;
   }
 
-  time_t newtime = (command.getDate() != "") ? mktime(&mytm) : time(0);
+  time_t newtime = (date != "") ? mktime(&mytm) : time(0);
   if (newtime == -1) newtime = time(0);
-  Message *dest = mailbox->createMessage(depot.mailboxToFilename(canonmailbox),
-					 newtime);
+  Message *dest = mailbox->createMessage(mbox, newtime);
   if (!dest) {
     session.setLastError(mailbox->getLastError());
     return NO;
@@ -183,29 +238,21 @@ Operator::ProcessResult AppendOperator::process(Depot &depot,
   com.flushContent();
   com.disableInputLimit();
 
+  // The literal is passed on as it arrives, in pieces of whatever
+  // size the client's input comes in. The message buffers the
+  // writes itself.
+  char buffer[65536];
   while (nchars > 0) {
-    // Read in chunks of 8192, followed by an optional chunk at the
-    // end which is < 8192 bytes.
-    string s;
-    int bytesToRead = nchars > 8192 ? 8192 : nchars;
-    int readBytes = com.readStr(s, bytesToRead);
+    int bytesToRead = nchars > (int) sizeof(buffer)
+      ? (int) sizeof(buffer) : nchars;
+    int readBytes = com.readBlock(buffer, bytesToRead);
     if (readBytes <= 0) {
-      mailbox->rollBackNewMessages();
       session.setLastError(com.getLastError());
       return NO;
     }
 
-    // Expect the exact number of bytes from readStr.
-    if (readBytes != bytesToRead) {
-      mailbox->rollBackNewMessages();
-      session.setLastError("expected " + toString(nchars)
-			   + " bytes, but got " + toString(readBytes));
-      return NO;
-    }
-
     // Write the chunk to the message.
-    if (!dest->appendChunk(s)) {
-      mailbox->rollBackNewMessages();
+    if (!dest->appendChunk(buffer, readBytes)) {
       session.setLastError(dest->getLastError());
       return NO;
     }
@@ -214,37 +261,52 @@ Operator::ProcessResult AppendOperator::process(Depot &depot,
     nchars -= readBytes;
   }
 
-  // Read the trailing CRLF after the message data.
-  if (com.readChar() != '\r') {
-    mailbox->rollBackNewMessages();
-    session.setLastError("expected CR");
-    return BAD;
-  }
-
-  if (com.readChar() != '\n') {
-    mailbox->rollBackNewMessages();
-    session.setLastError("expected LF");
-    return BAD;
+  if (!dest->close()) {
+    session.setLastError(dest->getLastError());
+    return NO;
   }
 
-  // Commit the message.
-  dest->close();
   dest->setStdFlag(newflags);
-  dest->setInternalDate(mktime(&mytm));
+  dest->setInternalDate(newtime);
+  return OK;
+}
 
-  if (!mailbox->commitNewMessages(depot.mailboxToFilename(canonmailbox))) {
-    session.setLastError("failed to commit after successful APPEND: "
-			 + mailbox->getLastError());
-    return NO;
-  }
+//----------------------------------------------------------------------
+Operator::ParseResult
+AppendOperator::expectFlagsAndDate(vector<string> &flags, string &date) const
+{
+  Session &session = Session::getInstance();
+  Operator::ParseResult res;
 
-  if (mailbox == depot.getSelected()) {
-    pendingUpdates(mailbox, PendingUpdates::EXISTS
-		   | PendingUpdates::RECENT 
-		   | PendingUpdates::FLAGS, true, false, true);
+  if ((res = expectThisString("(")) == ACCEPT) {
+    if ((res = expectFlag(flags)) == ACCEPT)
+      while (1) {
+	if ((res = expectSPACE()) != ACCEPT)
+	  break;
+	if ((res = expectFlag(flags)) != ACCEPT) {
+	  session.setLastError("expected a flag after the '('");
+	  return res;
+	}
+      }
+
+    if ((res = expectThisString(")")) != ACCEPT) {
+      session.setLastError("expected a ')'");
+      return res;
+    }
+
+    if ((res = expectSPACE()) != ACCEPT) {
+      session.setLastError("expected a SPACE after the flag list");
+      return res;
+    }
   }
 
-  return OK;
+  if ((res = expectDateTime(date)) == ACCEPT)
+    if ((res = expectSPACE()) != ACCEPT) {
+      session.setLastError("expected a SPACE after date_time");
+      return res;
+    }
+
+  return ACCEPT;
 }
 
 //----------------------------------------------------------------------
@@ -274,34 +336,9 @@ Operator::ParseResult AppendOperator::parse(Request &c_in) const
     return res;
   }
 
-  if ((res = expectThisString("(")) == ACCEPT) {
-    if ((res = expectFlag(c_in.getFlags())) == ACCEPT)
-      while (1) {
-	if ((res = expectSPACE()) != ACCEPT)
-	  break;
-	if ((res = expectFlag(c_in.getFlags())) != ACCEPT) {
-	  session.setLastError("expected a flag after the '('");
-	  return res;
-	}
-      }
-
-    if ((res = expectThisString(")")) != ACCEPT) {
-      session.setLastError("expected a ')'");
-      return res;
-    }
-
-    if ((res = expectSPACE()) != ACCEPT) {
-      session.setLastError("expected a SPACE after the flag list");
-      return res;
-    }
-  }
-
   string date;
-  if ((res = expectDateTime(date)) == ACCEPT)
-    if ((res = expectSPACE()) != ACCEPT) {
-      session.setLastError("expected a SPACE after date_time");
-      return res;
-    }
+  if ((res = expectFlagsAndDate(c_in.getFlags(), date)) != ACCEPT)
+    return res;
 
   c_in.setDate(date);
   c_in.setName("APPEND");
@@ -0,0 +1,136 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    operator-compress.cc
+ *  
+ *  Description:
+ *    Implementation of the COMPRESS command.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <iostream>
+
+#include "convert.h"
+#include "depot.h"
+#include "io.h"
+#include "operators.h"
+#include "recursivedescent.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+//----------------------------------------------------------------------
+CompressOperator::CompressOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+CompressOperator::~CompressOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+const string CompressOperator::getName(void) const
+{
+  return "COMPRESS";
+}
+
+//----------------------------------------------------------------------
+int CompressOperator::getState(void) const
+{
+  return Session::AUTHENTICATED | Session::SELECTED;
+}
+
+//------------------------------------------------------------------------
+Operator::ProcessResult CompressOperator::process(Depot &depot,
+						  Request &command)
+{
+  Session &session = Session::getInstance();
+  IO &com = IOFactory::getInstance().get(1);
+
+  if (com.isCompressed()) {
+    session.setResponseCode("COMPRESSIONACTIVE");
+    session.setLastError("DEFLATE is already active");
+    return NO;
+  }
+
+  string mechanism = command.getMode();
+  uppercase(mechanism);
+  if (mechanism != "DEFLATE") {
+    session.setLastError("Unsupported compression mechanism "
+			 + toImapString(command.getMode()));
+    return BAD;
+  }
+
+  // The tagged response is the last thing sent uncompressed.
+  com << command.getTag() << " OK DEFLATE active" << endl;
+  com.flushContent();
+
+  const string &level = session.globalconfig["Session"]["compression level"];
+  if (!com.enableCompression(level != "" ? atoi(level) : -1)) {
+    session.setLastError(com.getLastError());
+    return ABORT;
+  }
+
+  return NOTHING;
+}
+
+//----------------------------------------------------------------------
+Operator::ParseResult CompressOperator::parse(Request &c_in) const
+{
+  Session &session = Session::getInstance();
+
+  if (c_in.getUidMode())
+    return REJECT;
+
+  Operator::ParseResult res;
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE after COMPRESS");
+    return res;
+  }
+
+  string mechanism;
+  if ((res = expectAtom(mechanism)) != ACCEPT) {
+    session.setLastError("Expected mechanism after COMPRESS SPACE");
+    return ERROR;
+  }
+
+  if ((res = expectCRLF()) != ACCEPT) {
+    session.setLastError("Expected CRLF after COMPRESS SPACE mechanism");
+    return res;
+  }
+
+  c_in.setMode(mechanism);
+
+  c_in.setName("COMPRESS");
+  return ACCEPT;
+}
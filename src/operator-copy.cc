@@ -138,7 +138,12 @@ Operator::ProcessResult CopyOperator::process(Depot &depot,
       }
     } while (success);
 
-    dest->close();
+    if (!dest->close() && success) {
+      logger << "when writing to \""
+	     << dmailbox << "\": "
+	     << dest->getLastError() << endl;
+      success = false;
+    }
   }
 
   if (!success && !destMailbox->rollBackNewMessages()) {
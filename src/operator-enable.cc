@@ -0,0 +1,129 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    operator-enable.cc
+ *  
+ *  Description:
+ *    Implementation of the ENABLE command.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <iostream>
+
+#include "convert.h"
+#include "depot.h"
+#include "io.h"
+#include "operators.h"
+#include "recursivedescent.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+//----------------------------------------------------------------------
+EnableOperator::EnableOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+EnableOperator::~EnableOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+const string EnableOperator::getName(void) const
+{
+  return "ENABLE";
+}
+
+//----------------------------------------------------------------------
+int EnableOperator::getState(void) const
+{
+  return Session::AUTHENTICATED;
+}
+
+//------------------------------------------------------------------------
+Operator::ProcessResult EnableOperator::process(Depot &depot,
+						Request &command)
+{
+  Session &session = Session::getInstance();
+  IO &com = IOFactory::getInstance().get(1);
+
+  // Only the extensions that this command turns on are listed, and
+  // those that are not known are ignored.
+  string enabled;
+  for (vector<string>::const_iterator i = command.flags.begin();
+       i != command.flags.end(); ++i) {
+    string tmp = *i;
+    uppercase(tmp);
+
+    if (tmp == "CONDSTORE" && !session.condstore) {
+      session.condstore = true;
+      enabled += " CONDSTORE";
+    } else if (tmp == "QRESYNC" && !session.qresync) {
+      // QRESYNC implies CONDSTORE.
+      session.qresync = true;
+      session.condstore = true;
+      enabled += " QRESYNC";
+    }
+  }
+
+  com << "* ENABLED" << enabled << endl;
+  return OK;
+}
+
+//----------------------------------------------------------------------
+Operator::ParseResult EnableOperator::parse(Request &c_in) const
+{
+  Session &session = Session::getInstance();
+
+  if (c_in.getUidMode())
+    return REJECT;
+
+  Operator::ParseResult res;
+  do {
+    if ((res = expectSPACE()) != ACCEPT) {
+      session.setLastError("Expected SPACE after ENABLE");
+      return res;
+    }
+
+    string capability;
+    if ((res = expectAtom(capability)) != ACCEPT) {
+      session.setLastError("Expected capability");
+      return res;
+    }
+
+    c_in.flags.push_back(capability);
+  } while ((res = expectCRLF()) != ACCEPT);
+
+  c_in.setName("ENABLE");
+  return ACCEPT;
+}
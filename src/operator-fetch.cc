@@ -37,6 +37,9 @@
 
 #include <string>
 
+#include <string.h>
+#include <time.h>
+
 #include "depot.h"
 #include "io.h"
 #include "mailbox.h"
@@ -54,23 +57,50 @@ namespace {
   {
     IO &com = IOFactory::getInstance().get(1);
 
-    com << "FLAGS ";
-	  
-    com << "(";
-    int flags = message.getStdFlags();
-    vector<string> flagv;
-    if (flags & Message::F_SEEN) flagv.push_back("\\Seen");
-    if (flags & Message::F_ANSWERED) flagv.push_back("\\Answered");
-    if (flags & Message::F_DELETED) flagv.push_back("\\Deleted");
-    if (flags & Message::F_DRAFT) flagv.push_back("\\Draft");
-    if (flags & Message::F_RECENT) flagv.push_back("\\Recent");
-    if (flags & Message::F_FLAGGED) flagv.push_back("\\Flagged");
-    for (vector<string>::const_iterator k 
-	   = flagv.begin(); k != flagv.end(); ++k) {
-      if (k != flagv.begin()) com << " ";
-      com << *k;
+    com << "FLAGS " << Message::getStdFlagList(message.getStdFlags());
+  }
+
+  void outputInternalDate(time_t iDate)
+  {
+    IO &com = IOFactory::getInstance().get(1);
+
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    struct tm tmbuf;
+    struct tm *_tm = gmtime_r(&iDate, &tmbuf);
+    if (_tm == 0 || _tm->tm_year < -1900 || _tm->tm_year > 9999 - 1900) {
+      com << "\"NIL\"";
+      return;
     }
-    com << ")";
+
+    // Same as strftime("%d-%b-%Y %H:%M:%S GMT"), built in place.
+    char buf[32];
+    char *p = buf;
+    int year = _tm->tm_year + 1900;
+    *p++ = '"';
+    *p++ = '0' + _tm->tm_mday / 10;
+    *p++ = '0' + _tm->tm_mday % 10;
+    *p++ = '-';
+    memcpy(p, months + 3 * _tm->tm_mon, 3);
+    p += 3;
+    *p++ = '-';
+    *p++ = '0' + year / 1000;
+    *p++ = '0' + year / 100 % 10;
+    *p++ = '0' + year / 10 % 10;
+    *p++ = '0' + year % 10;
+    *p++ = ' ';
+    *p++ = '0' + _tm->tm_hour / 10;
+    *p++ = '0' + _tm->tm_hour % 10;
+    *p++ = ':';
+    *p++ = '0' + _tm->tm_min / 10;
+    *p++ = '0' + _tm->tm_min % 10;
+    *p++ = ':';
+    *p++ = '0' + _tm->tm_sec / 10;
+    *p++ = '0' + _tm->tm_sec % 10;
+    memcpy(p, " GMT\"", 5);
+    p += 5;
+
+    com.write(buf, p - buf);
   }
 
 }
@@ -131,6 +161,33 @@ Operator::ProcessResult FetchOperator::process(Depot &depot,
     }
   }
 
+  // CHANGEDSINCE implies MODSEQ, and either of them enables CONDSTORE.
+  bool modseqfetched = false;
+  for (f_i = request.fatt.begin(); f_i != request.fatt.end(); ++f_i)
+    if ((*f_i).type == "MODSEQ")
+      modseqfetched = true;
+
+  if (request.hasmodseq && !modseqfetched) {
+    req.fatt.push_back(BincImapParserFetchAtt("MODSEQ"));
+    modseqfetched = true;
+  }
+
+  if (modseqfetched)
+    session.condstore = true;
+
+  if (request.vanished) {
+    if (!request.getUidMode() || !request.hasmodseq || !session.qresync) {
+      session.setLastError("VANISHED requires UID FETCH, CHANGEDSINCE"
+			   " and QRESYNC");
+      return BAD;
+    }
+
+    SequenceSet vanished;
+    mailbox->getVanished(req.bset, vanished);
+    if (!vanished.isEmpty())
+      com << "* VANISHED (EARLIER) " << vanished.toString() << endl;
+  }
+
   // Convert macros ALL, FULL and FAST
   f_i = request.fatt.begin();
   while (f_i != request.fatt.end()) {
@@ -166,6 +223,8 @@ Operator::ProcessResult FetchOperator::process(Depot &depot,
 
   for (; i != mailbox->end(); ++i) {
     Message &message = *i;
+    if (req.hasmodseq && message.getModSeq() <= req.modseq)
+      continue;
     
     com << "* " << i.getSqnr() << " FETCH (";
     bool hasprinted = false;
@@ -187,6 +246,10 @@ Operator::ProcessResult FetchOperator::process(Depot &depot,
 	// UID
 	hasprinted = true;
 	com << prefix << "UID " << message.getUID();
+      } else if (fatt.type == "MODSEQ") {
+	// MODSEQ
+	hasprinted = true;
+	com << prefix << "MODSEQ (" << message.getModSeq() << ")";
       } else if (fatt.type == "RFC822.SIZE") {
 	// RFC822.SIZE
 	hasprinted = true;
@@ -212,17 +275,7 @@ Operator::ProcessResult FetchOperator::process(Depot &depot,
 	hasprinted = true;
 	com << prefix << "INTERNALDATE ";
 
-	time_t iDate = message.getInternalDate();
-	struct tm *_tm = gmtime(&iDate);
-	char internal[64];
-	string iDateStr;
-	if (strftime(internal, sizeof(internal),
-		     "%d-%b-%Y %H:%M:%S %Z", _tm) != 0)
-	  iDateStr = internal;
-	else
-	  iDateStr = "NIL";
-
-	com << toImapString(iDateStr);
+	outputInternalDate(message.getInternalDate());
       } else if (fatt.type == "BODY" || fatt.type == "BODY.PEEK") {
 	// BODY & BODY.PEEK
 	hasprinted = true;
@@ -395,7 +448,11 @@ Operator::ProcessResult FetchOperator::process(Depot &depot,
     if (message.hasFlagsChanged()) {
       updateFlags = true;
       com << "* " << i.getSqnr() << " FETCH (";
+      if (session.qresync)
+	com << "UID " << message.getUID() << " ";
       outputFlags(message);
+      if (session.condstore)
+	com << " MODSEQ (" << message.getModSeq() << ")";
       com << ")" << endl;
       message.setFlagsUnchanged();
     }
@@ -465,6 +522,32 @@ Operator::ParseResult FetchOperator::parse(Request &c_in) const
     return res;
   }
 
+  // RFC 7162 modifiers: (CHANGEDSINCE modseq [VANISHED])
+  if (expectSPACE() == ACCEPT) {
+    if ((res = expectThisString("(")) != ACCEPT
+	|| (res = expectThisString("CHANGEDSINCE")) != ACCEPT
+	|| (res = expectSPACE()) != ACCEPT
+	|| (res = expectNZNumber(c_in.modseq)) != ACCEPT) {
+      session.setLastError("Expected (CHANGEDSINCE mod-sequence)");
+      return res;
+    }
+
+    c_in.hasmodseq = true;
+    if (expectSPACE() == ACCEPT) {
+      if ((res = expectThisString("VANISHED")) != ACCEPT) {
+	session.setLastError("Expected VANISHED");
+	return res;
+      }
+
+      c_in.vanished = true;
+    }
+
+    if ((res = expectThisString(")")) != ACCEPT) {
+      session.setLastError("Expected )");
+      return res;
+    }
+  }
+
   if ((res = expectCRLF()) != ACCEPT) {
     session.setLastError("Expected CRLF");
     return res;
@@ -649,6 +732,7 @@ FetchOperator::expectFetchAtt(BincImapParserFetchAtt &f_in) const
   else if ((res = expectThisString("INTERNALDATE")) == ACCEPT)
     f_in.type = "INTERNALDATE";
   else if ((res = expectThisString("UID")) == ACCEPT) f_in.type = "UID";
+  else if ((res = expectThisString("MODSEQ")) == ACCEPT) f_in.type = "MODSEQ";
   else if ((res = expectThisString("RFC822")) == ACCEPT) {
     f_in.type = "RFC822";
     if ((res = expectThisString(".HEADER")) == ACCEPT) f_in.type += ".HEADER";
@@ -0,0 +1,353 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    operator-idle.cc
+ *
+ *  Description:
+ *    Implementation of the IDLE command.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include "convert.h"
+#include "depot.h"
+#include "io.h"
+#include "mailbox.h"
+#include "notifier.h"
+#include "operators.h"
+#include "pendingupdates.h"
+#include "recursivedescent.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  // A burst of deliveries is reported once the mailbox has been quiet
+  // for QUIET milliseconds, but no later than MAX_DELAY milliseconds
+  // after the first change.
+  const long QUIET = 250;
+  const long MAX_DELAY = 2000;
+
+  // Maildir::scan() leaves messages in new/ that are less than a
+  // second old, so the mailbox is looked at once more this long after
+  // a change has been reported.
+  const long SETTLE = 1100;
+
+  // Without inotify, the mailbox is checked this often instead.
+  const long POLL_INTERVAL = 30000;
+
+  //----------------------------------------------------------------------
+  long now(void)
+  {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  }
+
+  //----------------------------------------------------------------------
+  // Watches the directories of the selected mailbox for as long as
+  // IDLE runs.
+  class Watch {
+  public:
+    inline int getFd(void) const { return fd; }
+    void drain(void);
+
+    //--
+    Watch(Mailbox *mailbox, const string &path);
+    ~Watch(void);
+
+  private:
+    int fd;
+  };
+
+  //----------------------------------------------------------------------
+  Watch::Watch(Mailbox *mailbox, const string &path) : fd(-1)
+  {
+#ifdef HAVE_INOTIFY
+    vector<string> paths;
+    if (mailbox == 0 || !mailbox->getWatchPaths(path, paths))
+      return;
+
+    if ((fd = inotify_init()) == -1)
+      return;
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    for (vector<string>::const_iterator i = paths.begin();
+	 i != paths.end(); ++i)
+      if (inotify_add_watch(fd, (*i).c_str(),
+			    IN_CREATE | IN_DELETE | IN_MOVED_FROM
+			    | IN_MOVED_TO | IN_ONLYDIR) == -1) {
+	close(fd);
+	fd = -1;
+	return;
+      }
+#endif
+  }
+
+  //----------------------------------------------------------------------
+  Watch::~Watch(void)
+  {
+    if (fd != -1)
+      close(fd);
+  }
+
+  //----------------------------------------------------------------------
+  void Watch::drain(void)
+  {
+    // The events themselves are not looked at; the scan finds out
+    // what changed.
+    char buf[4096];
+    while (read(fd, buf, sizeof(buf)) > 0)
+      ;
+  }
+
+  //----------------------------------------------------------------------
+  bool reportUpdates(Mailbox *mailbox, bool forceScan)
+  {
+    Session &session = Session::getInstance();
+    IO &com = IOFactory::getInstance().get(1);
+    IO &logger = IOFactory::getInstance().get(2);
+
+    if (!pendingUpdates(mailbox,
+			PendingUpdates::EXPUNGE
+			| PendingUpdates::EXISTS
+			| PendingUpdates::RECENT
+			| PendingUpdates::FLAGS, true, false, forceScan)) {
+      com << "* BYE " << session.getLastError() << endl;
+      logger << "when scanning mailbox: "
+	     << session.getLastError() << endl;
+      return false;
+    }
+
+    com.flushContent();
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  // Waits until the client sends something, and reports changes to
+  // the selected mailbox meanwhile. Returns 1 when there is input, 0
+  // on timeout and -1 on errors. changed tells whether changes were
+  // seen that are not reported yet.
+  int waitForClient(Mailbox *mailbox, Watch &watch, bool &changed)
+  {
+    Session &session = Session::getInstance();
+    IO &com = IOFactory::getInstance().get(1);
+
+    const long start = now();
+    const long timeout = (long) session.idletimeout * 1000;
+    long lastCheck = start;
+    long recheck = -1;
+    long firstChange = 0;
+    long lastChange = 0;
+    changed = false;
+
+    for (;;) {
+      long deadline = timeout > 0 ? start + timeout : -1;
+      long next = -1;
+      if (changed)
+	next = lastChange + QUIET < firstChange + MAX_DELAY
+	  ? lastChange + QUIET : firstChange + MAX_DELAY;
+      else if (recheck != -1)
+	next = recheck;
+      else if (mailbox != 0 && watch.getFd() == -1)
+	next = lastCheck + POLL_INTERVAL;
+
+      if (next != -1 && (deadline == -1 || next < deadline))
+	deadline = next;
+
+      long t = now();
+      int r = com.waitForInput(watch.getFd(),
+			       deadline == -1 ? -1
+			       : (deadline > t ? (int) (deadline - t) : 0));
+      if (r == -1) {
+	session.setLastError(com.getLastError());
+	return -1;
+      }
+
+      if (r == 1)
+	return 1;
+
+      t = now();
+      if (r == 2) {
+	watch.drain();
+	if (!changed)
+	  firstChange = t;
+	lastChange = t;
+	changed = true;
+	continue;
+      }
+
+      if (changed
+	  && (t >= lastChange + QUIET || t >= firstChange + MAX_DELAY)) {
+	if (!reportUpdates(mailbox, true))
+	  return -1;
+	changed = false;
+	recheck = t + SETTLE;
+	lastCheck = t;
+      } else if (!changed && recheck != -1 && t >= recheck) {
+	if (!reportUpdates(mailbox, false))
+	  return -1;
+	recheck = -1;
+	lastCheck = t;
+      } else if (mailbox != 0 && watch.getFd() == -1
+		 && t >= lastCheck + POLL_INTERVAL) {
+	if (!reportUpdates(mailbox, false))
+	  return -1;
+	lastCheck = t;
+      }
+
+      if (timeout > 0 && t >= start + timeout)
+	return 0;
+    }
+  }
+}
+
+//----------------------------------------------------------------------
+IdleOperator::IdleOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+IdleOperator::~IdleOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+const string IdleOperator::getName(void) const
+{
+  return "IDLE";
+}
+
+//----------------------------------------------------------------------
+int IdleOperator::getState(void) const
+{
+  return Session::AUTHENTICATED | Session::SELECTED;
+}
+
+//------------------------------------------------------------------------
+Operator::ProcessResult IdleOperator::process(Depot &depot,
+					      Request &command)
+{
+  Session &session = Session::getInstance();
+  IO &com = IOFactory::getInstance().get(1);
+
+  // With NOTIFY, the client has said which changes it wants to hear
+  // about, and those are reported as they are between commands.
+  Notifier &notifier = Notifier::getInstance();
+  Mailbox *mailbox = !notifier.isActive()
+    && session.getState() == Session::SELECTED ? depot.getSelected() : 0;
+
+  // The watch is in place before the mailbox is looked at, so that
+  // nothing that changes after that is missed. Changes are picked up
+  // from the watch, or by polling if there is none.
+  Watch watch(mailbox, mailbox != 0
+	      ? depot.mailboxToFilename(mailbox->getName()) : "");
+  if (mailbox != 0 && !reportUpdates(mailbox, false))
+    return ABORT;
+
+  com << "+ idling" << endl;
+  com.flushContent();
+
+  bool changed = false;
+  int r = notifier.isActive() ? notifier.wait(depot, session.idletimeout)
+    : waitForClient(mailbox, watch, changed);
+  if (r == -1)
+    return ABORT;
+
+  if (r == 0) {
+    com << "* BYE Timeout after " << session.idletimeout
+	<< " seconds of inactivity." << endl;
+    return ABORT;
+  }
+
+  // IDLE ends with a line that says DONE.
+  string line;
+  for (;;) {
+    int c = com.readChar(session.timeout());
+    if (c == -1)
+      return ABORT;
+
+    if (c == -2) {
+      com << "* BYE Timeout after " << session.idletimeout
+	  << " seconds of inactivity." << endl;
+      return ABORT;
+    }
+
+    if (c == '\n')
+      break;
+
+    line += (char) c;
+  }
+
+  trim(line, "\r");
+  uppercase(line);
+  if (line != "DONE") {
+    session.setLastError("Expected DONE");
+    return BAD;
+  }
+
+  if (changed && !reportUpdates(mailbox, true))
+    return ABORT;
+
+  return OK;
+}
+
+//----------------------------------------------------------------------
+Operator::ParseResult IdleOperator::parse(Request &c_in) const
+{
+  Session &session = Session::getInstance();
+
+  if (c_in.getUidMode())
+    return REJECT;
+
+  Operator::ParseResult res;
+  if ((res = expectCRLF()) != ACCEPT) {
+    session.setLastError("Expected CRLF after IDLE");
+    return res;
+  }
+
+  c_in.setName("IDLE");
+  return ACCEPT;
+}
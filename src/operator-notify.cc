@@ -0,0 +1,345 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    operator-notify.cc
+ *
+ *  Description:
+ *    Implementation of the NOTIFY command.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "convert.h"
+#include "depot.h"
+#include "io.h"
+#include "notifier.h"
+#include "operators.h"
+#include "recursivedescent.h"
+#include "session.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  const char *SUPPORTED_EVENTS
+    = "MessageNew MessageExpunge FlagChange MailboxName";
+
+  //----------------------------------------------------------------------
+  Operator::ParseResult expectMailboxes(vector<string> &mailboxes)
+  {
+    Session &session = Session::getInstance();
+
+    Operator::ParseResult res;
+    if ((res = expectThisString("(")) != Operator::ACCEPT) {
+      string mailbox;
+      if ((res = expectMailbox(mailbox)) != Operator::ACCEPT) {
+	session.setLastError("Expected mailbox");
+	return res;
+      }
+
+      mailboxes.push_back(mailbox);
+      return Operator::ACCEPT;
+    }
+
+    for (;;) {
+      string mailbox;
+      if ((res = expectMailbox(mailbox)) != Operator::ACCEPT) {
+	session.setLastError("Expected mailbox");
+	return res;
+      }
+
+      mailboxes.push_back(mailbox);
+      if (expectSPACE() != Operator::ACCEPT)
+	break;
+    }
+
+    if ((res = expectThisString(")")) != Operator::ACCEPT) {
+      session.setLastError("Expected )");
+      return res;
+    }
+
+    return Operator::ACCEPT;
+  }
+
+  //----------------------------------------------------------------------
+  Operator::ParseResult expectEventGroup(Notifier::Group &group,
+					 string &unsupported)
+  {
+    Session &session = Session::getInstance();
+
+    Operator::ParseResult res;
+    if ((res = expectThisString("(")) != Operator::ACCEPT) {
+      session.setLastError("Expected (");
+      return res;
+    }
+
+    string filter;
+    if ((res = expectAtom(filter)) != Operator::ACCEPT) {
+      session.setLastError("Expected filter");
+      return res;
+    }
+
+    uppercase(filter);
+    if (filter == "SELECTED")
+      group.filter = Notifier::SELECTED;
+    else if (filter == "SELECTED-DELAYED")
+      group.filter = Notifier::SELECTED_DELAYED;
+    else if (filter == "INBOXES")
+      group.filter = Notifier::INBOXES;
+    else if (filter == "PERSONAL")
+      group.filter = Notifier::PERSONAL;
+    else if (filter == "SUBSCRIBED")
+      group.filter = Notifier::SUBSCRIBED;
+    else if (filter == "SUBTREE" || filter == "MAILBOXES") {
+      group.filter = filter == "SUBTREE"
+	? Notifier::SUBTREE : Notifier::MAILBOXES;
+
+      if ((res = expectSPACE()) != Operator::ACCEPT) {
+	session.setLastError("Expected SPACE after " + filter);
+	return res;
+      }
+
+      if ((res = expectMailboxes(group.mailboxes)) != Operator::ACCEPT)
+	return res;
+    } else {
+      session.setLastError("Unknown filter " + toImapString(filter));
+      return Operator::ERROR;
+    }
+
+    if ((res = expectSPACE()) != Operator::ACCEPT) {
+      session.setLastError("Expected SPACE after filter");
+      return res;
+    }
+
+    if ((res = expectThisString("NONE")) == Operator::ACCEPT) {
+      if ((res = expectThisString(")")) != Operator::ACCEPT) {
+	session.setLastError("Expected )");
+	return res;
+      }
+
+      return Operator::ACCEPT;
+    }
+
+    if ((res = expectThisString("(")) != Operator::ACCEPT) {
+      session.setLastError("Expected ( or NONE");
+      return res;
+    }
+
+    for (;;) {
+      string event;
+      if ((res = expectAtom(event)) != Operator::ACCEPT) {
+	session.setLastError("Expected event");
+	return res;
+      }
+
+      string tmp = event;
+      uppercase(tmp);
+      if (tmp == "MESSAGENEW")
+	group.events |= Notifier::MESSAGE_NEW;
+      else if (tmp == "MESSAGEEXPUNGE")
+	group.events |= Notifier::MESSAGE_EXPUNGE;
+      else if (tmp == "FLAGCHANGE")
+	group.events |= Notifier::FLAG_CHANGE;
+      else if (tmp == "MAILBOXNAME")
+	group.events |= Notifier::MAILBOX_NAME;
+      else if (unsupported == "")
+	unsupported = event;
+
+      if (expectSPACE() != Operator::ACCEPT)
+	break;
+
+      // The fetch attributes that MessageNew can carry are not sent.
+      if (tmp == "MESSAGENEW" && expectThisString("(") == Operator::ACCEPT) {
+	session.setLastError("Fetch attributes after MessageNew are not"
+			     " supported");
+	return Operator::ERROR;
+      }
+    }
+
+    if ((res = expectThisString(")")) != Operator::ACCEPT) {
+      session.setLastError("Expected )");
+      return res;
+    }
+
+    if ((res = expectThisString(")")) != Operator::ACCEPT) {
+      session.setLastError("Expected )");
+      return res;
+    }
+
+    return Operator::ACCEPT;
+  }
+}
+
+//----------------------------------------------------------------------
+NotifyOperator::NotifyOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+NotifyOperator::~NotifyOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+const string NotifyOperator::getName(void) const
+{
+  return "NOTIFY";
+}
+
+//----------------------------------------------------------------------
+int NotifyOperator::getState(void) const
+{
+  return Session::AUTHENTICATED | Session::SELECTED;
+}
+
+//------------------------------------------------------------------------
+Operator::ProcessResult NotifyOperator::process(Depot &depot,
+						Request &command)
+{
+  Session &session = Session::getInstance();
+  Notifier &notifier = Notifier::getInstance();
+
+  if (command.getMode() == "NONE") {
+    notifier.clear();
+    return OK;
+  }
+
+  const Notifier::Settings *settings
+    = dynamic_cast<const Notifier::Settings *>(command.extra);
+  if (settings == 0) {
+    session.setLastError("Expected event groups");
+    return BAD;
+  }
+
+  // Events that are not supported are refused as a whole, with the
+  // list of those that are.
+  if (settings->unsupported != "") {
+    session.setResponseCode("BADEVENT (" + string(SUPPORTED_EVENTS) + ")");
+    session.setLastError(settings->unsupported + " is not supported");
+    return NO;
+  }
+
+  for (vector<Notifier::Group>::const_iterator i = settings->groups.begin();
+       i != settings->groups.end(); ++i) {
+    // Clients can only ask for messages to come and go together, and
+    // for flag changes with both.
+    const int events = (*i).events;
+    if (((events & Notifier::MESSAGE_NEW) != 0)
+	!= ((events & Notifier::MESSAGE_EXPUNGE) != 0)) {
+      session.setLastError("MessageNew and MessageExpunge must be"
+			   " requested together");
+      return BAD;
+    }
+
+    if ((events & Notifier::FLAG_CHANGE)
+	&& !(events & Notifier::MESSAGE_NEW)) {
+      session.setLastError("FlagChange requires MessageNew and"
+			   " MessageExpunge");
+      return BAD;
+    }
+  }
+
+  if (!notifier.set(depot, *settings)) {
+    session.setLastError(notifier.getLastError());
+    return NO;
+  }
+
+  return OK;
+}
+
+//----------------------------------------------------------------------
+Operator::ParseResult NotifyOperator::parse(Request &c_in) const
+{
+  Session &session = Session::getInstance();
+
+  if (c_in.getUidMode())
+    return REJECT;
+
+  Operator::ParseResult res;
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE after NOTIFY");
+    return res;
+  }
+
+  if ((res = expectThisString("NONE")) == ACCEPT) {
+    if ((res = expectCRLF()) != ACCEPT) {
+      session.setLastError("Expected CRLF after NOTIFY NONE");
+      return res;
+    }
+
+    c_in.setMode("NONE");
+    c_in.setName("NOTIFY");
+    return ACCEPT;
+  }
+
+  if ((res = expectThisString("SET")) != ACCEPT) {
+    session.setLastError("Expected SET or NONE after NOTIFY");
+    return ERROR;
+  }
+
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE after NOTIFY SET");
+    return res;
+  }
+
+  Notifier::Settings *settings = new Notifier::Settings();
+  c_in.extra = settings;
+
+  if ((res = expectThisString("STATUS")) == ACCEPT) {
+    settings->status = true;
+    if ((res = expectSPACE()) != ACCEPT) {
+      session.setLastError("Expected SPACE after STATUS");
+      return res;
+    }
+  }
+
+  for (;;) {
+    Notifier::Group group;
+    if ((res = expectEventGroup(group, settings->unsupported)) != ACCEPT)
+      return res;
+
+    settings->groups.push_back(group);
+    if (expectSPACE() != ACCEPT)
+      break;
+  }
+
+  if ((res = expectCRLF()) != ACCEPT) {
+    session.setLastError("Expected CRLF after NOTIFY SET");
+    return res;
+  }
+
+  c_in.setMode("SET");
+  c_in.setName("NOTIFY");
+  return ACCEPT;
+}
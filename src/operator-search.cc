@@ -40,7 +40,19 @@
 #include <algorithm>
 
 #include <ctype.h>
+#include <float.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef WITH_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#endif
     
+#include "headersummary.h"
 #include "imapparser.h"
 #include "mailbox.h"
 #include "mime.h"
@@ -56,6 +68,520 @@
 using namespace ::std;
 using namespace Binc;
 
+namespace {
+  // The planner's estimate of what it costs to test one message.
+  // Flags, UIDs, sizes and internal dates are in the message table,
+  // header columns and text index lookups are binary searches, and
+  // the rest needs the message file.
+  const double MEMORY_COST = 1;
+  const double COLUMN_COST = 2;
+  const double HEADER_COST = 50;
+  const double BODY_COST = 1000;
+
+  // Guesses for the fraction of messages that match a test when the
+  // mailbox cannot tell.
+  const double TEXT_SELECTIVITY = 0.1;
+  const double DAY_SELECTIVITY = 0.05;
+  const double RANGE_SELECTIVITY = 0.5;
+
+  // Results of SearchNode::match(), and of the BODY and TEXT tests
+  // it is given.
+  enum { M_NO = 0, M_YES = 1, M_LATER = 2, M_NEEDED = 3 };
+
+  // The number of searches that the search cache holds at most.
+  const unsigned int SEARCH_CACHE_SIZE = 16;
+
+#ifdef WITH_PTHREAD
+  // Messages whose BODY and TEXT tests run on several threads at
+  // once are collected in batches of this size.
+  const unsigned int SCAN_BATCH = 256;
+
+  //----------------------------------------------------------------------
+  class ScanTest {
+  public:
+    string text;
+    bool onlyBody;
+    bool onlyTextParts;
+
+    ScanTest(const string &t, bool b, bool p)
+      : text(t), onlyBody(b), onlyTextParts(p) {}
+  };
+
+  //----------------------------------------------------------------------
+  // A message that matches, or that may match once the tests it was
+  // given to the pool for have run.
+  class ScanHit {
+  public:
+    unsigned int sqnr;
+    unsigned int uid;
+    int test;
+
+    ScanHit(unsigned int s, unsigned int u, int t)
+      : sqnr(s), uid(u), test(t) {}
+  };
+
+  //----------------------------------------------------------------------
+  // Runs the BODY and TEXT tests that a batch of messages needs on a
+  // number of threads. Each message is searched by one thread, from
+  // its own file descriptor, with that thread's CRLF reader. The
+  // threads are started for the first batch and wait for the next
+  // one until the pool is destroyed. Once the threads together have
+  // used the command's CPU budget, only the calling thread goes on.
+  class ScanPool {
+  public:
+    void add(Message *message, unsigned int sqnr, int fd,
+	     const vector<char> &needed);
+    void run(void);
+    void clear(void);
+
+    unsigned int size(void) const { return messages.size(); }
+    Message *getMessage(unsigned int i) const { return messages[i]; }
+    unsigned int getSqnr(unsigned int i) const { return sqnrs[i]; }
+    char *getResults(unsigned int i) { return &results[i * tests.size()]; }
+
+    ScanPool(const vector<ScanTest> &tests, unsigned int threads,
+	     double budget);
+    ~ScanPool(void);
+
+  private:
+    static void *worker(void *);
+    static double cpuTime(void);
+
+    void wait(void);
+    void work(bool owner, double &last);
+    bool take(bool owner, double &last, unsigned int &i);
+
+    const vector<ScanTest> &tests;
+    const unsigned int threads;
+    const double budget;
+
+    vector<Message *> messages;
+    vector<unsigned int> sqnrs;
+    vector<int> files;
+    vector<char> results;
+
+    vector<pthread_t> workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    unsigned int next;
+    unsigned int batch;
+    unsigned int running;
+    bool stopping;
+    double spent;
+    double ownerTime;
+  };
+
+  //----------------------------------------------------------------------
+  ScanPool::ScanPool(const vector<ScanTest> &t, unsigned int n, double b)
+    : tests(t), threads(n), budget(b), next(0), batch(0), running(0),
+      stopping(false), spent(0), ownerTime(cpuTime())
+  {
+    pthread_mutex_init(&lock, 0);
+    pthread_cond_init(&wake, 0);
+    pthread_cond_init(&idle, 0);
+  }
+
+  //----------------------------------------------------------------------
+  ScanPool::~ScanPool(void)
+  {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    for (vector<pthread_t>::const_iterator i = workers.begin();
+	 i != workers.end(); ++i)
+      pthread_join(*i, 0);
+
+    clear();
+    pthread_cond_destroy(&idle);
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&lock);
+  }
+
+  //----------------------------------------------------------------------
+  // Returns the CPU time used by the calling thread. Without
+  // RUSAGE_THREAD, each thread is given the time of the whole
+  // process, and the budget runs out sooner.
+  double ScanPool::cpuTime(void)
+  {
+    struct rusage r;
+#ifdef RUSAGE_THREAD
+    if (getrusage(RUSAGE_THREAD, &r) != 0)
+#else
+    if (getrusage(RUSAGE_SELF, &r) != 0)
+#endif
+      return 0;
+
+    return r.ru_utime.tv_sec + r.ru_stime.tv_sec
+      + (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1000000.0;
+  }
+
+  //----------------------------------------------------------------------
+  void ScanPool::add(Message *message, unsigned int sqnr, int fd,
+		     const vector<char> &needed)
+  {
+    messages.push_back(message);
+    sqnrs.push_back(sqnr);
+    files.push_back(fd);
+    results.insert(results.end(), needed.begin(), needed.end());
+  }
+
+  //----------------------------------------------------------------------
+  void ScanPool::clear(void)
+  {
+    for (vector<int>::const_iterator i = files.begin(); i != files.end(); ++i)
+      if (*i != -1)
+	::close(*i);
+
+    messages.clear();
+    sqnrs.clear();
+    files.clear();
+    results.clear();
+    next = 0;
+  }
+
+  //----------------------------------------------------------------------
+  // Gives the calling thread the next message of the batch, and adds
+  // the CPU time it has used since it last asked to what the pool
+  // has spent.
+  bool ScanPool::take(bool owner, double &last, unsigned int &i)
+  {
+    const double now = cpuTime();
+
+    pthread_mutex_lock(&lock);
+    spent += now - last;
+    last = now;
+
+    bool more = (owner || budget <= 0 || spent <= budget)
+      && next < messages.size();
+    if (more)
+      i = next++;
+    pthread_mutex_unlock(&lock);
+
+    return more;
+  }
+
+  //----------------------------------------------------------------------
+  void ScanPool::work(bool owner, double &last)
+  {
+    unsigned int i;
+    while (take(owner, last, i)) {
+      char *r = getResults(i);
+      for (unsigned int j = 0; j < tests.size(); ++j) {
+	if (r[j] != M_NEEDED)
+	  continue;
+
+	if (files[i] == -1)
+	  r[j] = M_NO;
+	else
+	  r[j] = messages[i]->searchFile(files[i], tests[j].text,
+					 tests[j].onlyBody,
+					 tests[j].onlyTextParts)
+	    ? M_YES : M_NO;
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------
+  // Works on each batch that run() hands out, until the pool is
+  // destroyed.
+  void ScanPool::wait(void)
+  {
+    double last = cpuTime();
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+      while (!stopping && batch == seen)
+	pthread_cond_wait(&wake, &lock);
+
+      if (stopping)
+	break;
+
+      seen = batch;
+      pthread_mutex_unlock(&lock);
+
+      work(false, last);
+
+      pthread_mutex_lock(&lock);
+      if (--running == 0)
+	pthread_cond_signal(&idle);
+    }
+    pthread_mutex_unlock(&lock);
+  }
+
+  //----------------------------------------------------------------------
+  void *ScanPool::worker(void *pool)
+  {
+    // Signals are for the thread that serves the client.
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, 0);
+
+    ((ScanPool *) pool)->wait();
+    return 0;
+  }
+
+  //----------------------------------------------------------------------
+  void ScanPool::run(void)
+  {
+    if (batch == 0)
+      for (unsigned int i = 1; i < threads; ++i) {
+	pthread_t t;
+	if (pthread_create(&t, 0, worker, this) != 0)
+	  break;
+	workers.push_back(t);
+      }
+
+    // Each worker takes part in every batch, if only to find that
+    // there is nothing left, so that none of them is still looking
+    // at this batch when the next one is collected.
+    pthread_mutex_lock(&lock);
+    ++batch;
+    running = workers.size();
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    work(true, ownerTime);
+
+    pthread_mutex_lock(&lock);
+    while (running > 0)
+      pthread_cond_wait(&idle, &lock);
+    pthread_mutex_unlock(&lock);
+  }
+#endif
+
+  //----------------------------------------------------------------------
+  // Returns true if the search key has a MODSEQ test anywhere.
+  bool hasModSeq(const BincImapParserSearchKey &key)
+  {
+    if (key.name == "MODSEQ")
+      return true;
+
+    for (vector<BincImapParserSearchKey>::const_iterator i
+	   = key.children.begin(); i != key.children.end(); ++i)
+      if (hasModSeq(*i))
+	return true;
+
+    return false;
+  }
+
+  //----------------------------------------------------------------------
+  // Gives a search key as text, for looking it up in the search
+  // cache. "$" is given with the result it stands for.
+  string keyToString(const BincImapParserSearchKey &key,
+		     const Mailbox *mailbox)
+  {
+    string tmp = "(" + toString(key.type) + " " + key.name + " "
+      + toImapString(key.astring) + " " + toImapString(key.bstring)
+      + " " + key.date + " " + toString(key.number) + " ";
+
+    if (key.bset.isSaved())
+      tmp += "$" + mailbox->getSavedResult().toString();
+    else
+      tmp += key.bset.toString();
+
+    for (vector<BincImapParserSearchKey>::const_iterator i
+	   = key.children.begin(); i != key.children.end(); ++i)
+      tmp += " " + keyToString(*i, mailbox);
+
+    return tmp + ")";
+  }
+}
+
+//----------------------------------------------------------------------
+SearchOperator::Results::Results(IO &c, Request &r, Mailbox *m,
+				 vector<pair<unsigned int, unsigned int> > *l)
+  : com(c), command(r), mailbox(m), matches(l), esearch(false),
+    wantMin(false), wantMax(false), wantCount(false), wantAll(false),
+    wantSave(false), wantModSeq(false), min(0), max(0), count(0),
+    first(0), minUid(0), firstUid(0), lastUid(0), uidsDone(false)
+{
+  const vector<string> &returns = r.getReturns();
+  for (vector<string>::const_iterator i = returns.begin();
+       i != returns.end(); ++i) {
+    if (*i == "MIN") wantMin = true;
+    else if (*i == "MAX") wantMax = true;
+    else if (*i == "COUNT") wantCount = true;
+    else if (*i == "ALL") wantAll = true;
+    else if (*i == "SAVE") wantSave = true;
+  }
+
+  // RETURN (SAVE) alone gives no response at all.
+  esearch = wantMin || wantMax || wantCount || wantAll;
+
+  // A search on MODSEQ also reports the highest mod-sequence of the
+  // messages it returns (RFC 7162).
+  wantModSeq = matches == 0 && hasModSeq(r.searchkey);
+
+  if (returns.empty() && matches == 0)
+    com << "* SEARCH";
+}
+
+//----------------------------------------------------------------------
+void SearchOperator::Results::add(unsigned int sqnr, unsigned int uid)
+{
+  if (count == 0)
+    minUid = firstUid = uid;
+  else if (uid != lastUid + 1) {
+    endUidRun();
+    firstUid = uid;
+  }
+
+  lastUid = uid;
+
+  if (matches != 0) {
+    matches->push_back(make_pair(uid, sqnr));
+    ++count;
+    return;
+  }
+
+  unsigned int n = command.getUidMode() ? uid : sqnr;
+  if (!esearch && !wantSave) {
+    ++count;
+    com << " " << n;
+    com.flushContent();
+    return;
+  }
+
+  // Matches come in ascending order, so consecutive numbers make
+  // up a run.
+  if (count == 0)
+    min = first = n;
+  else if (n != max + 1) {
+    endRun();
+    first = n;
+  }
+
+  max = n;
+  ++count;
+}
+
+//----------------------------------------------------------------------
+void SearchOperator::Results::endRun(void)
+{
+  if (!wantAll)
+    return;
+
+  if (all != "")
+    all += ",";
+  all += toString(first);
+  if (max != first)
+    all += ":" + toString(max);
+}
+
+//----------------------------------------------------------------------
+void SearchOperator::Results::endUidRun(void)
+{
+  uids.addRange(firstUid, lastUid);
+}
+
+//----------------------------------------------------------------------
+void SearchOperator::Results::setCount(unsigned int n)
+{
+  count = n;
+}
+
+//----------------------------------------------------------------------
+bool SearchOperator::Results::isDone(void) const
+{
+  // Only the lowest match is wanted, and it has been found.
+  return esearch && wantMin && !wantMax && !wantCount && !wantAll
+    && count != 0;
+}
+
+//----------------------------------------------------------------------
+bool SearchOperator::Results::onlyCount(void) const
+{
+  return wantCount && !wantMin && !wantMax && !wantAll && !wantSave;
+}
+
+//----------------------------------------------------------------------
+const SequenceSet &SearchOperator::Results::getUids(void)
+{
+  if (count != 0 && !uidsDone) {
+    endUidRun();
+    uidsDone = true;
+  }
+
+  return uids;
+}
+
+//----------------------------------------------------------------------
+SequenceSet SearchOperator::Results::getReturnedUids(void)
+{
+  // With MIN or MAX but neither COUNT nor ALL, only the lowest and
+  // highest match are returned.
+  if (count != 0 && (wantMin || wantMax) && !wantCount && !wantAll) {
+    SequenceSet returned;
+    if (wantMin) returned.addNumber(minUid);
+    if (wantMax && (!wantMin || lastUid != minUid))
+      returned.addNumber(lastUid);
+    return returned;
+  }
+
+  return getUids();
+}
+
+//----------------------------------------------------------------------
+unsigned int SearchOperator::Results::getHighestModSeq(void)
+{
+  unsigned int highest = 0;
+  Mailbox::iterator i = mailbox->begin(getReturnedUids(),
+				       Mailbox::SKIP_EXPUNGED
+				       | Mailbox::UID_MODE);
+  for (; i != mailbox->end(); ++i)
+    if ((*i).getModSeq() > highest)
+      highest = (*i).getModSeq();
+
+  return highest;
+}
+
+//----------------------------------------------------------------------
+void SearchOperator::Results::finish(void)
+{
+  if (matches != 0)
+    return;
+
+  if (wantSave)
+    mailbox->setSavedResult(getReturnedUids());
+
+  if (!esearch) {
+    if (!wantSave) {
+      if (wantModSeq && count != 0)
+	com << " (MODSEQ " << getHighestModSeq() << ")";
+      com << endl;
+    }
+    return;
+  }
+
+  com << "* ESEARCH (TAG \"" << command.getTag() << "\")";
+  if (command.getUidMode())
+    com << " UID";
+
+  if (count != 0) {
+    if (wantMin)
+      com << " MIN " << min;
+    if (wantMax)
+      com << " MAX " << max;
+  }
+
+  if (wantCount)
+    com << " COUNT " << count;
+
+  if (wantAll && count != 0) {
+    endRun();
+    com << " ALL " << all;
+  }
+
+  if (wantModSeq && count != 0)
+    com << " MODSEQ " << getHighestModSeq();
+
+  com << endl;
+}
+
 //----------------------------------------------------------------------
 bool SearchOperator::SearchNode::convertDate(const string &date, 
 					     time_t &t,
@@ -93,26 +619,53 @@ bool SearchOperator::SearchNode::convertDate(const string &date,
 }
 
 //----------------------------------------------------------------------
-bool SearchOperator::SearchNode::convertDateHeader(const string &d_in,
-						   time_t &t)
+SearchOperator::Statistics::Statistics(void) : messages(0), unsized(0)
 {
-  string date = d_in;
-  string::size_type n = date.find(',');
-  if (n != string::npos)
-    date = date.substr(n + 1);
-  trim(date);
-  
-  bool result = convertDate(date, t, " ");
-  return result;
+  for (int i = 0; i < 8; ++i)
+    flags[i] = 0;
+}
+
+//----------------------------------------------------------------------
+void SearchOperator::Statistics::add(const Message &message)
+{
+  ++messages;
+  if (message.getSize() == 0)
+    ++unsized;
+
+  unsigned char f = message.getStdFlags();
+  for (int i = 0; i < 8; ++i)
+    if (f & (1 << i))
+      ++flags[i];
+}
+
+//----------------------------------------------------------------------
+unsigned int SearchOperator::Statistics::count(unsigned char flag) const
+{
+  for (int i = 0; i < 8; ++i)
+    if (flag == (1 << i))
+      return flags[i];
+
+  return 0;
+}
+
+//----------------------------------------------------------------------
+double SearchOperator::Statistics::fraction(unsigned char flag) const
+{
+  if (messages == 0)
+    return 0;
+
+  return (double) count(flag) / messages;
 }
 
 //----------------------------------------------------------------------
 SearchOperator::SearchNode::SearchNode(void)
+  : useCandidates(false), scan(-1), day(0), cost(0), selectivity(1)
 {
 }
 
 //----------------------------------------------------------------------
 SearchOperator::SearchNode::SearchNode(const BincImapParserSearchKey &a)
+  : useCandidates(false), scan(-1), day(0), cost(0), selectivity(1)
 {
   init(a);
 }
@@ -124,11 +677,12 @@ int SearchOperator::SearchNode::getType(void) const
 }
 
 //----------------------------------------------------------------------
-bool SearchOperator::SearchNode::match(Mailbox *mailbox,
-				       Message *m,
-				       unsigned int seqnr,
-				       unsigned int lastmessage,
-				       unsigned int lastuid) const
+int SearchOperator::SearchNode::match(Mailbox *mailbox,
+				      Message *m,
+				      unsigned int seqnr,
+				      unsigned int lastmessage,
+				      unsigned int lastuid,
+				      char *scans) const
 {
   HeaderItem hitem;
   string tmp;
@@ -139,46 +693,49 @@ bool SearchOperator::SearchNode::match(Mailbox *mailbox,
     return true;
     //--------------------------------------------------------------------
   case S_ANSWERED: 
-    return (m->getStdFlags() & Message::F_ANSWERED);
+    return (m->getStdFlags() & Message::F_ANSWERED) != 0;
     //--------------------------------------------------------------------
   case S_BCC:
     return m->headerContains("bcc", astring);
     //--------------------------------------------------------------------
-  case S_BEFORE: {
-    time_t mtime = m->getInternalDate();
-    struct tm *mtime_ = localtime(&mtime);
-    mtime_->tm_sec = 0;
-    mtime_->tm_min = 0;
-    mtime_->tm_hour = 0;
-    mtime_->tm_wday = 0;
-    mtime_->tm_yday = 0;
-    mtime_->tm_isdst = 0;
-    mtime = mktime(mtime_);
-
-    time_t atime;
-    if (!convertDate(date, atime)) {
-      IO &logger = IOFactory::getInstance().get(2);
+  case S_BEFORE:
+    return day != 0 && HeaderSummary::getDay(m->getInternalDate()) < day;
+    //--------------------------------------------------------------------
+  case S_BODY:
+  case S_TEXT:
+    if (useCandidates && !binary_search(candidates.begin(), candidates.end(),
+					m->getUID()))
+      return M_NO;
+
+    if (scans != 0) {
+      if (scans[scan] == M_LATER || scans[scan] == M_NEEDED) {
+	scans[scan] = M_NEEDED;
+	return M_LATER;
+      }
 
-      logger << "warning, unable to convert " << date << 
-	" to a time_t" << endl;
-      return false;
+      return scans[scan];
     }
 
-    return mtime < atime;
-  } //--------------------------------------------------------------------
-  case S_BODY:
-    return m->bodyContains(astring);
+    if (type == S_BODY)
+      return m->bodyContains(astring);
+    return m->textContains(astring);
     //--------------------------------------------------------------------
   case S_CC:
+    if (useCandidates)
+      return binary_search(candidates.begin(), candidates.end(),
+			   m->getUID());
     return m->headerContains("cc", astring);
     //--------------------------------------------------------------------
   case S_DELETED:
-    return (m->getStdFlags() & Message::F_DELETED);
+    return (m->getStdFlags() & Message::F_DELETED) != 0;
     //--------------------------------------------------------------------
   case S_FLAGGED:
-    return (m->getStdFlags() & Message::F_FLAGGED);
+    return (m->getStdFlags() & Message::F_FLAGGED) != 0;
     //--------------------------------------------------------------------
   case S_FROM:
+    if (useCandidates)
+      return binary_search(candidates.begin(), candidates.end(),
+			   m->getUID());
     return m->headerContains("from", astring);
     //--------------------------------------------------------------------
   case S_KEYWORD: 
@@ -192,63 +749,28 @@ bool SearchOperator::SearchNode::match(Mailbox *mailbox,
   case S_OLD:
     return !(m->getStdFlags() & Message::F_RECENT);
     //--------------------------------------------------------------------
-  case S_ON: {
-    time_t mtime = m->getInternalDate();
-    struct tm *mtime_ = localtime(&mtime);
-    mtime_->tm_sec = 0;
-    mtime_->tm_min = 0;
-    mtime_->tm_hour = 0;
-    mtime_->tm_wday = 0;
-    mtime_->tm_yday = 0;
-    mtime_->tm_isdst = 0;
-    mtime = mktime(mtime_);
-
-    time_t atime;
-    if (!convertDate(date, atime)) {
-      IO &logger = IOFactory::getInstance().get(2);
-
-      logger << "warning, unable to convert " << date << 
-	" to a time_t" << endl;
-      return false;
-    }
-
-    return mtime == atime;
-  } //--------------------------------------------------------------------
+  case S_ON:
+    return day != 0 && HeaderSummary::getDay(m->getInternalDate()) == day;
+    //--------------------------------------------------------------------
   case S_RECENT:
-    return (m->getStdFlags() & Message::F_RECENT);
+    return (m->getStdFlags() & Message::F_RECENT) != 0;
     //--------------------------------------------------------------------
   case S_SEEN:
-    return (m->getStdFlags() & Message::F_SEEN);
-    //--------------------------------------------------------------------
-  case S_SINCE: {
-    time_t mtime = m->getInternalDate();
-    struct tm *mtime_ = localtime(&mtime);
-    mtime_->tm_sec = 0;
-    mtime_->tm_min = 0;
-    mtime_->tm_hour = 0;
-    mtime_->tm_wday = 0;
-    mtime_->tm_yday = 0;
-    mtime_->tm_isdst = 0;
-    mtime = mktime(mtime_);
-
-    time_t atime;
-    if (!convertDate(date, atime)) {
-      IO &logger = IOFactory::getInstance().get(2);
-
-      logger << "warning, unable to convert " << date << 
-	" to a time_t" << endl;
-      return false;
-    }
-
-    return mtime >= atime;
-  } //--------------------------------------------------------------------
+    return (m->getStdFlags() & Message::F_SEEN) != 0;
+    //--------------------------------------------------------------------
+  case S_SINCE:
+    return day != 0 && HeaderSummary::getDay(m->getInternalDate()) >= day;
+    //--------------------------------------------------------------------
   case S_SUBJECT:
+    if (useCandidates)
+      return binary_search(candidates.begin(), candidates.end(),
+			   m->getUID());
     return m->headerContains("subject", astring);
     //--------------------------------------------------------------------
-  case S_TEXT:
-    return m->textContains(astring);
-    //--------------------------------------------------------------------
   case S_TO:
+    if (useCandidates)
+      return binary_search(candidates.begin(), candidates.end(),
+			   m->getUID());
     return m->headerContains("to", astring);
     //--------------------------------------------------------------------
   case S_UNANSWERED:
@@ -268,107 +790,70 @@ bool SearchOperator::SearchNode::match(Mailbox *mailbox,
     return !(m->getStdFlags() & Message::F_SEEN);
     //--------------------------------------------------------------------
   case S_DRAFT:
-    return (m->getStdFlags() & Message::F_DRAFT);
+    return (m->getStdFlags() & Message::F_DRAFT) != 0;
     //--------------------------------------------------------------------
   case S_HEADER:
+    if (useCandidates)
+      return binary_search(candidates.begin(), candidates.end(),
+			   m->getUID());
     return m->headerContains(astring, bstring);
     //--------------------------------------------------------------------
   case S_LARGER: {
     return (m->getSize(true) > number);
   }
     //--------------------------------------------------------------------
-  case S_NOT:
+  case S_NOT: {
+    bool later = false;
     for (vector<SearchNode>::const_iterator i = children.begin();
-	 i != children.end(); ++i)
-      if ((*i).match(mailbox, m, seqnr, lastmessage, lastuid))
-	return false;
-    return true;
-    //--------------------------------------------------------------------
-  case S_OR:
-    for (vector<SearchNode>::const_iterator i = children.begin();
-	 i != children.end(); ++i)
-      if ((*i).match(mailbox, m, seqnr, lastmessage, lastuid))
-	return true;
-    return false;
-    //--------------------------------------------------------------------
-  case S_SENTBEFORE: {
-    string tmp = m->getHeader("date");
-    if (tmp == "")
-      return false;
-
-    lowercase(tmp);
-
-    time_t mtime;
-    if (!convertDateHeader(tmp, mtime))
-      return false;
-
-    if (mtime == (time_t) -1)
-      return false;
-
-    time_t atime;
-    if (!convertDate(date, atime)) {
-      IO &logger = IOFactory::getInstance().get(2);
-
-      logger << "warning, unable to convert " << date << 
-	" to a time_t" << endl;
-      return false;
+	 i != children.end(); ++i) {
+      int r = (*i).match(mailbox, m, seqnr, lastmessage, lastuid, scans);
+      if (r == M_YES)
+	return M_NO;
+      if (r == M_LATER)
+	later = true;
     }
-
-    return mtime < atime;
+    return later ? M_LATER : M_YES;
   } //--------------------------------------------------------------------
-  case S_SENTON: {
-    string tmp = m->getHeader("date");
-    if (tmp == "")
-      return false;
-
-    lowercase(tmp);
-
-    time_t mtime;
-    if (!convertDateHeader(tmp, mtime))
-      return false;
-
-    if (mtime == (time_t) -1)
-      return false;
-
-    time_t atime;
-    if (!convertDate(date, atime)) {
-      IO &logger = IOFactory::getInstance().get(2);
-
-      logger << "warning, unable to convert " << date << 
-	" to a time_t" << endl;
-      return false;
+  case S_OR: {
+    bool later = false;
+    for (vector<SearchNode>::const_iterator i = children.begin();
+	 i != children.end(); ++i) {
+      int r = (*i).match(mailbox, m, seqnr, lastmessage, lastuid, scans);
+      if (r == M_YES)
+	return M_YES;
+      if (r == M_LATER)
+	later = true;
     }
-
-    return mtime == atime;
-  } //--------------------------------------------------------------------
+    return later ? M_LATER : M_NO;
+  }
+    //--------------------------------------------------------------------
+  case S_SENTBEFORE:
+  case S_SENTON:
   case S_SENTSINCE: {
-    string tmp = m->getHeader("date");
-    if (tmp == "")
-      return false;
+    if (useCandidates)
+      return binary_search(candidates.begin(), candidates.end(),
+			   m->getUID());
 
-    lowercase(tmp);
-
-    time_t mtime;
-    if (!convertDateHeader(tmp, mtime))
+    if (day == 0)
       return false;
 
-    if (mtime == (time_t) -1)
+    int mday = HeaderSummary::getSentDay(m->getHeader("date"));
+    if (mday == 0)
       return false;
 
-    time_t atime;
-    if (!convertDate(date, atime)) {
-      IO &logger = IOFactory::getInstance().get(2);
-
-      logger << "warning, unable to convert " << date << 
-	" to a time_t" << endl;
-      return false;
-    }
-
-    return mtime >= atime;
+    if (type == S_SENTBEFORE)
+      return mday < day;
+    else if (type == S_SENTON)
+      return mday == day;
+    else
+      return mday >= day;
   } //--------------------------------------------------------------------
   case S_SMALLER:
     return (m->getSize(true) < number);
     //--------------------------------------------------------------------
+  case S_MODSEQ:
+    return m->getModSeq() >= number;
+    //--------------------------------------------------------------------
   case S_UID:
     if (!bset->isInSet(m->getUID()))
       if (!(m->getUID() == lastuid && !bset->isLimited()))
@@ -384,15 +869,21 @@ bool SearchOperator::SearchNode::match(Mailbox *mailbox,
 	return false;
     return true;
     //--------------------------------------------------------------------
-  case S_AND:
+  case S_AND: {
+    bool later = false;
     for (vector<SearchNode>::const_iterator i = children.begin();
-	 i != children.end(); ++i)
-      if (!(*i).match(mailbox, m, seqnr, lastmessage, lastuid))
-	return false;
-    return true;
+	 i != children.end(); ++i) {
+      int r = (*i).match(mailbox, m, seqnr, lastmessage, lastuid, scans);
+      if (r == M_NO)
+	return M_NO;
+      if (r == M_LATER)
+	later = true;
+    }
+    return later ? M_LATER : M_YES;
+  }
   }
 
-  return false;
+  return M_NO;
 }
 
 //----------------------------------------------------------------------
@@ -406,42 +897,41 @@ void SearchOperator::SearchNode::init(const BincImapParserSearchKey &a)
   uppercase(bstring);
   uppercase(date);
 
-  if (a.name      == "ALL")            { type = S_ALL;        weight = 1; }
-  else if (a.name == "ANSWERED")       { type = S_ANSWERED;   weight = 1; }
-  else if (a.name == "BCC")            { type = S_BCC;        weight = 2; }
-  else if (a.name == "BEFORE")         { type = S_BEFORE;     weight = 2; }
-  else if (a.name == "BODY")           { type = S_BODY;       weight = 1; }
-  else if (a.name == "CC")             { type = S_CC;         weight = 2; }
-  else if (a.name == "DELETED")        { type = S_DELETED;    weight = 1; }
-  else if (a.name == "FLAGGED")        { type = S_FLAGGED;    weight = 1; }
-  else if (a.name == "FROM")           { type = S_FROM;       weight = 2; }
-  else if (a.name == "KEYWORD")        { type = S_KEYWORD;    weight = 3; }
-  else if (a.name == "NEW")            { type = S_NEW;        weight = 1; }
-  else if (a.name == "OLD")            { type = S_OLD;        weight = 1; }
-  else if (a.name == "ON")             { type = S_ON;         weight = 1; }
-  else if (a.name == "RECENT")         { type = S_RECENT;     weight = 1; }
-  else if (a.name == "SEEN")           { type = S_SEEN;       weight = 1; }
-  else if (a.name == "SINCE")          { type = S_SINCE;      weight = 1; }
-  else if (a.name == "SUBJECT")        { type = S_SUBJECT;    weight = 2; }
-  else if (a.name == "TEXT")           { type = S_TEXT;       weight = 4; }
-  else if (a.name == "TO")             { type = S_TO;         weight = 2; }
-  else if (a.name == "UNANSWERED")     { type = S_UNANSWERED; weight = 1; }
-  else if (a.name == "UNDELETED")      { type = S_UNDELETED;  weight = 1; }
-  else if (a.name == "UNFLAGGED")      { type = S_UNFLAGGED;  weight = 1; }
-  else if (a.name == "UNKEYWORD")      { type = S_UNKEYWORD;  weight = 1; }
-  else if (a.name == "UNSEEN")         { type = S_UNSEEN;     weight = 1; }
-  else if (a.name == "DRAFT")          { type = S_DRAFT;      weight = 1; }
-  else if (a.name == "HEADER")         { type = S_HEADER;     weight = 3; }
-  else if (a.name == "LARGER")         { type = S_LARGER;     weight = 4; }
+  if (a.name      == "ALL")            { type = S_ALL; }
+  else if (a.name == "ANSWERED")       { type = S_ANSWERED; }
+  else if (a.name == "BCC")            { type = S_BCC; }
+  else if (a.name == "BEFORE")         { type = S_BEFORE; }
+  else if (a.name == "BODY")           { type = S_BODY; }
+  else if (a.name == "CC")             { type = S_CC; }
+  else if (a.name == "DELETED")        { type = S_DELETED; }
+  else if (a.name == "FLAGGED")        { type = S_FLAGGED; }
+  else if (a.name == "FROM")           { type = S_FROM; }
+  else if (a.name == "KEYWORD")        { type = S_KEYWORD; }
+  else if (a.name == "NEW")            { type = S_NEW; }
+  else if (a.name == "OLD")            { type = S_OLD; }
+  else if (a.name == "ON")             { type = S_ON; }
+  else if (a.name == "RECENT")         { type = S_RECENT; }
+  else if (a.name == "SEEN")           { type = S_SEEN; }
+  else if (a.name == "SINCE")          { type = S_SINCE; }
+  else if (a.name == "SUBJECT")        { type = S_SUBJECT; }
+  else if (a.name == "TEXT")           { type = S_TEXT; }
+  else if (a.name == "TO")             { type = S_TO; }
+  else if (a.name == "UNANSWERED")     { type = S_UNANSWERED; }
+  else if (a.name == "UNDELETED")      { type = S_UNDELETED; }
+  else if (a.name == "UNFLAGGED")      { type = S_UNFLAGGED; }
+  else if (a.name == "UNKEYWORD")      { type = S_UNKEYWORD; }
+  else if (a.name == "UNSEEN")         { type = S_UNSEEN; }
+  else if (a.name == "DRAFT")          { type = S_DRAFT; }
+  else if (a.name == "HEADER")         { type = S_HEADER; }
+  else if (a.name == "LARGER")         { type = S_LARGER; }
+  else if (a.name == "MODSEQ")         { type = S_MODSEQ; }
   else if (a.name == "NOT")            {
     // *******                         NOT
     type = S_NOT;
-    weight = 1;
 
     vector<BincImapParserSearchKey>::const_iterator i = a.children.begin();
     while (i != a.children.end()) {
       SearchNode b(*i);
-      weight += b.getWeight();
       children.push_back(b);
       ++i;
     }
@@ -449,39 +939,33 @@ void SearchOperator::SearchNode::init(const BincImapParserSearchKey &a)
   } else if (a.name == "OR") {
     // *******                         OR
     type = S_OR;
-    weight = 0;
 
     vector<BincImapParserSearchKey>::const_iterator i = a.children.begin();
     while (i != a.children.end()) {
       SearchNode b(*i);
-      weight += b.getWeight();
 
       children.push_back(b);
       ++i;
     }
 
-  } else if (a.name == "SENTBEFORE")   { type = S_SENTBEFORE; weight = 1; }
-  else if (a.name == "SENTON")         { type = S_SENTON;     weight = 1; }
-  else if (a.name == "SENTSINCE")      { type = S_SENTSINCE;  weight = 1; }
-  else if (a.name == "SMALLER")        { type = S_SMALLER;    weight = 4; } 
+  } else if (a.name == "SENTBEFORE")   { type = S_SENTBEFORE; }
+  else if (a.name == "SENTON")         { type = S_SENTON; }
+  else if (a.name == "SENTSINCE")      { type = S_SENTSINCE; }
+  else if (a.name == "SMALLER")        { type = S_SMALLER; } 
   else if (a.name == "UID") {
     bset = &a.getSet();
     type = S_UID;
-    weight = 1;
-  } else if (a.name == "UNDRAFT")        { type = S_UNDRAFT;    weight = 1; }
+  } else if (a.name == "UNDRAFT")        { type = S_UNDRAFT; }
   else if (a.type == BincImapParserSearchKey::KEY_SET) {
     bset = &a.getSet();
     type = S_SET;
-    weight = 1;
   } else if (a.type == BincImapParserSearchKey::KEY_AND) {
     // *******                         AND
     type = S_AND;
-    weight = 0;
 
     vector<BincImapParserSearchKey>::const_iterator i = a.children.begin();
     while (i != a.children.end()) {
       SearchNode b(*i);
-      weight += b.getWeight();
       children.push_back(b);
       ++i;
     }
@@ -489,28 +973,368 @@ void SearchOperator::SearchNode::init(const BincImapParserSearchKey &a)
 }
 
 //----------------------------------------------------------------------
-int SearchOperator::SearchNode::getWeight(void) const
+const string &SearchOperator::SearchNode::getText(void) const
+{
+  return astring;
+}
+
+//----------------------------------------------------------------------
+const SequenceSet &SearchOperator::SearchNode::getSet(void) const
+{
+  return *bset;
+}
+
+//----------------------------------------------------------------------
+double SearchOperator::SearchNode::getCost(void) const
+{
+  return cost;
+}
+
+//----------------------------------------------------------------------
+double SearchOperator::SearchNode::getSelectivity(void) const
+{
+  return selectivity;
+}
+
+//----------------------------------------------------------------------
+bool SearchOperator::SearchNode::compareAndNodes(const SearchNode &a,
+						 const SearchNode &b)
+{
+  // An AND stops at the first test that fails, so the cheapest tests
+  // that fail most often go first.
+  double ra = a.selectivity < 1 ? a.cost / (1 - a.selectivity) : DBL_MAX;
+  double rb = b.selectivity < 1 ? b.cost / (1 - b.selectivity) : DBL_MAX;
+  return ra < rb;
+}
+
+//----------------------------------------------------------------------
+bool SearchOperator::SearchNode::compareOrNodes(const SearchNode &a,
+						const SearchNode &b)
+{
+  // An OR stops at the first test that succeeds.
+  double ra = a.selectivity > 0 ? a.cost / a.selectivity : DBL_MAX;
+  double rb = b.selectivity > 0 ? b.cost / b.selectivity : DBL_MAX;
+  return ra < rb;
+}
+
+//----------------------------------------------------------------------
+const SearchOperator::SearchNode *
+SearchOperator::SearchNode::getRange(void) const
+{
+  if (type == S_UID || type == S_SET)
+    return this;
+
+  // Only a set that every match must be in can limit the messages
+  // that are searched.
+  if (type == S_AND)
+    for (vector<SearchNode>::const_iterator i = children.begin();
+	 i != children.end(); ++i) {
+      const SearchNode *range = (*i).getRange();
+      if (range != 0)
+	return range;
+    }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------
+bool SearchOperator::SearchNode::getCount(const Statistics &stats,
+					  unsigned int &n) const
 {
-  return weight;
+  // The statistics count every message and each of its flags, so a
+  // search on one flag is counted without visiting any message.
+  unsigned int c;
+  switch (type) {
+  case S_AND:
+    return children.size() == 1 && children[0].getCount(stats, n);
+  case S_NOT:
+    if (children.size() != 1 || !children[0].getCount(stats, c))
+      return false;
+    n = stats.messages - c;
+    return true;
+  case S_ALL:
+  case S_UNKEYWORD:
+    n = stats.messages;
+    return true;
+  case S_KEYWORD:
+    n = 0;
+    return true;
+  case S_ANSWERED: n = stats.count(Message::F_ANSWERED); return true;
+  case S_DELETED: n = stats.count(Message::F_DELETED); return true;
+  case S_DRAFT: n = stats.count(Message::F_DRAFT); return true;
+  case S_FLAGGED: n = stats.count(Message::F_FLAGGED); return true;
+  case S_RECENT: n = stats.count(Message::F_RECENT); return true;
+  case S_SEEN: n = stats.count(Message::F_SEEN); return true;
+  case S_UNANSWERED:
+    n = stats.messages - stats.count(Message::F_ANSWERED);
+    return true;
+  case S_UNDELETED:
+    n = stats.messages - stats.count(Message::F_DELETED);
+    return true;
+  case S_UNDRAFT:
+    n = stats.messages - stats.count(Message::F_DRAFT);
+    return true;
+  case S_UNFLAGGED:
+    n = stats.messages - stats.count(Message::F_FLAGGED);
+    return true;
+  case S_UNSEEN:
+    n = stats.messages - stats.count(Message::F_SEEN);
+    return true;
+  case S_OLD:
+    n = stats.messages - stats.count(Message::F_RECENT);
+    return true;
+  default:
+    return false;
+  }
 }
 
 //----------------------------------------------------------------------
-void SearchOperator::SearchNode::setWeight(int i)
+void SearchOperator::SearchNode::getScans(vector<SearchNode *> &scans)
 {
-  weight = i;
+  if (type == S_BODY || type == S_TEXT) {
+    scan = scans.size();
+    scans.push_back(this);
+  }
+
+  for (vector<SearchNode>::iterator i = children.begin();
+       i != children.end(); ++i)
+    (*i).getScans(scans);
 }
 
 //----------------------------------------------------------------------
-void SearchOperator::SearchNode::order(void)
+void SearchOperator::SearchNode::prepare(Mailbox *mailbox,
+					 const Statistics &stats)
 {
   for (vector<SearchNode>::iterator i = children.begin();
        i != children.end(); ++i)
-    (*i).order();
-  ::stable_sort(children.begin(), children.end(), compareNodes);
+    (*i).prepare(mailbox, stats);
+
+  // "$" is the saved result, which holds UIDs.
+  if ((type == S_SET || type == S_UID) && bset->isSaved()) {
+    bset = &mailbox->getSavedResult();
+    type = S_UID;
+  }
+
+  if (type == S_BEFORE || type == S_ON || type == S_SINCE
+      || type == S_SENTBEFORE || type == S_SENTON || type == S_SENTSINCE) {
+    time_t t;
+    if (convertDate(date, t))
+      day = HeaderSummary::getDay(t);
+
+    if (day == 0) {
+      IO &logger = IOFactory::getInstance().get(2);
+      logger << "warning, unable to convert " << date << 
+	" to a time_t" << endl;
+    }
+  }
+
+  // Ask the mailbox for the matching messages up front where it can
+  // tell without opening them. For BODY and TEXT, the text index
+  // only rules out messages; the rest are still searched.
+  switch (type) {
+  case S_BODY:
+  case S_TEXT:
+    useCandidates = mailbox->getSearchCandidates(astring, candidates);
+    break;
+  case S_CC:
+    useCandidates = mailbox->getHeaderMatches("cc", astring, candidates);
+    break;
+  case S_FROM:
+    useCandidates = mailbox->getHeaderMatches("from", astring, candidates);
+    break;
+  case S_SUBJECT:
+    useCandidates = mailbox->getHeaderMatches("subject", astring, candidates);
+    break;
+  case S_TO:
+    useCandidates = mailbox->getHeaderMatches("to", astring, candidates);
+    break;
+  case S_HEADER:
+    useCandidates = mailbox->getHeaderMatches(astring, bstring, candidates);
+    break;
+  case S_SENTBEFORE:
+  case S_SENTON:
+  case S_SENTSINCE:
+    if (day == 0)
+      break;
+
+    if (type == S_SENTBEFORE)
+      useCandidates = mailbox->getSentDayMatches(1, day - 1, candidates);
+    else if (type == S_SENTON)
+      useCandidates = mailbox->getSentDayMatches(day, day, candidates);
+    else
+      useCandidates = mailbox->getSentDayMatches(day, INT_MAX, candidates);
+    break;
+  default:
+    break;
+  }
+
+  // Estimate what testing one message costs and how many messages
+  // pass, from the statistics and the candidate lists.
+  double found = 0;
+  if (useCandidates && stats.messages != 0) {
+    found = (double) candidates.size() / stats.messages;
+    if (found > 1)
+      found = 1;
+  }
+
+  switch (type) {
+  case S_ALL:
+  case S_UNKEYWORD:
+    cost = 0;
+    selectivity = 1;
+    break;
+  case S_KEYWORD:
+    cost = 0;
+    selectivity = 0;
+    break;
+  case S_ANSWERED:
+    cost = MEMORY_COST;
+    selectivity = stats.fraction(Message::F_ANSWERED);
+    break;
+  case S_DELETED:
+    cost = MEMORY_COST;
+    selectivity = stats.fraction(Message::F_DELETED);
+    break;
+  case S_DRAFT:
+    cost = MEMORY_COST;
+    selectivity = stats.fraction(Message::F_DRAFT);
+    break;
+  case S_FLAGGED:
+    cost = MEMORY_COST;
+    selectivity = stats.fraction(Message::F_FLAGGED);
+    break;
+  case S_RECENT:
+    cost = MEMORY_COST;
+    selectivity = stats.fraction(Message::F_RECENT);
+    break;
+  case S_SEEN:
+    cost = MEMORY_COST;
+    selectivity = stats.fraction(Message::F_SEEN);
+    break;
+  case S_UNANSWERED:
+    cost = MEMORY_COST;
+    selectivity = 1 - stats.fraction(Message::F_ANSWERED);
+    break;
+  case S_UNDELETED:
+    cost = MEMORY_COST;
+    selectivity = 1 - stats.fraction(Message::F_DELETED);
+    break;
+  case S_UNDRAFT:
+    cost = MEMORY_COST;
+    selectivity = 1 - stats.fraction(Message::F_DRAFT);
+    break;
+  case S_UNFLAGGED:
+    cost = MEMORY_COST;
+    selectivity = 1 - stats.fraction(Message::F_FLAGGED);
+    break;
+  case S_UNSEEN:
+    cost = MEMORY_COST;
+    selectivity = 1 - stats.fraction(Message::F_SEEN);
+    break;
+  case S_NEW:
+    cost = MEMORY_COST;
+    selectivity = stats.fraction(Message::F_RECENT)
+      * (1 - stats.fraction(Message::F_SEEN));
+    break;
+  case S_OLD:
+    cost = MEMORY_COST;
+    selectivity = 1 - stats.fraction(Message::F_RECENT);
+    break;
+  case S_UID:
+  case S_SET:
+  case S_BEFORE:
+  case S_SINCE:
+  case S_MODSEQ:
+    cost = MEMORY_COST;
+    selectivity = RANGE_SELECTIVITY;
+    break;
+  case S_ON:
+    cost = MEMORY_COST;
+    selectivity = DAY_SELECTIVITY;
+    break;
+  case S_LARGER:
+  case S_SMALLER:
+    // Messages without a known size are parsed to find it.
+    cost = MEMORY_COST;
+    if (stats.messages != 0)
+      cost += BODY_COST * stats.unsized / stats.messages;
+    selectivity = RANGE_SELECTIVITY;
+    break;
+  case S_BCC:
+  case S_CC:
+  case S_FROM:
+  case S_HEADER:
+  case S_SUBJECT:
+  case S_TO:
+    cost = useCandidates ? COLUMN_COST : HEADER_COST;
+    selectivity = useCandidates ? found : TEXT_SELECTIVITY;
+    break;
+  case S_SENTBEFORE:
+  case S_SENTON:
+  case S_SENTSINCE:
+    cost = useCandidates ? COLUMN_COST : HEADER_COST;
+    if (useCandidates)
+      selectivity = found;
+    else
+      selectivity = type == S_SENTON ? DAY_SELECTIVITY : RANGE_SELECTIVITY;
+    break;
+  case S_BODY:
+  case S_TEXT:
+    // The candidates only rule messages out, so the ones that are
+    // left are still read.
+    if (useCandidates) {
+      cost = COLUMN_COST + BODY_COST * found;
+      selectivity = found < TEXT_SELECTIVITY ? found : TEXT_SELECTIVITY;
+    } else {
+      cost = BODY_COST;
+      selectivity = TEXT_SELECTIVITY;
+    }
+    break;
+  case S_NOT:
+    cost = 0;
+    selectivity = 1;
+    if (!children.empty()) {
+      cost = children[0].cost;
+      selectivity = 1 - children[0].selectivity;
+    }
+    break;
+  case S_AND: {
+    ::stable_sort(children.begin(), children.end(), compareAndNodes);
+
+    // Each test only runs on the messages that passed the ones
+    // before it.
+    double pass = 1;
+    cost = 0;
+    for (vector<SearchNode>::const_iterator i = children.begin();
+	 i != children.end(); ++i) {
+      cost += pass * (*i).cost;
+      pass *= (*i).selectivity;
+    }
+
+    selectivity = pass;
+    break;
+  }
+  case S_OR: {
+    ::stable_sort(children.begin(), children.end(), compareOrNodes);
+
+    double fail = 1;
+    cost = 0;
+    for (vector<SearchNode>::const_iterator i = children.begin();
+	 i != children.end(); ++i) {
+      cost += fail * (*i).cost;
+      fail *= 1 - (*i).selectivity;
+    }
+
+    selectivity = 1 - fail;
+    break;
+  }
+  default:
+    break;
+  }
 }
 
 //----------------------------------------------------------------------
-SearchOperator::SearchOperator(void)
+SearchOperator::SearchOperator(void) : cacheStamp(0)
 {
 }
 
@@ -541,33 +1365,190 @@ Operator::ProcessResult SearchOperator::process(Depot &depot,
   Mailbox *mailbox = depot.getSelected();
 
   if (command.getCharSet() != "" && command.getCharSet() != "US-ASCII") {
+    // A SEARCH that fails leaves nothing saved for "$".
+    const vector<string> &returns = command.getReturns();
+    if (find(returns.begin(), returns.end(), "SAVE") != returns.end())
+      mailbox->setSavedResult(SequenceSet());
+
     session.setLastError("[BADCHARSET (\"US-ASCII\")]");
     return NO;
   }
 
-  com << "* SEARCH";
-
-  SearchNode s(command.searchkey);
-  s.order();
+  Results results(com, command, mailbox);
+  search(mailbox, command, results);
+  return OK;
+}
 
+//------------------------------------------------------------------------
+void SearchOperator::search(Mailbox *mailbox, Request &command,
+			    Results &results)
+{
   const unsigned int maxsqnr = mailbox->getMaxSqnr();
   const unsigned int maxuid = mailbox->getMaxUid();
 
-  Mailbox::iterator i
+  // A MODSEQ test enables CONDSTORE.
+  if (hasModSeq(command.searchkey))
+    Session::getInstance().condstore = true;
+
+  // Repeated searches are answered from the cache for as long as
+  // nothing in the mailbox has changed.
+  if (mailbox->getChangeStamp() != cacheStamp
+      || mailbox->getName() != cacheMailbox) {
+    cache.clear();
+    cacheStamp = mailbox->getChangeStamp();
+    cacheMailbox = mailbox->getName();
+  }
+
+  const string key = keyToString(command.searchkey, mailbox);
+  map<string, SequenceSet>::const_iterator c = cache.find(key);
+  if (c != cache.end()) {
+    Mailbox::iterator i = mailbox->begin(c->second, Mailbox::SKIP_EXPUNGED
+					 | Mailbox::UID_MODE);
+    for (; i != mailbox->end() && !results.isDone(); ++i)
+      results.add(i.getSqnr(), (*i).getUID());
+
+    results.finish();
+    return;
+  }
+
+  Statistics stats;
+  Mailbox::iterator j
     = mailbox->begin(SequenceSet::all(), Mailbox::SKIP_EXPUNGED);
-  for (; i != mailbox->end(); ++i) {
-    Message &message = *i;
+  for (; j != mailbox->end(); ++j)
+    stats.add(*j);
+
+  SearchNode s(command.searchkey);
+  s.prepare(mailbox, stats);
+
+  unsigned int count;
+  if (results.onlyCount() && s.getCount(stats, count)) {
+    results.setCount(count);
+    results.finish();
+    return;
+  }
+
+  // Only visit the messages in a UID or sequence set that every
+  // match must be in. The set's "*" also matches the last message.
+  SequenceSet range = SequenceSet::all();
+  unsigned int mode = Mailbox::SKIP_EXPUNGED | Mailbox::SQNR_MODE;
+  const SearchNode *r = s.getRange();
+  if (r != 0) {
+    range = r->getSet();
+    if (r->getType() == SearchNode::S_UID) {
+      mode = Mailbox::SKIP_EXPUNGED | Mailbox::UID_MODE;
+      if (!range.isLimited())
+	range.addNumber(maxuid);
+    } else if (!range.isLimited())
+      range.addNumber(maxsqnr);
+  }
+
+  vector<SearchNode *> scans;
+  s.getScans(scans);
 
-    if (s.match(mailbox, &message, i.getSqnr(), maxsqnr, maxuid)) {
-      com << " " << (command.getUidMode() ?  message.getUID() : i.getSqnr());
-      com.flushContent();
+#ifdef WITH_PTHREAD
+  Session &session = Session::getInstance();
+  unsigned int threads
+    = atoi(session.globalconfig["Mailbox"]["search threads"].c_str());
+  if (threads > 1 && !scans.empty()) {
+    // Decide what can be decided without the BODY and TEXT tests
+    // first, then run the tests the rest need on several threads,
+    // one batch at a time, and report the matches in order.
+    bool onlyTextParts
+      = session.globalconfig["Mailbox"]["search text parts only"] == "yes";
+    vector<ScanTest> tests;
+    for (vector<SearchNode *>::const_iterator k = scans.begin();
+	 k != scans.end(); ++k)
+      tests.push_back(ScanTest((*k)->getText(),
+			       (*k)->getType() == SearchNode::S_BODY,
+			       onlyTextParts));
+
+    double budget
+      = atof(session.globalconfig["Mailbox"]["search cpu budget"].c_str());
+    ScanPool pool(tests, threads, budget);
+
+    // Matches in the current batch; -1 for a message that needs no
+    // tests, or its index in the pool.
+    vector<ScanHit> hits;
+    vector<char> needed(scans.size());
+
+    Mailbox::iterator i = mailbox->begin(range, mode);
+    for (;;) {
+      bool done = !(i != mailbox->end());
+      if (!done) {
+	Message &message = *i;
+
+	fill(needed.begin(), needed.end(), (char) M_LATER);
+	int r = s.match(mailbox, &message, i.getSqnr(), maxsqnr, maxuid,
+			&needed[0]);
+	if (r == M_YES)
+	  hits.push_back(ScanHit(i.getSqnr(), message.getUID(), -1));
+	else if (r == M_LATER) {
+	  hits.push_back(ScanHit(i.getSqnr(), message.getUID(),
+				 (int) pool.size()));
+	  pool.add(&message, i.getSqnr(), message.getSearchFile(), needed);
+	}
+
+	message.close();
+	++i;
+      }
+
+      if (!done && pool.size() < SCAN_BATCH)
+	continue;
+
+      pool.run();
+
+      for (vector<ScanHit>::const_iterator k = hits.begin();
+	   k != hits.end() && !results.isDone(); ++k) {
+	if ((*k).test != -1) {
+	  Message *message = pool.getMessage((*k).test);
+	  int r = s.match(mailbox, message, (*k).sqnr, maxsqnr, maxuid,
+			  pool.getResults((*k).test));
+	  message->close();
+	  if (r != M_YES)
+	    continue;
+	}
+
+	results.add((*k).sqnr, (*k).uid);
+      }
+
+      hits.clear();
+      pool.clear();
+
+      if (done || results.isDone())
+	break;
     }
 
+    if (!results.isDone())
+      addToCache(key, results.getUids());
+
+    results.finish();
+    return;
+  }
+#endif
+
+  Mailbox::iterator i = mailbox->begin(range, mode);
+  for (; i != mailbox->end() && !results.isDone(); ++i) {
+    Message &message = *i;
+
+    if (s.match(mailbox, &message, i.getSqnr(), maxsqnr, maxuid))
+      results.add(i.getSqnr(), message.getUID());
+
     message.close();
   }
 
-  com << endl;
-  return OK;
+  if (!results.isDone())
+    addToCache(key, results.getUids());
+
+  results.finish();
+}
+
+//------------------------------------------------------------------------
+void SearchOperator::addToCache(const string &key, const SequenceSet &uids)
+{
+  if (cache.size() >= SEARCH_CACHE_SIZE)
+    cache.clear();
+
+  cache[key] = uids;
 }
 
 //------------------------------------------------------------------------
@@ -581,6 +1562,50 @@ Operator::ParseResult SearchOperator::parse(Request & c_in) const
     return res;
   }
 
+  if ((res = expectThisString("RETURN")) == ACCEPT) {
+    if ((res = expectSPACE()) != ACCEPT) {
+      session.setLastError("Expected SPACE after RETURN");
+      return res;
+    }
+
+    if ((res = expectThisString("(")) != ACCEPT) {
+      session.setLastError("Expected ( after RETURN SPACE");
+      return res;
+    }
+
+    while (1) {
+      if ((res = expectThisString("MIN")) == ACCEPT)
+	c_in.getReturns().push_back("MIN");
+      else if ((res = expectThisString("MAX")) == ACCEPT)
+	c_in.getReturns().push_back("MAX");
+      else if ((res = expectThisString("COUNT")) == ACCEPT)
+	c_in.getReturns().push_back("COUNT");
+      else if ((res = expectThisString("ALL")) == ACCEPT)
+	c_in.getReturns().push_back("ALL");
+      else if ((res = expectThisString("SAVE")) == ACCEPT)
+	c_in.getReturns().push_back("SAVE");
+      else
+	break;
+
+      if (expectSPACE() != ACCEPT)
+	break;
+    }
+
+    if ((res = expectThisString(")")) != ACCEPT) {
+      session.setLastError("Expected search_return_opt or )");
+      return res;
+    }
+
+    // RETURN () means the same as RETURN (ALL).
+    if (c_in.getReturns().empty())
+      c_in.getReturns().push_back("ALL");
+
+    if ((res = expectSPACE()) != ACCEPT) {
+      session.setLastError("Expected SPACE after RETURN options");
+      return res;
+    }
+  }
+
   if ((res = expectThisString("CHARSET")) == ACCEPT) {
     if ((res = expectSPACE()) != ACCEPT) {
       session.setLastError("Expected SPACE after CHARSET");
@@ -601,6 +1626,19 @@ Operator::ParseResult SearchOperator::parse(Request & c_in) const
     }
   }
 
+  if ((res = expectSearchKeys(c_in)) != ACCEPT)
+    return res;
+
+  c_in.setName("SEARCH");
+  return ACCEPT;
+}
+
+//----------------------------------------------------------------------
+Operator::ParseResult SearchOperator::expectSearchKeys(Request &c_in) const
+{
+  Session &session = Session::getInstance();
+
+  Operator::ParseResult res;
   BincImapParserSearchKey b;
   if ((res = expectSearchKey(b)) != ACCEPT) {
     session.setLastError("Expected search_key");
@@ -627,8 +1665,7 @@ Operator::ParseResult SearchOperator::parse(Request & c_in) const
     session.setLastError("Expected CRLF after search_key");
     return res;
   }
-  
-  c_in.setName("SEARCH");
+
   return ACCEPT;
 }
 
@@ -818,6 +1855,46 @@ SearchOperator::expectSearchKey(BincImapParserSearchKey &s_in) const
       return res;
     }
 	
+    if ((res = expectNumber(s_in.number)) != ACCEPT) {
+      session.setLastError("Expected number");
+      return res;
+    }
+  } else if ((res = expectThisString("MODSEQ")) == ACCEPT) {
+    s_in.name = "MODSEQ";
+    if ((res = expectSPACE()) != ACCEPT) {
+      session.setLastError("Expected SPACE");
+      return res;
+    }
+
+    // The optional entry names a flag and its type. Flags have no
+    // mod-sequences of their own here, so only the syntax matters.
+    string entry;
+    if ((res = expectQuoted(entry)) == ACCEPT) {
+      if ((res = expectSPACE()) != ACCEPT) {
+	session.setLastError("Expected SPACE");
+	return res;
+      }
+
+      string entrytype;
+      if ((res = expectAtom(entrytype)) != ACCEPT) {
+	session.setLastError("Expected entry type");
+	return res;
+      }
+
+      lowercase(entrytype);
+      if (entrytype != "priv" && entrytype != "shared"
+	  && entrytype != "all") {
+	session.setLastError("Expected priv, shared or all");
+	return REJECT;
+      }
+
+      if ((res = expectSPACE()) != ACCEPT) {
+	session.setLastError("Expected SPACE");
+	return res;
+      }
+    } else if (res != REJECT)
+      return res;
+
     if ((res = expectNumber(s_in.number)) != ACCEPT) {
       session.setLastError("Expected number");
       return res;
@@ -46,6 +46,74 @@
 using namespace ::std;
 using namespace Binc;
 
+namespace {
+
+  //----------------------------------------------------------------------
+  Operator::ParseResult expectQresyncParameters(Request &c_in)
+  {
+    Session &session = Session::getInstance();
+
+    Operator::ParseResult res;
+    if ((res = expectSPACE()) != Operator::ACCEPT
+	|| (res = expectThisString("(")) != Operator::ACCEPT) {
+      session.setLastError("Expected SPACE ( after QRESYNC");
+      return res;
+    }
+
+    if ((res = expectNZNumber(c_in.knownuidvalidity)) != Operator::ACCEPT
+	|| (res = expectSPACE()) != Operator::ACCEPT
+	|| (res = expectNZNumber(c_in.modseq)) != Operator::ACCEPT) {
+      session.setLastError("Expected uidvalidity SPACE mod-sequence");
+      return res;
+    }
+
+    c_in.qresync = true;
+    c_in.hasmodseq = true;
+
+    // The sequence numbers that go with known UIDs are only a hint,
+    // and are not used.
+    bool match = false;
+    if (expectSPACE() == Operator::ACCEPT) {
+      if (expectThisString("(") == Operator::ACCEPT)
+	match = true;
+      else {
+	if ((res = expectSet(c_in.knownuids)) != Operator::ACCEPT) {
+	  session.setLastError("Expected known UIDs");
+	  return res;
+	}
+
+	if (expectSPACE() == Operator::ACCEPT) {
+	  if ((res = expectThisString("(")) != Operator::ACCEPT) {
+	    session.setLastError("Expected (");
+	    return res;
+	  }
+
+	  match = true;
+	}
+      }
+    }
+
+    if (match) {
+      SequenceSet sqnrs;
+      SequenceSet uids;
+      if ((res = expectSet(sqnrs)) != Operator::ACCEPT
+	  || (res = expectSPACE()) != Operator::ACCEPT
+	  || (res = expectSet(uids)) != Operator::ACCEPT
+	  || (res = expectThisString(")")) != Operator::ACCEPT) {
+	session.setLastError("Expected (known-sequence-set known-uid-set)");
+	return res;
+      }
+    }
+
+    if ((res = expectThisString(")")) != Operator::ACCEPT) {
+      session.setLastError("Expected )");
+      return res;
+    }
+
+    return Operator::ACCEPT;
+  }
+}
+
 //----------------------------------------------------------------------
 SelectOperator::SelectOperator(void)
 {
@@ -83,10 +151,23 @@ Operator::ProcessResult SelectOperator::process(Depot &depot,
   const string &srcmailbox = command.getMailbox();
   const string &canonmailbox = toCanonMailbox(srcmailbox);
 
+  if (command.qresync && !session.qresync) {
+    session.setLastError("QRESYNC is not enabled");
+    return BAD;
+  }
+
+  if (command.condstore)
+    session.condstore = true;
+
   Mailbox *mailbox = depot.getSelected();
   if (mailbox != 0) {
     mailbox->closeMailbox();
     mailbox = 0;
+
+    // With QRESYNC, the client is told where the responses for the
+    // old mailbox end and those for the new one begin.
+    if (session.qresync && session.getState() == Session::SELECTED)
+      com << "* OK [CLOSED] Previous mailbox closed" << endl;
   }
 
   mailbox = depot.get(canonmailbox);
@@ -145,6 +226,33 @@ Operator::ProcessResult SelectOperator::process(Depot &depot,
       << "\\Seen \\Draft)] Limited" 
       << endl;
 
+  // highestmodseq
+  com << "*" << " OK [HIGHESTMODSEQ " << mailbox->getHighestModSeq()
+      << "] Highest" << endl;
+
+  // With QRESYNC, the client is told what went and what changed
+  // since it last saw the mailbox, if the UIDs are still the same.
+  if (command.qresync
+      && command.knownuidvalidity == mailbox->getUidValidity()) {
+    const SequenceSet &known = command.knownuids.isEmpty()
+      ? SequenceSet::all() : command.knownuids;
+
+    SequenceSet vanished;
+    mailbox->getVanished(known, vanished);
+    if (!vanished.isEmpty())
+      com << "* VANISHED (EARLIER) " << vanished.toString() << endl;
+
+    Mailbox::iterator i = mailbox->begin(known, Mailbox::SKIP_EXPUNGED
+					 | Mailbox::UID_MODE);
+    for (; i != mailbox->end(); ++i) {
+      Message &message = *i;
+      if (message.getModSeq() > command.modseq)
+	com << "* " << i.getSqnr() << " FETCH (UID " << message.getUID()
+	    << " FLAGS " << Message::getStdFlagList(message.getStdFlags())
+	    << " MODSEQ (" << message.getModSeq() << "))" << endl;
+    }
+  }
+
   session.setState(Session::SELECTED);
   depot.setSelected(mailbox);
 
@@ -179,6 +287,36 @@ Operator::ParseResult SelectOperator::parse(Request &c_in) const
     return res;
   }
 
+  // RFC 7162 parameters: (CONDSTORE) or (QRESYNC (uidvalidity
+  // modseq [known-uids] [(known-sequence-set known-uid-set)])).
+  if (expectSPACE() == ACCEPT) {
+    if ((res = expectThisString("(")) != ACCEPT) {
+      session.setLastError("Expected ( after " + c_in.getName()
+			   + " SPACE mailbox SPACE");
+      return res;
+    }
+
+    for (;;) {
+      if (expectThisString("CONDSTORE") == ACCEPT)
+	c_in.condstore = true;
+      else if (expectThisString("QRESYNC") == ACCEPT) {
+	if ((res = expectQresyncParameters(c_in)) != ACCEPT)
+	  return res;
+      } else {
+	session.setLastError("Expected CONDSTORE or QRESYNC");
+	return ERROR;
+      }
+
+      if (expectSPACE() != ACCEPT)
+	break;
+    }
+
+    if ((res = expectThisString(")")) != ACCEPT) {
+      session.setLastError("Expected )");
+      return res;
+    }
+  }
+
   if ((res = expectCRLF()) != ACCEPT) {
     session.setLastError("Expected CRLF after " + c_in.getName()
 			 + " SPACE mailbox");
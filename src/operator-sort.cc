@@ -0,0 +1,250 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    operator-sort.cc
+ *  
+ *  Description:
+ *    Implementation of the SORT command.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "depot.h"
+#include "io.h"
+#include "mailbox.h"
+#include "operators.h"
+#include "recursivedescent.h"
+#include "session.h"
+#include "sortkeys.h"
+
+using namespace ::std;
+using namespace Binc;
+
+//----------------------------------------------------------------------
+SortOperator::SortOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+SortOperator::~SortOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+const string SortOperator::getName(void) const
+{
+  return "SORT";
+}
+
+//----------------------------------------------------------------------
+int SortOperator::getState(void) const
+{
+  return Session::SELECTED;
+}
+
+//------------------------------------------------------------------------
+bool SortOperator::checkCharSet(Request &command) const
+{
+  Session &session = Session::getInstance();
+
+  // Strings are matched byte by byte, which works for UTF-8 too.
+  string charset = command.getCharSet();
+  uppercase(charset);
+  if (charset != "US-ASCII" && charset != "UTF-8") {
+    session.setLastError("[BADCHARSET (\"US-ASCII\" \"UTF-8\")]");
+    return false;
+  }
+
+  return true;
+}
+
+//------------------------------------------------------------------------
+void SortOperator::readSortKeys(Mailbox *mailbox,
+				const vector<unsigned int> &uids,
+				SortKeys &keys) const
+{
+  // Without sort keys in the mailbox, the messages in uids are
+  // looked at now.
+  Mailbox::iterator i = mailbox->begin(SequenceSet::all(),
+				       Mailbox::SKIP_EXPUNGED);
+  for (; i != mailbox->end(); ++i) {
+    Message &message = *i;
+    if (!binary_search(uids.begin(), uids.end(), message.getUID()))
+      continue;
+
+    keys.add(message.getUID(), message);
+    message.close();
+  }
+}
+
+//------------------------------------------------------------------------
+Operator::ProcessResult SortOperator::process(Depot &depot,
+					      Request &command)
+{
+  IO &com = IOFactory::getInstance().get(1);
+
+  Mailbox *mailbox = depot.getSelected();
+  if (!checkCharSet(command))
+    return NO;
+
+  vector<SortKeys::Criterion> criteria;
+  bool reverse = false;
+  const vector<string> &c = command.getCriteria();
+  for (vector<string>::const_iterator i = c.begin(); i != c.end(); ++i) {
+    if (*i == "REVERSE") {
+      reverse = true;
+      continue;
+    }
+
+    SortKeys::Key key = SortKeys::ARRIVAL;
+    if (*i == "CC") key = SortKeys::CC;
+    else if (*i == "DATE") key = SortKeys::DATE;
+    else if (*i == "FROM") key = SortKeys::FROM;
+    else if (*i == "SIZE") key = SortKeys::SIZE;
+    else if (*i == "SUBJECT") key = SortKeys::SUBJECT;
+    else if (*i == "TO") key = SortKeys::TO;
+
+    criteria.push_back(SortKeys::Criterion(key, reverse));
+    reverse = false;
+  }
+
+  // The matches come as UID and sequence number, in ascending order.
+  vector<pair<unsigned int, unsigned int> > matches;
+  Results results(com, command, mailbox, &matches);
+  search(mailbox, command, results);
+
+  vector<unsigned int> uids;
+  for (vector<pair<unsigned int, unsigned int> >::const_iterator i
+	 = matches.begin(); i != matches.end(); ++i)
+    uids.push_back((*i).first);
+
+  if (!mailbox->sortMessages(criteria, uids)) {
+    SortKeys keys;
+    readSortKeys(mailbox, uids, keys);
+    keys.sort(criteria, uids);
+  }
+
+  com << "* SORT";
+  for (vector<unsigned int>::const_iterator i = uids.begin();
+       i != uids.end(); ++i) {
+    if (command.getUidMode()) {
+      com << " " << *i;
+      continue;
+    }
+
+    vector<pair<unsigned int, unsigned int> >::const_iterator m
+      = lower_bound(matches.begin(), matches.end(), make_pair(*i, 0U));
+    com << " " << (*m).second;
+  }
+
+  com << endl;
+  return OK;
+}
+
+//----------------------------------------------------------------------
+Operator::ParseResult SortOperator::parse(Request &c_in) const
+{
+  Session &session = Session::getInstance();
+
+  Operator::ParseResult res;
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE");
+    return res;
+  }
+
+  if ((res = expectThisString("(")) != ACCEPT) {
+    session.setLastError("Expected (");
+    return res;
+  }
+
+  while (1) {
+    if ((res = expectThisString("REVERSE")) == ACCEPT) {
+      c_in.getCriteria().push_back("REVERSE");
+      if ((res = expectSPACE()) != ACCEPT) {
+	session.setLastError("Expected SPACE after REVERSE");
+	return res;
+      }
+    }
+
+    if ((res = expectThisString("ARRIVAL")) == ACCEPT)
+      c_in.getCriteria().push_back("ARRIVAL");
+    else if ((res = expectThisString("CC")) == ACCEPT)
+      c_in.getCriteria().push_back("CC");
+    else if ((res = expectThisString("DATE")) == ACCEPT)
+      c_in.getCriteria().push_back("DATE");
+    else if ((res = expectThisString("FROM")) == ACCEPT)
+      c_in.getCriteria().push_back("FROM");
+    else if ((res = expectThisString("SIZE")) == ACCEPT)
+      c_in.getCriteria().push_back("SIZE");
+    else if ((res = expectThisString("SUBJECT")) == ACCEPT)
+      c_in.getCriteria().push_back("SUBJECT");
+    else if ((res = expectThisString("TO")) == ACCEPT)
+      c_in.getCriteria().push_back("TO");
+    else {
+      session.setLastError("Expected sort_key");
+      return res;
+    }
+
+    if (expectSPACE() != ACCEPT)
+      break;
+  }
+
+  if ((res = expectThisString(")")) != ACCEPT) {
+    session.setLastError("Expected )");
+    return res;
+  }
+
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE after sort criteria");
+    return res;
+  }
+
+  string charset;
+  if ((res = expectAstring(charset)) != ACCEPT) {
+    session.setLastError("Expected charset");
+    return res;
+  }
+
+  c_in.setCharSet(charset);
+
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE after charset");
+    return res;
+  }
+
+  if ((res = expectSearchKeys(c_in)) != ACCEPT)
+    return res;
+
+  c_in.setName("SORT");
+  return ACCEPT;
+}
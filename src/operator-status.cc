@@ -109,6 +109,16 @@ Operator::ProcessResult StatusOperator::process(Depot &depot,
       com << prefix << "UIDVALIDITY " << status.getUidValidity(); prefix = " ";
     } else if (tmp == "UNSEEN") {
       com << prefix << "UNSEEN " << status.getUnseen(); prefix = " ";
+    } else if (tmp == "HIGHESTMODSEQ") {
+      // The selected mailbox may have changes that are not saved yet.
+      Mailbox *selected = depot.getSelected();
+      unsigned int modseq = status.getHighestModSeq();
+      if (session.getState() == Session::SELECTED && selected != 0
+	  && selected->getName() == toCanonMailbox(command.getMailbox()))
+	modseq = selected->getHighestModSeq();
+
+      session.condstore = true;
+      com << prefix << "HIGHESTMODSEQ " << modseq; prefix = " ";
     }
   }
   com << ")" << endl;
@@ -159,6 +169,8 @@ Operator::ParseResult StatusOperator::parse(Request &c_in) const
       c_in.getStatuses().push_back("UIDVALIDITY");
     else if ((res = expectThisString("UNSEEN")) == ACCEPT)
       c_in.getStatuses().push_back("UNSEEN");
+    else if ((res = expectThisString("HIGHESTMODSEQ")) == ACCEPT)
+      c_in.getStatuses().push_back("HIGHESTMODSEQ");
     else {
       session.setLastError("Expected status_att");
       return res;
@@ -79,6 +79,10 @@ Operator::ProcessResult StoreOperator::process(Depot &depot,
 					       Request &command)
 {
   Mailbox *mailbox = depot.getSelected();
+  Session &session = Session::getInstance();
+
+  if (command.hasmodseq)
+    session.condstore = true;
 
   // mask all passed flags together
   unsigned int newflags = (unsigned int) Message::F_NONE;
@@ -99,9 +103,17 @@ Operator::ProcessResult StoreOperator::process(Depot &depot,
   Mailbox::iterator i
     = mailbox->begin(command.bset, Mailbox::SKIP_EXPUNGED | mode);
 
+  SequenceSet modified;
   for (; i != mailbox->end(); ++i) {
     Message &message = *i;
 
+    // messages that changed since the client last looked are left
+    // alone, and reported back.
+    if (command.hasmodseq && message.getModSeq() > command.modseq) {
+      modified.addNumber(command.getUidMode() ? message.getUID() : i.getSqnr());
+      continue;
+    }
+
     // get and reset the old flags
     unsigned int oldflags = (unsigned int) message.getStdFlags();
     unsigned int flags = oldflags;
@@ -134,6 +146,9 @@ Operator::ProcessResult StoreOperator::process(Depot &depot,
 		   | PendingUpdates::RECENT 
 		   | PendingUpdates::FLAGS, false);
 
+  if (!modified.isEmpty())
+    session.setResponseCode("MODIFIED " + modified.toString());
+
   return OK;
 }
 
@@ -158,6 +173,20 @@ Operator::ParseResult StoreOperator::parse(Request & c_in) const
     return res;
   }
 
+  // RFC 7162 modifier: (UNCHANGEDSINCE modseq)
+  if ((res = expectThisString("(")) == ACCEPT) {
+    if ((res = expectThisString("UNCHANGEDSINCE")) != ACCEPT
+	|| (res = expectSPACE()) != ACCEPT
+	|| (res = expectNumber(c_in.modseq)) != ACCEPT
+	|| (res = expectThisString(")")) != ACCEPT
+	|| (res = expectSPACE()) != ACCEPT) {
+      session.setLastError("Expected (UNCHANGEDSINCE mod-sequence) SPACE");
+      return res;
+    }
+
+    c_in.hasmodseq = true;
+  }
+
   string mode;
   if ((res = expectThisString("+")) == ACCEPT)
     mode = "+";
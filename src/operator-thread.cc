@@ -0,0 +1,213 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    operator-thread.cc
+ *  
+ *  Description:
+ *    Implementation of the THREAD command.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "depot.h"
+#include "io.h"
+#include "mailbox.h"
+#include "operators.h"
+#include "recursivedescent.h"
+#include "session.h"
+#include "sortkeys.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  //----------------------------------------------------------------------
+  // Writes a message and its replies. A message with one reply is
+  // followed by it in the same list.
+  void writeThread(IO &com, const vector<SortKeys::ThreadNode> &tree,
+		   unsigned int n)
+  {
+    for (;;) {
+      const SortKeys::ThreadNode &node = tree[n];
+      if (node.uid != 0) {
+	com << node.uid;
+	if (node.children.size() == 1) {
+	  com << " ";
+	  n = node.children[0];
+	  continue;
+	}
+
+	if (!node.children.empty())
+	  com << " ";
+      }
+
+      for (vector<unsigned int>::const_iterator i = node.children.begin();
+	   i != node.children.end(); ++i) {
+	com << "(";
+	writeThread(com, tree, *i);
+	com << ")";
+      }
+
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------
+ThreadOperator::ThreadOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+ThreadOperator::~ThreadOperator(void)
+{
+}
+
+//----------------------------------------------------------------------
+const string ThreadOperator::getName(void) const
+{
+  return "THREAD";
+}
+
+//----------------------------------------------------------------------
+int ThreadOperator::getState(void) const
+{
+  return Session::SELECTED;
+}
+
+//------------------------------------------------------------------------
+Operator::ProcessResult ThreadOperator::process(Depot &depot,
+						Request &command)
+{
+  IO &com = IOFactory::getInstance().get(1);
+
+  Mailbox *mailbox = depot.getSelected();
+  if (!checkCharSet(command))
+    return NO;
+
+  SortKeys::Algorithm algorithm = SortKeys::REFERENCES;
+  if (command.getCriteria()[0] == "ORDEREDSUBJECT")
+    algorithm = SortKeys::ORDEREDSUBJECT;
+
+  // The matches come as UID and sequence number, in ascending order.
+  vector<pair<unsigned int, unsigned int> > matches;
+  Results results(com, command, mailbox, &matches);
+  search(mailbox, command, results);
+
+  vector<unsigned int> uids;
+  for (vector<pair<unsigned int, unsigned int> >::const_iterator i
+	 = matches.begin(); i != matches.end(); ++i)
+    uids.push_back((*i).first);
+
+  vector<SortKeys::ThreadNode> tree;
+  if (!mailbox->threadMessages(algorithm, uids, tree)) {
+    SortKeys keys;
+    readSortKeys(mailbox, uids, keys);
+    keys.thread(algorithm, uids, tree);
+  }
+
+  if (!command.getUidMode())
+    for (vector<SortKeys::ThreadNode>::iterator i = tree.begin();
+	 i != tree.end(); ++i) {
+      if ((*i).uid == 0)
+	continue;
+
+      vector<pair<unsigned int, unsigned int> >::const_iterator m
+	= lower_bound(matches.begin(), matches.end(),
+		      make_pair((*i).uid, 0U));
+      (*i).uid = (*m).second;
+    }
+
+  com << "* THREAD";
+  if (!tree.empty()) {
+    const vector<unsigned int> &threads = tree[0].children;
+    if (!threads.empty())
+      com << " ";
+
+    for (vector<unsigned int>::const_iterator i = threads.begin();
+	 i != threads.end(); ++i) {
+      com << "(";
+      writeThread(com, tree, *i);
+      com << ")";
+    }
+  }
+
+  com << endl;
+  return OK;
+}
+
+//----------------------------------------------------------------------
+Operator::ParseResult ThreadOperator::parse(Request &c_in) const
+{
+  Session &session = Session::getInstance();
+
+  Operator::ParseResult res;
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE");
+    return res;
+  }
+
+  if ((res = expectThisString("ORDEREDSUBJECT")) == ACCEPT)
+    c_in.getCriteria().push_back("ORDEREDSUBJECT");
+  else if ((res = expectThisString("REFERENCES")) == ACCEPT)
+    c_in.getCriteria().push_back("REFERENCES");
+  else {
+    session.setLastError("Expected thread algorithm");
+    return res;
+  }
+
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE after thread algorithm");
+    return res;
+  }
+
+  string charset;
+  if ((res = expectAstring(charset)) != ACCEPT) {
+    session.setLastError("Expected charset");
+    return res;
+  }
+
+  c_in.setCharSet(charset);
+
+  if ((res = expectSPACE()) != ACCEPT) {
+    session.setLastError("Expected SPACE after charset");
+    return res;
+  }
+
+  if ((res = expectSearchKeys(c_in)) != ACCEPT)
+    return res;
+
+  c_in.setName("THREAD");
+  return ACCEPT;
+}
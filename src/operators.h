@@ -37,6 +37,7 @@
 
 #ifndef operators_h_included
 #define operators_h_included
+#include <map>
 #include <string>
 #include <vector>
 
@@ -45,6 +46,10 @@
 #include "message.h"
 
 namespace Binc {
+
+  class IO;
+  class Mailbox;
+  class SortKeys;
   
   //--------------------------------------------------------------------
   class Operator {
@@ -63,6 +68,12 @@ namespace Binc {
 
   //--------------------------------------------------------------------
   class AppendOperator : public Operator {
+  protected:
+    ProcessResult appendMessage(Mailbox *mailbox, const std::string &mbox,
+				const std::vector<std::string> &flags,
+				const std::string &date) const;
+    ParseResult expectFlagsAndDate(std::vector<std::string> &flags,
+				   std::string &date) const;
   public:
     ProcessResult process(Depot &, Request &);
     virtual ParseResult parse(Request &) const;
@@ -141,6 +152,19 @@ namespace Binc {
     ~CloseOperator(void);
   };
 
+  //--------------------------------------------------------------------
+  class CompressOperator : public Operator {
+  public:
+    ProcessResult process(Depot &, Request &);
+    virtual ParseResult parse(Request &) const;
+
+    const std::string getName(void) const;
+    int getState(void) const;
+
+    CompressOperator(void);
+    ~CompressOperator(void);
+  };
+
   //--------------------------------------------------------------------
   class CopyOperator : public Operator {
   public:
@@ -167,6 +191,19 @@ namespace Binc {
     ~DeleteOperator(void);
   };
 
+  //--------------------------------------------------------------------
+  class EnableOperator : public Operator {
+  public:
+    ProcessResult process(Depot &, Request &);
+    virtual ParseResult parse(Request &) const;
+
+    const std::string getName(void) const;
+    int getState(void) const;
+
+    EnableOperator(void);
+    ~EnableOperator(void);
+  };
+
   //--------------------------------------------------------------------
   class ExpungeOperator : public Operator {
   public:
@@ -199,6 +236,19 @@ namespace Binc {
     ~FetchOperator(void);
   };
 
+  //--------------------------------------------------------------------
+  class IdleOperator : public Operator {
+  public:
+    ProcessResult process(Depot &, Request &);
+    virtual ParseResult parse(Request &) const;
+
+    const std::string getName(void) const;
+    int getState(void) const;
+
+    IdleOperator(void);
+    ~IdleOperator(void);
+  };
+
   //--------------------------------------------------------------------
   class ListOperator : public Operator {
   protected:
@@ -283,6 +333,19 @@ namespace Binc {
     ~NoopPendingOperator(void);
   };
 
+  //--------------------------------------------------------------------
+  class NotifyOperator : public Operator {
+  public:
+    ProcessResult process(Depot &, Request &);
+    virtual ParseResult parse(Request &) const;
+
+    const std::string getName(void) const;
+    int getState(void) const;
+
+    NotifyOperator(void);
+    ~NotifyOperator(void);
+  };
+
   //--------------------------------------------------------------------
   class RenameOperator : public Operator {
   public:
@@ -301,6 +364,75 @@ namespace Binc {
   protected:
     ParseResult expectSearchKey(BincImapParserSearchKey &s_in) const;
 
+    //------------------------------------------------------------------
+    // What the search planner knows about the mailbox before it looks
+    // at any message: how many messages have each flag set, and how
+    // many have no known size yet.
+    class Statistics {
+    public:
+      unsigned int messages;
+      unsigned int unsized;
+      unsigned int flags[8];
+
+      void add(const Message &);
+      unsigned int count(unsigned char flag) const;
+      double fraction(unsigned char flag) const;
+
+      Statistics(void);
+    };
+
+    //------------------------------------------------------------------
+    // Reports the matches of a SEARCH. Without RETURN options, each
+    // match is written as soon as it is found. With them, only the
+    // lowest and highest match, the count and the matches as a
+    // sequence set are kept, and an ESEARCH response is written at
+    // the end. Given a list, the matches are only stored in it, as
+    // UID and sequence number. The UIDs of the matches are kept as a
+    // set of ranges, for RETURN (SAVE) and for the search cache.
+    class Results {
+    public:
+      void add(unsigned int sqnr, unsigned int uid);
+      void setCount(unsigned int n);
+      bool isDone(void) const;
+      bool onlyCount(void) const;
+      const SequenceSet &getUids(void);
+      void finish(void);
+
+      Results(IO &com, Request &command, Mailbox *mailbox,
+	      std::vector<std::pair<unsigned int, unsigned int> > *matches = 0);
+
+    private:
+      void endRun(void);
+      void endUidRun(void);
+      SequenceSet getReturnedUids(void);
+      unsigned int getHighestModSeq(void);
+
+      IO &com;
+      const Request &command;
+      Mailbox *mailbox;
+      std::vector<std::pair<unsigned int, unsigned int> > *matches;
+
+      bool esearch;
+      bool wantMin;
+      bool wantMax;
+      bool wantCount;
+      bool wantAll;
+      bool wantSave;
+      bool wantModSeq;
+
+      unsigned int min;
+      unsigned int max;
+      unsigned int count;
+      unsigned int first;
+      std::string all;
+
+      unsigned int minUid;
+      unsigned int firstUid;
+      unsigned int lastUid;
+      SequenceSet uids;
+      bool uidsDone;
+    };
+
     //------------------------------------------------------------------
     class SearchNode {
 
@@ -310,10 +442,19 @@ namespace Binc {
       unsigned int number;
       
       int type;
-      mutable int weight;
       const SequenceSet *bset;
       
       std::vector<SearchNode> children;
+
+      bool useCandidates;
+      std::vector<unsigned int> candidates;
+
+      int scan;
+
+      int day;
+
+      double cost;
+      double selectivity;
       
     public:
       enum {
@@ -322,30 +463,41 @@ namespace Binc {
 	S_SEEN, S_SINCE, S_SUBJECT, S_TEXT, S_TO, S_UNANSWERED,
 	S_UNDELETED, S_UNFLAGGED, S_UNKEYWORD, S_UNSEEN, S_DRAFT,
 	S_HEADER, S_LARGER, S_NOT, S_OR, S_SENTBEFORE, S_SENTON,
-	S_SENTSINCE, S_SMALLER, S_UID, S_UNDRAFT, S_SET, S_AND
+	S_SENTSINCE, S_SMALLER, S_UID, S_UNDRAFT, S_SET, S_AND,
+	S_MODSEQ
       };
       
       static bool convertDate(const std::string &date, time_t &t, const std::string &delim = "-");
-      static bool convertDateHeader(const std::string &d_in, time_t &t);
 
-      void order(void);
-      
-      bool match(Mailbox *, Message *, 
-		 unsigned seqnr, unsigned int lastmessage, 
-		 unsigned int lastuid) const;
+      void prepare(Mailbox *, const Statistics &);
+      const SearchNode *getRange(void) const;
+      bool getCount(const Statistics &, unsigned int &) const;
+      void getScans(std::vector<SearchNode *> &);
+
+      /*!
+	Returns 1 if the message matches, otherwise 0. If scans is
+	not 0, the BODY and TEXT tests are not run but read from
+	scans, in the order getScans() found them. A test that has
+	not been run yet is marked as needed there, and 2 is
+	returned if the outcome depends on it.
+      */
+      int match(Mailbox *, Message *, 
+		unsigned seqnr, unsigned int lastmessage, 
+		unsigned int lastuid, char *scans = 0) const;
       
       int getType(void) const;
-      int getWeight(void) const;
-      void setWeight(int i);
+      const std::string &getText(void) const;
+      const SequenceSet &getSet(void) const;
+      double getCost(void) const;
+      double getSelectivity(void) const;
       
       void init(const BincImapParserSearchKey &a);
 
       //-
-      static bool compareNodes(const SearchNode &a, 
-			       const SearchNode &b)
-      {
-	return a.getWeight() < b.getWeight();
-      }
+      static bool compareAndNodes(const SearchNode &a,
+				  const SearchNode &b);
+      static bool compareOrNodes(const SearchNode &a,
+				 const SearchNode &b);
       
       SearchNode(void);
       SearchNode(const BincImapParserSearchKey &a);
@@ -361,6 +513,50 @@ namespace Binc {
 
     SearchOperator(void);
     ~SearchOperator(void);
+
+  protected:
+    void search(Mailbox *mailbox, Request &command, Results &results);
+    ParseResult expectSearchKeys(Request &c_in) const;
+
+  private:
+    void addToCache(const std::string &key, const SequenceSet &uids);
+
+    // The UIDs that recent searches found, by search key. They are
+    // forgotten when the mailbox's change stamp moves.
+    std::map<std::string, SequenceSet> cache;
+    std::string cacheMailbox;
+    unsigned int cacheStamp;
+  };
+
+  //--------------------------------------------------------------------
+  class SortOperator : public SearchOperator {
+  public:
+    ProcessResult process(Depot &, Request &);
+    virtual ParseResult parse(Request &) const;
+
+    const std::string getName(void) const;
+    int getState(void) const;
+
+    SortOperator(void);
+    ~SortOperator(void);
+
+  protected:
+    bool checkCharSet(Request &command) const;
+    void readSortKeys(Mailbox *mailbox, const std::vector<unsigned int> &uids,
+		      SortKeys &keys) const;
+  };
+
+  //--------------------------------------------------------------------
+  class ThreadOperator : public SortOperator {
+  public:
+    ProcessResult process(Depot &, Request &);
+    virtual ParseResult parse(Request &) const;
+
+    const std::string getName(void) const;
+    int getState(void) const;
+
+    ThreadOperator(void);
+    ~ThreadOperator(void);
   };
 
   //--------------------------------------------------------------------
@@ -64,15 +64,26 @@ PendingUpdates::~PendingUpdates(void)
 }
 
 //------------------------------------------------------------------------
-void PendingUpdates::addExpunged(unsigned int uid)
+void PendingUpdates::addExpunged(unsigned int sqnr, unsigned int uid)
 {
-  expunges.push_back(uid);
+  expunges.push_back(sqnr);
+  expungedUids.addNumber(uid);
 }
 
 //------------------------------------------------------------------------
-void PendingUpdates::addFlagUpdates(unsigned int uid, unsigned int flags)
+void PendingUpdates::addFlagUpdates(unsigned int sqnr, unsigned int flags,
+				    unsigned int uid, unsigned int modseq)
 {
-  flagupdates[uid] = flags;
+  FlagUpdate &f = flagupdates[sqnr];
+  f.flags = flags;
+  f.uid = uid;
+  f.modseq = modseq;
+}
+
+//------------------------------------------------------------------------
+const SequenceSet &PendingUpdates::getExpungedUids(void) const
+{
+  return expungedUids;
 }
 
 //------------------------------------------------------------------------
@@ -165,7 +176,7 @@ PendingUpdates::flagupdates_const_iterator::flagupdates_const_iterator(void)
 }
 
 //------------------------------------------------------------------------
-PendingUpdates::flagupdates_const_iterator::flagupdates_const_iterator(map<unsigned int, unsigned int>::iterator i) : internal(i)
+PendingUpdates::flagupdates_const_iterator::flagupdates_const_iterator(map<unsigned int, FlagUpdate>::iterator i) : internal(i)
 {
 }
 
@@ -202,7 +213,19 @@ unsigned int PendingUpdates::flagupdates_const_iterator::first(void) const
 //------------------------------------------------------------------------
 unsigned int PendingUpdates::flagupdates_const_iterator::second(void) const
 {
-  return internal->second;
+  return internal->second.flags;
+}
+
+//------------------------------------------------------------------------
+unsigned int PendingUpdates::flagupdates_const_iterator::getUID(void) const
+{
+  return internal->second.uid;
+}
+
+//------------------------------------------------------------------------
+unsigned int PendingUpdates::flagupdates_const_iterator::getModSeq(void) const
+{
+  return internal->second.modseq;
 }
 
 //--------------------------------------------------------------------
@@ -222,12 +245,18 @@ bool Binc::pendingUpdates(Mailbox *mailbox, int type, bool rescan, bool showAll,
   }
 
   if (type & PendingUpdates::EXPUNGE) {
-    PendingUpdates::expunged_const_iterator i = p.beginExpunged();
-    PendingUpdates::expunged_const_iterator e = p.endExpunged();
-
-    while (i != e) {
-      com << "* " << *i << " EXPUNGE" << endl;
-      ++i;
+    // With QRESYNC, the client is told the UIDs instead.
+    if (session.qresync) {
+      if (!p.getExpungedUids().isEmpty())
+	com << "* VANISHED " << p.getExpungedUids().toString() << endl;
+    } else {
+      PendingUpdates::expunged_const_iterator i = p.beginExpunged();
+      PendingUpdates::expunged_const_iterator e = p.endExpunged();
+
+      while (i != e) {
+	com << "* " << *i << " EXPUNGE" << endl;
+	++i;
+      }
     }
   }
 
@@ -242,24 +271,13 @@ bool Binc::pendingUpdates(Mailbox *mailbox, int type, bool rescan, bool showAll,
     PendingUpdates::flagupdates_const_iterator e = p.endFlagUpdates();
 
     while (i != e) {
-      int flags = i.second();
-
-      vector<string> flagv;
-      if (flags & Message::F_SEEN) flagv.push_back("\\Seen");
-      if (flags & Message::F_ANSWERED) flagv.push_back("\\Answered");
-      if (flags & Message::F_DELETED) flagv.push_back("\\Deleted");
-      if (flags & Message::F_DRAFT) flagv.push_back("\\Draft");
-      if (flags & Message::F_RECENT) flagv.push_back("\\Recent");
-      if (flags & Message::F_FLAGGED) flagv.push_back("\\Flagged");
-
-      com << "* " << i.first() << " FETCH (FLAGS (";  
-      for (vector<string>::const_iterator k
-	     = flagv.begin(); k != flagv.end(); ++k) {
-	if (k != flagv.begin()) com << " ";
-	com << *k;
-      }
-	
-      com << "))" << endl;
+      com << "* " << i.first() << " FETCH (";
+      if (session.qresync)
+	com << "UID " << i.getUID() << " ";
+      com << "FLAGS " << Message::getStdFlagList(i.second());
+      if (session.condstore)
+	com << " MODSEQ (" << i.getModSeq() << ")";
+      com << ")" << endl;
 
       ++i;
     }
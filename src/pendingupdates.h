@@ -38,6 +38,8 @@
 #include <map>
 #include <vector>
 
+#include "imapparser.h"
+
 #ifndef pendingupdates_h_included
 #define pendingupdates_h_included
 
@@ -74,21 +76,31 @@ namespace Binc {
     expunged_const_iterator beginExpunged(void);
     expunged_const_iterator endExpunged(void);
 
+    //----------------------------------------------------------------------
+    class FlagUpdate {
+    public:
+      unsigned int flags;
+      unsigned int uid;
+      unsigned int modseq;
+    };
+
     //----------------------------------------------------------------------
     class flagupdates_const_iterator {
     private:
-      std::map<unsigned int, unsigned int>::iterator internal;
+      std::map<unsigned int, FlagUpdate>::iterator internal;
 
     public:
       unsigned int first(void) const;
       unsigned int second(void) const;
+      unsigned int getUID(void) const;
+      unsigned int getModSeq(void) const;
 
       void operator ++ (void);
       bool operator != (flagupdates_const_iterator) const;
 
       //--
       flagupdates_const_iterator(void);
-      flagupdates_const_iterator(std::map<unsigned int, unsigned int>::iterator i);
+      flagupdates_const_iterator(std::map<unsigned int, FlagUpdate>::iterator i);
     };
 
     //--
@@ -96,8 +108,10 @@ namespace Binc {
     flagupdates_const_iterator endFlagUpdates(void);
 
     //--
-    void addExpunged(unsigned int uid);
-    void addFlagUpdates(unsigned int uid, unsigned int flags);
+    void addExpunged(unsigned int sqnr, unsigned int uid);
+    void addFlagUpdates(unsigned int sqnr, unsigned int flags,
+			unsigned int uid, unsigned int modseq);
+    const SequenceSet &getExpungedUids(void) const;
     void setExists(unsigned int n);
     void setRecent(unsigned int n);
     unsigned int getExists(void) const;
@@ -111,7 +125,8 @@ namespace Binc {
 
   private:
     std::vector<unsigned int> expunges;
-    std::map<unsigned int, unsigned int> flagupdates;
+    SequenceSet expungedUids;
+    std::map<unsigned int, FlagUpdate> flagupdates;
 
     unsigned int exists;
     unsigned int recent;
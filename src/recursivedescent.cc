@@ -995,6 +995,18 @@ Operator::ParseResult Binc::expectSet(SequenceSet &s_in)
   
   Operator::ParseResult res;
 
+  /* "$" is the saved search result. it stands alone, and is never
+   * part of a longer set. */
+  if ((res = expectThisString("$")) == Operator::ACCEPT) {
+    if (!s_in.isEmpty()) {
+      session.setLastError("expected sequencenum");
+      return Operator::REJECT;
+    }
+
+    s_in.setSaved();
+    return Operator::ACCEPT;
+  }
+
   /* if a set does not start with a sequencenum, then it's not a
    * set. :-) seqnum == -1 means '*'. */
   if ((res = expectSequenceNum(seqnum)) != Operator::ACCEPT)
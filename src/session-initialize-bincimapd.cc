@@ -203,24 +203,53 @@ bool Session::initialize(int argc, char *argv[])
   brokerfactory.assign("CAPABILITY", new CapabilityOperator());
   brokerfactory.assign("CHECK", new CheckOperator());
   brokerfactory.assign("CLOSE", new CloseOperator());
+#ifdef WITH_ZLIB
+  brokerfactory.assign("COMPRESS", new CompressOperator());
+#endif
   brokerfactory.assign("COPY", new CopyOperator());
   brokerfactory.assign("CREATE", new CreateOperator());
   brokerfactory.assign("DELETE", new DeleteOperator());
+  brokerfactory.assign("ENABLE", new EnableOperator());
   brokerfactory.assign("EXAMINE", new ExamineOperator());
   brokerfactory.assign("EXPUNGE", new ExpungeOperator());
   brokerfactory.assign("FETCH", new FetchOperator());
+  brokerfactory.assign("IDLE", new IdleOperator());
   brokerfactory.assign("LIST", new ListOperator());
   brokerfactory.assign("LOGOUT", new LogoutOperator());
   brokerfactory.assign("LSUB", new LsubOperator());
   brokerfactory.assign("NOOP", new NoopPendingOperator());
+#ifdef HAVE_INOTIFY
+  brokerfactory.assign("NOTIFY", new NotifyOperator());
+#endif
   brokerfactory.assign("RENAME", new RenameOperator());
   brokerfactory.assign("SEARCH", new SearchOperator());
   brokerfactory.assign("SELECT", new SelectOperator());
+  brokerfactory.assign("SORT", new SortOperator());
   brokerfactory.assign("STATUS", new StatusOperator());
   brokerfactory.assign("STORE", new StoreOperator());
   brokerfactory.assign("SUBSCRIBE", new SubscribeOperator());
+  brokerfactory.assign("THREAD", new ThreadOperator());
   brokerfactory.assign("UNSUBSCRIBE", new UnsubscribeOperator());
 
+  brokerfactory.addCapability("IDLE");
+  brokerfactory.addCapability("MULTIAPPEND");
+  brokerfactory.addCapability("ENABLE");
+  brokerfactory.addCapability("CONDSTORE");
+  brokerfactory.addCapability("QRESYNC");
+  brokerfactory.addCapability("ESEARCH");
+  brokerfactory.addCapability("SEARCHRES");
+  brokerfactory.addCapability("SORT");
+  brokerfactory.addCapability("THREAD=ORDEREDSUBJECT");
+  brokerfactory.addCapability("THREAD=REFERENCES");
+
+#ifdef WITH_ZLIB
+  brokerfactory.addCapability("COMPRESS=DEFLATE");
+#endif
+
+#ifdef HAVE_INOTIFY
+  brokerfactory.addCapability("NOTIFY");
+#endif
+
   string path = session.globalconfig["Mailbox"]["path"];
   if (path == "") path = ".";
   else if (chdir(path.c_str()) != 0) {
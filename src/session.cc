@@ -61,6 +61,8 @@ Session::Session(void)
   idletimeout = 0;
   authtimeout = 0;
   mailboxchanges = true;
+  condstore = false;
+  qresync = false;
   logfacility = LOG_DAEMON;
 }
 
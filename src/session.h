@@ -66,6 +66,12 @@ namespace Binc {
 
     bool mailboxchanges;
 
+    // Set when the client has enabled CONDSTORE or QRESYNC (RFC
+    // 7162), which adds MODSEQ to flag updates and turns EXPUNGE
+    // into VANISHED.
+    bool condstore;
+    bool qresync;
+
     enum State {
       NONAUTHENTICATED = 0x01,
       AUTHENTICATED = 0x02,
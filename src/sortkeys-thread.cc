@@ -0,0 +1,346 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    sortkeys-thread.cc
+ *  
+ *  Description:
+ *    Implementation of THREAD in the SortKeys class.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc curly bincimap spot org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "sortkeys.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  // A message, or a Message-ID that is referred to, while threads
+  // are built. The row is -1 for a message that is not there.
+  class Container {
+  public:
+    int row;
+    int parent;
+    bool used;
+    vector<unsigned int> children;
+
+    Container(void) : row(-1), parent(-1), used(false) {}
+  };
+
+  //----------------------------------------------------------------------
+  // Returns true if a is b, or one of the parents of b.
+  bool isAncestor(const vector<Container> &c, int a, int b)
+  {
+    for (int i = b; i != -1; i = c[i].parent)
+      if (i == a)
+	return true;
+
+    return false;
+  }
+
+  //----------------------------------------------------------------------
+  // Returns the containers below root, each after its children.
+  void postOrder(const vector<Container> &c, unsigned int root,
+		 vector<unsigned int> &order)
+  {
+    vector<unsigned int> stack(1, root);
+    while (!stack.empty()) {
+      unsigned int n = stack.back();
+      stack.pop_back();
+      order.push_back(n);
+      stack.insert(stack.end(), c[n].children.begin(), c[n].children.end());
+    }
+
+    reverse(order.begin(), order.end());
+  }
+
+  //----------------------------------------------------------------------
+  // Orders nodes by sent date, and then by UID.
+  class CompareDates {
+  public:
+    bool operator ()(unsigned int a, unsigned int b) const
+    {
+      if (dates[a] != dates[b])
+	return dates[a] < dates[b];
+      return uids[a] < uids[b];
+    }
+
+    CompareDates(const vector<unsigned int> &d, const vector<unsigned int> &u)
+      : dates(d), uids(u) {}
+
+  private:
+    const vector<unsigned int> &dates;
+    const vector<unsigned int> &uids;
+  };
+
+  //----------------------------------------------------------------------
+  // Sorts all siblings below root by sent date. A missing message
+  // sorts as its first child.
+  void sortSiblings(vector<Container> &c, const vector<unsigned int> &sents,
+		    const vector<unsigned int> &uids)
+  {
+    vector<unsigned int> dates(c.size());
+    vector<unsigned int> first(c.size());
+
+    vector<unsigned int> order;
+    postOrder(c, 0, order);
+    for (vector<unsigned int>::const_iterator i = order.begin();
+	 i != order.end(); ++i) {
+      Container &n = c[*i];
+      stable_sort(n.children.begin(), n.children.end(),
+		  CompareDates(dates, first));
+
+      if (n.row != -1) {
+	dates[*i] = sents[n.row];
+	first[*i] = uids[n.row];
+      } else if (!n.children.empty()) {
+	dates[*i] = dates[n.children[0]];
+	first[*i] = first[n.children[0]];
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------
+  // Copies the containers below root into tree.
+  void makeTree(const vector<Container> &c, const vector<unsigned int> &uids,
+		vector<SortKeys::ThreadNode> &tree)
+  {
+    tree.clear();
+    tree.push_back(SortKeys::ThreadNode());
+
+    vector<unsigned int> containers(1, 0);
+    for (unsigned int i = 0; i < containers.size(); ++i) {
+      const vector<unsigned int> &children = c[containers[i]].children;
+      for (vector<unsigned int>::const_iterator j = children.begin();
+	   j != children.end(); ++j) {
+	tree[i].children.push_back(tree.size());
+	tree.push_back(SortKeys::ThreadNode(c[*j].row != -1
+					    ? uids[c[*j].row] : 0));
+	containers.push_back(*j);
+      }
+    }
+  }
+}
+
+//------------------------------------------------------------------------
+bool SortKeys::thread(Algorithm algorithm, const vector<unsigned int> &list,
+		      vector<ThreadNode> &tree) const
+{
+  vector<unsigned int> rows;
+  if (!getRows(list, rows))
+    return false;
+
+  if (algorithm == ORDEREDSUBJECT)
+    threadSubjects(rows, tree);
+  else
+    threadReferences(rows, tree);
+
+  return true;
+}
+
+//------------------------------------------------------------------------
+void SortKeys::threadSubjects(const vector<unsigned int> &rows,
+			      vector<ThreadNode> &tree) const
+{
+  // Messages with the same base subject make a thread, where the
+  // first message sent is the parent of the others.
+  vector<unsigned int> order(rows);
+  stable_sort(order.begin(), order.end(), CompareDates(sents, uids));
+
+  vector<Container> c(1);
+  map<unsigned int, unsigned int> threads;
+  for (vector<unsigned int>::const_iterator i = order.begin();
+       i != order.end(); ++i) {
+    unsigned int n = c.size();
+    c.push_back(Container());
+    c[n].row = *i;
+
+    const unsigned int subject = ids[SUBJECT_COLUMN][*i];
+    map<unsigned int, unsigned int>::const_iterator t = threads.find(subject);
+    if (t == threads.end()) {
+      threads[subject] = n;
+      c[0].children.push_back(n);
+    } else
+      c[t->second].children.push_back(n);
+  }
+
+  makeTree(c, uids, tree);
+}
+
+//------------------------------------------------------------------------
+void SortKeys::threadReferences(const vector<unsigned int> &rows,
+				vector<ThreadNode> &tree) const
+{
+  // There is a container for each Message-ID number, and container 0
+  // is the root. Messages without a Message-ID, or with one that is
+  // already taken, get containers of their own.
+  vector<Container> c(hashes.size());
+  c[0].used = true;
+
+  for (vector<unsigned int>::const_iterator i = rows.begin();
+       i != rows.end(); ++i) {
+    const unsigned int row = *i;
+    unsigned int n = messageIds[row];
+    if (n == 0 || c[n].row != -1) {
+      n = c.size();
+      c.push_back(Container());
+    }
+
+    c[n].row = row;
+    c[n].used = true;
+
+    // The references are linked in a chain, where they have no
+    // parent yet and no loop is made.
+    const unsigned int start = refStarts[row];
+    const unsigned int end
+      = row + 1 < uids.size() ? refStarts[row + 1] : refs.size();
+    for (unsigned int j = start; j < end; ++j) {
+      c[refs[j]].used = true;
+      if (j == start)
+	continue;
+
+      const int parent = refs[j - 1];
+      const int child = refs[j];
+      if (c[child].parent == -1 && !isAncestor(c, child, parent))
+	c[child].parent = parent;
+    }
+
+    // The last reference is the parent of the message, replacing
+    // any parent that was presumed from other messages.
+    c[n].parent = -1;
+    if (start != end && !isAncestor(c, n, refs[end - 1]))
+      c[n].parent = refs[end - 1];
+  }
+
+  for (unsigned int i = 1; i < c.size(); ++i)
+    if (c[i].used)
+      c[c[i].parent == -1 ? 0 : c[i].parent].children.push_back(i);
+
+  // Missing messages without replies are dropped, and those with
+  // replies give their place to them, except that several replies
+  // are not all made threads of their own.
+  vector<unsigned int> order;
+  postOrder(c, 0, order);
+  for (vector<unsigned int>::const_iterator i = order.begin();
+       i != order.end(); ++i) {
+    vector<unsigned int> kept;
+    const vector<unsigned int> &children = c[*i].children;
+    for (vector<unsigned int>::const_iterator j = children.begin();
+	 j != children.end(); ++j) {
+      const Container &child = c[*j];
+      if (child.row != -1 || (*i == 0 && child.children.size() > 1))
+	kept.push_back(*j);
+      else
+	kept.insert(kept.end(), child.children.begin(), child.children.end());
+    }
+
+    c[*i].children.swap(kept);
+  }
+
+  sortSiblings(c, sents, uids);
+
+  // Threads with the same base subject are put together. Each
+  // subject has one thread that the others join, preferably one
+  // whose first message is missing, or else one that does not start
+  // with a reply.
+  const vector<unsigned int> roots = c[0].children;
+  vector<int> subjects;
+  for (vector<unsigned int>::const_iterator i = roots.begin();
+       i != roots.end(); ++i) {
+    const int row = c[*i].row != -1 ? c[*i].row : c[c[*i].children[0]].row;
+    const unsigned int subject = ids[SUBJECT_COLUMN][row];
+    subjects.push_back(strings[SUBJECT_COLUMN][subject] != ""
+		       ? (int) subject : -1);
+  }
+
+  // The subject table holds a container and its place among the
+  // threads.
+  map<int, pair<unsigned int, unsigned int> > table;
+  for (unsigned int i = 0; i < roots.size(); ++i) {
+    if (subjects[i] == -1)
+      continue;
+
+    map<int, pair<unsigned int, unsigned int> >::iterator t
+      = table.find(subjects[i]);
+    if (t == table.end()) {
+      table[subjects[i]] = make_pair(roots[i], i);
+      continue;
+    }
+
+    const Container &a = c[t->second.first];
+    const Container &b = c[roots[i]];
+    if ((b.row == -1 && a.row != -1)
+	|| (b.row != -1 && a.row != -1 && replies[a.row] && !replies[b.row]))
+      t->second = make_pair(roots[i], i);
+  }
+
+  vector<int> slots(roots.begin(), roots.end());
+  for (unsigned int i = 0; i < roots.size(); ++i) {
+    if (subjects[i] == -1)
+      continue;
+
+    pair<unsigned int, unsigned int> &t = table[subjects[i]];
+    if (t.second == i)
+      continue;
+
+    const unsigned int k = roots[i];
+    slots[i] = -1;
+
+    if (c[t.first].row == -1 && c[k].row == -1)
+      c[t.first].children.insert(c[t.first].children.end(),
+				 c[k].children.begin(), c[k].children.end());
+    else if (c[t.first].row == -1)
+      c[t.first].children.push_back(k);
+    else if (!replies[c[t.first].row] && replies[c[k].row])
+      c[t.first].children.push_back(k);
+    else {
+      // Both become replies to a new missing message.
+      const unsigned int d = c.size();
+      c.push_back(Container());
+      c[d].children.push_back(t.first);
+      c[d].children.push_back(k);
+      slots[t.second] = d;
+      t.first = d;
+    }
+  }
+
+  c[0].children.clear();
+  for (vector<int>::const_iterator i = slots.begin(); i != slots.end(); ++i)
+    if (*i != -1)
+      c[0].children.push_back(*i);
+
+  sortSiblings(c, sents, uids);
+  makeTree(c, uids, tree);
+}
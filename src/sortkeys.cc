@@ -0,0 +1,785 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    sortkeys.cc
+ *  
+ *  Description:
+ *    Implementation of the Binc::SortKeys class.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "address.h"
+#include "convert.h"
+#include "message.h"
+#include "sortkeys.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  const string MAGIC = "BINCIMAP SORTKEYS 2\n";
+
+  const char *const months[12] = {
+    "jan", "feb", "mar", "apr", "may", "jun",
+    "jul", "aug", "sep", "oct", "nov", "dec"
+  };
+
+  //----------------------------------------------------------------------
+  // Returns the length of the subj-blob at pos, or 0.
+  string::size_type blobAt(const string &s, string::size_type pos)
+  {
+    if (pos >= s.length() || s[pos] != '[')
+      return 0;
+
+    string::size_type end = s.find_first_of("[]", pos + 1);
+    if (end == string::npos || s[end] != ']')
+      return 0;
+
+    ++end;
+    while (end < s.length() && s[end] == ' ')
+      ++end;
+
+    return end - pos;
+  }
+
+  //----------------------------------------------------------------------
+  // Returns the length of the subj-refwd at pos, or 0.
+  string::size_type refwdAt(const string &s, string::size_type pos)
+  {
+    string::size_type end = pos;
+    if (s.compare(end, 3, "FWD") == 0)
+      end += 3;
+    else if (s.compare(end, 2, "FW") == 0 || s.compare(end, 2, "RE") == 0)
+      end += 2;
+    else
+      return 0;
+
+    while (end < s.length() && s[end] == ' ')
+      ++end;
+
+    end += blobAt(s, end);
+    if (end >= s.length() || s[end] != ':')
+      return 0;
+
+    return end + 1 - pos;
+  }
+
+  //----------------------------------------------------------------------
+  // Returns the length of the subj-leader at the start of s, or 0.
+  string::size_type leaderAt(const string &s)
+  {
+    if (s != "" && s[0] == ' ')
+      return 1;
+
+    string::size_type pos = 0;
+    for (;;) {
+      string::size_type n = refwdAt(s, pos);
+      if (n != 0)
+	return pos + n;
+
+      n = blobAt(s, pos);
+      if (n == 0)
+	return 0;
+
+      pos += n;
+    }
+  }
+
+  //----------------------------------------------------------------------
+  // Returns the first mailbox name in an address header.
+  string firstMailbox(const string &header)
+  {
+    vector<string> addr;
+    splitAddr(unfold(header, true), addr);
+    if (addr.empty())
+      return "";
+
+    string tmp = Address(addr[0]).local;
+    uppercase(tmp);
+    return tmp;
+  }
+
+  //----------------------------------------------------------------------
+  // Returns the Message-IDs in a header, without white space.
+  void splitMessageIds(const string &header, vector<string> &ids)
+  {
+    string::size_type pos = 0;
+    for (;;) {
+      string::size_type start = header.find('<', pos);
+      if (start == string::npos)
+	return;
+
+      string::size_type end = header.find('>', start);
+      if (end == string::npos)
+	return;
+
+      string id;
+      for (string::size_type i = start; i <= end; ++i)
+	if (!isspace((unsigned char) header[i]))
+	  id += header[i];
+
+      if (id.length() > 2)
+	ids.push_back(id);
+      pos = end + 1;
+    }
+  }
+
+  //----------------------------------------------------------------------
+  // Orders the rows being sorted by their keys, one vector of keys
+  // per criterion.
+  class CompareRows {
+  public:
+    bool operator ()(unsigned int a, unsigned int b) const
+    {
+      for (unsigned int i = 0; i < keys.size(); ++i) {
+	const vector<unsigned int> &k = keys[i];
+	if (k[a] != k[b])
+	  return reverse[i] ? k[a] > k[b] : k[a] < k[b];
+      }
+
+      return false;
+    }
+
+    CompareRows(const vector<vector<unsigned int> > &k,
+		const vector<char> &r)
+      : keys(k), reverse(r) {}
+
+  private:
+    const vector<vector<unsigned int> > &keys;
+    const vector<char> &reverse;
+  };
+
+  //----------------------------------------------------------------------
+  // Orders the entries of a string table.
+  class CompareStrings {
+  public:
+    bool operator ()(unsigned int a, unsigned int b) const
+    {
+      return strings[a] < strings[b];
+    }
+
+    CompareStrings(const vector<string> &s) : strings(s) {}
+
+  private:
+    const vector<string> &strings;
+  };
+}
+
+//------------------------------------------------------------------------
+SortKeys::SortKeys(void)
+{
+  clear();
+  changed = false;
+}
+
+//------------------------------------------------------------------------
+void SortKeys::clear(unsigned int uidvalidity_in)
+{
+  uids.clear();
+  arrivals.clear();
+  sents.clear();
+  sizes.clear();
+  for (int c = 0; c < STRINGS; ++c) {
+    ids[c].clear();
+    strings[c].clear();
+    lookup[c].clear();
+  }
+
+  replies.clear();
+  messageIds.clear();
+  refStarts.clear();
+  refs.clear();
+  hashes.clear();
+  hashLookup.clear();
+  hashes.push_back(Hash(0, 0));
+
+  uidvalidity = uidvalidity_in;
+  changed = true;
+}
+
+//------------------------------------------------------------------------
+unsigned int SortKeys::intern(int column, const string &s)
+{
+  map<string, unsigned int>::const_iterator i = lookup[column].find(s);
+  if (i != lookup[column].end())
+    return i->second;
+
+  unsigned int id = strings[column].size();
+  strings[column].push_back(s);
+  lookup[column][s] = id;
+  return id;
+}
+
+//------------------------------------------------------------------------
+unsigned int SortKeys::internId(const string &messageId)
+{
+  // Two 32 bit hashes, FNV-1a and one from sdbm, make collisions
+  // between the Message-IDs of a mailbox unlikely.
+  unsigned int a = 2166136261U;
+  unsigned int b = 0;
+  for (string::const_iterator i = messageId.begin();
+       i != messageId.end(); ++i) {
+    unsigned char c = (unsigned char) *i;
+    a = (a ^ c) * 16777619U;
+    b = c + (b << 6) + (b << 16) - b;
+  }
+
+  Hash hash(a, b);
+  map<Hash, unsigned int>::const_iterator i = hashLookup.find(hash);
+  if (i != hashLookup.end())
+    return i->second;
+
+  unsigned int id = hashes.size();
+  hashes.push_back(hash);
+  hashLookup[hash] = id;
+  return id;
+}
+
+//------------------------------------------------------------------------
+void SortKeys::addRow(unsigned int uid, unsigned int arrival,
+		      unsigned int sent, unsigned int size, const string *v,
+		      bool reply, unsigned int messageId,
+		      const vector<unsigned int> &r)
+{
+  uids.push_back(uid);
+  arrivals.push_back(arrival);
+  sents.push_back(sent);
+  sizes.push_back(size);
+  for (int c = 0; c < STRINGS; ++c)
+    ids[c].push_back(intern(c, v[c]));
+
+  replies.push_back(reply);
+  messageIds.push_back(messageId);
+  refStarts.push_back(refs.size());
+  refs.insert(refs.end(), r.begin(), r.end());
+}
+
+//------------------------------------------------------------------------
+bool SortKeys::load(const string &fileName)
+{
+  FILE *fp = fopen(fileName.c_str(), "r");
+  if (fp == 0)
+    return false;
+
+  string data;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    data.append(buf, n);
+
+  bool error = ferror(fp) != 0;
+  fclose(fp);
+
+  if (error || data.compare(0, MAGIC.length(), MAGIC) != 0)
+    return false;
+
+  clear();
+
+  // The header is followed by the string tables and the Message-ID
+  // hashes, and then by the rows: the UID delta, the arrival and sent
+  // times, the size, an entry in each string table, the reply flag,
+  // the Message-ID and the references.
+  string::size_type pos = MAGIC.length();
+  unsigned int rows = 0;
+  bool complete = readVarint(data, pos, uidvalidity)
+    && readVarint(data, pos, rows);
+
+  vector<string> table[STRINGS];
+  for (int c = 0; complete && c < STRINGS; ++c) {
+    unsigned int count;
+    if (!readVarint(data, pos, count)) {
+      complete = false;
+      break;
+    }
+
+    for (unsigned int i = 0; i < count; ++i) {
+      unsigned int length;
+      if (!readVarint(data, pos, length) || length > data.length() - pos) {
+	complete = false;
+	break;
+      }
+
+      table[c].push_back(data.substr(pos, length));
+      pos += length;
+    }
+  }
+
+  unsigned int hashcount = 0;
+  if (complete && !readVarint(data, pos, hashcount))
+    complete = false;
+
+  for (unsigned int i = 0; complete && i < hashcount; ++i) {
+    Hash hash;
+    if (!readVarint(data, pos, hash.first)
+	|| !readVarint(data, pos, hash.second)) {
+      complete = false;
+      break;
+    }
+
+    hashLookup[hash] = hashes.size();
+    hashes.push_back(hash);
+  }
+
+  unsigned int uid = 0;
+  string v[STRINGS];
+  vector<unsigned int> r;
+  for (unsigned int i = 0; complete && i < rows; ++i) {
+    unsigned int delta, arrival, sent, size;
+    if (!readVarint(data, pos, delta) || !readVarint(data, pos, arrival)
+	|| !readVarint(data, pos, sent) || !readVarint(data, pos, size)) {
+      complete = false;
+      break;
+    }
+
+    for (int c = 0; c < STRINGS; ++c) {
+      unsigned int id;
+      if (!readVarint(data, pos, id) || id >= table[c].size()) {
+	complete = false;
+	break;
+      }
+
+      v[c] = table[c][id];
+    }
+
+    unsigned int reply, messageId, refcount;
+    if (!complete || !readVarint(data, pos, reply)
+	|| !readVarint(data, pos, messageId) || messageId >= hashes.size()
+	|| !readVarint(data, pos, refcount)) {
+      complete = false;
+      break;
+    }
+
+    r.clear();
+    for (unsigned int j = 0; j < refcount; ++j) {
+      unsigned int ref;
+      if (!readVarint(data, pos, ref) || ref >= hashes.size()) {
+	complete = false;
+	break;
+      }
+
+      r.push_back(ref);
+    }
+
+    uid += delta;
+    if (complete)
+      addRow(uid, arrival, sent, size, v, reply != 0, messageId, r);
+  }
+
+  if (!complete || pos != data.length()) {
+    clear();
+    return false;
+  }
+
+  changed = false;
+  return true;
+}
+
+//------------------------------------------------------------------------
+bool SortKeys::save(const string &fileName)
+{
+  // Write a temporary file and rename it in place, so that other
+  // instances never see a partial store.
+  string tpl = fileName + "XXXXXX";
+  vector<char> ftemplate(tpl.begin(), tpl.end());
+  ftemplate.push_back('\0');
+
+  int fd = mkstemp(&ftemplate[0]);
+  if (fd == -1)
+    return false;
+
+  FILE *fp = fdopen(fd, "w");
+  if (fp == 0) {
+    close(fd);
+    unlink(&ftemplate[0]);
+    return false;
+  }
+
+  string header = MAGIC;
+  appendVarint(header, uidvalidity);
+  appendVarint(header, uids.size());
+  for (int c = 0; c < STRINGS; ++c) {
+    appendVarint(header, strings[c].size());
+    for (vector<string>::const_iterator i = strings[c].begin();
+	 i != strings[c].end(); ++i) {
+      appendVarint(header, (*i).length());
+      header += *i;
+    }
+  }
+
+  appendVarint(header, hashes.size() - 1);
+  for (unsigned int i = 1; i < hashes.size(); ++i) {
+    appendVarint(header, hashes[i].first);
+    appendVarint(header, hashes[i].second);
+  }
+
+  fwrite(header.data(), 1, header.length(), fp);
+
+  unsigned int lastuid = 0;
+  for (unsigned int i = 0; i < uids.size(); ++i) {
+    string row;
+    appendVarint(row, uids[i] - lastuid);
+    appendVarint(row, arrivals[i]);
+    appendVarint(row, sents[i]);
+    appendVarint(row, sizes[i]);
+    for (int c = 0; c < STRINGS; ++c)
+      appendVarint(row, ids[c][i]);
+
+    const unsigned int start = refStarts[i];
+    const unsigned int end
+      = i + 1 < uids.size() ? refStarts[i + 1] : refs.size();
+    appendVarint(row, replies[i]);
+    appendVarint(row, messageIds[i]);
+    appendVarint(row, end - start);
+    for (unsigned int j = start; j < end; ++j)
+      appendVarint(row, refs[j]);
+
+    fwrite(row.data(), 1, row.length(), fp);
+    lastuid = uids[i];
+  }
+
+  bool error = ferror(fp) != 0;
+  if (fclose(fp) != 0 || error
+      || rename(&ftemplate[0], fileName.c_str()) != 0) {
+    unlink(&ftemplate[0]);
+    return false;
+  }
+
+  changed = false;
+  return true;
+}
+
+//------------------------------------------------------------------------
+void SortKeys::add(unsigned int uid, Message &message)
+{
+  string v[STRINGS];
+  bool reply;
+  v[SUBJECT_COLUMN] = getBaseSubject(message.getHeader("subject"), &reply);
+  v[FROM_COLUMN] = firstMailbox(message.getHeader("from"));
+  v[TO_COLUMN] = firstMailbox(message.getHeader("to"));
+  v[CC_COLUMN] = firstMailbox(message.getHeader("cc"));
+
+  // Messages without a usable Date header are sorted by their
+  // arrival.
+  unsigned int arrival = (unsigned int) message.getInternalDate();
+  unsigned int sent = (unsigned int) getSentTime(message.getHeader("date"));
+  if (sent == 0)
+    sent = arrival;
+
+  // The references are those of the References header, or else the
+  // first Message-ID in In-Reply-To.
+  vector<string> tmp;
+  splitMessageIds(message.getHeader("message-id"), tmp);
+  const string messageId = tmp.empty() ? "" : tmp[0];
+
+  tmp.clear();
+  splitMessageIds(message.getHeader("references"), tmp);
+  if (tmp.empty()) {
+    splitMessageIds(message.getHeader("in-reply-to"), tmp);
+    if (tmp.size() > 1)
+      tmp.resize(1);
+  }
+
+  vector<unsigned int> r;
+  for (vector<string>::const_iterator i = tmp.begin(); i != tmp.end(); ++i)
+    if (*i != messageId)
+      r.push_back(internId(*i));
+
+  addRow(uid, arrival, sent, message.getSize(true), v, reply,
+	 messageId != "" ? internId(messageId) : 0, r);
+  changed = true;
+}
+
+//------------------------------------------------------------------------
+void SortKeys::retain(const vector<unsigned int> &keep)
+{
+  // Message-ID numbers stay as they are, also for Message-IDs that
+  // are no longer used.
+  SortKeys tmp;
+  tmp.clear(uidvalidity);
+  tmp.hashes = hashes;
+  tmp.hashLookup = hashLookup;
+
+  string v[STRINGS];
+  vector<unsigned int> r;
+  for (unsigned int i = 0; i < uids.size(); ++i) {
+    if (!binary_search(keep.begin(), keep.end(), uids[i]))
+      continue;
+
+    for (int c = 0; c < STRINGS; ++c)
+      v[c] = strings[c][ids[c][i]];
+
+    const unsigned int end
+      = i + 1 < uids.size() ? refStarts[i + 1] : refs.size();
+    r.assign(refs.begin() + refStarts[i], refs.begin() + end);
+    tmp.addRow(uids[i], arrivals[i], sents[i], sizes[i], v, replies[i] != 0,
+	       messageIds[i], r);
+  }
+
+  *this = tmp;
+  changed = true;
+}
+
+//------------------------------------------------------------------------
+bool SortKeys::getRows(const vector<unsigned int> &list,
+		       vector<unsigned int> &rows) const
+{
+  for (vector<unsigned int>::const_iterator i = list.begin();
+       i != list.end(); ++i) {
+    vector<unsigned int>::const_iterator row
+      = lower_bound(uids.begin(), uids.end(), *i);
+    if (row == uids.end() || *row != *i)
+      return false;
+
+    rows.push_back(row - uids.begin());
+  }
+
+  return true;
+}
+
+//------------------------------------------------------------------------
+bool SortKeys::sort(const vector<Criterion> &criteria,
+		    vector<unsigned int> &list) const
+{
+  vector<unsigned int> rows;
+  if (!getRows(list, rows))
+    return false;
+
+  // Strings are compared through their rank in their table, so that
+  // all keys are numbers.
+  vector<unsigned int> ranks[STRINGS];
+  vector<vector<unsigned int> > keys(criteria.size());
+  vector<char> reverse(criteria.size());
+
+  for (unsigned int k = 0; k < criteria.size(); ++k) {
+    int column = -1;
+    switch (criteria[k].key) {
+    case SUBJECT: column = SUBJECT_COLUMN; break;
+    case FROM: column = FROM_COLUMN; break;
+    case TO: column = TO_COLUMN; break;
+    case CC: column = CC_COLUMN; break;
+    default: break;
+    }
+
+    if (column != -1 && ranks[column].empty()) {
+      const vector<string> &table = strings[column];
+      vector<unsigned int> order(table.size());
+      for (unsigned int i = 0; i < order.size(); ++i)
+	order[i] = i;
+      ::sort(order.begin(), order.end(), CompareStrings(table));
+
+      ranks[column].resize(table.size());
+      for (unsigned int i = 0; i < order.size(); ++i)
+	ranks[column][order[i]] = i;
+    }
+
+    vector<unsigned int> &key = keys[k];
+    key.resize(rows.size());
+    for (unsigned int i = 0; i < rows.size(); ++i) {
+      const unsigned int row = rows[i];
+      switch (criteria[k].key) {
+      case ARRIVAL: key[i] = arrivals[row]; break;
+      case DATE: key[i] = sents[row]; break;
+      case SIZE: key[i] = sizes[row]; break;
+      default: key[i] = ranks[column][ids[column][row]]; break;
+      }
+    }
+
+    reverse[k] = criteria[k].reverse;
+  }
+
+  vector<unsigned int> order(rows.size());
+  for (unsigned int i = 0; i < order.size(); ++i)
+    order[i] = i;
+  stable_sort(order.begin(), order.end(), CompareRows(keys, reverse));
+
+  vector<unsigned int> sorted(order.size());
+  for (unsigned int i = 0; i < order.size(); ++i)
+    sorted[i] = list[order[i]];
+
+  list.swap(sorted);
+  return true;
+}
+
+//------------------------------------------------------------------------
+string SortKeys::getBaseSubject(const string &subject, bool *reply)
+{
+  bool tmp;
+  if (reply == 0)
+    reply = &tmp;
+  *reply = false;
+
+  // Runs of white space become one space, and the subject is upper
+  // cased so that the rules below, and the comparisons, ignore case.
+  string s;
+  bool space = false;
+  for (string::const_iterator i = subject.begin(); i != subject.end(); ++i) {
+    if (*i == ' ' || *i == '\t' || *i == '\r' || *i == '\n') {
+      space = true;
+      continue;
+    }
+
+    if (space && s != "")
+      s += ' ';
+    space = false;
+    s += *i;
+  }
+
+  uppercase(s);
+
+  for (;;) {
+    // Remove trailing "(fwd)" and white space.
+    for (;;) {
+      chomp(s, " ");
+      if (s.length() < 5 || s.compare(s.length() - 5, 5, "(FWD)") != 0)
+	break;
+      s.erase(s.length() - 5);
+      *reply = true;
+    }
+
+    // Remove leading "Re:", "Fwd:" and [blob]s, as long as a subject
+    // is left.
+    bool changed = true;
+    while (changed) {
+      changed = false;
+
+      string::size_type n;
+      while ((n = leaderAt(s)) != 0) {
+	if (s[0] != ' ')
+	  *reply = true;
+	s.erase(0, n);
+	changed = true;
+      }
+
+      n = blobAt(s, 0);
+      if (n != 0 && n < s.length()) {
+	s.erase(0, n);
+	changed = true;
+      }
+    }
+
+    // "[fwd: subject]" is unwrapped, and the rules apply again.
+    if (s.length() >= 6 && s.compare(0, 5, "[FWD:") == 0
+	&& s[s.length() - 1] == ']') {
+      s = s.substr(5, s.length() - 6);
+      *reply = true;
+      continue;
+    }
+
+    return s;
+  }
+}
+
+//------------------------------------------------------------------------
+time_t SortKeys::getSentTime(const string &d_in)
+{
+  // Drop comments and the day of the week.
+  string date;
+  int depth = 0;
+  for (string::const_iterator i = d_in.begin(); i != d_in.end(); ++i) {
+    if (*i == '(')
+      ++depth;
+    else if (*i == ')' && depth > 0)
+      --depth;
+    else if (depth == 0)
+      date += *i;
+  }
+
+  lowercase(date);
+
+  string::size_type n = date.find(',');
+  if (n != string::npos)
+    date = date.substr(n + 1);
+
+  vector<string> parts;
+  split(date, " \t\r\n", parts);
+  if (parts.size() < 4)
+    return 0;
+
+  int day = atoi(parts[0].c_str());
+  int year = atoi(parts[2].c_str());
+  int month = -1;
+  for (int i = 0; i < 12; ++i)
+    if (parts[1].compare(0, 3, months[i]) == 0)
+      month = i;
+
+  if (year < 50)
+    year += 2000;
+  else if (year < 1000)
+    year += 1900;
+
+  vector<string> clock;
+  split(parts[3], ":", clock);
+  if (month == -1 || day < 1 || day > 31 || clock.size() < 2)
+    return 0;
+
+  long seconds = atoi(clock[0].c_str()) * 3600L
+    + atoi(clock[1].c_str()) * 60L
+    + (clock.size() > 2 ? atoi(clock[2].c_str()) : 0);
+
+  // The zone is an offset like "+0200" or one of the old US names.
+  long offset = 0;
+  if (parts.size() > 4) {
+    const string &zone = parts[4];
+    if (zone[0] == '+' || zone[0] == '-') {
+      int hhmm = atoi(zone.c_str() + 1);
+      offset = ((hhmm / 100) * 3600L + (hhmm % 100) * 60L)
+	* (zone[0] == '-' ? -1 : 1);
+    } else if (zone == "edt") offset = -4 * 3600L;
+    else if (zone == "est" || zone == "cdt") offset = -5 * 3600L;
+    else if (zone == "cst" || zone == "mdt") offset = -6 * 3600L;
+    else if (zone == "mst" || zone == "pdt") offset = -7 * 3600L;
+    else if (zone == "pst") offset = -8 * 3600L;
+  }
+
+  // Days since 1970-01-01 in the proleptic Gregorian calendar.
+  int y = year - (month < 2 ? 1 : 0);
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int mp = (month + 10) % 12;
+  int doy = (153 * mp + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = era * 146097L + doe - 719468L;
+
+  long t = days * 86400L + seconds - offset;
+  return t > 0 ? (time_t) t : 0;
+}
@@ -0,0 +1,199 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    sortkeys.h
+ *  
+ *  Description:
+ *    Declaration of the Binc::SortKeys class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifndef sortkeys_h_included
+#define sortkeys_h_included
+#include <map>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+namespace Binc {
+
+  class Message;
+
+  /*!
+    \class SortKeys
+    \brief The SortKeys class keeps what SORT and THREAD order
+    messages by, one row per message.
+
+    Each row holds the arrival time, the sent time, the size and,
+    as numbers into a table of distinct strings, the base subject and
+    the first From, To and Cc mailbox, upper cased so that they
+    compare like i;ascii-casemap. Rows are kept in ascending UID
+    order.
+
+    For THREAD, each row also holds the Message-ID of the message and
+    the Message-IDs it refers to. These are hashed, and each distinct
+    hash is given a small number, so that threads are built from
+    numbers only.
+  */
+  class SortKeys {
+  public:
+    enum Key {
+      ARRIVAL, CC, DATE, FROM, SIZE, SUBJECT, TO
+    };
+
+    //--
+    class Criterion {
+    public:
+      Key key;
+      bool reverse;
+
+      Criterion(Key k, bool r = false) : key(k), reverse(r) {}
+    };
+
+    enum Algorithm {
+      ORDEREDSUBJECT, REFERENCES
+    };
+
+    /*!
+      \class ThreadNode
+      \brief A message in a thread, and the numbers of the nodes
+      that are its replies. The UID is 0 for a message that is
+      referred to but not there.
+    */
+    class ThreadNode {
+    public:
+      unsigned int uid;
+      std::vector<unsigned int> children;
+
+      ThreadNode(unsigned int u = 0) : uid(u) {}
+    };
+
+    /*!
+      Drops all rows and starts over for a new UIDVALIDITY.
+    */
+    void clear(unsigned int uidvalidity = 0);
+
+    bool load(const std::string &fileName);
+    bool save(const std::string &fileName);
+
+    /*!
+      Adds a row for message, which must have a higher UID than all
+      rows added before it.
+    */
+    void add(unsigned int uid, Message &message);
+
+    /*!
+      Removes all rows whose UIDs are not in the sorted list uids.
+    */
+    void retain(const std::vector<unsigned int> &uids);
+
+    /*!
+      Sorts the ascending list uids by criteria. Messages that
+      compare equal stay in UID order. Returns false if a UID has no
+      row.
+    */
+    bool sort(const std::vector<Criterion> &criteria,
+	      std::vector<unsigned int> &uids) const;
+
+    /*!
+      Puts the messages in the ascending list uids in threads, as RFC
+      5256 describes. Node 0 of tree has the threads as its children.
+      Returns false if a UID has no row.
+    */
+    bool thread(Algorithm algorithm, const std::vector<unsigned int> &uids,
+		std::vector<ThreadNode> &tree) const;
+
+    inline unsigned int getUidValidity(void) const { return uidvalidity; }
+    inline unsigned int getLastUid(void) const
+    { return uids.empty() ? 0 : uids.back(); }
+    inline unsigned int getRowCount(void) const { return uids.size(); }
+    inline bool isChanged(void) const { return changed; }
+
+    /*!
+      Returns the base subject of subject, as RFC 5256 defines it,
+      without the decoding of encoded words. If reply is given, it
+      is set to whether a reply or forward prefix or trailer was
+      removed.
+    */
+    static std::string getBaseSubject(const std::string &subject,
+				      bool *reply = 0);
+
+    /*!
+      Returns the time in a Date header, or 0 if it can not be
+      parsed.
+    */
+    static time_t getSentTime(const std::string &date);
+
+    //--
+    SortKeys(void);
+
+  private:
+    // The string columns, in the order they are stored.
+    enum {
+      SUBJECT_COLUMN, FROM_COLUMN, TO_COLUMN, CC_COLUMN, STRINGS
+    };
+
+    typedef std::pair<unsigned int, unsigned int> Hash;
+
+    unsigned int intern(int column, const std::string &s);
+    unsigned int internId(const std::string &messageId);
+    void addRow(unsigned int uid, unsigned int arrival, unsigned int sent,
+		unsigned int size, const std::string *values, bool reply,
+		unsigned int messageId, const std::vector<unsigned int> &refs);
+    bool getRows(const std::vector<unsigned int> &list,
+		 std::vector<unsigned int> &rows) const;
+    void threadReferences(const std::vector<unsigned int> &rows,
+			  std::vector<ThreadNode> &tree) const;
+    void threadSubjects(const std::vector<unsigned int> &rows,
+			std::vector<ThreadNode> &tree) const;
+
+    std::vector<unsigned int> uids;
+    std::vector<unsigned int> arrivals;
+    std::vector<unsigned int> sents;
+    std::vector<unsigned int> sizes;
+    std::vector<unsigned int> ids[STRINGS];
+    std::vector<char> replies;
+    std::vector<unsigned int> messageIds;
+    std::vector<unsigned int> refStarts;
+    std::vector<unsigned int> refs;
+
+    std::vector<std::string> strings[STRINGS];
+    std::map<std::string, unsigned int> lookup[STRINGS];
+
+    // Message-ID number 0 stands for no Message-ID.
+    std::vector<Hash> hashes;
+    std::map<Hash, unsigned int> hashLookup;
+
+    unsigned int uidvalidity;
+    bool changed;
+  };
+}
+
+#endif
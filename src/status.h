@@ -49,6 +49,7 @@ namespace Binc {
     int unseen;
     int uidvalidity;
     int uidnext;
+    unsigned int highestmodseq;
 
     //--
     int statusid;
@@ -62,6 +63,7 @@ namespace Binc {
     inline void setUnseen(int i) { unseen = i; }
     inline void setUidValidity(int i) { uidvalidity = i; }
     inline void setUidNext(int i) { uidnext = i; }
+    inline void setHighestModSeq(unsigned int i) { highestmodseq = i; }
     
     //--
     inline int getMessages(void) const { return messages; }
@@ -70,6 +72,7 @@ namespace Binc {
     inline int getUnseen(void) const { return unseen; }
     inline int getUidValidity(void) const { return uidvalidity; }
     inline int getUidNext(void) const { return uidnext; }
+    inline unsigned int getHighestModSeq(void) const { return highestmodseq; }
 
 
     //--
@@ -0,0 +1,355 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    textindex.cc
+ *  
+ *  Description:
+ *    Implementation of the Binc::TextIndex class.
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "textindex.h"
+
+using namespace ::std;
+using namespace Binc;
+
+namespace {
+
+  const unsigned int NGRAMS = 36 * 36 * 36;
+  const string MAGIC = "BINCIMAP TEXTINDEX 1\n";
+
+  //----------------------------------------------------------------------
+  // Maps letters and digits to 1-36, ignoring case, and everything
+  // else to 0.
+  class FoldTable {
+  public:
+    unsigned char code[256];
+
+    FoldTable(void)
+    {
+      memset(code, 0, sizeof(code));
+      for (int i = 0; i < 10; ++i)
+	code['0' + i] = i + 1;
+      for (int i = 0; i < 26; ++i)
+	code['A' + i] = code['a' + i] = i + 11;
+    }
+  };
+
+  const FoldTable fold;
+
+  //----------------------------------------------------------------------
+  inline unsigned int trigram(int a, int b, int c)
+  {
+    return (a - 1) * 36 * 36 + (b - 1) * 36 + (c - 1);
+  }
+
+  //----------------------------------------------------------------------
+  void decode(const string &p, vector<unsigned int> &uids)
+  {
+    uids.clear();
+
+    string::size_type pos = 0;
+    unsigned int uid = 0;
+    unsigned int delta;
+    while (readVarint(p, pos, delta)) {
+      uid += delta;
+      uids.push_back(uid);
+    }
+  }
+
+  //----------------------------------------------------------------------
+  class ShorterPostings {
+    const vector<string> &postings;
+
+  public:
+    ShorterPostings(const vector<string> &p) : postings(p) {}
+
+    bool operator()(unsigned int a, unsigned int b) const
+    {
+      return postings[a].length() < postings[b].length();
+    }
+  };
+}
+
+//------------------------------------------------------------------------
+TextIndex::TextIndex(void)
+{
+  clear();
+  changed = false;
+}
+
+//------------------------------------------------------------------------
+void TextIndex::clear(unsigned int uidvalidity_in)
+{
+  vector<string>().swap(postings);
+  vector<unsigned int>().swap(lastuids);
+
+  uidvalidity = uidvalidity_in;
+  lastuid = 0;
+  messages = 0;
+  changed = true;
+
+  prev1 = 0;
+  prev2 = 0;
+}
+
+//------------------------------------------------------------------------
+bool TextIndex::load(const string &fileName)
+{
+  FILE *fp = fopen(fileName.c_str(), "r");
+  if (fp == 0)
+    return false;
+
+  string data;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    data.append(buf, n);
+
+  bool error = ferror(fp) != 0;
+  fclose(fp);
+
+  if (error || data.compare(0, MAGIC.length(), MAGIC) != 0)
+    return false;
+
+  clear();
+  postings.resize(NGRAMS);
+  lastuids.resize(NGRAMS, 0);
+
+  // The header is followed by one entry per trigram, and a zero.
+  string::size_type pos = MAGIC.length();
+  bool complete = false;
+  if (readVarint(data, pos, uidvalidity)
+      && readVarint(data, pos, lastuid)
+      && readVarint(data, pos, messages)) {
+    unsigned int key;
+    while (readVarint(data, pos, key)) {
+      if (key == 0) {
+	complete = (pos == data.length());
+	break;
+      }
+
+      unsigned int length;
+      if (key > NGRAMS || !readVarint(data, pos, lastuids[key - 1])
+	  || !readVarint(data, pos, length) || length > data.length() - pos)
+	break;
+
+      postings[key - 1].assign(data, pos, length);
+      pos += length;
+    }
+  }
+
+  if (!complete) {
+    clear();
+    return false;
+  }
+
+  changed = false;
+  return true;
+}
+
+//------------------------------------------------------------------------
+bool TextIndex::save(const string &fileName)
+{
+  // Write a temporary file and rename it in place, so that other
+  // instances never see a partial index.
+  string tpl = fileName + "XXXXXX";
+  vector<char> ftemplate(tpl.begin(), tpl.end());
+  ftemplate.push_back('\0');
+
+  int fd = mkstemp(&ftemplate[0]);
+  if (fd == -1)
+    return false;
+
+  FILE *fp = fdopen(fd, "w");
+  if (fp == 0) {
+    close(fd);
+    unlink(&ftemplate[0]);
+    return false;
+  }
+
+  string header = MAGIC;
+  appendVarint(header, uidvalidity);
+  appendVarint(header, lastuid);
+  appendVarint(header, messages);
+  fwrite(header.data(), 1, header.length(), fp);
+
+  for (unsigned int i = 0; i < postings.size(); ++i) {
+    if (postings[i].empty())
+      continue;
+
+    string entry;
+    appendVarint(entry, i + 1);
+    appendVarint(entry, lastuids[i]);
+    appendVarint(entry, postings[i].length());
+    fwrite(entry.data(), 1, entry.length(), fp);
+    fwrite(postings[i].data(), 1, postings[i].length(), fp);
+  }
+
+  fputc(0, fp);
+
+  bool error = ferror(fp) != 0;
+  if (fclose(fp) != 0 || error
+      || rename(&ftemplate[0], fileName.c_str()) != 0) {
+    unlink(&ftemplate[0]);
+    return false;
+  }
+
+  changed = false;
+  return true;
+}
+
+//------------------------------------------------------------------------
+void TextIndex::beginMessage(unsigned int uid)
+{
+  if (postings.empty()) {
+    postings.resize(NGRAMS);
+    lastuids.resize(NGRAMS, 0);
+  }
+
+  lastuid = uid;
+  ++messages;
+  changed = true;
+
+  prev1 = 0;
+  prev2 = 0;
+}
+
+//------------------------------------------------------------------------
+void TextIndex::addText(const char *data, unsigned int length)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  const unsigned char *end = p + length;
+
+  for (; p != end; ++p) {
+    int c = fold.code[*p];
+    if (c == 0) {
+      prev1 = prev2 = 0;
+      continue;
+    }
+
+    if (prev2 != 0) {
+      unsigned int key = trigram(prev2, prev1, c);
+      if (lastuids[key] != lastuid) {
+	appendVarint(postings[key], lastuid - lastuids[key]);
+	lastuids[key] = lastuid;
+      }
+    }
+
+    prev2 = prev1;
+    prev1 = c;
+  }
+}
+
+//------------------------------------------------------------------------
+void TextIndex::retain(const vector<unsigned int> &uids)
+{
+  vector<unsigned int> tmp;
+  for (unsigned int i = 0; i < postings.size(); ++i) {
+    if (postings[i].empty())
+      continue;
+
+    decode(postings[i], tmp);
+    postings[i] = "";
+    lastuids[i] = 0;
+
+    for (vector<unsigned int>::const_iterator j = tmp.begin();
+	 j != tmp.end(); ++j)
+      if (binary_search(uids.begin(), uids.end(), *j)) {
+	appendVarint(postings[i], *j - lastuids[i]);
+	lastuids[i] = *j;
+      }
+  }
+
+  messages = uids.size();
+  changed = true;
+}
+
+//------------------------------------------------------------------------
+bool TextIndex::getCandidates(const string &text,
+			      vector<unsigned int> &uids) const
+{
+  vector<unsigned int> keys;
+
+  int p1 = 0;
+  int p2 = 0;
+  for (string::const_iterator i = text.begin(); i != text.end(); ++i) {
+    int c = fold.code[(unsigned char) *i];
+    if (c == 0) {
+      p1 = p2 = 0;
+      continue;
+    }
+
+    if (p2 != 0)
+      keys.push_back(trigram(p2, p1, c));
+
+    p2 = p1;
+    p1 = c;
+  }
+
+  if (keys.empty())
+    return false;
+
+  uids.clear();
+  if (postings.empty())
+    return true;
+
+  // Start with the rarest trigram to keep the intersections short.
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  sort(keys.begin(), keys.end(), ShorterPostings(postings));
+
+  decode(postings[keys[0]], uids);
+
+  vector<unsigned int> next;
+  vector<unsigned int> tmp;
+  for (vector<unsigned int>::const_iterator i = keys.begin() + 1;
+       i != keys.end() && !uids.empty(); ++i) {
+    decode(postings[*i], next);
+    tmp.clear();
+    set_intersection(uids.begin(), uids.end(), next.begin(), next.end(),
+		     back_inserter(tmp));
+    uids.swap(tmp);
+  }
+
+  return true;
+}
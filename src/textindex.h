@@ -0,0 +1,111 @@
+/* -*- Mode: c++; -*- */
+/*  --------------------------------------------------------------------
+ *  Filename:
+ *    textindex.h
+ *  
+ *  Description:
+ *    Declaration of the Binc::TextIndex class
+ *
+ *  Authors:
+ *    Andreas Aardal Hanssen <andreas-binc@bincimap.org>
+ *
+ *  Bugs:
+ *
+ *  ChangeLog:
+ *
+ *  --------------------------------------------------------------------
+ *  Copyright 2002-2004 Andreas Aardal Hanssen
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Street #330, Boston, MA 02111-1307, USA.
+ *  --------------------------------------------------------------------
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifndef textindex_h_included
+#define textindex_h_included
+#include <string>
+#include <vector>
+
+namespace Binc {
+
+  /*!
+    \class TextIndex
+    \brief The TextIndex class maps the trigrams found in a mailbox's
+    messages to the UIDs of the messages that contain them.
+
+    Only runs of letters and digits are indexed, case folded. Any
+    message that contains a search string also contains every trigram
+    of letters and digits in it, so the UIDs returned by
+    getCandidates() are a superset of the actual matches. Postings
+    are stored as delta coded varints, in ascending UID order.
+  */
+  class TextIndex {
+  public:
+    /*!
+      Drops all postings and starts over for a new UIDVALIDITY.
+    */
+    void clear(unsigned int uidvalidity = 0);
+
+    bool load(const std::string &fileName);
+    bool save(const std::string &fileName);
+
+    /*!
+      Starts indexing a new message. Messages must be added in
+      ascending UID order.
+    */
+    void beginMessage(unsigned int uid);
+
+    /*!
+      Adds a block of the current message's text. Blocks are
+      contiguous, so trigrams may span two blocks.
+    */
+    void addText(const char *data, unsigned int length);
+
+    /*!
+      Removes all UIDs that are not in the sorted list uids.
+    */
+    void retain(const std::vector<unsigned int> &uids);
+
+    /*!
+      Stores the UIDs of all messages that may contain text in uids.
+      Returns false if text has no trigrams to look up.
+    */
+    bool getCandidates(const std::string &text,
+		       std::vector<unsigned int> &uids) const;
+
+    inline unsigned int getUidValidity(void) const { return uidvalidity; }
+    inline unsigned int getLastUid(void) const { return lastuid; }
+    inline unsigned int getMessageCount(void) const { return messages; }
+    inline bool isChanged(void) const { return changed; }
+
+    //--
+    TextIndex(void);
+
+  private:
+    std::vector<std::string> postings;
+    std::vector<unsigned int> lastuids;
+
+    unsigned int uidvalidity;
+    unsigned int lastuid;
+    unsigned int messages;
+    bool changed;
+
+    int prev1;
+    int prev2;
+  };
+}
+
+#endif
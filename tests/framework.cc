@@ -1,6 +1,7 @@
 
 /*-*-mode:c++-*-*/
 #include <unistd.h>
+#include <dirent.h>
 #include <iostream>
 #include <signal.h>
 #include <wait.h>
@@ -37,30 +38,47 @@ FrameWork::FrameWork(const std::string &binary)
   }
 }
 
-bool FrameWork::test(const std::string &request, const std::string &result)
+bool FrameWork::send(const std::string &request, const std::string &result)
 {
-  string tmp = request;
-  trim(tmp);
-  string tmp2 = result;
-  trim(tmp2);
-
   if (request != "") {
     ssize_t res = write(writepipe[1], request.c_str(), request.length());
     if (res != (ssize_t) request.length()) {
+      string tmp = request;
+      trim(tmp);
+      string tmp2 = result;
+      trim(tmp2);
       printf("test(\"%s\", \"%s\") failed: %s\n", tmp.c_str(), tmp2.c_str(), strerror(errno));
       return false;
     }
   }
-  
+
+  return true;
+}
+
+void FrameWork::readLine(void)
+{
   char c;
-  string got;
 
+  lastline = "";
   while (read(readpipe[0], &c, 1) == 1 && c != '\n')
-    got += c;
-  got += '\n';
+    lastline += c;
+  lastline += '\n';
+}
 
-  if (got != result) {
-    printf("test(\"%s\", \"%s\") failed: got %s\n", tmp.c_str(), tmp2.c_str(), got.c_str());
+bool FrameWork::test(const std::string &request, const std::string &result)
+{
+  string tmp = request;
+  trim(tmp);
+  string tmp2 = result;
+  trim(tmp2);
+
+  if (!send(request, result))
+    return false;
+
+  readLine();
+
+  if (lastline != result) {
+    printf("test(\"%s\", \"%s\") failed: got %s\n", tmp.c_str(), tmp2.c_str(), lastline.c_str());
     return false;
   }
 
@@ -68,6 +86,89 @@ bool FrameWork::test(const std::string &request, const std::string &result)
   return true;
 }
 
+// Like test(), but the line read only has to match the extended
+// regular expression in pattern.
+bool FrameWork::testMatch(const std::string &request, const std::string &pattern)
+{
+  string tmp = request;
+  trim(tmp);
+  string tmp2 = pattern;
+  trim(tmp2);
+
+  if (!send(request, pattern))
+    return false;
+
+  readLine();
+
+  if (regexMatch(lastline, pattern) != 0) {
+    printf("testMatch(\"%s\", \"%s\") failed: got %s\n", tmp.c_str(), tmp2.c_str(), lastline.c_str());
+    return false;
+  }
+
+  printf("testMatch(\"%s\", \"%s\") ok.\n", tmp.c_str(), tmp2.c_str());
+  return true;
+}
+
+const std::string &FrameWork::getLastLine(void) const
+{
+  return lastline;
+}
+
+bool FrameWork::testEmpty(const std::string &directory)
+{
+  DIR *dirp = opendir(directory.c_str());
+  if (dirp == 0) {
+    printf("testEmpty(\"%s\") failed: %s\n", directory.c_str(), strerror(errno));
+    return false;
+  }
+
+  int files = 0;
+  struct dirent *direntp;
+  while ((direntp = readdir(dirp)) != 0)
+    if (direntp->d_name[0] != '.')
+      ++files;
+  closedir(dirp);
+
+  if (files != 0) {
+    printf("testEmpty(\"%s\") failed: got %d files\n", directory.c_str(), files);
+    return false;
+  }
+
+  printf("testEmpty(\"%s\") ok.\n", directory.c_str());
+  return true;
+}
+
+bool FrameWork::deliver(const std::string &mailbox,
+			const std::string &name,
+			const std::string &message)
+{
+  // Write the message to tmp/ and move it into new/, the way a
+  // delivery agent does, so that the server never sees half a message.
+  const std::string tmpname = mailbox + "/tmp/" + name;
+  const std::string newname = mailbox + "/new/" + name;
+
+  FILE *fp = fopen(tmpname.c_str(), "w");
+  if (fp == 0) {
+    printf("deliver(\"%s\") failed: %s\n", tmpname.c_str(), strerror(errno));
+    return false;
+  }
+
+  const bool written = fputs(message.c_str(), fp) != EOF;
+  if (fclose(fp) != 0 || !written) {
+    printf("deliver(\"%s\") failed: %s\n", tmpname.c_str(), strerror(errno));
+    unlink(tmpname.c_str());
+    return false;
+  }
+
+  if (rename(tmpname.c_str(), newname.c_str()) != 0) {
+    printf("deliver(\"%s\") failed: %s\n", newname.c_str(), strerror(errno));
+    unlink(tmpname.c_str());
+    return false;
+  }
+
+  printf("deliver(\"%s\") ok.\n", newname.c_str());
+  return true;
+}
 
 FrameWork::~FrameWork(void)
 {
@@ -11,11 +11,23 @@ class FrameWork
   ~FrameWork(void);
 
   bool test(const std::string &request, const std::string &result);
+  bool testMatch(const std::string &request, const std::string &pattern);
+
+  const std::string &getLastLine(void) const;
+
+  static bool testEmpty(const std::string &directory);
+  static bool deliver(const std::string &mailbox,
+		      const std::string &name,
+		      const std::string &message);
 
   static void setConfig(const std::string &section, const std::string &key, const std::string &value);
 
 
  private:
+  bool send(const std::string &request, const std::string &result);
+  void readLine(void);
+
+  std::string lastline;
   int childspid;
   int readpipe[2];
   int writepipe[2];
@@ -1,4 +1,5 @@
 #include "framework.h"
+#include <string>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -19,6 +20,199 @@ int main(void)
   f.test("1 NOOP\r\n", "1 OK NOOP completed\r\n");
   f.test("1 CREATE INBOX/TestMailbox\r\n", "1 OK CREATE completed\r\n");
   f.test("1 DELETE INBOX/TestMailbox\r\n", "1 OK DELETE completed\r\n");
+
+  // APPEND, then a MULTIAPPEND of two messages.
+  f.test("1 CREATE INBOX/Append\r\n", "1 OK CREATE completed\r\n");
+  f.test("1 APPEND INBOX/Append (\\Seen) {75}\r\n",
+	 "+ go ahead with 75 characters\r\n");
+  f.test("From: alice@example.com\r\n"
+	 "Subject: Alpha\r\n"
+	 "Message-ID: <a@example>\r\n"
+	 "\r\n"
+	 "First\r\n"
+	 "\r\n", "1 OK APPEND completed\r\n");
+  f.test("1 APPEND INBOX/Append {103}\r\n",
+	 "+ go ahead with 103 characters\r\n");
+  f.test("From: bob@example.com\r\n"
+	 "Subject: Re: Alpha\r\n"
+	 "Message-ID: <b@example>\r\n"
+	 "References: <a@example>\r\n"
+	 "\r\n"
+	 "Second\r\n"
+	 " (\\Flagged) {74}\r\n", "+ go ahead with 74 characters\r\n");
+  f.test("From: carol@example.com\r\n"
+	 "Subject: Beta\r\n"
+	 "Message-ID: <c@example>\r\n"
+	 "\r\n"
+	 "Third\r\n"
+	 "\r\n", "1 OK APPEND completed\r\n");
+  f.test("1 STATUS INBOX/Append (MESSAGES UNSEEN)\r\n",
+	 "* STATUS \"INBOX/Append\" (MESSAGES 3 UNSEEN 2)\r\n");
+  f.test("", "1 OK STATUS completed\r\n");
+
+  // The messages of a MULTIAPPEND into a mailbox that is not selected
+  // get their UIDs in the order they were sent, whatever their
+  // internal dates.
+  f.test("1 CREATE INBOX/Order\r\n", "1 OK CREATE completed\r\n");
+  f.test("1 APPEND INBOX/Order {23}\r\n", "+ go ahead with 23 characters\r\n");
+  f.test("Subject: One\r\n"
+	 "\r\n"
+	 "First\r\n"
+	 " \"01-Jan-2020 10:00:00 +0000\" {24}\r\n",
+	 "+ go ahead with 24 characters\r\n");
+  f.test("Subject: Two\r\n"
+	 "\r\n"
+	 "Second\r\n"
+	 " \"01-Jan-2019 10:00:00 +0000\" {25}\r\n",
+	 "+ go ahead with 25 characters\r\n");
+  f.test("Subject: Three\r\n"
+	 "\r\n"
+	 "Third\r\n"
+	 "\r\n", "1 OK APPEND completed\r\n");
+  f.test("1 SELECT INBOX/Order\r\n", "* 3 EXISTS\r\n");
+  f.test("", "* 3 RECENT\r\n");
+  f.test("", "* OK [UNSEEN 1] Message 1 is first unseen\r\n");
+  f.testMatch("", "^\\* OK \\[UIDVALIDITY [0-9]+\\]\r\n");
+  f.test("", "* OK [UIDNEXT 4] 4 is the next UID\r\n");
+  f.test("", "* FLAGS (\\Answered \\Flagged \\Deleted \\Recent \\Seen \\Draft)\r\n");
+  f.test("", "* OK [PERMANENTFLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft)] Limited\r\n");
+  f.test("", "* OK [HIGHESTMODSEQ 4] Highest\r\n");
+  f.test("", "1 OK SELECT completed\r\n");
+  f.test("1 FETCH 1:* (UID BODY.PEEK[HEADER.FIELDS (SUBJECT)])\r\n",
+	 "* 1 FETCH (UID 1 BODY[HEADER.FIELDS (SUBJECT)] {16}\r\n");
+  f.test("", "Subject: One\r\n");
+  f.test("", "\r\n");
+  f.test("", ")\r\n");
+  f.test("", "* 2 FETCH (UID 2 BODY[HEADER.FIELDS (SUBJECT)] {16}\r\n");
+  f.test("", "Subject: Two\r\n");
+  f.test("", "\r\n");
+  f.test("", ")\r\n");
+  f.test("", "* 3 FETCH (UID 3 BODY[HEADER.FIELDS (SUBJECT)] {18}\r\n");
+  f.test("", "Subject: Three\r\n");
+  f.test("", "\r\n");
+  f.test("", ")\r\n");
+  f.test("", "1 OK FETCH completed\r\n");
+  f.test("1 CLOSE\r\n", "1 OK CLOSE completed\r\n");
+
+  // A MULTIAPPEND that fails leaves none of its messages behind.
+  f.test("1 CREATE INBOX/Failed\r\n", "1 OK CREATE completed\r\n");
+  f.test("1 APPEND INBOX/Failed {5}\r\n", "+ go ahead with 5 characters\r\n");
+  f.test("Hello {5}\r\n", "+ go ahead with 5 characters\r\n");
+  f.test("HelloX\r\n",
+	 "1 BAD APPEND failed: expected SPACE or CRLF after literal\r\n");
+  f.test("", "* BAD Syntax error; first token must be a tag\r\n");
+  FrameWork::testEmpty("Maildir/.Failed/tmp");
+  FrameWork::testEmpty("Maildir/.Failed/new");
+  FrameWork::testEmpty("Maildir/.Failed/cur");
+
+  f.test("1 SELECT INBOX/Append\r\n", "* 3 EXISTS\r\n");
+  f.test("", "* 3 RECENT\r\n");
+  f.test("", "* OK [UNSEEN 2] Message 2 is first unseen\r\n");
+  f.testMatch("", "^\\* OK \\[UIDVALIDITY [0-9]+\\]\r\n");
+  std::string uidvalidity = f.getLastLine().substr(18);
+  uidvalidity = uidvalidity.substr(0, uidvalidity.find(']'));
+  f.test("", "* OK [UIDNEXT 4] 4 is the next UID\r\n");
+  f.test("", "* FLAGS (\\Answered \\Flagged \\Deleted \\Recent \\Seen \\Draft)\r\n");
+  f.test("", "* OK [PERMANENTFLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft)] Limited\r\n");
+  f.test("", "* OK [HIGHESTMODSEQ 4] Highest\r\n");
+  f.test("", "1 OK SELECT completed\r\n");
+
+  // ESEARCH result options.
+  f.test("1 SEARCH RETURN (MIN MAX COUNT) ALL\r\n",
+	 "* ESEARCH (TAG \"1\") MIN 1 MAX 3 COUNT 3\r\n");
+  f.test("", "1 OK SEARCH completed\r\n");
+  f.test("1 UID SEARCH RETURN (ALL) NOT FLAGGED\r\n",
+	 "* ESEARCH (TAG \"1\") UID ALL 1:2\r\n");
+  f.test("", "1 OK SEARCH completed\r\n");
+  f.test("1 SEARCH RETURN () DELETED\r\n", "* ESEARCH (TAG \"1\")\r\n");
+  f.test("", "1 OK SEARCH completed\r\n");
+
+  // SEARCHRES: SAVE gives no untagged response, and $ refers to the
+  // saved result in later commands. Combined with MIN alone, only the
+  // minimum is saved.
+  f.test("1 SEARCH RETURN (SAVE) FLAGGED\r\n", "1 OK SEARCH completed\r\n");
+  f.test("1 FETCH $ (FLAGS)\r\n", "* 3 FETCH (FLAGS (\\Recent \\Flagged))\r\n");
+  f.test("", "1 OK FETCH completed\r\n");
+  f.test("1 UID SEARCH RETURN (SAVE MIN) UNSEEN\r\n",
+	 "* ESEARCH (TAG \"1\") UID MIN 2\r\n");
+  f.test("", "1 OK SEARCH completed\r\n");
+  f.test("1 SEARCH $\r\n", "* SEARCH 2\r\n");
+  f.test("", "1 OK SEARCH completed\r\n");
+
+  // SORT. The base subject drops the "Re:".
+  f.test("1 SORT (SUBJECT) US-ASCII ALL\r\n", "* SORT 1 2 3\r\n");
+  f.test("", "1 OK SORT completed\r\n");
+  f.test("1 SORT (REVERSE FROM) US-ASCII ALL\r\n", "* SORT 3 2 1\r\n");
+  f.test("", "1 OK SORT completed\r\n");
+  f.test("1 UID SORT (SUBJECT) US-ASCII UNSEEN\r\n", "* SORT 2 3\r\n");
+  f.test("", "1 OK SORT completed\r\n");
+
+  // THREAD, by References and by subject.
+  f.test("1 THREAD REFERENCES US-ASCII ALL\r\n", "* THREAD (1 2)(3)\r\n");
+  f.test("", "1 OK THREAD completed\r\n");
+  f.test("1 THREAD ORDEREDSUBJECT US-ASCII ALL\r\n", "* THREAD (1 2)(3)\r\n");
+  f.test("", "1 OK THREAD completed\r\n");
+  f.test("1 UID THREAD REFERENCES US-ASCII NOT SEEN\r\n",
+	 "* THREAD (2)(3)\r\n");
+  f.test("", "1 OK THREAD completed\r\n");
+
+  // IDLE reports a message delivered while it waits, and ends on
+  // DONE.
+  f.test("1 IDLE\r\n", "+ idling\r\n");
+  FrameWork::deliver("Maildir/.Append", "1.autotests.localhost",
+		     "From: dave@example.com\r\n"
+		     "Subject: Gamma\r\n"
+		     "\r\n"
+		     "Fourth\r\n");
+  f.test("", "* 4 EXISTS\r\n");
+  f.test("", "* 4 RECENT\r\n");
+  f.test("", "* 4 FETCH (FLAGS (\\Recent))\r\n");
+  f.test("DONE\r\n", "1 OK IDLE completed\r\n");
+
+  // QRESYNC: reselecting with the UIDVALIDITY and mod-sequence seen
+  // last reports only what changed since, and FETCH CHANGEDSINCE and
+  // expunges follow the mod-sequences.
+  f.test("1 CLOSE\r\n", "1 OK CLOSE completed\r\n");
+  f.test("1 ENABLE QRESYNC\r\n", "* ENABLED QRESYNC\r\n");
+  f.test("", "1 OK ENABLE completed\r\n");
+  f.test("1 SELECT INBOX/Append (QRESYNC (" + uidvalidity + " 4))\r\n",
+	 "* 4 EXISTS\r\n");
+  f.test("", "* 0 RECENT\r\n");
+  f.test("", "* OK [UNSEEN 2] Message 2 is first unseen\r\n");
+  f.test("", "* OK [UIDVALIDITY " + uidvalidity + "]\r\n");
+  f.test("", "* OK [UIDNEXT 5] 5 is the next UID\r\n");
+  f.test("", "* FLAGS (\\Answered \\Flagged \\Deleted \\Recent \\Seen \\Draft)\r\n");
+  f.test("", "* OK [PERMANENTFLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft)] Limited\r\n");
+  f.test("", "* OK [HIGHESTMODSEQ 5] Highest\r\n");
+  f.test("", "* 4 FETCH (UID 4 FLAGS () MODSEQ (5))\r\n");
+  f.test("", "1 OK SELECT completed\r\n");
+  f.test("1 STORE 2 +FLAGS (\\Seen)\r\n",
+	 "* 2 FETCH (UID 2 FLAGS (\\Seen) MODSEQ (6))\r\n");
+  f.test("", "1 OK STORE completed\r\n");
+  f.test("1 FETCH 1:* (FLAGS) (CHANGEDSINCE 5)\r\n",
+	 "* 2 FETCH (FLAGS (\\Seen) MODSEQ (6))\r\n");
+  f.test("", "1 OK FETCH completed\r\n");
+  f.test("1 STORE 3 +FLAGS.SILENT (\\Deleted)\r\n", "1 OK STORE completed\r\n");
+  f.test("1 EXPUNGE\r\n", "* VANISHED 3\r\n");
+  f.test("", "* 3 EXISTS\r\n");
+  f.test("", "1 OK EXPUNGE completed\r\n");
+  f.test("1 UID FETCH 1:* (FLAGS) (CHANGEDSINCE 5 VANISHED)\r\n",
+	 "* VANISHED (EARLIER) 3\r\n");
+  f.test("", "* 2 FETCH (FLAGS (\\Seen) UID 2 MODSEQ (6))\r\n");
+  f.test("", "1 OK FETCH completed\r\n");
+
+  // Selecting another mailbox closes the old one first.
+  f.test("1 EXAMINE INBOX/Order\r\n", "* OK [CLOSED] Previous mailbox closed\r\n");
+  f.test("", "* 3 EXISTS\r\n");
+  f.test("", "* 0 RECENT\r\n");
+  f.test("", "* OK [UNSEEN 1] Message 1 is first unseen\r\n");
+  f.testMatch("", "^\\* OK \\[UIDVALIDITY [0-9]+\\]\r\n");
+  f.test("", "* OK [UIDNEXT 4] 4 is the next UID\r\n");
+  f.test("", "* FLAGS (\\Answered \\Flagged \\Deleted \\Recent \\Seen \\Draft)\r\n");
+  f.test("", "* OK [PERMANENTFLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft)] Limited\r\n");
+  f.test("", "* OK [HIGHESTMODSEQ 4] Highest\r\n");
+  f.test("", "1 OK EXAMINE completed\r\n");
+
   f.test("X LOGOUT\r\n", "X OK LOGOUT completed\r\n");
 
   return 0;